@@ -0,0 +1,257 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "fd-util.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "write-full.h"
+#include "anvil-shm.h"
+#include "penalty.h"
+
+#include <stdio.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/**
+ * Compares looking up penalties from anvil's shared memory tables against
+ * sending PENALTY-GET queries to an anvil-like process over a UNIX socket,
+ * which is what auth processes did for every authentication before. The
+ * server process answers the queries from the same penalty table as anvil.
+ * With multiple client processes all the socket queries go through the
+ * single server process, while the shared memory lookups don't need it.
+ */
+
+#define BENCH_MIN_NSECS (500ULL*1000*1000)
+#define BENCH_SHM_PATH ".bench-anvil-shm"
+#define BENCH_IDENT_COUNT 10000
+#define BENCH_MAX_LINE_LEN 256
+
+static const char *bench_ident(unsigned int i)
+{
+	return t_strdup_printf("10.0.%u.%u", i / 256, i % 256);
+}
+
+static unsigned int bench_shm(struct anvil_shm *shm)
+{
+	unsigned int count = 0, value, last_penalty;
+	uint64_t start = i_nanoseconds();
+
+	do {
+		T_BEGIN {
+			if (anvil_shm_lookup(shm, ANVIL_SHM_TABLE_PENALTY,
+					     bench_ident(count % BENCH_IDENT_COUNT),
+					     &value, &last_penalty) != 1)
+				i_fatal("anvil_shm_lookup() failed");
+		} T_END;
+		count++;
+	} while (i_nanoseconds() - start < BENCH_MIN_NSECS);
+	return count;
+}
+
+static unsigned int bench_socket(int fd)
+{
+	unsigned int count = 0;
+	uint64_t start = i_nanoseconds();
+	char reply[BENCH_MAX_LINE_LEN];
+	size_t pos;
+	ssize_t ret;
+
+	do {
+		T_BEGIN {
+			const char *query = t_strdup_printf("PENALTY-GET\t%s\n",
+				bench_ident(count % BENCH_IDENT_COUNT));
+			if (write_full(fd, query, strlen(query)) < 0)
+				i_fatal("write() failed: %m");
+		} T_END;
+		pos = 0;
+		do {
+			ret = read(fd, reply + pos, sizeof(reply) - pos);
+			if (ret <= 0)
+				i_fatal("read() failed: %m");
+			pos += ret;
+		} while (reply[pos-1] != '\n' && pos < sizeof(reply));
+		count++;
+	} while (i_nanoseconds() - start < BENCH_MIN_NSECS);
+	return count;
+}
+
+static void bench_server_input(struct penalty *penalty, int fd,
+			       char *buf, size_t *pos)
+{
+	const char *ident;
+	char *line, *p;
+	time_t last_penalty;
+	unsigned int value;
+
+	line = buf;
+	while ((p = memchr(line, '\n', *pos - (line - buf))) != NULL) {
+		*p = '\0';
+		if (!str_begins(line, "PENALTY-GET\t", &ident))
+			i_fatal("Unexpected query: %s", line);
+		T_BEGIN {
+			value = penalty_get(penalty, ident, &last_penalty);
+			const char *reply = t_strdup_printf("%u %s\n", value,
+							    dec2str(last_penalty));
+			if (write_full(fd, reply, strlen(reply)) < 0)
+				i_fatal("write() failed: %m");
+		} T_END;
+		line = p + 1;
+	}
+	*pos -= line - buf;
+	memmove(buf, line, *pos);
+}
+
+static void ATTR_NORETURN
+bench_server(struct penalty *penalty, int *fds, unsigned int fd_count)
+{
+	struct pollfd *pfds = t_new(struct pollfd, fd_count);
+	char *bufs = t_malloc0(BENCH_MAX_LINE_LEN * fd_count);
+	size_t *positions = t_new(size_t, fd_count);
+	unsigned int i, open_count = fd_count;
+	ssize_t ret;
+
+	for (i = 0; i < fd_count; i++) {
+		pfds[i].fd = fds[i];
+		pfds[i].events = POLLIN;
+	}
+	while (open_count > 0) {
+		if (poll(pfds, fd_count, -1) < 0)
+			i_fatal("poll() failed: %m");
+		for (i = 0; i < fd_count; i++) {
+			if (pfds[i].revents == 0)
+				continue;
+			char *buf = bufs + BENCH_MAX_LINE_LEN * i;
+
+			ret = read(pfds[i].fd, buf + positions[i],
+				   BENCH_MAX_LINE_LEN - positions[i]);
+			if (ret <= 0) {
+				i_close_fd(&pfds[i].fd);
+				open_count--;
+				continue;
+			}
+			positions[i] += ret;
+			bench_server_input(penalty, pfds[i].fd, buf,
+					   &positions[i]);
+		}
+	}
+	_exit(0);
+}
+
+static double
+bench_parallel(struct anvil_shm *shm, struct penalty *penalty,
+	       unsigned int process_count)
+{
+	unsigned int i, count, total_count = 0;
+	int *server_fds = NULL, *client_fds = NULL;
+	pid_t server_pid = -1;
+	uint64_t start, nsecs;
+	int fd[2], sfd[2], status;
+
+	if (shm == NULL) {
+		/* one socket per client process, like one anvil connection
+		   per auth process */
+		server_fds = t_new(int, process_count);
+		client_fds = t_new(int, process_count);
+		for (i = 0; i < process_count; i++) {
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, sfd) < 0)
+				i_fatal("socketpair() failed: %m");
+			server_fds[i] = sfd[0];
+			client_fds[i] = sfd[1];
+		}
+		if ((server_pid = fork()) < 0)
+			i_fatal("fork() failed: %m");
+		if (server_pid == 0) {
+			for (i = 0; i < process_count; i++)
+				i_close_fd(&client_fds[i]);
+			bench_server(penalty, server_fds, process_count);
+		}
+		for (i = 0; i < process_count; i++)
+			i_close_fd(&server_fds[i]);
+	}
+
+	if (pipe(fd) < 0)
+		i_fatal("pipe() failed: %m");
+	start = i_nanoseconds();
+	for (i = 0; i < process_count; i++) {
+		switch (fork()) {
+		case -1:
+			i_fatal("fork() failed: %m");
+		case 0:
+			count = shm != NULL ? bench_shm(shm) :
+				bench_socket(client_fds[i]);
+			if (write(fd[1], &count, sizeof(count)) != sizeof(count))
+				i_fatal("write() failed: %m");
+			_exit(0);
+		default:
+			break;
+		}
+	}
+	i_close_fd(&fd[1]);
+	while (read(fd[0], &count, sizeof(count)) == sizeof(count))
+		total_count += count;
+	nsecs = i_nanoseconds() - start;
+	i_close_fd(&fd[0]);
+
+	if (client_fds != NULL) {
+		/* the server exits after all the sockets are closed */
+		for (i = 0; i < process_count; i++)
+			i_close_fd(&client_fds[i]);
+	}
+	for (i = 0; i < process_count + (server_pid != -1 ? 1 : 0); i++) {
+		if (wait(&status) < 0)
+			i_fatal("wait() failed: %m");
+	}
+	return total_count * 1000000000.0 / nsecs;
+}
+
+int main(int argc, const char *argv[])
+{
+	struct ioloop *ioloop;
+	struct anvil_shm *shm;
+	struct penalty *penalty;
+	unsigned int i, process_count;
+	const char *error;
+	long cpus;
+
+	lib_init();
+	ioloop = io_loop_create();
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	process_count = cpus <= 0 ? 1 : (unsigned int)cpus;
+	if (argc > 2 ||
+	    (argc == 2 && (str_to_uint(argv[1], &process_count) < 0 ||
+			   process_count == 0))) {
+		fprintf(stderr, "Usage: %s [process count]\n", argv[0]);
+		return 1;
+	}
+
+	if (anvil_shm_create(BENCH_SHM_PATH, &shm, &error) < 0)
+		i_fatal("%s", error);
+	penalty = penalty_init();
+	penalty_set_shm(penalty, shm);
+	for (i = 0; i < BENCH_IDENT_COUNT; i++) T_BEGIN {
+		penalty_inc(penalty, bench_ident(i), 0, i % 4 + 1);
+	} T_END;
+
+	printf("%-8s %14s %14s\n", "procs", "socket/s", "shm/s");
+	T_BEGIN {
+		printf("%-8u %14.0f %14.0f\n", 1U,
+		       bench_parallel(NULL, penalty, 1),
+		       bench_parallel(shm, penalty, 1));
+		if (process_count > 1) {
+			printf("%-8u %14.0f %14.0f\n", process_count,
+			       bench_parallel(NULL, penalty, process_count),
+			       bench_parallel(shm, penalty, process_count));
+		}
+	} T_END;
+
+	penalty_deinit(&penalty);
+	anvil_shm_close(&shm);
+	i_unlink(BENCH_SHM_PATH);
+	io_loop_destroy(&ioloop);
+	lib_deinit();
+	return 0;
+}
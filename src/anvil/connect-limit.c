@@ -9,6 +9,7 @@
 #include "str-table.h"
 #include "strescape.h"
 #include "ostream.h"
+#include "anvil-shm.h"
 #include "connect-limit.h"
 
 struct process {
@@ -87,6 +88,8 @@ struct connect_limit {
 	/* alt_username => struct session linked list. This array is resized
 	   every time a new alt_username_field index is added. */
 	HASH_TABLE_TYPE(session_alt_username) *alt_username_hashes;
+
+	struct anvil_shm *shm;
 };
 
 struct connect_limit_iter {
@@ -192,6 +195,32 @@ unsigned int connect_limit_lookup(struct connect_limit *limit,
 	return POINTER_CAST_TO(value, unsigned int);
 }
 
+void connect_limit_set_shm(struct connect_limit *limit, struct anvil_shm *shm)
+{
+	limit->shm = shm;
+}
+
+static void
+userip_shm_update(struct connect_limit *limit, const struct userip *userip,
+		  unsigned int count)
+{
+	if (limit->shm == NULL)
+		return;
+
+	T_BEGIN {
+		const char *key =
+			anvil_shm_userip_key(userip->username,
+					     userip->protocol, &userip->ip);
+		if (count > 0) {
+			anvil_shm_set(limit->shm, ANVIL_SHM_TABLE_USERIP,
+				      key, count, 0);
+		} else {
+			anvil_shm_unset(limit->shm, ANVIL_SHM_TABLE_USERIP,
+					key);
+		}
+	} T_END;
+}
+
 static struct process *process_lookup(struct connect_limit *limit, pid_t pid)
 {
 	return hash_table_lookup(limit->process_hash, POINTER_CAST(pid));
@@ -434,11 +463,15 @@ void connect_limit_connect(struct connect_limit *limit, pid_t pid,
 						 userip_lookup.protocol);
 		userip->ip = key->ip;
 		value = POINTER_CAST(1);
-		if (SESSION_TRACK_USERIP(session))
+		if (SESSION_TRACK_USERIP(session)) {
 			hash_table_insert(limit->userip_hash, userip, value);
+			userip_shm_update(limit, userip, 1);
+		}
 	} else {
 		value = POINTER_CAST(POINTER_CAST_TO(value, unsigned int) + 1);
 		hash_table_update(limit->userip_hash, userip, value);
+		userip_shm_update(limit, userip,
+				  POINTER_CAST_TO(value, unsigned int));
 	}
 	session->userip = userip;
 
@@ -468,6 +501,7 @@ userip_hash_unref(struct connect_limit *limit, struct session *session)
 		i_panic("connect limit hash tables are inconsistent");
 
 	new_refcount = POINTER_CAST_TO(value, unsigned int) - 1;
+	userip_shm_update(limit, userip, new_refcount);
 	if (new_refcount > 0) {
 		value = POINTER_CAST(new_refcount);
 		hash_table_update(limit->userip_hash, userip, value);
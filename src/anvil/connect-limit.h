@@ -39,9 +39,15 @@ struct connect_limit_iter_result {
 	guid_128_t conn_guid;
 };
 
+struct anvil_shm;
+
 struct connect_limit *connect_limit_init(void);
 void connect_limit_deinit(struct connect_limit **limit);
 
+/* Publish the connect_limit_lookup() results also to the shared memory
+   tables. */
+void connect_limit_set_shm(struct connect_limit *limit, struct anvil_shm *shm);
+
 /* Get the number of connections matching the given key. Note that the service
    is truncated from the first "-". Note that sessions with non-zero dest_ip
    aren't counted. */
@@ -11,6 +11,7 @@
 #include "master-service.h"
 #include "master-service-settings.h"
 #include "master-interface.h"
+#include "anvil-shm.h"
 #include "admin-client-pool.h"
 #include "connect-limit.h"
 #include "penalty.h"
@@ -20,6 +21,7 @@
 
 #define ANVIL_CLIENT_POOL_MAX_CONNECTIONS 100
 #define ANVIL_PROCTITLE_REFRESH_INTERVAL_MSECS 1000
+#define ANVIL_SHM_REFRESH_INTERVAL_MSECS 1000
 
 struct connect_limit *connect_limit;
 struct penalty *penalty;
@@ -29,6 +31,8 @@ static bool verbose_proctitle = FALSE;
 static struct io *log_fdpass_io;
 static struct admin_client_pool *admin_pool;
 static struct timeout *to_refresh;
+static struct anvil_shm *shm;
+static struct timeout *to_shm_refresh;
 static unsigned int prev_cmd_counter = 0;
 static unsigned int prev_connect_dump_counter = 0;
 
@@ -90,6 +94,27 @@ void admin_cmd_send(const char *service, pid_t pid, const char *cmd,
 				   callback, context);
 }
 
+static void anvil_shm_refresh_timeout(void *context ATTR_UNUSED)
+{
+	anvil_shm_refresh(shm);
+}
+
+static void anvil_shm_init(const char *base_dir)
+{
+	const char *path, *error;
+
+	path = t_strconcat(base_dir, "/"ANVIL_SHM_FILE_NAME, NULL);
+	if (anvil_shm_create(path, &shm, &error) < 0) {
+		/* clients keep sending all the lookups via the sockets */
+		i_error("%s", error);
+		return;
+	}
+	connect_limit_set_shm(connect_limit, shm);
+	penalty_set_shm(penalty, shm);
+	to_shm_refresh = timeout_add(ANVIL_SHM_REFRESH_INTERVAL_MSECS,
+				     anvil_shm_refresh_timeout, NULL);
+}
+
 static void client_connected(struct master_service_connection *conn)
 {
 	bool master = conn->listen_fd == MASTER_LISTEN_FD_FIRST;
@@ -136,6 +161,7 @@ static void main_init(void)
 					    ANVIL_CLIENT_POOL_MAX_CONNECTIONS);
 	connect_limit = connect_limit_init();
 	penalty = penalty_init();
+	anvil_shm_init(set->base_dir);
 	log_fdpass_io = io_add(MASTER_ANVIL_LOG_FDPASS_FD, IO_READ,
 			       log_fdpass_input, NULL);
 }
@@ -143,6 +169,8 @@ static void main_init(void)
 static void main_deinit(void)
 {
 	io_remove(&log_fdpass_io);
+	timeout_remove(&to_shm_refresh);
+	anvil_shm_close(&shm);
 	penalty_deinit(&penalty);
 	connect_limit_deinit(&connect_limit);
 	admin_client_pool_deinit(&admin_pool);
@@ -11,6 +11,7 @@
 #include "strescape.h"
 #include "llist.h"
 #include "ostream.h"
+#include "anvil-shm.h"
 #include "penalty.h"
 
 #include <time.h>
@@ -46,6 +47,8 @@ struct penalty {
 
 	unsigned int expire_secs;
 	struct timeout *to;
+
+	struct anvil_shm *shm;
 };
 
 struct penalty *penalty_init(void)
@@ -81,6 +84,11 @@ void penalty_deinit(struct penalty **_penalty)
 	i_free(penalty);
 }
 
+void penalty_set_shm(struct penalty *penalty, struct anvil_shm *shm)
+{
+	penalty->shm = shm;
+}
+
 void penalty_set_expire_secs(struct penalty *penalty, unsigned int expire_secs)
 {
 	penalty->expire_secs = expire_secs;
@@ -176,6 +184,10 @@ static void penalty_timeout(struct penalty *penalty)
 						  penalty_timeout, penalty);
 			break;
 		}
+		if (penalty->shm != NULL) {
+			anvil_shm_unset(penalty->shm, ANVIL_SHM_TABLE_PENALTY,
+					rec->ident);
+		}
 		hash_table_remove(penalty->hash, rec->ident);
 		penalty_rec_free(penalty, rec);
 	}
@@ -221,6 +233,10 @@ void penalty_inc(struct penalty *penalty, const char *ident,
 	}
 
 	DLLIST2_APPEND(&penalty->oldest, &penalty->newest, rec);
+	if (penalty->shm != NULL) {
+		anvil_shm_set(penalty->shm, ANVIL_SHM_TABLE_PENALTY, rec->ident,
+			      rec->penalty, rec->last_penalty);
+	}
 
 	if (penalty->to == NULL) {
 		penalty->to = timeout_add(penalty->expire_secs * 1000,
@@ -3,9 +3,14 @@
 
 #define PENALTY_MAX_VALUE ((1 << 16)-1)
 
+struct anvil_shm;
+
 struct penalty *penalty_init(void);
 void penalty_deinit(struct penalty **penalty);
 
+/* Publish the penalties also to the shared memory tables. */
+void penalty_set_shm(struct penalty *penalty, struct anvil_shm *shm);
+
 void penalty_set_expire_secs(struct penalty *penalty, unsigned int expire_secs);
 
 unsigned int penalty_get(struct penalty *penalty, const char *ident,
@@ -2,14 +2,25 @@
 
 #include "auth-common.h"
 #include "lib-signals.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "ostream.h"
 #include "hash.h"
+#include "safe-mkstemp.h"
+#include "strnum.h"
 #include "str.h"
 #include "strescape.h"
 #include "var-expand.h"
 #include "auth-request.h"
 #include "auth-cache.h"
 
+#include <stdio.h>
 #include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define AUTH_CACHE_FILE_HEADER_PREFIX "auth-cache\t1\t"
+#define AUTH_CACHE_SAVE_INTERVAL_MSECS (5*60*1000)
 
 struct auth_cache {
 	HASH_TABLE(char *, struct auth_cache_node *) hash;
@@ -18,7 +29,14 @@ struct auth_cache {
 	size_t max_size, size_left;
 	unsigned int ttl_secs, neg_ttl_secs;
 
-	unsigned int hit_count, miss_count;
+	char *persistent_path;
+	/* Identifies the passdb/userdb configuration that the cache entries
+	   came from. A snapshot with a different one is ignored. */
+	char *config_fingerprint;
+	struct timeout *to_save;
+	struct event *event;
+
+	unsigned int hit_count, miss_count, evict_count;
 	unsigned int pos_entries, neg_entries;
 	unsigned long long pos_size, neg_size;
 };
@@ -211,6 +229,7 @@ static void sig_auth_cache_stats(const siginfo_t *si ATTR_UNUSED, void *context)
 	       "negative: %u entries %llu bytes",
 	       cache->pos_entries, cache->pos_size,
 	       cache->neg_entries, cache->neg_size);
+	i_info("Authentication cache evictions: %u", cache->evict_count);
 
 	cache_used = cache->max_size - cache->size_left;
 	i_info("Authentication cache current size: "
@@ -219,14 +238,245 @@ static void sig_auth_cache_stats(const siginfo_t *si ATTR_UNUSED, void *context)
 	       (unsigned int)(cache_used * 100ULL / cache->max_size));
 
 	/* reset counters */
-	cache->hit_count = cache->miss_count = 0;
+	cache->hit_count = cache->miss_count = cache->evict_count = 0;
 	cache->pos_entries = cache->neg_entries = 0;
 	cache->pos_size = cache->neg_size = 0;
 }
 
+static bool
+auth_cache_node_is_expired(struct auth_cache *cache,
+			   const struct auth_cache_node *node, time_t now)
+{
+	const char *value = node->data + strlen(node->data) + 1;
+	unsigned int ttl_secs = *value == '\0' ? cache->neg_ttl_secs :
+		cache->ttl_secs;
+
+	return node->created < now - (time_t)ttl_secs;
+}
+
+static void
+auth_cache_insert_node(struct auth_cache *cache, const char *key,
+		       const char *value, time_t created, bool last_success)
+{
+	struct auth_cache_node *node;
+	size_t data_size, alloc_size, key_len, value_len = strlen(value);
+	char *hash_key;
+	unsigned int evicted = 0;
+
+	key_len = strlen(key);
+
+	data_size = key_len + 1 + value_len + 1;
+	alloc_size = sizeof(struct auth_cache_node) + data_size;
+
+	/* make sure we have enough space */
+	while (cache->size_left < alloc_size && cache->tail != NULL) {
+		auth_cache_node_destroy(cache, cache->tail);
+		cache->evict_count++;
+		evicted++;
+	}
+	if (evicted > 0) {
+		e_debug(event_create_passthrough(cache->event)->
+			set_name("auth_cache_evicted")->
+			add_int("entries", evicted)->event(),
+			"Evicted %u entries to make space", evicted);
+	}
+
+	node = hash_table_lookup(cache->hash, key);
+	if (node != NULL) {
+		/* key is already in cache (probably expired), remove it */
+		auth_cache_node_destroy(cache, node);
+	}
+
+	/* @UNSAFE */
+	node = i_malloc(alloc_size);
+	node->created = created;
+	node->alloc_size = alloc_size;
+	node->last_success = last_success;
+	memcpy(node->data, key, key_len);
+	memcpy(node->data + key_len + 1, value, value_len);
+
+	auth_cache_node_link_head(cache, node);
+
+	cache->size_left -= alloc_size;
+	hash_key = node->data;
+	hash_table_insert(cache->hash, hash_key, node);
+
+	if (*value != '\0') {
+		cache->pos_entries++;
+		cache->pos_size += alloc_size;
+	} else {
+		cache->neg_entries++;
+		cache->neg_size += alloc_size;
+	}
+}
+
+static int
+auth_cache_load_line(struct auth_cache *cache, const char *line, time_t now,
+		     bool *loaded_r)
+{
+	const char *const *args;
+	time_t created;
+
+	/* <created> <last success> <key> <value> */
+	*loaded_r = FALSE;
+	args = t_strsplit_tabescaped(line);
+	if (str_array_length(args) != 4 ||
+	    str_to_time(args[0], &created) < 0 ||
+	    (args[1][0] != '0' && args[1][0] != '1') || args[1][1] != '\0' ||
+	    args[2][0] == '\0')
+		return -1;
+
+	if (args[3][0] == '\0' && cache->neg_ttl_secs == 0) {
+		/* we're not caching negative entries */
+		return 0;
+	}
+	/* the file may have been written by another server with a slightly
+	   different clock */
+	if (created > now)
+		created = now;
+	auth_cache_insert_node(cache, args[2], args[3], created,
+			       args[1][0] == '1');
+	if (auth_cache_node_is_expired(cache, cache->head, now))
+		auth_cache_node_destroy(cache, cache->head);
+	else
+		*loaded_r = TRUE;
+	return 0;
+}
+
+static void auth_cache_load(struct auth_cache *cache)
+{
+	struct istream *input;
+	const char *line, *fingerprint;
+	unsigned int line_num = 1, count = 0;
+	time_t now = time(NULL);
+	bool loaded;
+	int fd, ret = 0;
+
+	fd = open(cache->persistent_path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT) {
+			e_error(cache->event, "open(%s) failed: %m",
+				cache->persistent_path);
+		}
+		return;
+	}
+
+	input = i_stream_create_fd_autoclose(&fd, SIZE_MAX);
+	line = i_stream_read_next_line(input);
+	if (line == NULL)
+		;
+	else if (!str_begins(line, AUTH_CACHE_FILE_HEADER_PREFIX, &fingerprint)) {
+		e_error(cache->event, "%s: Unsupported file format",
+			cache->persistent_path);
+		line = NULL;
+	} else if (strcmp(fingerprint, cache->config_fingerprint) != 0) {
+		/* the passdbs/userdbs have changed, so the cache keys may
+		   now point to a different database */
+		e_debug(cache->event, "%s: Ignoring cache saved with "
+			"different passdb/userdb configuration",
+			cache->persistent_path);
+		line = NULL;
+	}
+	while (line != NULL &&
+	       (line = i_stream_read_next_line(input)) != NULL) {
+		line_num++;
+		T_BEGIN {
+			ret = auth_cache_load_line(cache, line, now, &loaded);
+		} T_END;
+		if (ret < 0) {
+			/* don't log the line, it may contain passwords */
+			e_error(cache->event, "%s: Corrupted record at line %u",
+				cache->persistent_path, line_num);
+			break;
+		}
+		if (loaded)
+			count++;
+	}
+	if (input->stream_errno != 0) {
+		e_error(cache->event, "read(%s) failed: %s",
+			cache->persistent_path, i_stream_get_error(input));
+	}
+	i_stream_destroy(&input);
+
+	e_debug(event_create_passthrough(cache->event)->
+		set_name("auth_cache_loaded")->
+		add_int("entries", count)->event(),
+		"Loaded %u entries from %s", count, cache->persistent_path);
+}
+
+static int auth_cache_save(struct auth_cache *cache)
+{
+	struct auth_cache_node *node;
+	struct ostream *output;
+	string_t *temp_path, *str;
+	unsigned int count = 0;
+	time_t now = time(NULL);
+	int fd, ret = 0;
+
+	temp_path = t_str_new(128);
+	str_append(temp_path, cache->persistent_path);
+	fd = safe_mkstemp_hostpid(temp_path, 0600, (uid_t)-1, (gid_t)-1);
+	if (fd == -1) {
+		e_error(cache->event, "safe_mkstemp(%s) failed: %m",
+			str_c(temp_path));
+		return -1;
+	}
+	output = o_stream_create_fd_file_autoclose(&fd, 0);
+	o_stream_cork(output);
+	o_stream_nsend_str(output, t_strconcat(AUTH_CACHE_FILE_HEADER_PREFIX,
+		cache->config_fingerprint, "\n", NULL));
+
+	/* write the least recently used entries first, so the LRU order is
+	   the same after loading */
+	str = t_str_new(256);
+	for (node = cache->tail; node != NULL; node = node->next) {
+		if (auth_cache_node_is_expired(cache, node, now))
+			continue;
+
+		str_truncate(str, 0);
+		str_printfa(str, "%lld\t%d\t", (long long)node->created,
+			    node->last_success ? 1 : 0);
+		str_append_tabescaped(str, node->data);
+		str_append_c(str, '\t');
+		str_append_tabescaped(str, node->data + strlen(node->data) + 1);
+		str_append_c(str, '\n');
+		o_stream_nsend(output, str_data(str), str_len(str));
+		count++;
+	}
+	if (o_stream_finish(output) < 0) {
+		e_error(cache->event, "write(%s) failed: %s",
+			str_c(temp_path), o_stream_get_error(output));
+		ret = -1;
+	}
+	o_stream_destroy(&output);
+
+	if (ret == 0 && rename(str_c(temp_path), cache->persistent_path) < 0) {
+		e_error(cache->event, "rename(%s, %s) failed: %m",
+			str_c(temp_path), cache->persistent_path);
+		ret = -1;
+	}
+	if (ret < 0) {
+		i_unlink_if_exists(str_c(temp_path));
+		return -1;
+	}
+	e_debug(event_create_passthrough(cache->event)->
+		set_name("auth_cache_saved")->
+		add_int("entries", count)->event(),
+		"Saved %u entries to %s", count, cache->persistent_path);
+	return 0;
+}
+
+static void auth_cache_save_timeout(struct auth_cache *cache)
+{
+	T_BEGIN {
+		(void)auth_cache_save(cache);
+	} T_END;
+}
+
 struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
-				  unsigned int neg_ttl_secs
-)
+				  unsigned int neg_ttl_secs,
+				  const char *persistent_path,
+				  const char *config_fingerprint)
 {
 	struct auth_cache *cache;
 
@@ -236,6 +486,16 @@ struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 	cache->size_left = max_size;
 	cache->ttl_secs = ttl_secs;
 	cache->neg_ttl_secs = neg_ttl_secs;
+	cache->event = event_create(NULL);
+	event_set_append_log_prefix(cache->event, "auth-cache: ");
+
+	if (persistent_path != NULL && persistent_path[0] != '\0') {
+		cache->persistent_path = i_strdup(persistent_path);
+		cache->config_fingerprint = i_strdup(config_fingerprint);
+		auth_cache_load(cache);
+		cache->to_save = timeout_add(AUTH_CACHE_SAVE_INTERVAL_MSECS,
+					     auth_cache_save_timeout, cache);
+	}
 
 	lib_signals_set_handler(SIGHUP, LIBSIG_FLAGS_SAFE,
 				sig_auth_cache_clear, cache);
@@ -252,8 +512,17 @@ void auth_cache_free(struct auth_cache **_cache)
 	lib_signals_unset_handler(SIGHUP, sig_auth_cache_clear, cache);
 	lib_signals_unset_handler(SIGUSR2, sig_auth_cache_stats, cache);
 
+	if (cache->persistent_path != NULL) {
+		timeout_remove(&cache->to_save);
+		T_BEGIN {
+			(void)auth_cache_save(cache);
+		} T_END;
+		i_free(cache->persistent_path);
+		i_free(cache->config_fingerprint);
+	}
 	auth_cache_clear(cache);
 	hash_table_destroy(&cache->hash);
+	event_unref(&cache->event);
 	i_free(cache);
 }
 
@@ -334,7 +603,7 @@ auth_cache_escape(const char *string,
 	return str_tabescape(string);
 }
 
-static const char *
+const char *
 auth_request_expand_cache_key(const struct auth_request *request,
 			      const char *key, const char *username)
 {
@@ -369,6 +638,21 @@ auth_request_expand_cache_key(const struct auth_request *request,
 	return str_c(value);
 }
 
+static void
+auth_cache_lookup_event(struct auth_cache *cache, const char *result,
+			const char *reason)
+{
+	struct event_passthrough *e =
+		event_create_passthrough(cache->event)->
+		set_name("auth_cache_lookup")->
+		add_str("result", result)->
+		add_str("reason", reason);
+	if (reason == NULL)
+		e_debug(e->event(), "Lookup: %s", result);
+	else
+		e_debug(e->event(), "Lookup: %s (%s)", result, reason);
+}
+
 const char *
 auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		  const char *key, struct auth_cache_node **node_r,
@@ -386,6 +670,7 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 	node = hash_table_lookup(cache->hash, key);
 	if (node == NULL) {
 		cache->miss_count++;
+		auth_cache_lookup_event(cache, "miss", "not_found");
 		return NULL;
 	}
 
@@ -396,6 +681,7 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 	if (node->created < now - (time_t)ttl_secs) {
 		/* TTL expired */
 		cache->miss_count++;
+		auth_cache_lookup_event(cache, "miss", "expired");
 		*expired_r = TRUE;
 	} else {
 		/* move to head */
@@ -404,6 +690,7 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 			auth_cache_node_link_head(cache, node);
 		}
 		cache->hit_count++;
+		auth_cache_lookup_event(cache, "hit", NULL);
 	}
 	if (node->created < now - (time_t)cache->neg_ttl_secs)
 		*neg_expired_r = TRUE;
@@ -417,52 +704,13 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 		       const char *key, const char *value, bool last_success)
 {
-        struct auth_cache_node *node;
-	size_t data_size, alloc_size, key_len, value_len = strlen(value);
-	char *hash_key;
-
 	if (*value == '\0' && cache->neg_ttl_secs == 0) {
 		/* we're not caching negative entries */
 		return;
 	}
 
 	key = auth_request_expand_cache_key(request, key, request->fields.translated_username);
-	key_len = strlen(key);
-
-	data_size = key_len + 1 + value_len + 1;
-	alloc_size = sizeof(struct auth_cache_node) + data_size;
-
-	/* make sure we have enough space */
-	while (cache->size_left < alloc_size && cache->tail != NULL)
-		auth_cache_node_destroy(cache, cache->tail);
-
-	node = hash_table_lookup(cache->hash, key);
-	if (node != NULL) {
-		/* key is already in cache (probably expired), remove it */
-		auth_cache_node_destroy(cache, node);
-	}
-
-	/* @UNSAFE */
-	node = i_malloc(alloc_size);
-	node->created = time(NULL);
-	node->alloc_size = alloc_size;
-	node->last_success = last_success;
-	memcpy(node->data, key, key_len);
-	memcpy(node->data + key_len + 1, value, value_len);
-
-	auth_cache_node_link_head(cache, node);
-
-	cache->size_left -= alloc_size;
-	hash_key = node->data;
-	hash_table_insert(cache->hash, hash_key, node);
-
-	if (*value != '\0') {
-		cache->pos_entries++;
-		cache->pos_size += alloc_size;
-	} else {
-		cache->neg_entries++;
-		cache->neg_size += alloc_size;
-	}
+	auth_cache_insert_node(cache, key, value, time(NULL), last_success);
 }
 
 void auth_cache_remove(struct auth_cache *cache,
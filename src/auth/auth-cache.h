@@ -23,9 +23,15 @@ char *auth_cache_parse_key(pool_t pool, const char *query);
 /* Create a new cache. max_size specifies the maximum amount of memory in
    bytes to use for cache (it's not fully exact). ttl_secs specifies time to
    live for cache record, requests older than that are not used.
-   neg_ttl_secs specifies the TTL for negative entries. */
+   neg_ttl_secs specifies the TTL for negative entries. If persistent_path
+   is non-empty, the cache is loaded from it and the cache contents are
+   periodically saved to it, so they survive restarts. config_fingerprint
+   identifies the passdb/userdb configuration. It's saved with the cache, and
+   a saved cache with a different fingerprint isn't loaded. */
 struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
-				  unsigned int neg_ttl_secs);
+				  unsigned int neg_ttl_secs,
+				  const char *persistent_path,
+				  const char *config_fingerprint);
 void auth_cache_free(struct auth_cache **cache);
 
 /* Clear the cache. Returns how many entries were removed. */
@@ -45,6 +51,12 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 		       const char *key, const char *value, bool last_success);
 
+/* Expand the cache key for the request. Requests with the same expanded key
+   get the same reply from the passdb/userdb. */
+const char *
+auth_request_expand_cache_key(const struct auth_request *request,
+			      const char *key, const char *username);
+
 /* Remove key from cache */
 void auth_cache_remove(struct auth_cache *cache,
 		       const struct auth_request *request,
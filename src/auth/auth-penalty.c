@@ -6,6 +6,7 @@
 #include "crc32.h"
 #include "master-service.h"
 #include "anvil-client.h"
+#include "anvil-shm.h"
 #include "auth-request.h"
 #include "auth-penalty.h"
 
@@ -23,10 +24,25 @@ struct auth_penalty_request {
 
 struct auth_penalty {
 	struct anvil_client *client;
+	/* anvil's penalty table in shared memory, or NULL if not available */
+	struct anvil_shm *shm;
 
 	bool disabled:1;
 };
 
+static void auth_penalty_shm_open(struct auth_penalty *penalty,
+				  const char *path)
+{
+	const char *p, *shm_path, *error;
+
+	p = strrchr(path, '/');
+	shm_path = p == NULL ? ANVIL_SHM_FILE_NAME :
+		t_strconcat(t_strdup_until(path, p + 1),
+			    ANVIL_SHM_FILE_NAME, NULL);
+	if (anvil_shm_open(shm_path, &penalty->shm, &error) < 0)
+		i_error("%s", error);
+}
+
 struct auth_penalty *auth_penalty_init(const char *path)
 {
 	struct auth_penalty *penalty;
@@ -39,6 +55,8 @@ struct auth_penalty *auth_penalty_init(const char *path)
 	else {
 		anvil_client_cmd(penalty->client, t_strdup_printf(
 			"PENALTY-SET-EXPIRE-SECS\t%u", AUTH_PENALTY_TIMEOUT));
+		/* open while we still have the permissions to do it */
+		auth_penalty_shm_open(penalty, path);
 	}
 	return penalty;
 }
@@ -48,6 +66,7 @@ void auth_penalty_deinit(struct auth_penalty **_penalty)
 	struct auth_penalty *penalty = *_penalty;
 
 	*_penalty = NULL;
+	anvil_shm_close(&penalty->shm);
 	anvil_client_deinit(&penalty->client);
 	i_free(penalty);
 }
@@ -61,13 +80,34 @@ unsigned int auth_penalty_to_secs(unsigned int penalty)
 	return secs < AUTH_PENALTY_MAX_SECS ? secs : AUTH_PENALTY_MAX_SECS;
 }
 
+static unsigned int
+auth_penalty_get_current(unsigned int penalty, time_t last_penalty)
+{
+	unsigned int secs, drop_penalty;
+
+	if (last_penalty > ioloop_time) {
+		/* time moved backwards? */
+		last_penalty = ioloop_time;
+	}
+
+	/* update penalty. */
+	drop_penalty = AUTH_PENALTY_MAX_PENALTY;
+	while (penalty > 0) {
+		secs = auth_penalty_to_secs(drop_penalty);
+		if (ioloop_time - last_penalty < secs)
+			break;
+		drop_penalty--;
+		penalty--;
+	}
+	return penalty;
+}
+
 static void
 auth_penalty_anvil_callback(const char *reply,
 			    struct auth_penalty_request *request)
 {
 	unsigned int penalty = 0;
 	unsigned long last_penalty = 0;
-	unsigned int secs, drop_penalty;
 
 	if (reply == NULL) {
 		/* internal failure. */
@@ -80,20 +120,8 @@ auth_penalty_anvil_callback(const char *reply,
 		e_error(request->auth_request->event,
 			"Invalid PENALTY-GET reply: %s", reply);
 	} else {
-		if ((time_t)last_penalty > ioloop_time) {
-			/* time moved backwards? */
-			last_penalty = ioloop_time;
-		}
-
-		/* update penalty. */
-		drop_penalty = AUTH_PENALTY_MAX_PENALTY;
-		while (penalty > 0) {
-			secs = auth_penalty_to_secs(drop_penalty);
-			if (ioloop_time - last_penalty < secs)
-				break;
-			drop_penalty--;
-			penalty--;
-		}
+		penalty = auth_penalty_get_current(penalty,
+						   (time_t)last_penalty);
 	}
 
 	request->callback(penalty, request->auth_request);
@@ -120,6 +148,7 @@ void auth_penalty_lookup(struct auth_penalty *penalty,
 			 auth_penalty_callback_t *callback)
 {
 	struct auth_penalty_request *request;
+	unsigned int value, last_penalty;
 	const char *ident;
 
 	ident = auth_penalty_get_ident(auth_request);
@@ -128,6 +157,14 @@ void auth_penalty_lookup(struct auth_penalty *penalty,
 		callback(0, auth_request);
 		return;
 	}
+	if (penalty->shm != NULL &&
+	    anvil_shm_lookup(penalty->shm, ANVIL_SHM_TABLE_PENALTY, ident,
+			     &value, &last_penalty) >= 0) {
+		/* found the answer without asking anvil */
+		callback(auth_penalty_get_current(value, last_penalty),
+			 auth_request);
+		return;
+	}
 
 	request = i_new(struct auth_penalty_request, 1);
 	request->auth_request = auth_request;
@@ -1,9 +1,12 @@
 /* Copyright (c) 2016-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
+#include "hash.h"
 #include "net.h"
 #include "passdb.h"
 #include "str.h"
+#include "strnum.h"
 #include "istream.h"
 #include "ioloop.h"
 #include "base64.h"
@@ -22,6 +25,8 @@
 #include "iostream-ssl.h"
 
 #define AUTH_POLICY_DNS_SOCKET_PATH "dns-client"
+/* Maximum number of cached policy results */
+#define AUTH_POLICY_CACHE_MAX_ENTRIES 100000
 
 static struct http_client_settings http_client_set = {
 	.dns_client_socket_path = AUTH_POLICY_DNS_SOCKET_PATH,
@@ -47,9 +52,15 @@ struct policy_lookup_ctx {
 	bool expect_result;
 	int result;
 	const char *message;
+	unsigned int ttl_secs;
 	auth_policy_callback_t callback;
 	void *callback_context;
 
+	/* auth_policy_cache_key expanded for this request, or NULL */
+	const char *cache_key;
+	/* cache entry that is waiting for this lookup to finish */
+	struct policy_cache_entry *cache_entry;
+
 	struct istream *payload;
 	struct io *io;
 	struct event *event;
@@ -57,12 +68,34 @@ struct policy_lookup_ctx {
 	enum {
 		POLICY_RESULT = 0,
 		POLICY_RESULT_VALUE_STATUS,
-		POLICY_RESULT_VALUE_MESSAGE
+		POLICY_RESULT_VALUE_MESSAGE,
+		POLICY_RESULT_VALUE_TTL
 	} parse_state;
 
 	bool parse_error;
+	/* the result is the policy server's response (or the failure to
+	   parse it), rather than the default result */
+	bool result_parsed;
 };
 
+struct policy_cache_entry {
+	char *key;
+	/* the result can be used until this time */
+	time_t expires;
+	int result;
+	char *message;
+
+	/* lookup that sent the HTTP request, or NULL if it's finished */
+	struct policy_lookup_ctx *lookup;
+	/* concurrent lookups with the same cache key, which are waiting for
+	   the HTTP request to finish */
+	ARRAY(struct policy_lookup_ctx *) waiters;
+};
+
+static HASH_TABLE(char *, struct policy_cache_entry *) policy_cache;
+
+static void auth_policy_cache_finish(struct policy_lookup_ctx *context);
+
 struct policy_template_keyvalue {
 	const char *key;
 	const char *value;
@@ -229,12 +262,37 @@ void auth_policy_init(void)
 	if (global_auth_settings->policy_log_only)
 		i_warning("auth-policy: Currently in log-only mode. Ignoring "
 			  "tarpit and disconnect instructions from policy server");
+	hash_table_create(&policy_cache, default_pool, 0, str_hash, strcmp);
+}
+
+static void auth_policy_cache_entry_free(struct policy_cache_entry *entry)
+{
+	i_assert(entry->lookup == NULL);
+	i_assert(array_count(&entry->waiters) == 0);
+
+	array_free(&entry->waiters);
+	i_free(entry->message);
+	i_free(entry->key);
+	i_free(entry);
 }
 
 void auth_policy_deinit(void)
 {
+	struct hash_iterate_context *iter;
+	struct policy_cache_entry *entry;
+	char *key;
+
+	/* this aborts the pending lookups, which also finishes the lookups
+	   waiting for them */
 	if (http_client != NULL)
 		http_client_deinit(&http_client);
+	if (hash_table_is_created(policy_cache)) {
+		iter = hash_table_iterate_init(policy_cache);
+		while (hash_table_iterate(iter, policy_cache, &key, &entry))
+			auth_policy_cache_entry_free(entry);
+		hash_table_iterate_deinit(&iter);
+		hash_table_destroy(&policy_cache);
+	}
 	i_free(auth_policy_json_template);
 }
 
@@ -270,6 +328,9 @@ void auth_policy_log_result(struct policy_lookup_ctx *context)
 static
 void auth_policy_finish(struct policy_lookup_ctx *context)
 {
+	/* the lookup was aborted before the callback was called */
+	auth_policy_cache_finish(context);
+
 	if (context->parser != NULL) {
 		const char *error ATTR_UNUSED;
 		(void)json_parser_deinit(&context->parser, &error);
@@ -288,6 +349,147 @@ void auth_policy_callback(struct policy_lookup_ctx *context)
 		context->callback(context->result, context->callback_context);
 	if (context->event != NULL)
 		auth_policy_log_result(context);
+	auth_policy_cache_finish(context);
+}
+
+static
+void auth_policy_apply_result(struct policy_lookup_ctx *context)
+{
+	context->request->policy_refusal = FALSE;
+
+	if (context->result < 0) {
+		if (context->message != NULL) {
+			/* set message here */
+			e_debug(context->event,
+				"Policy response %d with message: %s",
+				context->result, context->message);
+			auth_request_set_field(context->request, "reason", context->message, NULL);
+		}
+		context->request->policy_refusal = TRUE;
+	} else {
+		e_debug(context->event,
+			"Policy response %d", context->result);
+	}
+
+	if (context->request->policy_refusal) {
+		e_info(context->event, "Authentication failure due to policy server refusal%s%s",
+		       (context->message!=NULL?": ":""),
+		       (context->message!=NULL?context->message:""));
+	}
+}
+
+static
+void auth_policy_cache_purge(void)
+{
+	struct hash_iterate_context *iter;
+	struct policy_cache_entry *entry;
+	char *key;
+
+	iter = hash_table_iterate_init(policy_cache);
+	while (hash_table_iterate(iter, policy_cache, &key, &entry)) {
+		if (entry->lookup == NULL && entry->expires <= ioloop_time) {
+			hash_table_remove(policy_cache, key);
+			auth_policy_cache_entry_free(entry);
+		}
+	}
+	hash_table_iterate_deinit(&iter);
+}
+
+static
+void auth_policy_cache_finish(struct policy_lookup_ctx *context)
+{
+	struct policy_cache_entry *entry = context->cache_entry;
+	struct policy_lookup_ctx *const *waiters;
+	unsigned int i, count;
+	bool cache;
+
+	if (entry == NULL)
+		return;
+	context->cache_entry = NULL;
+	i_assert(entry->lookup == context);
+	entry->lookup = NULL;
+
+	/* Cache only "allow" results that the policy server explicitly
+	   allowed to be cached. Tarpit and reject verdicts are always asked
+	   from the policy server, so it sees the repeated attempts. */
+	cache = context->result_parsed && !context->parse_error &&
+		context->result == 0 && context->ttl_secs > 0;
+	if (cache) {
+		entry->result = context->result;
+		entry->message = i_strdup(context->message);
+		entry->expires = ioloop_time + context->ttl_secs;
+	} else {
+		hash_table_remove(policy_cache, entry->key);
+	}
+
+	/* the callbacks may start new lookups with the same key */
+	waiters = array_get(&entry->waiters, &count);
+	if (count > 0) {
+		waiters = p_memdup(pool_datastack_create(), waiters,
+				   sizeof(*waiters) * count);
+		array_clear(&entry->waiters);
+	}
+	for (i = 0; i < count; i++) {
+		struct policy_lookup_ctx *waiter = waiters[i];
+
+		waiter->result = context->result;
+		waiter->message = p_strdup(waiter->pool, context->message);
+		if (context->result_parsed)
+			auth_policy_apply_result(waiter);
+		auth_policy_callback(waiter);
+		auth_policy_finish(waiter);
+	}
+	if (!cache)
+		auth_policy_cache_entry_free(entry);
+}
+
+/* Returns TRUE if the lookup was finished or is waiting for another lookup
+   with the same cache key, FALSE if the policy server must be asked. */
+static
+bool auth_policy_cache_lookup(struct policy_lookup_ctx *context)
+{
+	struct policy_cache_entry *entry;
+
+	if (context->cache_key == NULL)
+		return FALSE;
+
+	entry = hash_table_lookup(policy_cache, context->cache_key);
+	if (entry != NULL && entry->lookup == NULL &&
+	    entry->expires <= ioloop_time) {
+		hash_table_remove(policy_cache, entry->key);
+		auth_policy_cache_entry_free(entry);
+		entry = NULL;
+	}
+	if (entry == NULL) {
+		if (hash_table_count(policy_cache) >= AUTH_POLICY_CACHE_MAX_ENTRIES) {
+			auth_policy_cache_purge();
+			if (hash_table_count(policy_cache) >= AUTH_POLICY_CACHE_MAX_ENTRIES)
+				return FALSE;
+		}
+		entry = i_new(struct policy_cache_entry, 1);
+		entry->key = i_strdup(context->cache_key);
+		entry->lookup = context;
+		i_array_init(&entry->waiters, 4);
+		hash_table_insert(policy_cache, entry->key, entry);
+		context->cache_entry = entry;
+		return FALSE;
+	}
+
+	auth_request_ref(context->request);
+	if (entry->lookup != NULL) {
+		e_debug(context->event,
+			"Waiting for a concurrent policy request");
+		array_push_back(&entry->waiters, &context);
+		return TRUE;
+	}
+
+	e_debug(context->event, "Policy response found from cache");
+	context->result = entry->result;
+	context->message = p_strdup(context->pool, entry->message);
+	auth_policy_apply_result(context);
+	auth_policy_callback(context);
+	auth_policy_finish(context);
+	return TRUE;
 }
 
 static
@@ -305,6 +507,8 @@ void auth_policy_parse_response(struct policy_lookup_ctx *context)
 				context->parse_state = POLICY_RESULT_VALUE_STATUS;
 			else if (strcmp(value, "msg") == 0)
 				context->parse_state = POLICY_RESULT_VALUE_MESSAGE;
+			else if (strcmp(value, "ttl") == 0)
+				context->parse_state = POLICY_RESULT_VALUE_TTL;
 			else
 				continue;
 		} else if (context->parse_state == POLICY_RESULT_VALUE_STATUS) {
@@ -317,6 +521,11 @@ void auth_policy_parse_response(struct policy_lookup_ctx *context)
 			if (*value != '\0')
 				context->message = p_strdup(context->pool, value);
 			context->parse_state = POLICY_RESULT;
+		} else if (context->parse_state == POLICY_RESULT_VALUE_TTL) {
+			if (type != JSON_TYPE_NUMBER ||
+			    str_to_uint(value, &context->ttl_secs) != 0)
+				break;
+			context->parse_state = POLICY_RESULT;
 		} else {
 			break;
 		}
@@ -352,28 +561,8 @@ void auth_policy_parse_response(struct policy_lookup_ctx *context)
 		context->result = (context->set->policy_reject_on_fail ? -1 : 0);
 	}
 
-	context->request->policy_refusal = FALSE;
-
-	if (context->result < 0) {
-		if (context->message != NULL) {
-			/* set message here */
-			e_debug(context->event,
-				"Policy response %d with message: %s",
-				context->result, context->message);
-			auth_request_set_field(context->request, "reason", context->message, NULL);
-		}
-		context->request->policy_refusal = TRUE;
-	} else {
-		e_debug(context->event,
-			"Policy response %d", context->result);
-	}
-
-	if (context->request->policy_refusal) {
-		e_info(context->event, "Authentication failure due to policy server refusal%s%s",
-		       (context->message!=NULL?": ":""),
-		       (context->message!=NULL?context->message:""));
-	}
-
+	context->result_parsed = TRUE;
+	auth_policy_apply_result(context);
 	auth_policy_callback(context);
 	i_stream_unref(&context->payload);
 }
@@ -579,6 +768,24 @@ void auth_policy_create_json(struct policy_lookup_ctx *context,
 	str_append_c(context->json, '}');
 	e_debug(context->event,
 		"Policy server request JSON: %s", str_c(context->json));
+
+	if (context->expect_result && *context->set->policy_cache_key != '\0') {
+		/* the checks before and after authentication are cached
+		   separately */
+		string_t *key = t_str_new(64);
+		str_append(key, context->request->policy_processed ?
+			   "after\t" : "before\t");
+		if (auth_request_var_expand_with_table(key,
+				context->set->policy_cache_key,
+				context->request, var_table,
+				auth_policy_escape_function, &error) <= 0) {
+			e_error(context->event,
+				"Failed to expand auth_policy_cache_key: %s",
+				error);
+		} else {
+			context->cache_key = p_strdup(context->pool, str_c(key));
+		}
+	}
 }
 
 static
@@ -624,7 +831,8 @@ void auth_policy_check(struct auth_request *request, const char *password,
 	T_BEGIN {
 		auth_policy_create_json(ctx, password, FALSE);
 	} T_END;
-	auth_policy_send_request(ctx);
+	if (!auth_policy_cache_lookup(ctx))
+		auth_policy_send_request(ctx);
 }
 
 void auth_policy_report(struct auth_request *request)
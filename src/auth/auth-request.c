@@ -611,6 +611,7 @@ void auth_request_passdb_lookup_begin(struct auth_request *request)
 	i_assert(!request->userdb_lookup);
 
 	request->passdb_cache_result = AUTH_REQUEST_CACHE_NONE;
+	request->passdb_verified_cache_result = AUTH_REQUEST_CACHE_NONE;
 
 	name = (request->passdb->set->name[0] != '\0' ?
 		request->passdb->set->name :
@@ -648,6 +649,10 @@ void auth_request_passdb_lookup_end(struct auth_request *request,
 	if (request->passdb_cache_result != AUTH_REQUEST_CACHE_NONE &&
 	    request->set->cache_ttl != 0 && request->set->cache_size != 0)
 		e->add_str("cache", auth_request_cache_result_to_str(request->passdb_cache_result));
+	if (request->passdb_verified_cache_result != AUTH_REQUEST_CACHE_NONE) {
+		e->add_str("verified_cache", auth_request_cache_result_to_str(
+			request->passdb_verified_cache_result));
+	}
 	e_debug(e->event(), "Finished passdb lookup");
 	event_unref(&event);
 	array_pop_back(&request->authdb_event);
@@ -2417,6 +2422,57 @@ int auth_request_password_verify_log(struct auth_request *request,
 	return ret;
 }
 
+bool auth_request_password_verify_is_slow(struct auth_request *request,
+					  const char *crypted_password,
+					  const char *scheme)
+{
+	if (worker || !request->set->verify_slow_passwords_with_worker)
+		return FALSE;
+	/* these don't verify the password at all */
+	if (request->fields.skip_password_check ||
+	    request->passdb->set->deny ||
+	    auth_fields_exists(request->fields.extra_fields, "nopassword"))
+		return FALSE;
+	return password_scheme_is_slow(scheme, crypted_password);
+}
+
+void auth_request_password_verify_async(struct auth_request *request,
+					const char *plain_password,
+					const char *crypted_password,
+					const char *scheme,
+					verify_plain_callback_t *callback)
+{
+	unsigned char verified_mac[PASSDB_VERIFIED_MAC_LEN];
+	bool slow_scheme;
+	int ret;
+
+	if (auth_request_password_verify_is_slow(request, crypted_password,
+						 scheme)) {
+		passdb_blocking_verify_password(request, plain_password,
+						crypted_password, scheme,
+						callback);
+		return;
+	}
+
+	slow_scheme = !worker &&
+		password_scheme_is_slow(scheme, crypted_password);
+	if (slow_scheme &&
+	    passdb_cache_verified_lookup(request, plain_password,
+			t_strdup_printf("{%s}%s", scheme, crypted_password),
+			verified_mac)) {
+		callback(PASSDB_RESULT_OK, request);
+		return;
+	}
+
+	ret = auth_request_password_verify(request, plain_password,
+					   crypted_password, scheme,
+					   AUTH_SUBSYS_DB);
+	if (ret > 0 && slow_scheme)
+		passdb_cache_verified_add(verified_mac);
+	callback(ret > 0 ? PASSDB_RESULT_OK : PASSDB_RESULT_PASSWORD_MISMATCH,
+		 request);
+}
+
 enum passdb_result auth_request_password_missing(struct auth_request *request)
 {
 	if (request->fields.skip_password_check) {
@@ -165,6 +165,7 @@ struct auth_request {
 	void *context;
 
 	enum auth_request_cache_result passdb_cache_result;
+	enum auth_request_cache_result passdb_verified_cache_result;
 	enum auth_request_cache_result userdb_cache_result;
 
 	/* this is a lookup on auth socket (not login socket).
@@ -321,6 +322,18 @@ int auth_request_password_verify_log(struct auth_request *request,
 				 const char *crypted_password,
 				 const char *scheme, const char *subsystem,
 				 bool log_password_mismatch);
+/* Returns TRUE if verifying the crypted password is CPU intensive and should
+   be done in an auth worker instead of blocking this process. */
+bool auth_request_password_verify_is_slow(struct auth_request *request,
+					  const char *crypted_password,
+					  const char *scheme);
+/* Verify the password and call the callback with the result. Slow schemes
+   are verified in an auth worker, so the callback may be called later. */
+void auth_request_password_verify_async(struct auth_request *request,
+					const char *plain_password,
+					const char *crypted_password,
+					const char *scheme,
+					verify_plain_callback_t *callback);
 enum passdb_result auth_request_password_missing(struct auth_request *request);
 
 void auth_request_get_log_prefix(string_t *str, struct auth_request *auth_request,
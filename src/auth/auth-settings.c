@@ -22,7 +22,8 @@ static struct file_listener_settings auth_unix_listeners_array[] = {
 	{ "auth-login", 0600, "$default_internal_user", "" },
 	{ "auth-client", 0600, "$default_internal_user", "" },
 	{ "auth-userdb", 0666, "$default_internal_user", "" },
-	{ "auth-master", 0600, "", "" }
+	{ "auth-master", 0600, "", "" },
+	{ "auth-master.%{pid}", 0600, "", "" }
 };
 static struct file_listener_settings *auth_unix_listeners[] = {
 	&auth_unix_listeners_array[0],
@@ -30,7 +31,8 @@ static struct file_listener_settings *auth_unix_listeners[] = {
 	&auth_unix_listeners_array[2],
 	&auth_unix_listeners_array[3],
 	&auth_unix_listeners_array[4],
-	&auth_unix_listeners_array[5]
+	&auth_unix_listeners_array[5],
+	&auth_unix_listeners_array[6]
 };
 static buffer_t auth_unix_listeners_buf = {
 	{ { auth_unix_listeners, sizeof(auth_unix_listeners) } }
@@ -61,8 +63,6 @@ struct service_settings auth_service_settings = {
 			      sizeof(auth_unix_listeners[0]) } },
 	.fifo_listeners = ARRAY_INIT,
 	.inet_listeners = ARRAY_INIT,
-
-	.process_limit_1 = TRUE
 };
 
 /* <settings checks> */
@@ -233,6 +233,8 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(TIME, cache_ttl),
 	DEF(TIME, cache_negative_ttl),
 	DEF(BOOL, cache_verify_password_with_worker),
+	DEF(STR, cache_persistent_path),
+	DEF(TIME, cache_verified_password_ttl),
 	DEF(STR, username_chars),
 	DEF(STR, username_translation),
 	DEF(STR, username_format),
@@ -243,6 +245,7 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(STR, winbind_helper_path),
 	DEF(STR, proxy_self),
 	DEF(TIME, failure_delay),
+	DEF(BOOL, verify_slow_passwords_with_worker),
 
 	DEF(STR, policy_server_url),
 	DEF(STR, policy_server_api_header),
@@ -256,6 +259,7 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(BOOL, policy_report_after_auth),
 	DEF(BOOL, policy_log_only),
 	DEF(UINT, policy_hash_truncate),
+	DEF(STR, policy_cache_key),
 
 	DEF(BOOL, verbose),
 	DEF(BOOL, debug),
@@ -290,6 +294,8 @@ static const struct auth_settings auth_default_settings = {
 	.cache_ttl = 60*60,
 	.cache_negative_ttl = 60*60,
 	.cache_verify_password_with_worker = FALSE,
+	.cache_persistent_path = "",
+	.cache_verified_password_ttl = 0,
 	.username_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ01234567890.-_@",
 	.username_translation = "",
 	.username_format = "%Lu",
@@ -300,6 +306,7 @@ static const struct auth_settings auth_default_settings = {
 	.winbind_helper_path = "/usr/bin/ntlm_auth",
 	.proxy_self = "",
 	.failure_delay = 2,
+	.verify_slow_passwords_with_worker = FALSE,
 
 	.policy_server_url = "",
 	.policy_server_api_header = "",
@@ -313,6 +320,7 @@ static const struct auth_settings auth_default_settings = {
 	.policy_report_after_auth = TRUE,
 	.policy_log_only = FALSE,
 	.policy_hash_truncate = 12,
+	.policy_cache_key = "",
 
 	.verbose = FALSE,
 	.debug = FALSE,
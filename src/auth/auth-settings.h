@@ -45,6 +45,8 @@ struct auth_settings {
 	unsigned int cache_ttl;
 	unsigned int cache_negative_ttl;
 	bool cache_verify_password_with_worker;
+	const char *cache_persistent_path;
+	unsigned int cache_verified_password_ttl;
 	const char *username_chars;
 	const char *username_translation;
 	const char *username_format;
@@ -55,6 +57,7 @@ struct auth_settings {
 	const char *winbind_helper_path;
 	const char *proxy_self;
 	unsigned int failure_delay;
+	bool verify_slow_passwords_with_worker;
 
 	const char *policy_server_url;
 	const char *policy_server_api_header;
@@ -68,6 +71,7 @@ struct auth_settings {
 	bool policy_report_after_auth;
 	bool policy_log_only;
 	unsigned int policy_hash_truncate;
+	const char *policy_cache_key;
 
 	bool verbose, debug, debug_passwords;
 	bool allow_weak_schemes;
@@ -4,6 +4,7 @@
 #include "ioloop.h"
 #include "array.h"
 #include "aqueue.h"
+#include "hash.h"
 #include "connection.h"
 #include "net.h"
 #include "istream.h"
@@ -12,6 +13,7 @@
 #include "str.h"
 #include "strescape.h"
 #include "eacces-error.h"
+#include "time-util.h"
 #include "auth-request.h"
 #include "auth-worker-server.h"
 #include "auth-worker-connection.h"
@@ -30,14 +32,31 @@
 #define AUTH_WORKER_DELAY_WARN_SECS 3
 #define AUTH_WORKER_DELAY_WARN_MIN_INTERVAL_SECS (5*60)
 #define AUTH_WORKER_CONNECT_RETRY_TIMEOUT_MSECS (5*1000)
+/* If the average lookup takes this many times longer than the baseline,
+   the backend is assumed to be overloaded and the worker pool is shrunk. */
+#define AUTH_WORKER_OVERLOAD_LATENCY_FACTOR 4
+/* While slow requests are queued, send one of them after this many other
+   requests even if more of those are still waiting. */
+#define AUTH_WORKER_SLOW_REQUEST_INTERVAL 8
 
 struct auth_worker_request {
 	unsigned int id;
 	time_t created;
+	struct timeval queued_time, sent_time;
 	const char *username;
 	const char *data;
 	auth_worker_callback_t *callback;
 	void *context;
+
+	/* Key identifying identical lookups, or NULL if the reply can't be
+	   shared with other requests. */
+	const char *coalesce_key;
+	/* Requests waiting for this request's reply */
+	struct auth_worker_request *waiters, *waiters_tail, *waiter_next;
+	unsigned int waiter_count;
+	bool multiline:1;
+	/* CPU intensive request, see auth_worker_call_slow() */
+	bool slow:1;
 };
 
 struct auth_worker_connection {
@@ -57,15 +76,132 @@ static struct connection_list *connections = NULL;
 static unsigned int idle_count = 0, auth_workers_with_errors = 0;
 static ARRAY(struct auth_worker_request *) worker_request_array;
 static struct aqueue *worker_request_queue;
+/* CPU intensive requests are queued separately, so they don't delay the
+   other requests much. See AUTH_WORKER_SLOW_REQUEST_INTERVAL. */
+static ARRAY(struct auth_worker_request *) worker_slow_request_array;
+static struct aqueue *worker_slow_request_queue;
+static unsigned int slow_requests_running = 0, slow_requests_limit;
+static unsigned int requests_sent_before_slow = 0;
 static time_t auth_worker_last_warn;
 static unsigned int auth_workers_throttle_count;
 static unsigned int auth_worker_process_limit = 0;
+static HASH_TABLE(const char *, struct auth_worker_request *) coalesced_requests;
+
+/* Worker count limit based on the lookup latency, 0 if not limited */
+static unsigned int auth_worker_latency_limit = 0;
+static unsigned int auth_worker_exec_usecs_avg, auth_worker_exec_usecs_base;
+static time_t auth_worker_last_resize;
 
 static const char *worker_socket_path;
 
 static void auth_worker_deinit(struct auth_worker_connection **worker,
 			       const char *reason, bool restart) ATTR_NULL(2);
 
+static struct auth_worker_connection *auth_worker_create(void);
+static struct auth_worker_connection *auth_worker_find_free(void);
+static void auth_worker_request_send_next(struct auth_worker_connection *worker);
+
+static bool
+auth_worker_request_callback(struct auth_worker_connection *worker,
+			     struct auth_worker_request *request,
+			     const char *const *args)
+{
+	struct auth_worker_request *waiter, *next;
+	bool ret;
+
+	if (request->coalesce_key == NULL)
+		return request->callback(worker, args, request->context);
+
+	i_assert(args[0][0] != '*');
+	hash_table_remove(coalesced_requests, request->coalesce_key);
+
+	/* the callbacks may free the requests' pools */
+	waiter = request->waiters;
+	ret = request->callback(worker, args, request->context);
+	for (; waiter != NULL; waiter = next) {
+		next = waiter->waiter_next;
+		(void)waiter->callback(worker, args, waiter->context);
+	}
+	return ret;
+}
+
+static void auth_worker_latency_update(unsigned int exec_usecs)
+{
+	struct auth_worker_connection *worker;
+	unsigned int count = connections->connections_count;
+
+	if (auth_worker_exec_usecs_avg == 0)
+		auth_worker_exec_usecs_avg = exec_usecs;
+	else {
+		auth_worker_exec_usecs_avg =
+			(auth_worker_exec_usecs_avg * 7 + exec_usecs) / 8;
+	}
+	if (auth_worker_exec_usecs_base == 0 ||
+	    auth_worker_exec_usecs_avg < auth_worker_exec_usecs_base)
+		auth_worker_exec_usecs_base = auth_worker_exec_usecs_avg;
+
+	/* resize at most once per second */
+	if (auth_worker_last_resize == ioloop_time)
+		return;
+	auth_worker_last_resize = ioloop_time;
+	/* let the baseline slowly follow permanent latency changes */
+	auth_worker_exec_usecs_base += auth_worker_exec_usecs_base / 32 + 1;
+
+	if (auth_worker_exec_usecs_avg >
+	    auth_worker_exec_usecs_base * AUTH_WORKER_OVERLOAD_LATENCY_FACTOR) {
+		/* the backend is getting slower as the number of workers grows.
+		   more parallel lookups would only make it worse. */
+		if (count > 1 && (auth_worker_latency_limit == 0 ||
+				  auth_worker_latency_limit >= count)) {
+			auth_worker_latency_limit = count - 1;
+			e_debug(auth_event, "auth-worker: Lookups are slow "
+				"(%u usecs, baseline %u usecs), "
+				"reducing workers to %u",
+				auth_worker_exec_usecs_avg,
+				auth_worker_exec_usecs_base,
+				auth_worker_latency_limit);
+		}
+	} else if (auth_worker_latency_limit > 0 &&
+		   auth_worker_exec_usecs_avg <
+		   auth_worker_exec_usecs_base * 2 &&
+		   aqueue_count(worker_request_queue) > 0) {
+		/* latency has recovered and requests are waiting */
+		auth_worker_latency_limit++;
+		if (auth_worker_latency_limit >= auth_worker_process_limit)
+			auth_worker_latency_limit = 0;
+		worker = auth_worker_create();
+		if (worker != NULL)
+			auth_worker_request_send_next(worker);
+	}
+}
+
+static void
+auth_worker_request_finished(struct auth_worker_connection *worker,
+			     struct auth_worker_request *request)
+{
+	long long queue_usecs =
+		timeval_diff_usecs(&request->sent_time, &request->queued_time);
+	long long exec_usecs =
+		timeval_diff_usecs(&ioloop_timeval, &request->sent_time);
+
+	if (exec_usecs < 0)
+		exec_usecs = 0;
+	e_debug(event_create_passthrough(worker->conn.event)->
+		set_name("auth_worker_request_finished")->
+		add_int("queue_usecs", queue_usecs)->
+		add_int("exec_usecs", exec_usecs)->
+		add_int("coalesced", request->waiter_count)->event(),
+		"Finished %s request for %s "
+		"(queued %lld usecs, executed %lld usecs, %u coalesced)",
+		t_strcut(request->data, '\t'), request->username,
+		queue_usecs, exec_usecs, request->waiter_count);
+
+	/* multi-line replies depend on the reader, and slow requests on the
+	   CPU, not on the backend */
+	if (!request->multiline && !request->slow)
+		auth_worker_latency_update(exec_usecs);
+}
+
 static void auth_worker_idle_timeout(struct auth_worker_connection *worker)
 {
 	i_assert(worker->request == NULL);
@@ -101,7 +237,7 @@ static bool auth_worker_request_send(struct auth_worker_connection *worker,
 			t_strdup_printf("%d", PASSDB_RESULT_INTERNAL_FAILURE),
 			NULL,
 		};
-		request->callback(worker, args, request->context);
+		(void)auth_worker_request_callback(worker, request, args);
 		return FALSE;
 	}
 	if (age_secs >= AUTH_WORKER_DELAY_WARN_SECS &&
@@ -115,6 +251,13 @@ static bool auth_worker_request_send(struct auth_worker_connection *worker,
 	}
 
 	request->id = ++worker->id_counter;
+	request->sent_time = ioloop_timeval;
+	if (request->slow) {
+		slow_requests_running++;
+		requests_sent_before_slow = 0;
+	} else if (aqueue_count(worker_slow_request_queue) > 0) {
+		requests_sent_before_slow++;
+	}
 
 	iov[0].iov_base = t_strdup_printf("%d\t", request->id);
 	iov[0].iov_len = strlen(iov[0].iov_base);
@@ -137,20 +280,42 @@ static bool auth_worker_request_send(struct auth_worker_connection *worker,
 	return TRUE;
 }
 
+static bool auth_worker_slow_request_can_send(bool force)
+{
+	return aqueue_count(worker_slow_request_queue) > 0 &&
+		slow_requests_running < slow_requests_limit &&
+		(force || requests_sent_before_slow >=
+			  AUTH_WORKER_SLOW_REQUEST_INTERVAL);
+}
+
 static void auth_worker_request_send_next(struct auth_worker_connection *worker)
 {
 	struct auth_worker_request *request;
 
 	do {
-		if (aqueue_count(worker_request_queue) == 0)
+		if (auth_worker_slow_request_can_send(
+				aqueue_count(worker_request_queue) == 0)) {
+			request = array_idx_elem(&worker_slow_request_array,
+				aqueue_idx(worker_slow_request_queue, 0));
+			aqueue_delete_tail(worker_slow_request_queue);
+		} else if (aqueue_count(worker_request_queue) > 0) {
+			request = array_idx_elem(&worker_request_array,
+				aqueue_idx(worker_request_queue, 0));
+			aqueue_delete_tail(worker_request_queue);
+		} else {
 			return;
-
-		request = array_idx_elem(&worker_request_array,
-					 aqueue_idx(worker_request_queue, 0));
-		aqueue_delete_tail(worker_request_queue);
+		}
 	} while (!auth_worker_request_send(worker, request));
 }
 
+static void auth_worker_request_done(struct auth_worker_request *request)
+{
+	if (request->slow) {
+		i_assert(slow_requests_running > 0);
+		slow_requests_running--;
+	}
+}
+
 static int auth_worker_handshake_args(struct connection *conn,
 				      const char *const *args)
 {
@@ -228,7 +393,9 @@ static struct auth_worker_connection *auth_worker_create(void)
 	/* first connection will negotiate auth_worker_process_limit
 	   via handshake */
 	if (auth_worker_process_limit > 0 &&
-	    connections->connections_count >= auth_workers_throttle_count)
+	    (connections->connections_count >= auth_workers_throttle_count ||
+	     (auth_worker_latency_limit > 0 &&
+	      connections->connections_count >= auth_worker_latency_limit)))
 		return NULL;
 
 	struct auth_worker_connection *worker = i_new(struct auth_worker_connection, 1);
@@ -270,6 +437,7 @@ static void auth_worker_deinit(struct auth_worker_connection **_worker,
 	if (worker->request == NULL)
 		idle_count--;
 	else {
+		auth_worker_request_done(worker->request);
 		e_error(worker->conn.event, "Aborted %s request for %s: %s",
 			t_strcut(worker->request->data, '\t'),
 			worker->request->username, reason);
@@ -278,7 +446,8 @@ static void auth_worker_deinit(struct auth_worker_connection **_worker,
 			t_strdup_printf("%d", PASSDB_RESULT_INTERNAL_FAILURE),
 			NULL,
 		};
-		worker->request->callback(worker, args, worker->request->context);
+		(void)auth_worker_request_callback(worker, worker->request,
+						   args);
 	}
 
 	timeout_remove(&worker->to_lookup);
@@ -290,6 +459,11 @@ static void auth_worker_deinit(struct auth_worker_connection **_worker,
 		worker = auth_worker_create();
 		if (worker != NULL)
 			auth_worker_request_send_next(worker);
+	} else if (aqueue_count(worker_slow_request_queue) > 0) {
+		/* the aborted request may have been blocking a slow request */
+		worker = auth_worker_find_free();
+		if (worker != NULL)
+			auth_worker_request_send_next(worker);
 	}
 }
 
@@ -320,6 +494,7 @@ static int auth_worker_request_handle(struct auth_worker_connection *worker,
 	   if they do, reset timeouts
 	   if they do not, mark this request as handled */
 	if (args[0][0] == '*') {
+		_request->multiline = TRUE;
 		if (worker->resuming)
 			timeout_reset(worker->to_lookup);
 		else {
@@ -336,9 +511,11 @@ static int auth_worker_request_handle(struct auth_worker_connection *worker,
 		worker->to_lookup = timeout_add(AUTH_WORKER_MAX_IDLE_SECS * 1000,
 						auth_worker_idle_timeout, worker);
 		idle_count++;
+		auth_worker_request_done(_request);
+		auth_worker_request_finished(worker, _request);
 	}
 
-	if (!_request->callback(worker, args, _request->context)) {
+	if (!auth_worker_request_callback(worker, _request, args)) {
 		worker->timeout_pending_resume = FALSE;
 		timeout_remove(&worker->to_lookup);
 		return -1;
@@ -441,6 +618,10 @@ static int worker_input_args(struct connection *conn, const char *const *args)
 	} else if (worker->shutdown) {
 		auth_worker_deinit(&worker, "Idle kill", FALSE);
 		ret = 0;
+	} else if (auth_worker_latency_limit > 0 &&
+		   connections->connections_count > auth_worker_latency_limit) {
+		auth_worker_deinit(&worker, "Backend is overloaded", FALSE);
+		ret = 0;
 	} else {
 		auth_worker_request_send_next(worker);
 		ret = 1;
@@ -478,18 +659,79 @@ static const struct connection_vfuncs auth_worker_connection_funcs =
 	.input_args = worker_input_args,
 };
 
-void auth_worker_call(pool_t pool, const char *username, const char *data,
-		      auth_worker_callback_t *callback, void *context)
+static struct auth_worker_request *
+auth_worker_request_new(pool_t pool, const char *username, const char *data,
+			auth_worker_callback_t *callback, void *context)
 {
-	struct auth_worker_connection *worker;
 	struct auth_worker_request *request;
 
 	request = p_new(pool, struct auth_worker_request, 1);
 	request->created = ioloop_time;
+	request->queued_time = ioloop_timeval;
 	request->username = p_strdup(pool, username);
 	request->data = p_strdup(pool, data);
 	request->callback = callback;
 	request->context = context;
+	return request;
+}
+
+void auth_worker_call(pool_t pool, const char *username, const char *data,
+		      auth_worker_callback_t *callback, void *context)
+{
+	auth_worker_call_coalesced(pool, username, NULL, data,
+				   callback, context);
+}
+
+void auth_worker_call_slow(pool_t pool, const char *username, const char *data,
+			   auth_worker_callback_t *callback, void *context)
+{
+	struct auth_worker_connection *worker = NULL;
+	struct auth_worker_request *request;
+
+	request = auth_worker_request_new(pool, username, data,
+					  callback, context);
+	request->slow = TRUE;
+
+	if (aqueue_count(worker_request_queue) == 0 &&
+	    aqueue_count(worker_slow_request_queue) == 0 &&
+	    slow_requests_running < slow_requests_limit) {
+		worker = auth_worker_find_free();
+		if (worker == NULL)
+			worker = auth_worker_create();
+	}
+	if (worker != NULL) {
+		if (!auth_worker_request_send(worker, request))
+			i_unreached();
+	} else {
+		aqueue_append(worker_slow_request_queue, &request);
+	}
+}
+
+void auth_worker_call_coalesced(pool_t pool, const char *username,
+				const char *coalesce_key, const char *data,
+				auth_worker_callback_t *callback, void *context)
+{
+	struct auth_worker_connection *worker;
+	struct auth_worker_request *request, *leader;
+
+	request = auth_worker_request_new(pool, username, data,
+					  callback, context);
+	if (coalesce_key != NULL) {
+		leader = hash_table_lookup(coalesced_requests, coalesce_key);
+		if (leader != NULL) {
+			/* identical lookup is already in progress */
+			if (leader->waiters == NULL)
+				leader->waiters = request;
+			else
+				leader->waiters_tail->waiter_next = request;
+			leader->waiters_tail = request;
+			leader->waiter_count++;
+			return;
+		}
+		request->coalesce_key = p_strdup(pool, coalesce_key);
+		hash_table_insert(coalesced_requests, request->coalesce_key,
+				  request);
+	}
 
 	if (aqueue_count(worker_request_queue) > 0) {
 		/* requests are already being queued, no chance of
@@ -502,6 +744,14 @@ void auth_worker_call(pool_t pool, const char *username, const char *data,
 			worker = auth_worker_create();
 		}
 	}
+	if (worker != NULL && auth_worker_slow_request_can_send(FALSE)) {
+		/* a slow request has waited long enough, it gets the worker
+		   first */
+		auth_worker_request_send_next(worker);
+		worker = auth_worker_find_free();
+		if (worker == NULL)
+			worker = auth_worker_create();
+	}
 	if (worker != NULL) {
 		if (!auth_worker_request_send(worker, request))
 			i_unreached();
@@ -531,6 +781,13 @@ void auth_worker_connection_init(void)
 
 	i_array_init(&worker_request_array, 128);
 	worker_request_queue = aqueue_init(&worker_request_array.arr);
+	i_array_init(&worker_slow_request_array, 32);
+	worker_slow_request_queue = aqueue_init(&worker_slow_request_array.arr);
+	hash_table_create(&coalesced_requests, default_pool, 0,
+			  str_hash, strcmp);
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	slow_requests_limit = cpus <= 0 ? 1 : (unsigned int)cpus;
 
 	connections = connection_list_init(&auth_worker_connection_settings,
 					   &auth_worker_connection_funcs);
@@ -539,7 +796,13 @@ void auth_worker_connection_init(void)
 void auth_worker_connection_deinit(void)
 {
 	connection_list_deinit(&connections);
+	auth_worker_process_limit = 0;
+	auth_worker_latency_limit = 0;
+	auth_worker_exec_usecs_avg = auth_worker_exec_usecs_base = 0;
 
+	hash_table_destroy(&coalesced_requests);
+	aqueue_deinit(&worker_slow_request_queue);
+	array_free(&worker_slow_request_array);
 	aqueue_deinit(&worker_request_queue);
 	array_free(&worker_request_array);
 }
@@ -10,6 +10,19 @@ typedef bool auth_worker_callback_t(struct auth_worker_connection *conn,
 
 void auth_worker_call(pool_t pool, const char *username, const char *data,
 		      auth_worker_callback_t *callback, void *context);
+/* Same as auth_worker_call(), but if an identical lookup with the same
+   coalesce_key is already queued or running, share its reply instead of
+   sending a new request to the workers. The reply must be a single line.
+   NULL coalesce_key disables coalescing. */
+void auth_worker_call_coalesced(pool_t pool, const char *username,
+				const char *coalesce_key, const char *data,
+				auth_worker_callback_t *callback,
+				void *context) ATTR_NULL(3);
+/* Same as auth_worker_call(), but the request is CPU intensive (e.g. password
+   hashing). Such requests are sent only when no other requests are waiting,
+   and at most one per CPU is running at a time. */
+void auth_worker_call_slow(pool_t pool, const char *username, const char *data,
+			   auth_worker_callback_t *callback, void *context);
 void auth_worker_connection_resume_input(struct auth_worker_connection *conn);
 
 void auth_worker_connection_init(void);
@@ -301,7 +301,7 @@ auth_worker_handle_passv(struct auth_worker_command *cmd,
 static bool
 auth_worker_handle_passw(struct auth_worker_command *cmd,
 			 unsigned int id, const char *const *args,
-			 const char **error_r)
+			 const char *subsystem, const char **error_r)
 {
 	struct auth_worker_server *server = cmd->server;
 	struct auth_request *request;
@@ -332,7 +332,7 @@ auth_worker_handle_passw(struct auth_worker_command *cmd,
 		p_strdup(request->pool, password);
 
 	ret = auth_request_password_verify(request, password,
-					   crypted, scheme, "cache");
+					   crypted, scheme, subsystem);
 	str = t_str_new(128);
 	str_printfa(str, "%u\t", request->id);
 
@@ -810,8 +810,13 @@ auth_worker_server_input_args(struct connection *conn, const char *const *args)
 		ret = auth_worker_handle_passv(cmd, id, args + 2, &error);
 	else if (strcmp(args[1], "PASSL") == 0)
 		ret = auth_worker_handle_passl(cmd, id, args + 2, &error);
-	else if (strcmp(args[1], "PASSW") == 0)
-		ret = auth_worker_handle_passw(cmd, id, args + 2, &error);
+	else if (strcmp(args[1], "PASSW") == 0) {
+		ret = auth_worker_handle_passw(cmd, id, args + 2,
+					       "cache", &error);
+	} else if (strcmp(args[1], "PASSH") == 0) {
+		ret = auth_worker_handle_passw(cmd, id, args + 2,
+					       AUTH_SUBSYS_DB, &error);
+	}
 	else if (strcmp(args[1], "SETCRED") == 0)
 		ret = auth_worker_handle_setcred(cmd, id, args + 2, &error);
 	else if (strcmp(args[1], "USER") == 0)
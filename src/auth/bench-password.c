@@ -0,0 +1,143 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "fd-util.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "password-scheme.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/**
+ * Measures how long verifying a password takes with each scheme, and how the
+ * verification throughput scales when several processes verify passwords in
+ * parallel. Slow schemes are verified in auth workers with at most one
+ * verification per CPU, so they don't delay the cheap requests handled by
+ * the auth process.
+ */
+
+#define BENCH_MIN_NSECS (500ULL*1000*1000)
+#define BENCH_PASSWORD "bench-password"
+
+static const char *const bench_schemes[] = {
+	"PLAIN", "SHA512", "SSHA512", "PBKDF2", "SCRAM-SHA-256",
+	"SHA512-CRYPT", "BLF-CRYPT", "ARGON2I", "ARGON2ID", NULL
+};
+
+static const struct password_generate_params bench_params = {
+	.user = "testuser",
+	.rounds = 0,
+};
+
+static unsigned int
+bench_verify(const char *scheme, const unsigned char *raw_password,
+	     size_t size, uint64_t *nsecs_r)
+{
+	uint64_t start = i_nanoseconds(), now;
+	unsigned int count = 0;
+	const char *error;
+
+	do {
+		if (password_verify(BENCH_PASSWORD, &bench_params, scheme,
+				    raw_password, size, &error) != 1)
+			i_fatal("%s: password_verify() failed: %s", scheme, error);
+		count++;
+		now = i_nanoseconds();
+	} while (now - start < BENCH_MIN_NSECS);
+	*nsecs_r = now - start;
+	return count;
+}
+
+static double
+bench_verify_parallel(const char *scheme, const unsigned char *raw_password,
+		      size_t size, unsigned int process_count)
+{
+	unsigned int i, count, total_count = 0;
+	uint64_t start, nsecs;
+	int fd[2], status;
+
+	if (pipe(fd) < 0)
+		i_fatal("pipe() failed: %m");
+
+	start = i_nanoseconds();
+	for (i = 0; i < process_count; i++) {
+		switch (fork()) {
+		case -1:
+			i_fatal("fork() failed: %m");
+		case 0:
+			count = bench_verify(scheme, raw_password, size, &nsecs);
+			if (write(fd[1], &count, sizeof(count)) != sizeof(count))
+				i_fatal("write() failed: %m");
+			_exit(0);
+		default:
+			break;
+		}
+	}
+	i_close_fd(&fd[1]);
+	while (read(fd[0], &count, sizeof(count)) == sizeof(count))
+		total_count += count;
+	nsecs = i_nanoseconds() - start;
+	i_close_fd(&fd[0]);
+
+	for (i = 0; i < process_count; i++) {
+		if (wait(&status) < 0)
+			i_fatal("wait() failed: %m");
+	}
+	return total_count * 1000000000.0 / nsecs;
+}
+
+static void bench_scheme(const char *scheme, unsigned int process_count)
+{
+	const unsigned char *raw_password;
+	const char *crypted, *error;
+	unsigned int count;
+	uint64_t nsecs;
+	size_t size;
+
+	if (!password_generate_encoded(BENCH_PASSWORD, &bench_params,
+				       scheme, &crypted)) {
+		printf("%-14s not supported\n", scheme);
+		return;
+	}
+	if (password_decode(crypted, scheme, &raw_password, &size, &error) <= 0)
+		i_fatal("%s: password_decode() failed: %s", scheme, error);
+
+	count = bench_verify(scheme, raw_password, size, &nsecs);
+	printf("%-14s %12.1f %12.0f %6s %12.0f\n", scheme,
+	       nsecs / 1000.0 / count, count * 1000000000.0 / nsecs,
+	       password_scheme_is_slow(scheme, crypted) ? "yes" : "no",
+	       bench_verify_parallel(scheme, raw_password, size,
+				     process_count));
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int i, process_count;
+	long cpus;
+
+	lib_init();
+	password_schemes_init();
+	password_schemes_allow_weak(TRUE);
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	process_count = cpus <= 0 ? 1 : (unsigned int)cpus;
+	if (argc > 2 ||
+	    (argc == 2 && (str_to_uint(argv[1], &process_count) < 0 ||
+			   process_count == 0))) {
+		fprintf(stderr, "Usage: %s [process count]\n", argv[0]);
+		return 1;
+	}
+
+	printf("%-14s %12s %12s %6s %12s\n", "scheme", "usecs/verify",
+	       "verifies/s", "slow", t_strdup_printf("%u procs/s",
+						      process_count));
+	for (i = 0; bench_schemes[i] != NULL; i++) T_BEGIN {
+		bench_scheme(bench_schemes[i], process_count);
+	} T_END;
+
+	password_schemes_deinit();
+	lib_deinit();
+	return 0;
+}
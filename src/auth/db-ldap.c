@@ -126,6 +126,8 @@ static struct setting_def setting_defs[] = {
 	DEF_STR(default_pass_scheme),
 	DEF_BOOL(userdb_warning_disable),
 	DEF_BOOL(blocking),
+	DEF_INT(max_connections),
+	DEF_INT(max_pending_requests),
 
 	{ 0, NULL, 0 }
 };
@@ -162,7 +164,9 @@ static struct ldap_settings default_ldap_settings = {
 	.iterate_filter = "(objectClass=posixAccount)",
 	.default_pass_scheme = "crypt",
 	.userdb_warning_disable = FALSE,
-	.blocking = FALSE
+	.blocking = FALSE,
+	.max_connections = 1,
+	.max_pending_requests = 8
 };
 
 static struct ldap_connection *ldap_connections = NULL;
@@ -373,7 +377,7 @@ static bool db_ldap_request_queue_next(struct ldap_connection *conn)
 		/* no non-pending requests */
 		return FALSE;
 	}
-	if (conn->pending_count > DB_LDAP_MAX_PENDING_REQUESTS) {
+	if (conn->pending_count > conn->set.max_pending_requests) {
 		/* wait until server has replied to some requests */
 		return FALSE;
 	}
@@ -427,6 +431,8 @@ static bool db_ldap_request_queue_next(struct ldap_connection *conn)
 	if (ret > 0) {
 		/* success */
 		i_assert(request->msgid != -1);
+		if (request->send_count == 0)
+			request->send_tv = ioloop_timeval;
 		request->send_count++;
 		conn->pending_count++;
 		return TRUE;
@@ -462,13 +468,84 @@ db_ldap_check_hanging(struct ldap_connection *conn)
 	}
 }
 
+struct ldap_connection *db_ldap_pool_get_conn(struct ldap_connection *conn)
+{
+	struct ldap_connection *pconn, *best_conn = NULL;
+
+	if (conn->primary != NULL)
+		conn = conn->primary;
+
+	/* Use the first connection that isn't busy, so the later ones don't
+	   get connected unless there's enough load for them. If all of them
+	   are busy, use the one with the fewest outstanding requests. */
+	array_foreach_elem(&conn->pool_conns, pconn) {
+		if (aqueue_count(pconn->request_queue) <
+		    conn->set.max_pending_requests)
+			return pconn;
+		if (best_conn == NULL ||
+		    aqueue_count(pconn->request_queue) <
+		    aqueue_count(best_conn->request_queue))
+			best_conn = pconn;
+	}
+	return best_conn;
+}
+
+static struct ldap_connection *
+db_ldap_request_get_conn(struct ldap_connection *conn,
+			 struct ldap_request *request)
+{
+	if (request->type == LDAP_REQUEST_TYPE_SEARCH &&
+	    ((struct ldap_request_search *)request)->multi_entry) {
+		/* iteration input is paused and resumed via the connection
+		   the caller has */
+		return conn;
+	}
+	return db_ldap_pool_get_conn(conn);
+}
+
+static void
+db_ldap_request_finished(struct ldap_connection *conn,
+			 struct ldap_request *request)
+{
+	long long latency_usecs = 0;
+
+	if (request->send_count > 0) {
+		latency_usecs = timeval_diff_usecs(&ioloop_timeval,
+						   &request->send_tv);
+		if (latency_usecs < 0)
+			latency_usecs = 0;
+		/* exponential moving average with weight 1/8 */
+		conn->avg_latency_usecs = conn->avg_latency_usecs == 0 ?
+			(unsigned int)latency_usecs :
+			(conn->avg_latency_usecs * 7 + latency_usecs) / 8;
+	}
+
+	struct event_passthrough *e =
+		event_create_passthrough(authdb_event(request->auth_request))->
+		set_name("ldap_request_finished")->
+		add_int("ldap_connection", conn->pool_idx)->
+		add_int("queue_depth", aqueue_count(conn->request_queue))->
+		add_int("pending_count", conn->pending_count)->
+		add_int("queue_usecs", request->send_count == 0 ? 0 :
+			timeval_diff_usecs(&request->send_tv,
+					   &request->queue_tv))->
+		add_int("latency_usecs", latency_usecs)->
+		add_int("avg_latency_usecs", conn->avg_latency_usecs);
+	e_debug(e->event(), "Finished LDAP request on connection %u "
+		"(latency %lld usecs, avg %u usecs, %u requests queued)",
+		conn->pool_idx, latency_usecs, conn->avg_latency_usecs,
+		aqueue_count(conn->request_queue));
+}
+
 void db_ldap_request(struct ldap_connection *conn,
 		     struct ldap_request *request)
 {
 	i_assert(request->auth_request != NULL);
 
+	conn = db_ldap_request_get_conn(conn, request);
 	request->msgid = -1;
 	request->create_time = ioloop_time;
+	request->queue_tv = ioloop_timeval;
 
 	db_ldap_check_hanging(conn);
 
@@ -850,6 +927,7 @@ db_ldap_handle_request_result(struct ldap_connection *conn,
 	if (final_result) {
 		conn->pending_count--;
 		aqueue_delete(conn->request_queue, idx);
+		db_ldap_request_finished(conn, request);
 	}
 
 	T_BEGIN {
@@ -1869,6 +1947,47 @@ static const char *parse_setting(const char *key, const char *value,
 				       &conn->set, key, value);
 }
 
+static struct ldap_connection *
+db_ldap_conn_init_pooled(struct ldap_connection *primary)
+{
+	struct ldap_connection *conn;
+
+	conn = p_new(primary->pool, struct ldap_connection, 1);
+	conn->pool = primary->pool;
+	conn->refcount = 1;
+	conn->primary = primary;
+	conn->pool_idx = array_count(&primary->pool_conns);
+
+	conn->userdb_used = primary->userdb_used;
+	conn->conn_state = LDAP_CONN_STATE_DISCONNECTED;
+	conn->default_bind_msgid = -1;
+	conn->fd = -1;
+	conn->config_path = primary->config_path;
+	conn->set = primary->set;
+
+	conn->event = event_create(auth_event);
+	event_set_append_log_prefix(conn->event, t_strdup_printf(
+		"ldap(%s #%u): ", conn->config_path, conn->pool_idx));
+
+	i_array_init(&conn->request_array, 512);
+	conn->request_queue = aqueue_init(&conn->request_array.arr);
+	/* the connection is created when the first request is sent to it */
+	return conn;
+}
+
+static void db_ldap_conn_deinit(struct ldap_connection *conn)
+{
+	db_ldap_abort_requests(conn, UINT_MAX, 0, FALSE, "Shutting down");
+	i_assert(conn->pending_count == 0);
+	db_ldap_conn_close(conn);
+	i_assert(conn->to == NULL);
+
+	array_free(&conn->request_array);
+	aqueue_deinit(&conn->request_queue);
+
+	event_unref(&conn->event);
+}
+
 static struct ldap_connection *ldap_conn_find(const char *config_path)
 {
 	struct ldap_connection *conn;
@@ -1932,6 +2051,8 @@ struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
 	if (conn->set.sasl_bind)
 		i_fatal("LDAP %s: sasl_bind=yes but no SASL support compiled in", conn->config_path);
 #endif
+	if (conn->set.max_connections == 0)
+		i_fatal("LDAP %s: max_connections must not be 0", config_path);
 	if (conn->set.ldap_version < 3) {
 		if (conn->set.sasl_bind)
 			i_fatal("LDAP %s: sasl_bind=yes requires ldap_version=3", config_path);
@@ -1969,6 +2090,14 @@ struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
 	i_array_init(&conn->request_array, 512);
 	conn->request_queue = aqueue_init(&conn->request_array.arr);
 
+	p_array_init(&conn->pool_conns, pool, conn->set.max_connections);
+	array_push_back(&conn->pool_conns, &conn);
+	while (array_count(&conn->pool_conns) < conn->set.max_connections) {
+		struct ldap_connection *pconn =
+			db_ldap_conn_init_pooled(conn);
+		array_push_back(&conn->pool_conns, &pconn);
+	}
+
 	conn->next = ldap_connections;
         ldap_connections = conn;
 
@@ -1978,7 +2107,7 @@ struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
 
 void db_ldap_unref(struct ldap_connection **_conn)
 {
-        struct ldap_connection *conn = *_conn;
+        struct ldap_connection *conn = *_conn, *pconn;
 	struct ldap_connection **p;
 
 	*_conn = NULL;
@@ -1993,15 +2122,8 @@ void db_ldap_unref(struct ldap_connection **_conn)
 		}
 	}
 
-	db_ldap_abort_requests(conn, UINT_MAX, 0, FALSE, "Shutting down");
-	i_assert(conn->pending_count == 0);
-	db_ldap_conn_close(conn);
-	i_assert(conn->to == NULL);
-
-	array_free(&conn->request_array);
-	aqueue_deinit(&conn->request_queue);
-
-	event_unref(&conn->event);
+	array_foreach_elem(&conn->pool_conns, pconn)
+		db_ldap_conn_deinit(pconn);
 	pool_unref(&conn->pool);
 }
 
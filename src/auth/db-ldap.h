@@ -6,8 +6,6 @@
    It is now set in m4/want_ldap.m4 if ldap is enabled. */
 /* #define LDAP_DEPRECATED 1 */
 
-/* Maximum number of pending requests before delaying new requests. */
-#define DB_LDAP_MAX_PENDING_REQUESTS 8
 /* connect() timeout to LDAP */
 #define DB_LDAP_CONNECT_TIMEOUT_SECS 5
 /* If LDAP connection is down, fail requests after waiting for this long. */
@@ -69,6 +67,14 @@ struct ldap_settings {
 	bool userdb_warning_disable; /* deprecated for now at least */
 	bool blocking;
 
+	/* Maximum number of LDAP connections opened for this configuration.
+	   Requests are sent to the first connection that has fewer than
+	   max_pending_requests outstanding requests. */
+	unsigned int max_connections;
+	/* Maximum number of sent requests waiting for a reply in a single
+	   connection before delaying new requests. */
+	unsigned int max_pending_requests;
+
 	/* ... */
 	int ldap_deref, ldap_scope, ldap_tls_require_cert_parsed;
 	uid_t uid;
@@ -104,6 +110,8 @@ struct ldap_request {
 	int msgid;
 	/* timestamp when request was created */
 	time_t create_time;
+	/* timestamps when request was queued and first sent */
+	struct timeval queue_tv, send_tv;
 
 	/* Number of times this request has been sent to LDAP server. This
 	   increases when LDAP gets disconnected and reconnect send the request
@@ -166,6 +174,13 @@ struct ldap_connection {
 	char *config_path;
         struct ldap_settings set;
 
+	/* Pooled connections sharing the same configuration. The first
+	   connection is the one returned by db_ldap_init(), which also owns
+	   the rest of them. The other connections point to it via primary. */
+	ARRAY(struct ldap_connection *) pool_conns;
+	struct ldap_connection *primary;
+	unsigned int pool_idx;
+
 	LDAP *ld;
 	enum ldap_connection_state conn_state;
 	int default_bind_msgid;
@@ -183,6 +198,8 @@ struct ldap_connection {
 
 	/* Timestamp when we last received a reply */
 	time_t last_reply_stamp;
+	/* Moving average of request latencies in microseconds */
+	unsigned int avg_latency_usecs;
 
 	char **pass_attr_names, **user_attr_names, **iterate_attr_names;
 	ARRAY_TYPE(ldap_field) pass_attr_map, user_attr_map, iterate_attr_map;
@@ -190,9 +207,14 @@ struct ldap_connection {
 	bool delayed_connect;
 };
 
-/* Send/queue request */
+/* Send/queue request. The request is sent via the connection returned by
+   db_ldap_pool_get_conn(), except iteration requests, which always use the
+   given connection. */
 void db_ldap_request(struct ldap_connection *conn,
 		     struct ldap_request *request);
+/* Returns the first pooled connection that isn't busy with
+   max_pending_requests, or the least busy one if all of them are. */
+struct ldap_connection *db_ldap_pool_get_conn(struct ldap_connection *conn);
 
 void db_ldap_set_attrs(struct ldap_connection *conn, const char *attrlist,
 		       char ***attr_names_r, ARRAY_TYPE(ldap_field) *attr_map,
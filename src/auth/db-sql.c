@@ -4,6 +4,8 @@
 
 #if defined(PASSDB_SQL) || defined(USERDB_SQL)
 
+#include "array.h"
+#include "str.h"
 #include "settings.h"
 #include "auth-request.h"
 #include "auth-worker-server.h"
@@ -99,6 +101,11 @@ struct db_sql_connection *db_sql_init(const char *config_path, bool userdb)
 	if (conn->set.iterate_query == default_db_sql_settings.iterate_query)
 		conn->default_iterate_query = TRUE;
 
+	db_sql_statement_template_init(pool, conn->set.password_query,
+				       &conn->password_stmt);
+	db_sql_statement_template_init(pool, conn->set.user_query,
+				       &conn->user_stmt);
+
 	if (conn->set.driver == NULL) {
 		i_fatal("sql: driver not set in configuration file %s",
 			config_path);
@@ -175,4 +182,91 @@ void db_sql_check_userdb_warning(struct db_sql_connection *conn)
 	}
 }
 
+void db_sql_statement_template_init(pool_t pool, const char *query,
+				    struct db_sql_statement_template *tmpl_r)
+{
+	string_t *str = t_str_new(128);
+	const char *p, *end, *content;
+
+	i_zero(tmpl_r);
+	p_array_init(&tmpl_r->params, pool, 4);
+	for (p = query; *p != '\0'; p++) {
+		if (*p == '%' || *p == '?') {
+			/* a variable outside quoted strings can't be bound,
+			   and a literal '?' would be taken as a placeholder */
+			return;
+		}
+		if (*p != '\'' && *p != '"') {
+			str_append_c(str, *p);
+			continue;
+		}
+
+		/* find the end of the quoted string, skipping doubled
+		   quotes */
+		for (end = p + 1; *end != '\0'; end++) {
+			if (*end == *p) {
+				if (end[1] != *p)
+					break;
+				end++;
+			}
+		}
+		if (*end == '\0')
+			return;
+		content = t_strdup_until(p + 1, end);
+		if (strchr(content, '\\') != NULL) {
+			/* backslash escapes depend on the database */
+			return;
+		}
+		if (strchr(content, '%') == NULL)
+			str_append_data(str, p, end - p + 1);
+		else if (*p == '"' || strchr(content, *p) != NULL) {
+			/* a variable in an identifier, or a string that
+			   needs unescaping */
+			return;
+		} else {
+			content = p_strdup(pool, content);
+			array_push_back(&tmpl_r->params, &content);
+			str_append_c(str, '?');
+		}
+		p = end;
+	}
+	tmpl_r->query = p_strdup(pool, str_c(str));
+}
+
+int db_sql_statement_init(struct db_sql_connection *conn,
+			  const struct db_sql_statement_template *tmpl,
+			  const struct auth_request *auth_request,
+			  struct sql_statement **stmt_r, const char **error_r)
+{
+	struct sql_prepared_statement *prep_stmt;
+	struct sql_statement *stmt;
+	const char *param, *value;
+	unsigned int i, count;
+	int ret;
+
+	i_assert(tmpl->query != NULL);
+
+	if ((sql_get_flags(conn->db) & SQL_DB_FLAG_PREP_STATEMENTS) != 0) {
+		prep_stmt = sql_prepared_statement_init(conn->db, tmpl->query);
+		stmt = sql_statement_init_prepared(prep_stmt);
+		sql_prepared_statement_unref(&prep_stmt);
+	} else {
+		stmt = sql_statement_init(conn->db, tmpl->query);
+	}
+
+	count = array_count(&tmpl->params);
+	for (i = 0; i < count; i++) {
+		param = array_idx_elem(&tmpl->params, i);
+		ret = t_auth_request_var_expand(param, auth_request, NULL,
+						&value, error_r);
+		if (ret <= 0) {
+			sql_statement_abort(&stmt);
+			return ret;
+		}
+		sql_statement_bind_str(stmt, i, value);
+	}
+	*stmt_r = stmt;
+	return 1;
+}
+
 #endif
@@ -3,6 +3,8 @@
 
 #include "sql-api.h"
 
+struct auth_request;
+
 struct db_sql_settings {
 	const char *driver;
 	const char *connect;
@@ -14,6 +16,15 @@ struct db_sql_settings {
 	bool userdb_warning_disable;
 };
 
+struct db_sql_statement_template {
+	/* The query with each quoted string containing %variables replaced
+	   by a '?' placeholder, or NULL if the query can't be converted. */
+	const char *query;
+	/* The quoted strings' contents. They're expanded into the values
+	   bound to the placeholders. */
+	ARRAY_TYPE(const_string) params;
+};
+
 struct db_sql_connection {
 	struct db_sql_connection *next;
 
@@ -23,6 +34,7 @@ struct db_sql_connection {
 	char *config_path;
 	struct db_sql_settings set;
 	struct sql_db *db;
+	struct db_sql_statement_template password_stmt, user_stmt;
 
 	bool default_password_query:1;
 	bool default_user_query:1;
@@ -39,4 +51,17 @@ void db_sql_success(struct db_sql_connection *conn);
 
 void db_sql_check_userdb_warning(struct db_sql_connection *conn);
 
+/* Convert the query into a statement template. Variables are bound as
+   parameters only when they're inside quoted strings, so that their values
+   can't change how the query is parsed. Otherwise the template's query is
+   NULL and the query must be expanded as text. */
+void db_sql_statement_template_init(pool_t pool, const char *query,
+				    struct db_sql_statement_template *tmpl_r);
+/* Create a statement from the template with the parameters expanded for
+   the auth request. Returns the same as t_auth_request_var_expand(). */
+int db_sql_statement_init(struct db_sql_connection *conn,
+			  const struct db_sql_statement_template *tmpl,
+			  const struct auth_request *auth_request,
+			  struct sql_statement **stmt_r, const char **error_r);
+
 #endif
@@ -4,6 +4,7 @@
 #include "array.h"
 #include "auth-settings.h"
 #include "ioloop.h"
+#include "hostpid.h"
 #include "net.h"
 #include "lib-signals.h"
 #include "restrict-access.h"
@@ -100,7 +101,7 @@ static const char *const *read_global_settings(void)
 static enum auth_socket_type
 auth_socket_type_get(const char *path)
 {
-	const char *name, *suffix;
+	const char *name, *suffix, *p;
 
 	name = strrchr(path, '/');
 	if (name == NULL)
@@ -108,6 +109,11 @@ auth_socket_type_get(const char *path)
 	else
 		name++;
 
+	/* per-process sockets are named "<socket>.<pid>" */
+	p = strrchr(name, '.');
+	if (p != NULL && strcmp(p + 1, my_pid) == 0)
+		name = t_strdup_until(name, p);
+
 	suffix = strrchr(name, '-');
 	if (suffix == NULL)
 		suffix = name;
@@ -3,6 +3,8 @@
 #include "auth-common.h"
 #include "str.h"
 #include "strescape.h"
+#include "auth-cache.h"
+#include "passdb-cache.h"
 #include "auth-worker-connection.h"
 #include "password-scheme.h"
 #include "passdb.h"
@@ -99,6 +101,64 @@ void passdb_blocking_verify_plain(struct auth_request *request)
 			 verify_plain_callback, request);
 }
 
+struct passdb_blocking_verify_context {
+	struct auth_request *request;
+	verify_plain_callback_t *callback;
+	unsigned char verified_mac[PASSDB_VERIFIED_MAC_LEN];
+};
+
+static bool
+verify_password_callback(struct auth_worker_connection *conn ATTR_UNUSED,
+			 const char *const *args, void *context)
+{
+	struct passdb_blocking_verify_context *ctx = context;
+	struct auth_request *request = ctx->request;
+	enum passdb_result result;
+
+	result = passdb_blocking_auth_worker_reply_parse(request, args);
+	if (result == PASSDB_RESULT_OK)
+		passdb_cache_verified_add(ctx->verified_mac);
+	ctx->callback(result, request);
+	auth_request_unref(&request);
+	return TRUE;
+}
+
+void passdb_blocking_verify_password(struct auth_request *request,
+				     const char *plain_password,
+				     const char *crypted_password,
+				     const char *scheme,
+				     verify_plain_callback_t *callback)
+{
+	struct passdb_blocking_verify_context *ctx;
+	const char *crypted;
+	string_t *str;
+
+	ctx = p_new(request->pool, struct passdb_blocking_verify_context, 1);
+	ctx->request = request;
+	ctx->callback = callback;
+
+	crypted = t_strdup_printf("{%s}%s", scheme, crypted_password);
+	if (passdb_cache_verified_lookup(request, plain_password, crypted,
+					 ctx->verified_mac)) {
+		callback(PASSDB_RESULT_OK, request);
+		return;
+	}
+
+	str = t_str_new(128);
+	str_printfa(str, "PASSH\t%u\t", request->passdb->passdb->id);
+	str_append_tabescaped(str, plain_password);
+	str_append_c(str, '\t');
+	str_append_tabescaped(str, crypted);
+	str_append_c(str, '\t');
+	auth_request_export(request, str);
+
+	e_debug(authdb_event(request), "Verifying %s password in worker",
+		scheme);
+	auth_request_ref(request);
+	auth_worker_call_slow(request->pool, request->fields.user, str_c(str),
+			      verify_password_callback, ctx);
+}
+
 static bool
 lookup_credentials_callback(struct auth_worker_connection *conn ATTR_UNUSED,
 			    const char *const *args, void *context)
@@ -128,6 +188,7 @@ lookup_credentials_callback(struct auth_worker_connection *conn ATTR_UNUSED,
 
 void passdb_blocking_lookup_credentials(struct auth_request *request)
 {
+	const char *coalesce_key = NULL;
 	string_t *str;
 
 	str = t_str_new(128);
@@ -136,9 +197,18 @@ void passdb_blocking_lookup_credentials(struct auth_request *request)
 	str_append_c(str, '\t');
 	auth_request_export(request, str);
 
+	if (request->passdb->cache_key != NULL) {
+		coalesce_key = t_strconcat("PASSL\t",
+			str_tabescape(request->wanted_credentials_scheme), "\t",
+			auth_request_expand_cache_key(request,
+				request->passdb->cache_key,
+				request->fields.translated_username), NULL);
+	}
+
 	auth_request_ref(request);
-	auth_worker_call(request->pool, request->fields.user, str_c(str),
-			 lookup_credentials_callback, request);
+	auth_worker_call_coalesced(request->pool, request->fields.user,
+				   coalesce_key, str_c(str),
+				   lookup_credentials_callback, request);
 }
 
 static bool
@@ -5,6 +5,12 @@ enum passdb_result
 passdb_blocking_auth_worker_reply_parse(struct auth_request *request,
 					const char *const *args);
 void passdb_blocking_verify_plain(struct auth_request *request);
+/* Verify plain_password against crypted_password in an auth worker. */
+void passdb_blocking_verify_password(struct auth_request *request,
+				     const char *plain_password,
+				     const char *crypted_password,
+				     const char *scheme,
+				     verify_plain_callback_t *callback);
 void passdb_blocking_lookup_credentials(struct auth_request *request);
 void passdb_blocking_set_credentials(struct auth_request *request,
 				     const char *new_credentials);
@@ -1,17 +1,41 @@
 /* Copyright (c) 2004-2018 Dovecot authors, see the included COPYING file */
 
 #include "auth-common.h"
+#include "ioloop.h"
+#include "hash.h"
+#include "hex-binary.h"
+#include "hmac.h"
+#include "llist.h"
+#include "randgen.h"
+#include "sha2.h"
 #include "str.h"
 #include "strescape.h"
 #include "restrict-process-size.h"
+#include "safe-memset.h"
 #include "auth-worker-connection.h"
 #include "password-scheme.h"
 #include "passdb.h"
 #include "passdb-cache.h"
 #include "passdb-blocking.h"
 
+/* Maximum number of successful password verifications to remember */
+#define PASSDB_VERIFIED_CACHE_MAX_ENTRIES 10000
+
+struct passdb_verified_entry {
+	struct passdb_verified_entry *prev, *next;
+	time_t created;
+	unsigned char mac[PASSDB_VERIFIED_MAC_LEN];
+};
+
 struct auth_cache *passdb_cache = NULL;
 
+static unsigned int verified_ttl_secs = 0, verified_count = 0;
+static unsigned char verified_hmac_key[SHA256_RESULTLEN];
+static HASH_TABLE(unsigned char *, struct passdb_verified_entry *)
+	verified_hash;
+/* newest entries are at the head */
+static struct passdb_verified_entry *verified_head, *verified_tail;
+
 static void
 passdb_cache_log_hit(struct auth_request *request, const char *value)
 {
@@ -52,30 +76,148 @@ passdb_cache_lookup(struct auth_request *request, const char *key,
 	return TRUE;
 }
 
+static unsigned int passdb_verified_mac_hash(const unsigned char *mac)
+{
+	/* the MAC is already uniformly distributed */
+	return be32_to_cpu_unaligned(mac);
+}
+
+static int
+passdb_verified_mac_cmp(const unsigned char *mac1, const unsigned char *mac2)
+{
+	return mem_equals_timing_safe(mac1, mac2, PASSDB_VERIFIED_MAC_LEN) ?
+		0 : 1;
+}
+
+static void passdb_verified_entry_free(struct passdb_verified_entry *entry)
+{
+	hash_table_remove(verified_hash, &entry->mac[0]);
+	DLLIST2_REMOVE(&verified_head, &verified_tail, entry);
+	verified_count--;
+	i_free(entry);
+}
+
+bool passdb_cache_verified_lookup(struct auth_request *request,
+				  const char *plain_password,
+				  const char *crypted_password,
+				  unsigned char mac_r[PASSDB_VERIFIED_MAC_LEN])
+{
+	struct passdb_verified_entry *entry;
+	struct hmac_context ctx;
+
+	if (verified_ttl_secs == 0)
+		return FALSE;
+
+	hmac_init(&ctx, verified_hmac_key, sizeof(verified_hmac_key),
+		  &hash_method_sha256);
+	hmac_update(&ctx, request->fields.user,
+		    strlen(request->fields.user) + 1);
+	hmac_update(&ctx, crypted_password, strlen(crypted_password) + 1);
+	hmac_update(&ctx, plain_password, strlen(plain_password));
+	hmac_final(&ctx, mac_r);
+
+	entry = hash_table_lookup(verified_hash, mac_r);
+	if (entry != NULL &&
+	    entry->created < ioloop_time - (time_t)verified_ttl_secs) {
+		passdb_verified_entry_free(entry);
+		entry = NULL;
+	}
+	if (entry == NULL) {
+		request->passdb_verified_cache_result = AUTH_REQUEST_CACHE_MISS;
+		return FALSE;
+	}
+	e_debug(authdb_event(request),
+		"Password was recently verified, skipping verification");
+	request->passdb_verified_cache_result = AUTH_REQUEST_CACHE_HIT;
+	return TRUE;
+}
+
+void passdb_cache_verified_add(const unsigned char mac[PASSDB_VERIFIED_MAC_LEN])
+{
+	struct passdb_verified_entry *entry;
+
+	if (verified_ttl_secs == 0 ||
+	    hash_table_lookup(verified_hash, mac) != NULL)
+		return;
+
+	if (verified_count >= PASSDB_VERIFIED_CACHE_MAX_ENTRIES)
+		passdb_verified_entry_free(verified_tail);
+
+	entry = i_new(struct passdb_verified_entry, 1);
+	entry->created = ioloop_time;
+	memcpy(entry->mac, mac, sizeof(entry->mac));
+	DLLIST2_PREPEND(&verified_head, &verified_tail, entry);
+	hash_table_insert(verified_hash, &entry->mac[0], entry);
+	verified_count++;
+}
+
+static void passdb_cache_verified_init(const struct auth_settings *set)
+{
+	verified_ttl_secs = set->cache_verified_password_ttl;
+	if (verified_ttl_secs == 0)
+		return;
+
+	random_fill(verified_hmac_key, sizeof(verified_hmac_key));
+	hash_table_create(&verified_hash, default_pool, 0,
+			  passdb_verified_mac_hash, passdb_verified_mac_cmp);
+}
+
+static void passdb_cache_verified_deinit(void)
+{
+	if (verified_ttl_secs == 0)
+		return;
+
+	while (verified_head != NULL)
+		passdb_verified_entry_free(verified_head);
+	hash_table_destroy(&verified_hash);
+	safe_memset(verified_hmac_key, 0, sizeof(verified_hmac_key));
+	verified_ttl_secs = 0;
+}
+
+struct passdb_cache_verify_context {
+	struct auth_request *request;
+	unsigned char verified_mac[PASSDB_VERIFIED_MAC_LEN];
+};
+
 static bool
 passdb_cache_verify_plain_callback(struct auth_worker_connection *conn ATTR_UNUSED,
 				   const char *const *args,
 				   void *context)
 {
-	struct auth_request *request = context;
+	struct passdb_cache_verify_context *ctx = context;
+	struct auth_request *request = ctx->request;
 	enum passdb_result result;
 
 	result = passdb_blocking_auth_worker_reply_parse(request, args);
 	if (result != PASSDB_RESULT_OK)
 		auth_fields_rollback(request->fields.extra_fields);
+	else
+		passdb_cache_verified_add(ctx->verified_mac);
 	auth_request_verify_plain_callback_finish(result, request);
 	auth_request_unref(&request);
 	return TRUE;
 }
 
+static bool
+passdb_cache_password_is_slow(struct auth_request *request,
+			      const char *cached_pw)
+{
+	const char *scheme = password_get_scheme(&cached_pw);
+
+	return scheme != NULL &&
+		auth_request_password_verify_is_slow(request, cached_pw,
+						     scheme);
+}
+
 bool passdb_cache_verify_plain(struct auth_request *request, const char *key,
 			       const char *password,
 			       enum passdb_result *result_r, bool use_expired)
 {
 	const char *value, *cached_pw, *scheme, *const *list;
 	struct auth_cache_node *node;
+	unsigned char verified_mac[PASSDB_VERIFIED_MAC_LEN];
 	int ret;
-	bool neg_expired;
+	bool neg_expired, use_worker, verified = FALSE;
 
 	if (passdb_cache == NULL || key == NULL)
 		return FALSE;
@@ -95,12 +237,20 @@ bool passdb_cache_verify_plain(struct auth_request *request, const char *key,
 	list = t_strsplit_tabescaped(value);
 
 	cached_pw = list[0];
+	use_worker = *cached_pw != '\0' &&
+		(request->set->cache_verify_password_with_worker ||
+		 passdb_cache_password_is_slow(request, cached_pw));
+	if (use_worker) {
+		verified = passdb_cache_verified_lookup(request, password,
+							cached_pw, verified_mac);
+	}
 	if (*cached_pw == '\0') {
 		/* NULL password */
 		e_info(authdb_event(request),
 		       "Cached NULL password access");
 		ret = 1;
-	} else if (request->set->cache_verify_password_with_worker) {
+	} else if (use_worker && !verified) {
+		struct passdb_cache_verify_context *ctx;
 		string_t *str;
 
 		str = t_str_new(128);
@@ -118,9 +268,17 @@ bool passdb_cache_verify_plain(struct auth_request *request, const char *key,
 		   If verification fails, roll back fields. */
 		auth_request_set_fields(request, list + 1, NULL);
 		auth_fields_snapshot(request->fields.extra_fields);
-		auth_worker_call(request->pool, request->fields.user, str_c(str),
-				 passdb_cache_verify_plain_callback, request);
+		ctx = p_new(request->pool, struct passdb_cache_verify_context, 1);
+		ctx->request = request;
+		memcpy(ctx->verified_mac, verified_mac, sizeof(verified_mac));
+		auth_worker_call_slow(request->pool, request->fields.user,
+				      str_c(str),
+				      passdb_cache_verify_plain_callback,
+				      ctx);
 		return TRUE;
+	} else if (verified) {
+		/* password was recently verified against this hash */
+		ret = 1;
 	} else {
 		scheme = password_get_scheme(&cached_pw);
 		i_assert(scheme != NULL);
@@ -186,10 +344,25 @@ bool passdb_cache_lookup_credentials(struct auth_request *request,
 	return TRUE;
 }
 
+static const char *passdb_cache_get_config_fingerprint(void)
+{
+	unsigned char passdb_md5[MD5_RESULTLEN];
+	unsigned char userdb_md5[MD5_RESULTLEN];
+	string_t *str = t_str_new(MD5_RESULTLEN * 4 + 1);
+
+	passdbs_generate_md5(passdb_md5);
+	userdbs_generate_md5(userdb_md5);
+	binary_to_hex_append(str, passdb_md5, sizeof(passdb_md5));
+	str_append_c(str, '\t');
+	binary_to_hex_append(str, userdb_md5, sizeof(userdb_md5));
+	return str_c(str);
+}
+
 void passdb_cache_init(const struct auth_settings *set)
 {
 	rlim_t limit;
 
+	passdb_cache_verified_init(set);
 	if (set->cache_size == 0 || set->cache_ttl == 0)
 		return;
 
@@ -201,11 +374,14 @@ void passdb_cache_init(const struct auth_settings *set)
 			  (uoff_t)(limit/1024/1024));
 	}
 	passdb_cache = auth_cache_new(set->cache_size, set->cache_ttl,
-				      set->cache_negative_ttl);
+				      set->cache_negative_ttl,
+				      set->cache_persistent_path,
+				      passdb_cache_get_config_fingerprint());
 }
 
 void passdb_cache_deinit(void)
 {
+	passdb_cache_verified_deinit();
 	if (passdb_cache != NULL)
 		auth_cache_free(&passdb_cache);
 }
@@ -4,8 +4,21 @@
 #include "auth-cache.h"
 #include "passdb.h"
 
+#define PASSDB_VERIFIED_MAC_LEN 32
+
 extern struct auth_cache *passdb_cache;
 
+/* Returns TRUE if the user's plain_password was recently verified
+   successfully against crypted_password ({SCHEME} prefixed), so the
+   expensive verification can be skipped. mac_r is filled with the key
+   that can be given to passdb_cache_verified_add() after a successful
+   verification. */
+bool passdb_cache_verified_lookup(struct auth_request *request,
+				  const char *plain_password,
+				  const char *crypted_password,
+				  unsigned char mac_r[PASSDB_VERIFIED_MAC_LEN]);
+void passdb_cache_verified_add(const unsigned char mac[PASSDB_VERIFIED_MAC_LEN]);
+
 bool passdb_cache_verify_plain(struct auth_request *request, const char *key,
 			       const char *password,
 			       enum passdb_result *result_r, bool use_expired);
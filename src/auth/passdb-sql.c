@@ -133,13 +133,10 @@ static void sql_query_callback(struct sql_result *result,
 		return;
 	}
 
-	ret = auth_request_password_verify(auth_request,
+	auth_request_password_verify_async(auth_request,
 					   auth_request->mech_password,
-					   password, scheme, AUTH_SUBSYS_DB);
-
-	sql_request->callback.verify_plain(ret > 0 ? PASSDB_RESULT_OK :
-					   PASSDB_RESULT_PASSWORD_MISMATCH,
-					   auth_request);
+					   password, scheme,
+					   sql_request->callback.verify_plain);
 	i_assert(dup_password != NULL);
 	safe_memset(dup_password, 0, strlen(dup_password));
 	auth_request_unref(&auth_request);
@@ -159,11 +156,22 @@ static void sql_lookup_pass(struct passdb_sql_request *sql_request)
 	struct passdb_module *_module =
 		sql_request->auth_request->passdb->passdb;
 	struct sql_passdb_module *module = (struct sql_passdb_module *)_module;
-	const char *query, *error;
+	struct db_sql_connection *conn = module->conn;
+	struct sql_statement *stmt = NULL;
+	const char *query = NULL, *error;
+	int ret;
 
-	if (t_auth_request_var_expand(module->conn->set.password_query,
-				      sql_request->auth_request,
-				      passdb_sql_escape, &query, &error) <= 0) {
+	if (conn->password_stmt.query != NULL) {
+		ret = db_sql_statement_init(conn, &conn->password_stmt,
+					    sql_request->auth_request,
+					    &stmt, &error);
+	} else {
+		ret = t_auth_request_var_expand(conn->set.password_query,
+						sql_request->auth_request,
+						passdb_sql_escape,
+						&query, &error);
+	}
+	if (ret <= 0) {
 		e_debug(authdb_event(sql_request->auth_request),
 			"Failed to expand password_query=%s: %s",
 			module->conn->set.password_query, error);
@@ -172,12 +180,14 @@ static void sql_lookup_pass(struct passdb_sql_request *sql_request)
 		return;
 	}
 
-	e_debug(authdb_event(sql_request->auth_request),
-		"query: %s", query);
+	e_debug(authdb_event(sql_request->auth_request), "query: %s",
+		stmt != NULL ? sql_statement_get_query(stmt) : query);
 
 	auth_request_ref(sql_request->auth_request);
-	sql_query(module->conn->db, query,
-		  sql_query_callback, sql_request);
+	if (stmt != NULL)
+		sql_statement_query(&stmt, sql_query_callback, sql_request);
+	else
+		sql_query(conn->db, query, sql_query_callback, sql_request);
 }
 
 static void sql_verify_plain(struct auth_request *request,
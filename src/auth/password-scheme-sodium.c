@@ -78,6 +78,7 @@ static const struct password_scheme sodium_schemes[] = {
 		.name = "ARGON2I",
 		.default_encoding = PW_ENCODING_NONE,
 		.raw_password_len = 0,
+		.slow = TRUE,
 		.password_verify = verify_argon2,
 		.password_generate = generate_argon2i,
 	},
@@ -86,6 +87,7 @@ static const struct password_scheme sodium_schemes[] = {
 		.name = "ARGON2ID",
 		.default_encoding = PW_ENCODING_NONE,
 		.raw_password_len = 0,
+		.slow = TRUE,
 		.password_verify = verify_argon2,
 		.password_generate = generate_argon2id,
 	},
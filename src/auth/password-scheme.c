@@ -266,6 +266,32 @@ const char *password_generate_salt(size_t len)
 	return salt;
 }
 
+static bool password_crypt_is_slow(const char *crypted)
+{
+	/* DES, extended DES and MD5 based crypt() hashes are cheap to verify.
+	   Only the algorithms designed to be expensive count as slow:
+	   bcrypt, SHA-256/512, scrypt and yescrypt. */
+	return str_begins_with(crypted, "$2") ||
+		str_begins_with(crypted, "$5$") ||
+		str_begins_with(crypted, "$6$") ||
+		str_begins_with(crypted, "$7$") ||
+		str_begins_with(crypted, "$y$") ||
+		str_begins_with(crypted, "$gy$");
+}
+
+bool password_scheme_is_slow(const char *scheme, const char *crypted)
+{
+	const struct password_scheme *s;
+	enum password_encoding encoding;
+
+	s = password_scheme_lookup(scheme, &encoding);
+	if (s == NULL)
+		return FALSE;
+	if (strcmp(s->name, "CRYPT") == 0)
+		return crypted != NULL && password_crypt_is_slow(crypted);
+	return s->slow;
+}
+
 bool password_scheme_is_alias(const char *scheme1, const char *scheme2)
 {
 	const struct password_scheme *s1 = NULL, *s2 = NULL;
@@ -872,6 +898,7 @@ static const struct password_scheme builtin_schemes[] = {
 		.name = "SCRAM-SHA-1",
 		.default_encoding = PW_ENCODING_NONE,
 		.raw_password_len = 0,
+		.slow = TRUE,
 		.password_verify = scram_sha1_verify,
 		.password_generate = scram_sha1_generate,
 	},
@@ -879,6 +906,7 @@ static const struct password_scheme builtin_schemes[] = {
 		.name = "SCRAM-SHA-256",
 		.default_encoding = PW_ENCODING_NONE,
 		.raw_password_len = 0,
+		.slow = TRUE,
 		.password_verify = scram_sha256_verify,
 		.password_generate = scram_sha256_generate,
 	},
@@ -932,6 +960,7 @@ static const struct password_scheme builtin_schemes[] = {
 		.name = "PBKDF2",
 		.default_encoding = PW_ENCODING_NONE,
 		.raw_password_len = 0,
+		.slow = TRUE,
 		.password_verify = pbkdf2_verify,
 		.password_generate = pbkdf2_generate,
 	},
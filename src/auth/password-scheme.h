@@ -25,6 +25,8 @@ struct password_scheme {
 	unsigned int raw_password_len;
 	/* If set, then this scheme is weak */
 	bool weak;
+	/* If set, verifying a password is CPU intensive (by design) */
+	bool slow;
 
 	int (*password_verify)(const char *plaintext,
 			       const struct password_generate_params *params,
@@ -72,6 +74,12 @@ bool password_generate_encoded(const char *plaintext,
 			       const struct password_generate_params *params,
 			       const char *scheme, const char **password_r);
 
+/* Returns TRUE if verifying passwords with the scheme is CPU intensive.
+   Such verifications shouldn't be done in a process that is serving other
+   requests at the same time. For the generic CRYPT scheme this depends on
+   the crypted password's algorithm, so it's FALSE if crypted is NULL. */
+bool password_scheme_is_slow(const char *scheme, const char *crypted);
+
 /* Returns TRUE if schemes are equivalent. */
 bool password_scheme_is_alias(const char *scheme1, const char *scheme2);
 
@@ -1,6 +1,11 @@
 /* Copyright (c) 2013-2018 Dovecot authors, see the included COPYING file */
 
+#define AUTH_REQUEST_FIELDS_CONST
+
 #include "lib.h"
+#include "lib-event-private.h"
+#include "event-filter.h"
+#include "ioloop.h"
 #include "str.h"
 #include "auth-request.h"
 #include "auth-cache.h"
@@ -21,20 +26,29 @@ auth_request_var_expand_static_tab[AUTH_REQUEST_VAR_TAB_COUNT + 1] = {
 
 struct var_expand_table *
 auth_request_get_var_expand_table_full(const struct auth_request *auth_request ATTR_UNUSED,
-				       const char *username ATTR_UNUSED,
+				       const char *username,
 				       auth_request_escape_func_t *escape_func ATTR_UNUSED,
 				       unsigned int *count ATTR_UNUSED)
 {
-	i_unreached();
+	struct var_expand_table *tab = t_new(struct var_expand_table, 3);
+
+	tab[0].key = 'u';
+	tab[0].value = username;
+	tab[0].long_key = "user";
+	tab[1].key = '!';
+	tab[1].value = "1";
+	return tab;
 }
 
 int auth_request_var_expand_with_table(string_t *dest, const char *str,
 				       const struct auth_request *auth_request ATTR_UNUSED,
-				       const struct var_expand_table *table ATTR_UNUSED,
+				       const struct var_expand_table *table,
 				       auth_request_escape_func_t *escape_func ATTR_UNUSED,
 				       const char **error_r ATTR_UNUSED)
 {
-	return var_expand(dest, str, auth_request_var_expand_static_tab, error_r);
+	if (table == NULL)
+		table = auth_request_var_expand_static_tab;
+	return var_expand(dest, str, table, error_r);
 }
 
 static void test_auth_cache_parse_key(void)
@@ -72,10 +86,167 @@ static void test_auth_cache_parse_key(void)
 	test_end();
 }
 
+static void test_auth_cache_lookup_user(struct auth_cache *cache,
+					const char *username,
+					const char *expected_value)
+{
+	struct auth_request request;
+	struct auth_cache_node *node;
+	const char *value;
+	bool expired, neg_expired;
+
+	i_zero(&request);
+	request.fields.translated_username = username;
+	value = auth_cache_lookup(cache, &request, "%u", &node,
+				  &expired, &neg_expired);
+	if (expected_value == NULL)
+		test_assert_strcmp(value, NULL);
+	else {
+		test_assert_strcmp(value, expected_value);
+		test_assert(!expired && !neg_expired);
+	}
+}
+
+static void test_auth_cache_persistence(void)
+{
+	const char *path = ".test-auth-cache";
+	struct ioloop *ioloop;
+	struct auth_cache *cache;
+	struct auth_request request;
+
+	test_begin("auth cache persistence");
+	ioloop = io_loop_create();
+	i_unlink_if_exists(path);
+
+	cache = auth_cache_new(1024*1024, 3600, 3600, path, "fp1");
+	i_zero(&request);
+	request.fields.translated_username = "user1";
+	auth_cache_insert(cache, &request, "%u", "{PLAIN}pass1\tfoo=bar", TRUE);
+	request.fields.translated_username = "user2";
+	auth_cache_insert(cache, &request, "%u", "{PLAIN}pass2", FALSE);
+	request.fields.translated_username = "user3";
+	auth_cache_insert(cache, &request, "%u", "", FALSE);
+	auth_cache_free(&cache);
+
+	/* reload the saved cache */
+	cache = auth_cache_new(1024*1024, 3600, 3600, path, "fp1");
+	test_auth_cache_lookup_user(cache, "user1", "{PLAIN}pass1\tfoo=bar");
+	test_auth_cache_lookup_user(cache, "user2", "{PLAIN}pass2");
+	test_auth_cache_lookup_user(cache, "user3", "");
+	test_auth_cache_lookup_user(cache, "user4", NULL);
+	auth_cache_free(&cache);
+
+	/* negative entries are dropped when they're no longer cached */
+	cache = auth_cache_new(1024*1024, 3600, 0, path, "fp1");
+	test_auth_cache_lookup_user(cache, "user1", "{PLAIN}pass1\tfoo=bar");
+	test_auth_cache_lookup_user(cache, "user3", NULL);
+	auth_cache_free(&cache);
+
+	/* the cache is ignored when the passdbs/userdbs have changed */
+	cache = auth_cache_new(1024*1024, 3600, 3600, path, "fp2");
+	test_auth_cache_lookup_user(cache, "user1", NULL);
+	test_auth_cache_lookup_user(cache, "user2", NULL);
+	auth_cache_free(&cache);
+	cache = auth_cache_new(1024*1024, 3600, 3600, path, "fp1");
+	test_auth_cache_lookup_user(cache, "user1", NULL);
+	auth_cache_free(&cache);
+
+	i_unlink(path);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static unsigned int test_lookup_hits, test_lookup_misses, test_evictions;
+
+static bool
+test_auth_cache_event_callback(struct event *event,
+			       enum event_callback_type type,
+			       struct failure_context *ctx ATTR_UNUSED,
+			       const char *fmt ATTR_UNUSED,
+			       va_list args ATTR_UNUSED)
+{
+	const struct event_field *field;
+	const char *name;
+
+	if (type != EVENT_CALLBACK_TYPE_SEND || event->sending_name == NULL)
+		return TRUE;
+
+	name = event->sending_name;
+	if (strcmp(name, "auth_cache_lookup") == 0) {
+		field = event_find_field_nonrecursive(event, "result");
+		test_assert(field != NULL &&
+			    field->value_type == EVENT_FIELD_VALUE_TYPE_STR);
+		if (field == NULL)
+			;
+		else if (strcmp(field->value.str, "hit") == 0)
+			test_lookup_hits++;
+		else if (strcmp(field->value.str, "miss") == 0)
+			test_lookup_misses++;
+		else
+			test_assert(FALSE);
+	} else if (strcmp(name, "auth_cache_evicted") == 0) {
+		field = event_find_field_nonrecursive(event, "entries");
+		test_assert(field != NULL &&
+			    field->value_type == EVENT_FIELD_VALUE_TYPE_INTMAX);
+		if (field != NULL)
+			test_evictions += field->value.intmax;
+	}
+	/* don't log the debug messages */
+	return FALSE;
+}
+
+static void test_auth_cache_events(void)
+{
+	struct event_filter *filter;
+	struct auth_cache *cache;
+	struct auth_request request;
+	const char *error, *value;
+
+	test_begin("auth cache events");
+	value = t_strdup_printf("{PLAIN}%0400d", 0);
+	event_register_callback(test_auth_cache_event_callback);
+	filter = event_filter_create();
+	test_assert(event_filter_parse("event=auth_cache_lookup OR "
+				       "event=auth_cache_evicted",
+				       filter, &error) == 0);
+	event_set_global_debug_log_filter(filter);
+	event_filter_unref(&filter);
+
+	cache = auth_cache_new(1024, 3600, 3600, NULL, "fp1");
+	i_zero(&request);
+	request.fields.translated_username = "user1";
+	auth_cache_insert(cache, &request, "%u", value, TRUE);
+	request.fields.translated_username = "user2";
+	auth_cache_insert(cache, &request, "%u", value, TRUE);
+	test_assert(test_evictions == 0);
+
+	test_auth_cache_lookup_user(cache, "user1", value);
+	test_auth_cache_lookup_user(cache, "user3", NULL);
+	test_assert(test_lookup_hits == 1);
+	test_assert(test_lookup_misses == 1);
+
+	/* no room for the third entry - the least recently used user2
+	   gets evicted */
+	request.fields.translated_username = "user3";
+	auth_cache_insert(cache, &request, "%u", value, TRUE);
+	test_assert(test_evictions == 1);
+	test_auth_cache_lookup_user(cache, "user2", NULL);
+	test_auth_cache_lookup_user(cache, "user3", value);
+	test_assert(test_lookup_hits == 2);
+	test_assert(test_lookup_misses == 2);
+	auth_cache_free(&cache);
+
+	event_unset_global_debug_log_filter();
+	event_unregister_callback(test_auth_cache_event_callback);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_auth_cache_parse_key,
+		test_auth_cache_persistence,
+		test_auth_cache_events,
 		NULL
 	};
 	return test_run(test_functions);
@@ -0,0 +1,366 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-auth.h"
+#include "str.h"
+#include "strnum.h"
+#include "write-full.h"
+#include "hostpid.h"
+#include "ioloop.h"
+#include "net.h"
+#include "master-service.h"
+#include "master-service-settings.h"
+#include "settings-parser.h"
+#include "auth-common.h"
+#include "auth-request.h"
+#include "auth-settings.h"
+#include "auth-policy.h"
+#include "passdb.h"
+#include "test-subprocess.h"
+
+#include <unistd.h>
+#include <sys/signal.h>
+
+#define SERVER_KILL_TIMEOUT_SECS 20
+
+static struct ip_addr bind_ip;
+static in_port_t bind_port;
+static int fd_listen = -1;
+/* the server writes a byte here for each policy request it receives */
+static int fd_requests[2] = { -1, -1 };
+static bool debug = FALSE;
+
+static struct auth_settings set;
+/* the policy refusal reason is set as a passdb field */
+static struct auth_passdb *test_passdb;
+static unsigned int checks_pending;
+
+/*
+ * Server
+ */
+
+static const char *test_server_get_response(const char *login)
+{
+	/* the response depends on the login name's prefix */
+	if (str_begins_with(login, "allow"))
+		return "{\"status\":0,\"ttl\":60}";
+	if (str_begins_with(login, "nottl"))
+		return "{\"status\":0}";
+	if (str_begins_with(login, "tarpit"))
+		return "{\"status\":5,\"ttl\":60}";
+	if (str_begins_with(login, "reject"))
+		return "{\"status\":-1,\"msg\":\"go away\",\"ttl\":60}";
+	i_fatal("Unexpected login: %s", login);
+}
+
+static bool test_server_read_request(int fd, const char **login_r)
+{
+	string_t *str = t_str_new(256);
+	const char *p, *body, *login;
+	unsigned char buf[1024];
+	unsigned int content_length;
+	ssize_t ret;
+
+	/* read the headers */
+	while ((p = strstr(str_c(str), "\r\n\r\n")) == NULL) {
+		if ((ret = read(fd, buf, sizeof(buf))) <= 0)
+			return FALSE;
+		str_append_data(str, buf, ret);
+	}
+	body = p + 4;
+	p = strstr(str_c(str), "Content-Length: ");
+	if (p == NULL || str_parse_uint(p + 16, &content_length, &p) < 0)
+		i_fatal("Content-Length missing from request");
+	i_assert(strstr(str_c(str), "POST /?command=allow ") != NULL);
+
+	/* read the body */
+	size_t body_pos = body - str_c(str);
+	while (str_len(str) - body_pos < content_length) {
+		if ((ret = read(fd, buf, sizeof(buf))) <= 0)
+			return FALSE;
+		str_append_data(str, buf, ret);
+	}
+	login = strstr(str_c(str) + body_pos, "\"login\":\"");
+	if (login == NULL)
+		i_fatal("login missing from request");
+	login += 9;
+	*login_r = t_strcut(login, '"');
+	return TRUE;
+}
+
+static void test_server_accept(void *context ATTR_UNUSED)
+{
+	const char *login, *body, *response;
+	int fd;
+
+	fd = net_accept(fd_listen, NULL, NULL);
+	if (fd == -1)
+		return;
+	if (fd < 0)
+		i_fatal("accept() failed: %m");
+	/* the requests are small, so just read them blocking */
+	fd_set_nonblock(fd, FALSE);
+	if (test_server_read_request(fd, &login)) {
+		if (write_full(fd_requests[1], "", 1) < 0)
+			i_fatal("write(requests pipe) failed: %m");
+		body = test_server_get_response(login);
+		response = t_strdup_printf(
+			"HTTP/1.1 200 OK\r\n"
+			"Connection: close\r\n"
+			"Content-Type: application/json\r\n"
+			"Content-Length: %zu\r\n\r\n%s",
+			strlen(body), body);
+		if (write_full(fd, response, strlen(response)) < 0)
+			i_fatal("write() failed: %m");
+	}
+	i_close_fd(&fd);
+}
+
+static int test_run_server(void *context ATTR_UNUSED)
+{
+	struct ioloop *ioloop;
+	struct io *io_listen;
+
+	i_set_failure_prefix("SERVER: ");
+	if (debug)
+		i_debug("PID=%s", my_pid);
+	test_subprocess_notify_signal_send_parent(SIGHUP);
+
+	ioloop = io_loop_create();
+	io_listen = io_add(fd_listen, IO_READ, test_server_accept, NULL);
+	io_loop_run(ioloop);
+	io_remove(&io_listen);
+	io_loop_destroy(&ioloop);
+	return 0;
+}
+
+/*
+ * Client
+ */
+
+static void test_client_init(void)
+{
+	fd_listen = net_listen(&bind_ip, &bind_port, 128);
+	if (fd_listen == -1)
+		i_fatal("listen(%s) failed: %m", net_ip2addr(&bind_ip));
+	if (pipe(fd_requests) < 0)
+		i_fatal("pipe() failed: %m");
+	fd_set_nonblock(fd_requests[0], TRUE);
+
+	test_subprocess_notify_signal_reset(SIGHUP);
+	test_subprocess_fork(test_run_server, (void *)NULL, FALSE);
+	i_close_fd(&fd_listen);
+	i_close_fd(&fd_requests[1]);
+	test_subprocess_notify_signal_wait(SIGHUP, 10000);
+
+	set = *(const struct auth_settings *)auth_setting_parser_info.defaults;
+	set.debug = debug;
+	set.policy_server_url = t_strdup_printf("http://%s:%u/",
+		net_ip2addr(&bind_ip), bind_port);
+	set.policy_hash_nonce = "nonce";
+	set.policy_cache_key = "%{requested_username}";
+	global_auth_settings = &set;
+	auth_policy_init();
+}
+
+static void test_client_deinit(void)
+{
+	auth_policy_deinit();
+	test_subprocess_kill_all(SERVER_KILL_TIMEOUT_SECS);
+	i_close_fd(&fd_requests[0]);
+	bind_port = 0;
+}
+
+/* Returns the number of policy requests the server has received since the
+   previous call. */
+static unsigned int test_server_get_request_count(void)
+{
+	unsigned char buf[128];
+	unsigned int count = 0;
+	ssize_t ret;
+
+	while ((ret = read(fd_requests[0], buf, sizeof(buf))) > 0)
+		count += ret;
+	if (ret < 0 && errno != EAGAIN)
+		i_fatal("read(requests pipe) failed: %m");
+	return count;
+}
+
+static void test_check_callback(int result, void *context)
+{
+	int *result_r = context;
+
+	*result_r = result;
+	i_assert(checks_pending > 0);
+	if (--checks_pending == 0)
+		io_loop_stop(current_ioloop);
+}
+
+static struct auth_request *
+test_check_begin(const char *username, int *result_r)
+{
+	struct auth_request *request;
+
+	request = auth_request_new_dummy(NULL);
+	request->passdb = test_passdb;
+	request->fields.service = "imap";
+	request->fields.user = p_strdup(request->pool, username);
+	*result_r = INT_MIN;
+	checks_pending++;
+	auth_policy_check(request, "password", test_check_callback, result_r);
+	return request;
+}
+
+static void test_checks_wait(void)
+{
+	/* the cached results are returned immediately */
+	if (checks_pending > 0)
+		io_loop_run(current_ioloop);
+	i_assert(checks_pending == 0);
+}
+
+static int test_check(const char *username)
+{
+	struct auth_request *request;
+	int result;
+
+	request = test_check_begin(username, &result);
+	test_checks_wait();
+	auth_request_unref(&request);
+	return result;
+}
+
+static void test_auth_policy_cache(void)
+{
+	struct ioloop *ioloop = io_loop_create();
+
+	test_begin("auth policy cache");
+	test_client_init();
+
+	/* allow with a ttl is cached */
+	test_assert(test_check("allow1") == 0);
+	test_assert(test_server_get_request_count() == 1);
+	test_assert(test_check("allow1") == 0);
+	test_assert(test_server_get_request_count() == 0);
+	/* the cache key is different */
+	test_assert(test_check("allow2") == 0);
+	test_assert(test_server_get_request_count() == 1);
+
+	/* allow without a ttl isn't cached */
+	test_assert(test_check("nottl") == 0);
+	test_assert(test_check("nottl") == 0);
+	test_assert(test_server_get_request_count() == 2);
+
+	/* tarpit and reject verdicts aren't cached, even with a ttl */
+	test_assert(test_check("tarpit") == 5);
+	test_assert(test_check("tarpit") == 5);
+	test_assert(test_server_get_request_count() == 2);
+	test_assert(test_check("reject") == -1);
+	test_assert(test_check("reject") == -1);
+	test_assert(test_server_get_request_count() == 2);
+
+	test_client_deinit();
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_auth_policy_coalesce(void)
+{
+	struct ioloop *ioloop = io_loop_create();
+	struct auth_request *requests[4];
+	int results[N_ELEMENTS(requests)];
+	unsigned int i;
+
+	test_begin("auth policy coalesce");
+	test_client_init();
+
+	/* concurrent checks with the same key send one request */
+	requests[0] = test_check_begin("allow", &results[0]);
+	requests[1] = test_check_begin("allow", &results[1]);
+	requests[2] = test_check_begin("allow", &results[2]);
+	/* a different key isn't coalesced */
+	requests[3] = test_check_begin("allow-other", &results[3]);
+	test_checks_wait();
+	for (i = 0; i < N_ELEMENTS(requests); i++) {
+		test_assert_idx(results[i] == 0, i);
+		auth_request_unref(&requests[i]);
+	}
+	test_assert(test_server_get_request_count() == 2);
+
+	/* the waiting checks get the verdict even when it isn't cached */
+	requests[0] = test_check_begin("reject", &results[0]);
+	requests[1] = test_check_begin("reject", &results[1]);
+	test_checks_wait();
+	for (i = 0; i < 2; i++) {
+		test_assert_idx(results[i] == -1, i);
+		auth_request_unref(&requests[i]);
+	}
+	test_assert(test_server_get_request_count() == 1);
+	/* ..and the next check asks the server again */
+	test_assert(test_check("reject") == -1);
+	test_assert(test_server_get_request_count() == 1);
+
+	test_client_deinit();
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void main_deinit(void)
+{
+	/* also called from sub-processes */
+	if (fd_requests[0] != -1)
+		i_close_fd(&fd_requests[0]);
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*const test_functions[])(void) = {
+		test_auth_policy_cache,
+		test_auth_policy_coalesce,
+		NULL
+	};
+	const enum master_service_flags service_flags =
+		MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+		MASTER_SERVICE_FLAG_STANDALONE |
+		MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+		MASTER_SERVICE_FLAG_NO_SSL_INIT;
+	const char *error;
+	int c, ret;
+
+	master_service = master_service_init("test-auth-policy", service_flags,
+					     &argc, &argv, "D");
+	while ((c = master_getopt(master_service)) > 0) {
+		switch (c) {
+		case 'D':
+			debug = TRUE;
+			break;
+		default:
+			i_fatal("Usage: %s [-D]", argv[0]);
+		}
+	}
+	if (master_service_settings_read_simple(master_service, NULL,
+						&error) < 0)
+		i_fatal("master_service_settings_read_simple() failed: %s",
+			error);
+	master_service_init_finish(master_service);
+	process_start_time = time(NULL);
+	passdbs_init();
+	passdb_mock_mod_init();
+	test_passdb = passdb_mock();
+
+	test_subprocesses_init(debug);
+	test_subprocess_set_cleanup_callback(main_deinit);
+
+	/* listen on localhost */
+	i_zero(&bind_ip);
+	bind_ip.family = AF_INET;
+	bind_ip.u.ip4.s_addr = htonl(INADDR_LOOPBACK);
+
+	ret = test_run(test_functions);
+
+	test_subprocesses_deinit();
+	i_free(test_passdb);
+	passdb_mock_mod_deinit();
+	passdbs_deinit();
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -0,0 +1,496 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-auth.h"
+#include "array.h"
+#include "ioloop.h"
+#include "net.h"
+#include "ostream.h"
+#include "time-util.h"
+#include "connection.h"
+#include "auth-common.h"
+#include "auth-request.h"
+#include "auth-worker-server.h"
+#include "auth-worker-connection.h"
+
+#include <unistd.h>
+
+/* auth_worker_connection_init() uses this path */
+#define TEST_WORKER_SOCKET_PATH "auth-worker"
+#define TEST_WORKER_PROCESS_LIMIT 4
+#define TEST_WAIT_TIMEOUT_SECS 20
+/* the number of lookups kept running in the pool test */
+#define TEST_POOL_LOOKUP_COUNT 8
+#define TEST_POOL_FAST_REPLY_MSECS 10
+#define TEST_POOL_SLOW_REPLY_MSECS 100
+
+struct test_worker {
+	struct connection conn;
+};
+
+struct test_worker_request {
+	struct test_worker *worker;
+	unsigned int id;
+	char *data;
+	struct timeval reply_time;
+};
+
+struct test_lookup {
+	char *reply;
+	bool finished;
+};
+
+struct test_lookup_context {
+	pool_t pool;
+	struct test_lookup *lookup;
+};
+
+static int fd_listen = -1;
+static struct io *io_listen;
+static struct connection_list *test_workers;
+static ARRAY(struct test_worker_request) test_worker_requests;
+static unsigned int test_workers_max_count;
+/* reply to the requests after this delay instead of waiting for the test */
+static unsigned int test_worker_reply_msecs;
+static struct timeout *to_worker_reply;
+
+static unsigned int lookups_finished, lookups_running;
+/* keep lookups running in the pool test */
+static bool lookups_refill;
+
+/*
+ * Fake auth-worker processes
+ */
+
+static void test_worker_reply(const struct test_worker_request *request)
+{
+	o_stream_nsend_str(request->worker->conn.output,
+			   t_strdup_printf("%u\tOK\t%s\n", request->id,
+					   request->data));
+}
+
+static void test_worker_reply_all(void)
+{
+	struct test_worker_request *request;
+
+	array_foreach_modifiable(&test_worker_requests, request) {
+		test_worker_reply(request);
+		i_free(request->data);
+	}
+	array_clear(&test_worker_requests);
+}
+
+static void test_worker_reply_due(void *context ATTR_UNUSED)
+{
+	struct test_worker_request *request;
+	unsigned int i;
+
+	for (i = 0; i < array_count(&test_worker_requests); ) {
+		request = array_idx_modifiable(&test_worker_requests, i);
+		if (timeval_cmp(&request->reply_time, &ioloop_timeval) > 0) {
+			i++;
+			continue;
+		}
+		test_worker_reply(request);
+		i_free(request->data);
+		array_delete(&test_worker_requests, i, 1);
+	}
+}
+
+static void test_worker_set_reply_msecs(unsigned int msecs)
+{
+	test_worker_reply_msecs = msecs;
+	timeout_remove(&to_worker_reply);
+	if (msecs > 0) {
+		to_worker_reply = timeout_add_short(1, test_worker_reply_due,
+						    NULL);
+	}
+}
+
+static int
+test_worker_handshake_args(struct connection *conn, const char *const *args)
+{
+	if (!conn->version_received) {
+		if (connection_handshake_args_default(conn, args) < 0)
+			return -1;
+		return 0;
+	}
+	test_assert(strcmp(args[0], "DBHASH") == 0);
+	return 1;
+}
+
+static int test_worker_input_args(struct connection *conn,
+				  const char *const *args)
+{
+	struct test_worker *worker =
+		container_of(conn, struct test_worker, conn);
+	struct test_worker_request *request;
+	unsigned int id;
+
+	if (str_to_uint(args[0], &id) < 0)
+		i_fatal("Invalid request ID: %s", args[0]);
+
+	request = array_append_space(&test_worker_requests);
+	request->worker = worker;
+	request->id = id;
+	request->data = i_strdup(t_strarray_join(args + 1, "\t"));
+	request->reply_time = ioloop_timeval;
+	timeval_add_msecs(&request->reply_time, test_worker_reply_msecs);
+	return 1;
+}
+
+static void test_worker_destroy(struct connection *conn)
+{
+	struct test_worker *worker =
+		container_of(conn, struct test_worker, conn);
+	struct test_worker_request *request;
+	unsigned int i;
+
+	for (i = array_count(&test_worker_requests); i > 0; i--) {
+		request = array_idx_modifiable(&test_worker_requests, i - 1);
+		if (request->worker == worker) {
+			i_free(request->data);
+			array_delete(&test_worker_requests, i - 1, 1);
+		}
+	}
+	connection_deinit(conn);
+	i_free(worker);
+}
+
+static const struct connection_settings test_worker_set = {
+	.service_name_in = AUTH_MASTER_NAME,
+	.service_name_out = AUTH_WORKER_NAME,
+	.major_version = AUTH_WORKER_PROTOCOL_MAJOR_VERSION,
+	.minor_version = AUTH_WORKER_PROTOCOL_MINOR_VERSION,
+	.input_max_size = SIZE_MAX,
+	.output_max_size = SIZE_MAX,
+};
+
+static const struct connection_vfuncs test_worker_vfuncs = {
+	.handshake_args = test_worker_handshake_args,
+	.input_args = test_worker_input_args,
+	.destroy = test_worker_destroy,
+};
+
+static void test_worker_accept(void *context ATTR_UNUSED)
+{
+	struct test_worker *worker;
+	int fd;
+
+	fd = net_accept(fd_listen, NULL, NULL);
+	if (fd == -1)
+		return;
+	if (fd < 0)
+		i_fatal("accept() failed: %m");
+
+	worker = i_new(struct test_worker, 1);
+	connection_init_server(test_workers, &worker->conn, "auth-worker",
+			       fd, fd);
+	o_stream_nsend_str(worker->conn.output, t_strdup_printf(
+		"PROCESS-LIMIT\t%u\n", TEST_WORKER_PROCESS_LIMIT));
+	test_workers_max_count = I_MAX(test_workers_max_count,
+				       test_workers->connections_count);
+}
+
+static void test_init(void)
+{
+	i_unlink_if_exists(TEST_WORKER_SOCKET_PATH);
+	fd_listen = net_listen_unix(TEST_WORKER_SOCKET_PATH, 128);
+	if (fd_listen == -1)
+		i_fatal("net_listen_unix(%s) failed: %m",
+			TEST_WORKER_SOCKET_PATH);
+	io_listen = io_add(fd_listen, IO_READ, test_worker_accept, NULL);
+	test_workers = connection_list_init(&test_worker_set,
+					    &test_worker_vfuncs);
+	i_array_init(&test_worker_requests, 16);
+	test_workers_max_count = 0;
+	test_worker_reply_msecs = 0;
+
+	lookups_finished = lookups_running = 0;
+	lookups_refill = FALSE;
+	auth_worker_connection_init();
+}
+
+static void test_deinit(void)
+{
+	auth_worker_connection_deinit();
+
+	timeout_remove(&to_worker_reply);
+	connection_list_deinit(&test_workers);
+	test_assert(array_count(&test_worker_requests) == 0);
+	array_free(&test_worker_requests);
+	io_remove(&io_listen);
+	i_close_fd(&fd_listen);
+	i_unlink(TEST_WORKER_SOCKET_PATH);
+}
+
+static void test_wait_stop(struct ioloop *ioloop)
+{
+	io_loop_stop(ioloop);
+}
+
+/* Run ioloop until cond() returns TRUE. */
+static void test_wait(bool (*cond)(void))
+{
+	struct timeout *to;
+	time_t deadline = time(NULL) + TEST_WAIT_TIMEOUT_SECS;
+
+	to = timeout_add_short(10, test_wait_stop, current_ioloop);
+	while (!cond() && time(NULL) < deadline)
+		io_loop_run(current_ioloop);
+	timeout_remove(&to);
+	test_assert(cond());
+}
+
+/*
+ * Lookups
+ */
+
+static bool test_lookup_callback(struct auth_worker_connection *conn,
+				 const char *const *args, void *context);
+
+static void
+test_lookup(struct test_lookup *lookup, const char *coalesce_key,
+	    const char *data)
+{
+	struct test_lookup_context *ctx;
+	pool_t pool;
+
+	/* like auth requests, each lookup has its own pool */
+	pool = pool_alloconly_create("test auth worker lookup", 256);
+	ctx = p_new(pool, struct test_lookup_context, 1);
+	ctx->pool = pool;
+	ctx->lookup = lookup;
+	lookups_running++;
+	auth_worker_call_coalesced(pool, "user", coalesce_key, data,
+				   test_lookup_callback, ctx);
+}
+
+static void test_lookup_slow(struct test_lookup *lookup, const char *data)
+{
+	struct test_lookup_context *ctx;
+	pool_t pool;
+
+	pool = pool_alloconly_create("test auth worker lookup", 256);
+	ctx = p_new(pool, struct test_lookup_context, 1);
+	ctx->pool = pool;
+	ctx->lookup = lookup;
+	lookups_running++;
+	auth_worker_call_slow(pool, "user", data, test_lookup_callback, ctx);
+}
+
+static void test_lookup_refill(void)
+{
+	static unsigned int counter = 0;
+
+	/* each lookup is different, so nothing is coalesced */
+	test_lookup(NULL, NULL, t_strdup_printf("USER\tuser%u", ++counter));
+}
+
+static bool test_lookup_callback(struct auth_worker_connection *conn ATTR_UNUSED,
+				 const char *const *args, void *context)
+{
+	struct test_lookup_context *ctx = context;
+	struct test_lookup *lookup = ctx->lookup;
+
+	pool_unref(&ctx->pool);
+	if (lookup != NULL) {
+		i_assert(!lookup->finished);
+		lookup->reply = i_strdup(t_strarray_join(args, "\t"));
+		lookup->finished = TRUE;
+	}
+	i_assert(lookups_running > 0);
+	lookups_running--;
+	lookups_finished++;
+	if (lookups_refill)
+		test_lookup_refill();
+	return TRUE;
+}
+
+static void test_lookups_free(struct test_lookup *lookups, unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		i_free(lookups[i].reply);
+		lookups[i].finished = FALSE;
+	}
+}
+
+static unsigned int test_worker_requests_count(const char *data)
+{
+	const struct test_worker_request *request;
+	unsigned int count = 0;
+
+	array_foreach(&test_worker_requests, request) {
+		if (strcmp(request->data, data) == 0)
+			count++;
+	}
+	return count;
+}
+
+static unsigned int test_wanted_count;
+
+static bool test_worker_requests_reached(void)
+{
+	return array_count(&test_worker_requests) >= test_wanted_count;
+}
+
+static bool test_lookups_finished(void)
+{
+	return lookups_running == 0;
+}
+
+static bool test_lookups_finished_reached(void)
+{
+	return lookups_finished >= test_wanted_count;
+}
+
+static struct test_lookup *test_wanted_lookup;
+
+static bool test_lookup_finished(void)
+{
+	return test_wanted_lookup->finished;
+}
+
+static bool test_workers_shrunk(void)
+{
+	return test_workers->connections_count < test_wanted_count;
+}
+
+static bool test_workers_reached(void)
+{
+	return test_workers->connections_count >= test_wanted_count;
+}
+
+static void test_auth_worker_connection_coalesce(void)
+{
+	struct test_lookup lookups[6];
+	unsigned int i;
+
+	i_zero(&lookups);
+	test_init();
+
+	/* identical lookups are sent once */
+	test_lookup(&lookups[0], "key1", "USER\tuser1");
+	test_lookup(&lookups[1], "key1", "USER\tuser1");
+	test_lookup(&lookups[2], "key1", "USER\tuser1");
+	/* different keys aren't coalesced */
+	test_lookup(&lookups[3], "key2", "USER\tuser2");
+	/* neither are lookups without a key */
+	test_lookup(&lookups[4], NULL, "USER\tuser1");
+
+	test_wanted_count = 3;
+	test_wait(test_worker_requests_reached);
+	test_assert(array_count(&test_worker_requests) == 3);
+	test_assert(test_worker_requests_count("USER\tuser1") == 2);
+	test_assert(test_worker_requests_count("USER\tuser2") == 1);
+
+	/* all the waiting lookups get the reply */
+	test_worker_reply_all();
+	test_wait(test_lookups_finished);
+	for (i = 0; i < 3; i++)
+		test_assert_strcmp_idx(lookups[i].reply, "OK\tUSER\tuser1", i);
+	test_assert_strcmp(lookups[3].reply, "OK\tUSER\tuser2");
+	test_assert_strcmp(lookups[4].reply, "OK\tUSER\tuser1");
+
+	/* a finished lookup isn't shared with the later ones */
+	test_lookup(&lookups[5], "key1", "USER\tuser1");
+	test_wanted_count = 1;
+	test_wait(test_worker_requests_reached);
+	test_assert(test_worker_requests_count("USER\tuser1") == 1);
+	test_worker_reply_all();
+	test_wait(test_lookups_finished);
+	test_assert_strcmp(lookups[5].reply, "OK\tUSER\tuser1");
+
+	test_deinit();
+	test_lookups_free(lookups, N_ELEMENTS(lookups));
+}
+
+static void test_auth_worker_connection_pool_size(void)
+{
+	struct test_lookup lookup;
+	unsigned int i;
+
+	i_zero(&lookup);
+	test_init();
+	test_worker_set_reply_msecs(TEST_POOL_FAST_REPLY_MSECS);
+
+	/* the first worker negotiates the process limit */
+	test_lookup(&lookup, NULL, "USER\tuser");
+	test_wait(test_lookups_finished);
+	test_assert(test_workers->connections_count == 1);
+
+	/* the pool grows up to the process limit with fast lookups */
+	lookups_refill = TRUE;
+	for (i = 0; i < TEST_POOL_LOOKUP_COUNT; i++)
+		test_lookup_refill();
+	test_wanted_count = TEST_WORKER_PROCESS_LIMIT;
+	test_wait(test_workers_reached);
+	test_wanted_count = 100;
+	test_wait(test_lookups_finished_reached);
+	test_assert(test_workers->connections_count ==
+		    TEST_WORKER_PROCESS_LIMIT);
+
+	/* the pool shrinks when the lookups get slow */
+	test_worker_set_reply_msecs(TEST_POOL_SLOW_REPLY_MSECS);
+	test_wanted_count = TEST_WORKER_PROCESS_LIMIT;
+	test_wait(test_workers_shrunk);
+
+	/* ..and grows back once they're fast again */
+	test_worker_set_reply_msecs(TEST_POOL_FAST_REPLY_MSECS);
+	test_wanted_count = TEST_WORKER_PROCESS_LIMIT;
+	test_wait(test_workers_reached);
+	test_assert(test_workers_max_count == TEST_WORKER_PROCESS_LIMIT);
+
+	lookups_refill = FALSE;
+	test_wait(test_lookups_finished);
+	test_deinit();
+	test_lookups_free(&lookup, 1);
+}
+
+static void test_auth_worker_connection_slow_starvation(void)
+{
+	struct test_lookup slow_lookup;
+	unsigned int i;
+
+	i_zero(&slow_lookup);
+	test_init();
+	test_worker_set_reply_msecs(TEST_POOL_FAST_REPLY_MSECS);
+
+	/* keep more lookups running than there are workers, so there are
+	   always other requests queued */
+	lookups_refill = TRUE;
+	for (i = 0; i < TEST_POOL_LOOKUP_COUNT; i++)
+		test_lookup_refill();
+	test_wanted_count = TEST_WORKER_PROCESS_LIMIT;
+	test_wait(test_workers_reached);
+
+	/* the slow request still gets its turn */
+	test_lookup_slow(&slow_lookup, "PASSW\tslow");
+	test_wanted_lookup = &slow_lookup;
+	test_wait(test_lookup_finished);
+	test_assert_strcmp(slow_lookup.reply, "OK\tPASSW\tslow");
+
+	lookups_refill = FALSE;
+	test_wait(test_lookups_finished);
+	test_deinit();
+	test_lookups_free(&slow_lookup, 1);
+}
+
+void test_auth_worker_connection(void)
+{
+	struct ioloop *ioloop = io_loop_create();
+
+	auth_event = event_create(NULL);
+	test_begin("auth worker connection coalesce");
+	test_auth_worker_connection_coalesce();
+	test_end();
+	test_begin("auth worker connection pool size");
+	test_auth_worker_connection_pool_size();
+	test_end();
+	test_begin("auth worker connection slow requests aren't starved");
+	test_auth_worker_connection_slow_starvation();
+	test_end();
+	event_unref(&auth_event);
+	io_loop_destroy(&ioloop);
+}
@@ -16,7 +16,11 @@ void test_auth_request_var_expand(void);
 void test_auth_request_fields(void);
 void test_db_dict_parse_cache_key(void);
 void test_username_filter(void);
+void test_auth_worker_connection(void);
+void test_passdb_cache(void);
 void test_db_lua(void);
+void test_db_ldap(void);
+void test_db_sql(void);
 struct auth_passdb *passdb_mock(void);
 void passdb_mock_mod_init(void);
 void passdb_mock_mod_deinit(void);
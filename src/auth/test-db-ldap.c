@@ -0,0 +1,112 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-auth.h"
+
+#ifdef BUILTIN_LDAP
+#include "array.h"
+#include "aqueue.h"
+#include "db-ldap.h"
+
+#define TEST_POOL_CONN_COUNT 3
+#define TEST_MAX_PENDING_REQUESTS 4
+
+static struct ldap_connection test_conns[TEST_POOL_CONN_COUNT];
+static struct ldap_request test_request;
+
+static void test_pool_init(void)
+{
+	unsigned int i;
+
+	i_zero(&test_conns);
+	for (i = 0; i < TEST_POOL_CONN_COUNT; i++) {
+		struct ldap_connection *conn = &test_conns[i];
+
+		conn->set.max_connections = TEST_POOL_CONN_COUNT;
+		conn->set.max_pending_requests = TEST_MAX_PENDING_REQUESTS;
+		conn->pool_idx = i;
+		if (i > 0)
+			conn->primary = &test_conns[0];
+		i_array_init(&conn->request_array, 8);
+		conn->request_queue = aqueue_init(&conn->request_array.arr);
+	}
+	i_array_init(&test_conns[0].pool_conns, TEST_POOL_CONN_COUNT);
+	for (i = 0; i < TEST_POOL_CONN_COUNT; i++) {
+		struct ldap_connection *conn = &test_conns[i];
+		array_push_back(&test_conns[0].pool_conns, &conn);
+	}
+}
+
+static void test_pool_deinit(void)
+{
+	unsigned int i;
+
+	array_free(&test_conns[0].pool_conns);
+	for (i = 0; i < TEST_POOL_CONN_COUNT; i++) {
+		aqueue_deinit(&test_conns[i].request_queue);
+		array_free(&test_conns[i].request_array);
+	}
+}
+
+static void test_pool_queue(unsigned int conn_idx, unsigned int count)
+{
+	struct ldap_request *request = &test_request;
+
+	for (; count > 0; count--)
+		aqueue_append(test_conns[conn_idx].request_queue, &request);
+}
+
+static unsigned int test_pool_get_conn_idx(unsigned int conn_idx)
+{
+	return db_ldap_pool_get_conn(&test_conns[conn_idx])->pool_idx;
+}
+
+static void test_db_ldap_pool_get_conn(void)
+{
+	test_begin("db_ldap_pool_get_conn()");
+	test_pool_init();
+
+	/* idle pool uses the primary connection */
+	test_assert(test_pool_get_conn_idx(0) == 0);
+	/* pooled connections also return the first non-busy connection */
+	test_assert(test_pool_get_conn_idx(2) == 0);
+
+	/* a single outstanding request doesn't open another connection */
+	test_pool_queue(0, 1);
+	test_assert(test_pool_get_conn_idx(0) == 0);
+	/* ..and neither do requests below max_pending_requests */
+	test_pool_queue(0, TEST_MAX_PENDING_REQUESTS - 2);
+	test_assert(test_pool_get_conn_idx(0) == 0);
+
+	/* busy primary moves requests to the next connection */
+	test_pool_queue(0, 1);
+	test_assert(test_pool_get_conn_idx(0) == 1);
+	test_pool_queue(1, TEST_MAX_PENDING_REQUESTS - 1);
+	test_assert(test_pool_get_conn_idx(0) == 1);
+	test_pool_queue(1, 1);
+	test_assert(test_pool_get_conn_idx(0) == 2);
+	/* a non-busy earlier connection is preferred over an idle later one */
+	aqueue_delete_tail(test_conns[0].request_queue);
+	test_assert(test_pool_get_conn_idx(0) == 0);
+	test_pool_queue(0, 1);
+
+	/* all busy: use the one with the fewest outstanding requests */
+	test_pool_queue(0, 2);
+	test_pool_queue(1, 1);
+	test_pool_queue(2, TEST_MAX_PENDING_REQUESTS);
+	test_assert(test_pool_get_conn_idx(0) == 2);
+	test_pool_queue(2, 2);
+	test_assert(test_pool_get_conn_idx(0) == 1);
+	/* ties prefer the earlier connection */
+	test_pool_queue(1, 1);
+	test_assert(test_pool_get_conn_idx(0) == 0);
+
+	test_pool_deinit();
+	test_end();
+}
+
+void test_db_ldap(void)
+{
+	test_db_ldap_pool_get_conn();
+}
+
+#endif
@@ -0,0 +1,169 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-auth.h"
+
+#if defined(PASSDB_SQL) || defined(USERDB_SQL)
+#include "array.h"
+#include "str.h"
+#include "write-full.h"
+#include "auth-common.h"
+#include "auth-settings.h"
+#include "auth-request.h"
+#include "db-sql.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TEST_SQL_CONFIG_PATH ".test-db-sql.conf"
+#define TEST_SQL_DB_PATH ".test-db-sql.sqlite"
+
+static void test_db_sql_statement_template(void)
+{
+	static const struct {
+		const char *query;
+		/* NULL if the query is expanded as text */
+		const char *stmt_query;
+		const char *params;
+	} tests[] = {
+		{ "SELECT password FROM users WHERE username = '%n' AND domain = '%d'",
+		  "SELECT password FROM users WHERE username = ? AND domain = ?",
+		  "%n\t%d" },
+		{ "SELECT password FROM users WHERE userid = '%n@%{domain}'",
+		  "SELECT password FROM users WHERE userid = ?",
+		  "%n@%{domain}" },
+		{ "SELECT password FROM users WHERE userid = '%Lu' AND pct = '100%%'",
+		  "SELECT password FROM users WHERE userid = ? AND pct = ?",
+		  "%Lu\t100%%" },
+		/* quoted strings without variables are kept as they are */
+		{ "SELECT '?' AS x, \"pass word\" FROM users WHERE a = 'it''s' AND u = '%u'",
+		  "SELECT '?' AS x, \"pass word\" FROM users WHERE a = 'it''s' AND u = ?",
+		  "%u" },
+		{ "SELECT home FROM users",
+		  "SELECT home FROM users", "" },
+
+		/* variables outside quoted strings */
+		{ "SELECT password FROM users WHERE uid = %{uid}", NULL, NULL },
+		{ "SELECT password FROM \"%d\" WHERE username = '%n'", NULL, NULL },
+		/* quoted strings that need unescaping */
+		{ "SELECT password FROM users WHERE userid = 'it''s %u'", NULL, NULL },
+		{ "SELECT password FROM users WHERE userid = 'a\\'%u'", NULL, NULL },
+		/* literal placeholder and broken quoting */
+		{ "SELECT password FROM users WHERE userid = ?", NULL, NULL },
+		{ "SELECT password FROM users WHERE userid = '%u", NULL, NULL },
+	};
+	struct db_sql_statement_template tmpl;
+	pool_t pool;
+	unsigned int i;
+
+	test_begin("db-sql statement template");
+	pool = pool_alloconly_create("test db-sql", 1024);
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		db_sql_statement_template_init(pool, tests[i].query, &tmpl);
+		test_assert_strcmp_idx(tmpl.query, tests[i].stmt_query, i);
+		if (tests[i].params != NULL && tmpl.query != NULL) {
+			array_append_zero(&tmpl.params);
+			test_assert_strcmp_idx(t_strarray_join(
+				array_front(&tmpl.params), "\t"),
+				tests[i].params, i);
+		}
+	}
+	pool_unref(&pool);
+	test_end();
+}
+
+#ifdef BUILD_SQLITE
+static struct auth_settings test_db_sql_set = {
+	.master_user_separator = "",
+	.default_domain = "",
+	.username_format = "",
+};
+
+static void test_db_sql_lookup(struct db_sql_connection *conn,
+			       const char *user, const char *password)
+{
+	struct auth_request *request = auth_request_new_dummy(NULL);
+	struct sql_statement *stmt;
+	struct sql_result *result;
+	const char *error;
+
+	request->fields.user = p_strdup(request->pool, user);
+	test_assert(db_sql_statement_init(conn, &conn->password_stmt, request,
+					  &stmt, &error) == 1);
+	result = sql_statement_query_s(&stmt);
+	if (password == NULL)
+		test_assert(sql_result_next_row(result) == SQL_RESULT_NEXT_LAST);
+	else {
+		test_assert(sql_result_next_row(result) == SQL_RESULT_NEXT_OK);
+		test_assert_strcmp(sql_result_find_field_value(result, "password"),
+				   password);
+	}
+	sql_result_unref(result);
+	auth_request_unref(&request);
+}
+
+static void test_db_sql_statement_sqlite(void)
+{
+	const char *config =
+		"driver = sqlite\n"
+		"connect = "TEST_SQL_DB_PATH"\n";
+	struct db_sql_connection *conn;
+	struct auth_request *request;
+	struct sql_statement *stmt;
+	const char *error;
+	int fd;
+
+	test_begin("db-sql statement with sqlite");
+	global_auth_settings = &test_db_sql_set;
+	auth_event = event_create(NULL);
+	sql_drivers_init();
+	sql_drivers_register_all();
+	i_unlink_if_exists(TEST_SQL_DB_PATH);
+	i_unlink_if_exists(TEST_SQL_CONFIG_PATH);
+	fd = open(TEST_SQL_CONFIG_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", TEST_SQL_CONFIG_PATH);
+	if (write_full(fd, config, strlen(config)) < 0)
+		i_fatal("write(%s) failed: %m", TEST_SQL_CONFIG_PATH);
+	i_close_fd(&fd);
+
+	conn = db_sql_init(TEST_SQL_CONFIG_PATH, FALSE);
+	test_assert(conn->password_stmt.query != NULL);
+	sql_exec(conn->db, "CREATE TABLE users "
+		 "(username TEXT, domain TEXT, password TEXT)");
+	sql_exec(conn->db, "INSERT INTO users VALUES "
+		 "('o''brien', 'example.com', '{PLAIN}pass1'), "
+		 "('user', 'example.com', '{PLAIN}pass2')");
+
+	/* the bound values are escaped when the query is sent as text */
+	request = auth_request_new_dummy(NULL);
+	request->fields.user = "o'brien@example.com";
+	test_assert(db_sql_statement_init(conn, &conn->password_stmt, request,
+					  &stmt, &error) == 1);
+	test_assert_strcmp(sql_statement_get_query(stmt),
+		"SELECT username, domain, password FROM users "
+		"WHERE username = 'o''brien' AND domain = 'example.com'");
+	sql_statement_abort(&stmt);
+	auth_request_unref(&request);
+
+	test_db_sql_lookup(conn, "o'brien@example.com", "{PLAIN}pass1");
+	test_db_sql_lookup(conn, "user@example.com", "{PLAIN}pass2");
+	test_db_sql_lookup(conn, "' OR ''='@example.com", NULL);
+
+	db_sql_unref(&conn);
+	sql_drivers_deinit();
+	event_unref(&auth_event);
+	i_unlink(TEST_SQL_CONFIG_PATH);
+	i_unlink(TEST_SQL_DB_PATH);
+	test_end();
+}
+#endif
+
+void test_db_sql(void)
+{
+	test_db_sql_statement_template();
+#ifdef BUILD_SQLITE
+	test_db_sql_statement_sqlite();
+#endif
+}
+
+#endif
@@ -93,6 +93,30 @@ static void test_password_failures(void)
 	test_end();
 }
 
+static void test_password_scheme_is_slow(void)
+{
+	test_begin("password scheme is slow");
+	test_assert(!password_scheme_is_slow("PLAIN", NULL));
+	test_assert(!password_scheme_is_slow("SHA512", NULL));
+	test_assert(!password_scheme_is_slow("SSHA256.HEX", NULL));
+	test_assert(!password_scheme_is_slow("INVALID", NULL));
+	test_assert(password_scheme_is_slow("BLF-CRYPT", NULL));
+	test_assert(password_scheme_is_slow("PBKDF2", NULL));
+	test_assert(password_scheme_is_slow("SCRAM-SHA-256", NULL));
+	test_assert(password_scheme_is_slow("SHA512-CRYPT", NULL));
+	/* generic CRYPT depends on the hash */
+	test_assert(!password_scheme_is_slow("CRYPT", NULL));
+	test_assert(!password_scheme_is_slow("CRYPT", "JBOZ0DgmtucwE"));
+	test_assert(!password_scheme_is_slow("CRYPT", "$1$salt$hash"));
+	test_assert(password_scheme_is_slow("CRYPT", "$2y$05$hash"));
+	test_assert(password_scheme_is_slow("CRYPT", "$6$salt$hash"));
+	test_assert(!password_scheme_is_slow("MD5-CRYPT", "$1$salt$hash"));
+#ifdef HAVE_LIBSODIUM
+	test_assert(password_scheme_is_slow("ARGON2I", NULL));
+#endif
+	test_end();
+}
+
 static void test_password_schemes(void)
 {
 	test_password_scheme("PLAIN", "{PLAIN}test", "test");
@@ -130,6 +154,7 @@ int main(void)
 	static void (*const test_functions[])(void) = {
 		test_password_schemes,
 		test_password_failures,
+		test_password_scheme_is_slow,
 		NULL
 	};
 	password_schemes_init();
@@ -6,6 +6,7 @@
 #include "test-auth.h"
 #include "password-scheme.h"
 #include "passdb.h"
+#include "userdb.h"
 
 int main(int argc, const char *argv[])
 {
@@ -16,14 +17,23 @@ int main(int argc, const char *argv[])
 		TEST_NAMED(test_auth_request_fields)
 		TEST_NAMED(test_db_dict_parse_cache_key)
 		TEST_NAMED(test_username_filter)
+		TEST_NAMED(test_auth_worker_connection)
+		TEST_NAMED(test_passdb_cache)
 #if defined(BUILTIN_LUA)
 		TEST_NAMED(test_db_lua)
+#endif
+#if defined(BUILTIN_LDAP)
+		TEST_NAMED(test_db_ldap)
+#endif
+#if defined(PASSDB_SQL) || defined(USERDB_SQL)
+		TEST_NAMED(test_db_sql)
 #endif
 		{ NULL, NULL }
 	};
 
 	password_schemes_init();
 	passdbs_init();
+	userdbs_init();
 	passdb_mock_mod_init();
 
 	if (argc > 2 && strcasecmp(argv[1], "--match") == 0)
@@ -34,6 +44,7 @@ int main(int argc, const char *argv[])
 	passdb_mock_mod_deinit();
 	password_schemes_deinit();
 	passdbs_deinit();
+	userdbs_deinit();
 
 	return ret;
 }
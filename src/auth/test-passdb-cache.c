@@ -0,0 +1,147 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-auth.h"
+#include "ioloop.h"
+#include "auth-settings.h"
+#include "auth-request.h"
+#include "passdb-cache.h"
+
+#define TEST_VERIFIED_TTL_SECS 60
+#define TEST_VERIFIED_MAX_ENTRIES 10000
+#define TEST_NOW 1000000
+
+static const char *test_crypted = "{BLF-CRYPT}$2y$05$hash1";
+static const char *test_crypted_changed = "{BLF-CRYPT}$2y$05$hash2";
+
+static struct auth_settings test_passdb_cache_set = {
+	.master_user_separator = "",
+	.default_domain = "",
+	.username_format = "",
+};
+
+static struct auth_request *test_request_new(const char *user)
+{
+	struct auth_request *request = auth_request_new_dummy(NULL);
+
+	request->fields.user = p_strdup(request->pool, user);
+	return request;
+}
+
+/* Returns TRUE if the verification was found in the cache. If not, it's
+   added there when add_on_miss is TRUE. */
+static bool
+test_verified(const char *user, const char *crypted, const char *password,
+	      bool add_on_miss)
+{
+	struct auth_request *request = test_request_new(user);
+	unsigned char mac[PASSDB_VERIFIED_MAC_LEN];
+	bool ret;
+
+	ret = passdb_cache_verified_lookup(request, password, crypted, mac);
+	test_assert((request->passdb_verified_cache_result ==
+		     AUTH_REQUEST_CACHE_HIT) == ret);
+	if (!ret && add_on_miss)
+		passdb_cache_verified_add(mac);
+	auth_request_unref(&request);
+	return ret;
+}
+
+static void test_passdb_cache_init(unsigned int verified_ttl_secs)
+{
+	test_passdb_cache_set.cache_verified_password_ttl = verified_ttl_secs;
+	ioloop_time = TEST_NOW;
+	passdb_cache_init(&test_passdb_cache_set);
+}
+
+static void test_passdb_cache_verified(void)
+{
+	test_begin("passdb cache verified password");
+	test_passdb_cache_init(TEST_VERIFIED_TTL_SECS);
+
+	/* first verification misses and is added */
+	test_assert(!test_verified("user", test_crypted, "pass", TRUE));
+	test_assert(test_verified("user", test_crypted, "pass", FALSE));
+	/* a wrong password misses */
+	test_assert(!test_verified("user", test_crypted, "wrong", FALSE));
+	test_assert(!test_verified("user", test_crypted, "pass2", FALSE));
+	/* so does another user with the same hash and password */
+	test_assert(!test_verified("user2", test_crypted, "pass", FALSE));
+	/* a changed password hash invalidates the entry */
+	test_assert(!test_verified("user", test_crypted_changed, "pass",
+				   FALSE));
+	/* ..but the failed lookups didn't affect the original entry */
+	test_assert(test_verified("user", test_crypted, "pass", FALSE));
+
+	passdb_cache_deinit();
+	test_end();
+}
+
+static void test_passdb_cache_verified_expire(void)
+{
+	test_begin("passdb cache verified password expire");
+	test_passdb_cache_init(TEST_VERIFIED_TTL_SECS);
+
+	test_assert(!test_verified("user", test_crypted, "pass", TRUE));
+	ioloop_time = TEST_NOW + TEST_VERIFIED_TTL_SECS;
+	test_assert(test_verified("user", test_crypted, "pass", FALSE));
+	ioloop_time = TEST_NOW + TEST_VERIFIED_TTL_SECS + 1;
+	test_assert(!test_verified("user", test_crypted, "pass", FALSE));
+	/* the expired entry was dropped */
+	ioloop_time = TEST_NOW;
+	test_assert(!test_verified("user", test_crypted, "pass", TRUE));
+	test_assert(test_verified("user", test_crypted, "pass", FALSE));
+
+	passdb_cache_deinit();
+	test_end();
+}
+
+static void test_passdb_cache_verified_max_entries(void)
+{
+	unsigned int i;
+
+	test_begin("passdb cache verified password max entries");
+	test_passdb_cache_init(TEST_VERIFIED_TTL_SECS);
+
+	for (i = 0; i < TEST_VERIFIED_MAX_ENTRIES; i++) T_BEGIN {
+		test_assert_idx(!test_verified(t_strdup_printf("user%u", i),
+					       test_crypted, "pass", TRUE), i);
+	} T_END;
+	test_assert(test_verified("user0", test_crypted, "pass", FALSE));
+	test_assert(test_verified("user1", test_crypted, "pass", FALSE));
+
+	/* the oldest entry is evicted when the cache is full */
+	test_assert(!test_verified("new", test_crypted, "pass", TRUE));
+	test_assert(test_verified("new", test_crypted, "pass", FALSE));
+	test_assert(!test_verified("user0", test_crypted, "pass", FALSE));
+	test_assert(test_verified("user1", test_crypted, "pass", FALSE));
+	test_assert(test_verified(t_strdup_printf("user%u",
+						  TEST_VERIFIED_MAX_ENTRIES - 1),
+				  test_crypted, "pass", FALSE));
+
+	passdb_cache_deinit();
+	test_end();
+}
+
+static void test_passdb_cache_verified_disabled(void)
+{
+	test_begin("passdb cache verified password disabled");
+	test_passdb_cache_init(0);
+
+	test_assert(!test_verified("user", test_crypted, "pass", TRUE));
+	test_assert(!test_verified("user", test_crypted, "pass", FALSE));
+
+	passdb_cache_deinit();
+	test_end();
+}
+
+void test_passdb_cache(void)
+{
+	time_t orig_ioloop_time = ioloop_time;
+
+	global_auth_settings = &test_passdb_cache_set;
+	test_passdb_cache_verified();
+	test_passdb_cache_verified_expire();
+	test_passdb_cache_verified_max_entries();
+	test_passdb_cache_verified_disabled();
+	ioloop_time = orig_ioloop_time;
+}
@@ -2,6 +2,7 @@
 
 #include "auth-common.h"
 #include "str.h"
+#include "auth-cache.h"
 #include "auth-worker-connection.h"
 #include "userdb.h"
 #include "userdb-blocking.h"
@@ -62,15 +63,26 @@ static bool user_callback(struct auth_worker_connection *conn ATTR_UNUSED,
 
 void userdb_blocking_lookup(struct auth_request *request)
 {
+	const char *coalesce_key = NULL;
 	string_t *str;
 
 	str = t_str_new(128);
 	str_printfa(str, "USER\t%u\t", request->userdb->userdb->id);
 	auth_request_export(request, str);
 
+	/* identical lookups can share the reply. The cache key contains
+	   everything that the lookup result depends on. */
+	if (request->userdb->cache_key != NULL) {
+		coalesce_key = t_strconcat("USER\t",
+			auth_request_expand_cache_key(request,
+				request->userdb->cache_key,
+				request->fields.translated_username), NULL);
+	}
+
 	auth_request_ref(request);
-	auth_worker_call(request->pool, request->fields.user,
-			 str_c(str), user_callback, request);
+	auth_worker_call_coalesced(request->pool, request->fields.user,
+				   coalesce_key, str_c(str),
+				   user_callback, request);
 }
 
 static bool iter_callback(struct auth_worker_connection *conn,
@@ -104,12 +104,22 @@ static void userdb_sql_lookup(struct auth_request *auth_request,
 	struct userdb_module *_module = auth_request->userdb->userdb;
 	struct sql_userdb_module *module =
 		(struct sql_userdb_module *)_module;
+	struct db_sql_connection *conn = module->conn;
 	struct userdb_sql_request *sql_request;
-	const char *query, *error;
+	struct sql_statement *stmt = NULL;
+	const char *query = NULL, *error;
+	int ret;
 
-	if (t_auth_request_var_expand(module->conn->set.user_query,
-				      auth_request, userdb_sql_escape,
-				      &query, &error) <= 0) {
+	if (conn->user_stmt.query != NULL) {
+		ret = db_sql_statement_init(conn, &conn->user_stmt,
+					    auth_request, &stmt, &error);
+	} else {
+		ret = t_auth_request_var_expand(conn->set.user_query,
+						auth_request,
+						userdb_sql_escape,
+						&query, &error);
+	}
+	if (ret <= 0) {
 		e_error(authdb_event(auth_request),
 			"Failed to expand user_query=%s: %s",
 			module->conn->set.user_query, error);
@@ -122,10 +132,13 @@ static void userdb_sql_lookup(struct auth_request *auth_request,
 	sql_request->callback = callback;
 	sql_request->auth_request = auth_request;
 
-	e_debug(authdb_event(auth_request), "%s", query);
+	e_debug(authdb_event(auth_request), "%s",
+		stmt != NULL ? sql_statement_get_query(stmt) : query);
 
-	sql_query(module->conn->db, query,
-		  sql_query_callback, sql_request);
+	if (stmt != NULL)
+		sql_statement_query(&stmt, sql_query_callback, sql_request);
+	else
+		sql_query(conn->db, query, sql_query_callback, sql_request);
 }
 
 static void sql_iter_query_callback(struct sql_result *sql_result,
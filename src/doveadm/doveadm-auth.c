@@ -24,6 +24,7 @@
 
 #include <stdio.h>
 #include <unistd.h>
+#include <signal.h>
 
 static struct event_category event_category_auth = {
 	.name = "auth",
@@ -327,12 +328,31 @@ cmd_user_list(struct auth_master_connection *conn,
 		i_fatal("user listing failed");
 }
 
-static void cmd_auth_cache_flush(struct doveadm_cmd_context *cctx)
+static int
+cmd_auth_cache_flush_socket(struct doveadm_cmd_context *cctx,
+			    const char *master_socket_path,
+			    const char *const *users, unsigned int *count_r)
 {
-	const char *master_socket_path;
 	struct auth_master_connection *conn;
+	int ret = 0;
+
+	conn = doveadm_get_auth_master_conn(master_socket_path);
+	if (auth_master_cache_flush(conn, users, count_r) < 0) {
+		e_error(cctx->event, "Cache flush failed");
+		doveadm_exit_code = EX_TEMPFAIL;
+		ret = -1;
+	}
+	auth_master_deinit(&conn);
+	return ret;
+}
+
+static void cmd_auth_cache_flush(struct doveadm_cmd_context *cctx)
+{
+	const char *master_socket_path, *error;
 	const char *const *users = NULL;
-	unsigned int count;
+	ARRAY_TYPE(uint) pids;
+	unsigned int pid, count, total_count = 0, socket_count = 0;
+	int ret = 0;
 
 	if (!doveadm_cmd_param_str(cctx, "socket-path", &master_socket_path)) {
 		master_socket_path = t_strconcat(doveadm_settings->base_dir,
@@ -340,14 +360,32 @@ static void cmd_auth_cache_flush(struct doveadm_cmd_context *cctx)
 	}
 	(void)doveadm_cmd_param_array(cctx, "user", &users);
 
-	conn = doveadm_get_auth_master_conn(master_socket_path);
-	if (auth_master_cache_flush(conn, users, &count) < 0) {
-		e_error(cctx->event, "Cache flush failed");
-		doveadm_exit_code = EX_TEMPFAIL;
-	} else {
-		printf("%u cache entries flushed\n", count);
+	/* With multiple auth processes each one has its own cache. Flush
+	   them all via their own sockets. */
+	t_array_init(&pids, 8);
+	if (auth_master_find_pid_sockets(master_socket_path, &pids,
+					 &error) < 0)
+		e_error(cctx->event, "%s", error);
+	array_foreach_elem(&pids, pid) {
+		if (kill((pid_t)pid, 0) < 0 && errno == ESRCH) {
+			/* left behind by a process that no longer exists */
+			continue;
+		}
+		socket_count++;
+		if (cmd_auth_cache_flush_socket(cctx,
+				auth_master_get_pid_socket_path(
+					master_socket_path, pid),
+				users, &count) < 0)
+			ret = -1;
+		else
+			total_count += count;
 	}
-	auth_master_deinit(&conn);
+	if (socket_count == 0) {
+		ret = cmd_auth_cache_flush_socket(cctx, master_socket_path,
+						  users, &total_count);
+	}
+	if (ret == 0)
+		printf("%u cache entries flushed\n", total_count);
 }
 
 static void authtest_input_init(struct authtest_input *input)
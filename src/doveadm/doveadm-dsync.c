@@ -50,6 +50,10 @@
 #define DSYNC_LIST_VNAME_ALT_ESCAPE_CHAR '~'
 
 #define DSYNC_DEFAULT_IO_STREAM_TIMEOUT_SECS (60*10)
+/* Maximum number of parallel connections allowed with -j. Each one is a
+   separate remote process, so keep this small. Update DSYNC_COMMON_USAGE
+   if changed. */
+#define DSYNC_MAX_PARALLEL 64
 
 enum dsync_run_type {
 	DSYNC_RUN_TYPE_LOCAL,
@@ -97,6 +101,11 @@ struct dsync_cmd_context {
 
 	unsigned int lock_timeout;
 	unsigned int import_commit_msgs_interval;
+	/* Number of parallel connections to use for syncing mails */
+	unsigned int parallel;
+	/* The lock taken by the mailbox tree sync with -j. It's kept until
+	   all the partitions have finished. */
+	struct dsync_brain_lock *tree_lock;
 
 	bool lock:1;
 	bool purge_remote:1;
@@ -174,35 +183,39 @@ static void remote_error_input(struct dsync_cmd_context *ctx)
 	}
 }
 
-static void
-run_cmd(struct dsync_cmd_context *ctx, const char *const *args)
+static pid_t
+run_cmd_fork(struct dsync_cmd_context *ctx, const char *const *args,
+	     int *fd_in_r, int *fd_out_r, int *fd_err_r)
 {
 	struct doveadm_cmd_context *cctx = ctx->ctx.cctx;
-	int fd_in[2], fd_out[2], fd_err[2];
-
-	ctx->remote_cmd_args = p_strarray_dup(ctx->ctx.pool, args);
+	int fd_in[2], fd_out[2], fd_err[2] = { -1, -1 };
+	pid_t pid;
 
-	if (pipe(fd_in) < 0 || pipe(fd_out) < 0 || pipe(fd_err) < 0)
+	if (pipe(fd_in) < 0 || pipe(fd_out) < 0 ||
+	    (fd_err_r != NULL && pipe(fd_err) < 0))
 		i_fatal("pipe() failed: %m");
 
-	ctx->remote_pid = fork();
-	switch (ctx->remote_pid) {
+	pid = fork();
+	switch (pid) {
 	case -1:
 		i_fatal("fork() failed: %m");
 	case 0:
 		/* child, which will execute the proxy server. stdin/stdout
-		   goes to pipes which we'll pass to proxy client. */
+		   goes to pipes which we'll pass to proxy client. stderr
+		   goes to our stderr unless it's captured. */
 		if (dup2(fd_in[0], STDIN_FILENO) < 0 ||
 		    dup2(fd_out[1], STDOUT_FILENO) < 0 ||
-		    dup2(fd_err[1], STDERR_FILENO) < 0)
+		    (fd_err_r != NULL && dup2(fd_err[1], STDERR_FILENO) < 0))
 			i_fatal("dup2() failed: %m");
 
 		i_close_fd(&fd_in[0]);
 		i_close_fd(&fd_in[1]);
 		i_close_fd(&fd_out[0]);
 		i_close_fd(&fd_out[1]);
-		i_close_fd(&fd_err[0]);
-		i_close_fd(&fd_err[1]);
+		if (fd_err_r != NULL) {
+			i_close_fd(&fd_err[0]);
+			i_close_fd(&fd_err[1]);
+		}
 
 		execvp_const(args[0], args);
 	default:
@@ -212,17 +225,28 @@ run_cmd(struct dsync_cmd_context *ctx, const char *const *args)
 
 	i_close_fd(&fd_in[0]);
 	i_close_fd(&fd_out[1]);
-	i_close_fd(&fd_err[1]);
-	ctx->fd_in = fd_out[0];
-	ctx->fd_out = fd_in[1];
-	ctx->fd_err = fd_err[0];
+	*fd_in_r = fd_out[0];
+	*fd_out_r = fd_in[1];
+	if (fd_err_r != NULL) {
+		i_close_fd(&fd_err[1]);
+		*fd_err_r = fd_err[0];
+	}
 
 	if (ctx->remote_user_prefix) {
 		const char *prefix =
 			t_strdup_printf("%s\n", cctx->username);
-		if (write_full(ctx->fd_out, prefix, strlen(prefix)) < 0)
+		if (write_full(*fd_out_r, prefix, strlen(prefix)) < 0)
 			i_fatal("write(remote out) failed: %m");
 	}
+	return pid;
+}
+
+static void
+run_cmd(struct dsync_cmd_context *ctx, const char *const *args)
+{
+	ctx->remote_cmd_args = p_strarray_dup(ctx->ctx.pool, args);
+	ctx->remote_pid = run_cmd_fork(ctx, args, &ctx->fd_in, &ctx->fd_out,
+				       &ctx->fd_err);
 
 	fd_set_nonblock(ctx->fd_err, TRUE);
 	ctx->err_stream = i_stream_create_fd(ctx->fd_err, IO_BLOCK_SIZE);
@@ -624,7 +648,8 @@ cmd_dsync_ibc_stream_init(struct dsync_cmd_context *ctx,
 					    &ctx->input, &ctx->output);
 	}
 	return dsync_ibc_init_stream(ctx->input, ctx->output,
-				     name, temp_prefix, ctx->io_timeout_secs);
+				     name, temp_prefix, ctx->io_timeout_secs,
+				     doveadm_settings->dsync_compression);
 }
 
 static void
@@ -686,6 +711,360 @@ static void dsync_errors_finish(struct dsync_cmd_context *ctx)
 	i_close_fd(&ctx->fd_err);
 }
 
+struct dsync_cmd_partition {
+	struct dsync_cmd_context *ctx;
+
+	struct dsync_ibc *ibc, *ibc2;
+	struct dsync_brain *brain, *brain2;
+
+	/* remote command */
+	pid_t remote_pid;
+	struct child_wait *child_wait;
+	int fd_in, fd_out;
+	struct istream *input;
+	struct ostream *output;
+	int exit_status;
+
+	/* results after the brains are deinitialized */
+	const char *state, *changes_during_sync;
+	enum mail_error mail_error;
+
+	bool exited:1;
+	bool failed:1;
+};
+
+static void
+cmd_dsync_partition_remote_exited(const struct child_wait_status *status,
+				  struct dsync_cmd_partition *part)
+{
+	part->exited = TRUE;
+	part->exit_status = status->status;
+	io_loop_stop(current_ioloop);
+}
+
+static int
+cmd_dsync_partition_init(struct dsync_cmd_partition *part,
+			 const char *temp_prefix)
+{
+	struct dsync_cmd_context *ctx = part->ctx;
+	struct mail_user *user2;
+	const char *error;
+	int ret;
+
+	switch (ctx->run_type) {
+	case DSYNC_RUN_TYPE_LOCAL:
+		/* mail_location was already changed to point to the
+		   destination by cmd_dsync_run_local() */
+		ret = mail_storage_service_next(ctx->ctx.storage_service,
+						ctx->ctx.cur_service_user,
+						&user2, &error);
+		if (ret < 0) {
+			e_error(ctx->ctx.cctx->event,
+				"Failed to initialize user: %s", error);
+			ctx->ctx.exit_code = ret == -1 ? EX_TEMPFAIL : EX_CONFIG;
+			return -1;
+		}
+		doveadm_user_init_dsync(user2);
+		dsync_ibc_init_pipe(&part->ibc, &part->ibc2);
+		part->brain2 = dsync_brain_slave_init(user2, part->ibc2, TRUE, "",
+			doveadm_settings->dsync_alt_char[0]);
+		mail_user_unref(&user2);
+		break;
+	case DSYNC_RUN_TYPE_CMD:
+		part->remote_pid = run_cmd_fork(ctx, ctx->remote_cmd_args,
+						&part->fd_in, &part->fd_out,
+						NULL);
+		part->child_wait = child_wait_new_with_pid(part->remote_pid,
+			cmd_dsync_partition_remote_exited, part);
+		fd_set_nonblock(part->fd_in, TRUE);
+		fd_set_nonblock(part->fd_out, TRUE);
+		part->input = i_stream_create_fd(part->fd_in, SIZE_MAX);
+		part->output = o_stream_create_fd(part->fd_out, SIZE_MAX);
+		part->ibc = dsync_ibc_init_stream(part->input, part->output,
+						  ctx->remote_name, temp_prefix,
+						  ctx->io_timeout_secs,
+						  doveadm_settings->dsync_compression);
+		break;
+	case DSYNC_RUN_TYPE_STREAM:
+		i_unreached();
+	}
+	return 0;
+}
+
+static void cmd_dsync_partition_deinit(struct dsync_cmd_partition *part)
+{
+	enum mail_error mail_error;
+	bool remote_only_changes;
+	const char *changes;
+
+	if (part->ctx->state_input != NULL) {
+		string_t *state_str = t_str_new(128);
+		dsync_brain_get_state(part->brain, state_str);
+		part->state = str_c(state_str);
+	}
+	changes = dsync_brain_get_unexpected_changes_reason(part->brain,
+							    &remote_only_changes);
+	if (changes == NULL && part->brain2 != NULL) {
+		changes = dsync_brain_get_unexpected_changes_reason(
+			part->brain2, &remote_only_changes);
+	}
+	part->changes_during_sync = t_strdup(changes);
+
+	if (part->brain2 != NULL &&
+	    dsync_brain_deinit(&part->brain2, &mail_error) < 0) {
+		part->mail_error = mail_error;
+		part->failed = TRUE;
+	}
+	if (dsync_brain_deinit(&part->brain, &mail_error) < 0) {
+		part->mail_error = mail_error;
+		part->failed = TRUE;
+	}
+	dsync_ibc_deinit(&part->ibc);
+	if (part->ibc2 != NULL)
+		dsync_ibc_deinit(&part->ibc2);
+	/* closing the pipes makes the remote process exit */
+	i_stream_destroy(&part->input);
+	o_stream_destroy(&part->output);
+	if (part->fd_in != -1) {
+		i_close_fd(&part->fd_out);
+		i_close_fd(&part->fd_in);
+	}
+}
+
+static void cmd_dsync_partitions_run_local(struct dsync_cmd_partition *parts,
+					   unsigned int count)
+{
+	bool running, running1, running2, changed1, changed2;
+	unsigned int i;
+
+	/* the pipe brains don't use ioloop. run each partition a bit at a
+	   time until all of them have finished. */
+	do {
+		running = FALSE;
+		for (i = 0; i < count; i++) {
+			struct dsync_cmd_partition *part = &parts[i];
+
+			if (part->brain == NULL)
+				continue;
+			if (!dsync_brain_has_failed(part->brain) &&
+			    !dsync_brain_has_failed(part->brain2)) {
+				running1 = dsync_brain_run(part->brain, &changed1);
+				running2 = dsync_brain_run(part->brain2, &changed2);
+				if (running1 || running2) {
+					running = TRUE;
+					continue;
+				}
+			}
+			cmd_dsync_partition_deinit(part);
+		}
+	} while (running && !doveadm_is_killed());
+}
+
+static bool cmd_dsync_partition_is_running(struct dsync_cmd_partition *part)
+{
+	/* The ibc closes the input stream if the connection fails. The brain
+	   itself finds that out only when it's deinitialized. */
+	return !dsync_brain_has_finished(part->brain) &&
+		!dsync_brain_has_failed(part->brain) &&
+		!part->input->closed;
+}
+
+static void cmd_dsync_partitions_run_remote(struct dsync_cmd_context *ctx,
+					    struct dsync_cmd_partition *parts,
+					    unsigned int count)
+{
+	unsigned int i, running = count;
+
+	/* Each brain stops the ioloop when it finishes or fails. Deinitialize
+	   them immediately, because their ibcs would keep stopping the ioloop
+	   while the other partitions are still running. */
+	while (running > 0 && !doveadm_is_killed()) {
+		io_loop_run(current_ioloop);
+		/* io_loop_run() deactivates the context - put it back */
+		mail_storage_service_io_activate_user(ctx->ctx.cur_service_user);
+
+		for (i = 0; i < count; i++) {
+			if (parts[i].brain != NULL &&
+			    !cmd_dsync_partition_is_running(&parts[i])) {
+				cmd_dsync_partition_deinit(&parts[i]);
+				running--;
+			}
+		}
+	}
+}
+
+static bool cmd_dsync_partitions_exited(struct dsync_cmd_partition *parts,
+					unsigned int count)
+{
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (!parts[i].exited)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void cmd_dsync_partitions_wait_timeout(bool *timed_out)
+{
+	*timed_out = TRUE;
+	io_loop_stop(current_ioloop);
+}
+
+static void cmd_dsync_partitions_wait_remote(struct dsync_cmd_context *ctx,
+					     struct dsync_cmd_partition *parts,
+					     unsigned int count)
+{
+	struct timeout *to;
+	unsigned int i;
+	bool timed_out = FALSE;
+
+	/* wait in ioloop for the remote processes to die */
+	to = timeout_add(DSYNC_REMOTE_CMD_EXIT_WAIT_SECS*1000,
+			 cmd_dsync_partitions_wait_timeout, &timed_out);
+	while (!timed_out && !cmd_dsync_partitions_exited(parts, count))
+		io_loop_run(current_ioloop);
+	timeout_remove(&to);
+	/* io_loop_run() deactivates the context - put it back */
+	mail_storage_service_io_activate_user(ctx->ctx.cur_service_user);
+
+	for (i = 0; i < count; i++) {
+		struct dsync_cmd_partition *part = &parts[i];
+
+		if (part->exited) {
+			cmd_dsync_log_remote_status(part->exit_status, FALSE,
+						    ctx->remote_cmd_args,
+						    ctx->ctx.cctx->event);
+			continue;
+		}
+		e_error(ctx->ctx.cctx->event,
+			"Remote command process isn't dying, killing it");
+		if (kill(part->remote_pid, SIGKILL) < 0 && errno != ESRCH) {
+			e_error(ctx->ctx.cctx->event,
+				"kill(%ld, SIGKILL) failed: %m",
+				(long)part->remote_pid);
+		}
+	}
+}
+
+static int
+cmd_dsync_run_partitions(struct dsync_cmd_context *ctx, struct mail_user *user,
+			 const struct dsync_brain_settings *main_set,
+			 enum dsync_brain_flags brain_flags,
+			 const char **changes_during_sync_r,
+			 enum mail_error *mail_error_r)
+{
+	struct dsync_cmd_partition *parts;
+	struct dsync_brain_settings set = *main_set;
+	ARRAY_TYPE(const_string) states;
+	string_t *temp_prefix, *state_str;
+	const char *error;
+	unsigned int i, count = ctx->parallel;
+	int ret = 0;
+
+	/* The mailbox tree was already synced by the main brain, and its
+	   lock is still held until all the partitions have finished. The
+	   partitions don't lock: they can't wait for each other, and a lock
+	   taken by one of them in this process would be dropped as soon as
+	   any of them unlocks it. */
+	set.sync_partition_count = count;
+	set.lock_timeout_secs = 0;
+
+	temp_prefix = t_str_new(64);
+	mail_user_set_get_temp_prefix(temp_prefix, user->set);
+
+	parts = t_new(struct dsync_cmd_partition, count);
+	for (i = 0; i < count; i++) {
+		parts[i].ctx = ctx;
+		parts[i].fd_in = parts[i].fd_out = -1;
+		if (cmd_dsync_partition_init(&parts[i],
+					     str_c(temp_prefix)) < 0) {
+			count = i;
+			ret = -1;
+			break;
+		}
+		set.sync_partition_idx = i;
+		parts[i].brain = dsync_brain_master_init(user, parts[i].ibc,
+			ctx->sync_type, brain_flags, &set);
+	}
+
+	if (ret == 0) {
+		e_debug(ctx->ctx.cctx->event,
+			"Syncing mails using %u parallel connections", count);
+		if (ctx->run_type == DSYNC_RUN_TYPE_LOCAL)
+			cmd_dsync_partitions_run_local(parts, count);
+		else
+			cmd_dsync_partitions_run_remote(ctx, parts, count);
+		if (doveadm_is_killed())
+			ret = -1;
+	}
+
+	t_array_init(&states, count + 1);
+	*changes_during_sync_r = NULL;
+	for (i = 0; i < count; i++) {
+		struct dsync_cmd_partition *part = &parts[i];
+
+		if (part->brain != NULL)
+			cmd_dsync_partition_deinit(part);
+		if (part->failed) {
+			*mail_error_r = part->mail_error;
+			ret = -1;
+		}
+		if (part->state != NULL)
+			array_push_back(&states, &part->state);
+		if (*changes_during_sync_r == NULL)
+			*changes_during_sync_r = part->changes_during_sync;
+	}
+	if (ctx->run_type == DSYNC_RUN_TYPE_CMD) {
+		cmd_dsync_partitions_wait_remote(ctx, parts, count);
+		for (i = 0; i < count; i++)
+			child_wait_free(&parts[i].child_wait);
+	}
+
+	if (ctx->state_input != NULL) {
+		array_append_zero(&states);
+		state_str = t_str_new(128);
+		if (ret < 0) {
+			/* some of the partitions didn't finish. the next sync
+			   must be a full sync. */
+		} else if (dsync_brain_join_partition_states(array_front(&states),
+							     state_str, &error) < 0) {
+			/* shouldn't happen - we just created them */
+			e_error(ctx->ctx.cctx->event,
+				"Failed to join sync states: %s", error);
+			str_truncate(state_str, 0);
+		}
+		doveadm_print(str_c(state_str));
+	}
+	return ret;
+}
+
+static void
+cmd_dsync_warn_changes(struct dsync_cmd_context *ctx,
+		       const char *changes_during_sync,
+		       bool remote_only_changes,
+		       const char *changes_during_sync2)
+{
+	struct doveadm_cmd_context *cctx = ctx->ctx.cctx;
+
+	if (changes_during_sync == NULL && changes_during_sync2 == NULL)
+		return;
+
+	/* don't log a warning when running via doveadm server
+	   (e.g. called by replicator) */
+	if (cctx->conn_type == DOVEADM_CONNECTION_TYPE_CLI) {
+		e_warning(cctx->event,
+			  "Mailbox changes caused a desync. "
+			  "You may want to run dsync again: %s",
+			  changes_during_sync == NULL ||
+			  (remote_only_changes && changes_during_sync2 != NULL) ?
+			  changes_during_sync2 : changes_during_sync);
+	}
+	/* a failure exit code is more important */
+	if (ctx->ctx.exit_code == 0)
+		ctx->ctx.exit_code = 2;
+}
+
 static int
 cmd_dsync_run(struct doveadm_mail_cmd_context *_ctx, struct mail_user *user)
 {
@@ -702,7 +1081,7 @@ cmd_dsync_run(struct doveadm_mail_cmd_context *_ctx, struct mail_user *user)
 	enum mail_error mail_error = 0, mail_error2;
 	bool cli = (cctx->conn_type == DOVEADM_CONNECTION_TYPE_CLI);
 	const char *changes_during_sync, *changes_during_sync2 = NULL;
-	bool remote_only_changes;
+	bool remote_only_changes, tree_synced;
 	int ret = 0;
 
 	/* replicator_notify indicates here automated attempt,
@@ -786,8 +1165,6 @@ cmd_dsync_run(struct doveadm_mail_cmd_context *_ctx, struct mail_user *user)
 			brain_flags |= DSYNC_BRAIN_FLAG_BACKUP_SEND;
 	}
 
-	if (ctx->no_mail_sync)
-		brain_flags |= DSYNC_BRAIN_FLAG_NO_MAIL_SYNC;
 	if (ctx->oneway)
 		brain_flags |= DSYNC_BRAIN_FLAG_NO_BACKUP_OVERWRITE;
 	if (ctx->empty_hdr_workaround)
@@ -797,6 +1174,18 @@ cmd_dsync_run(struct doveadm_mail_cmd_context *_ctx, struct mail_user *user)
 	if (doveadm_debug)
 		brain_flags |= DSYNC_BRAIN_FLAG_DEBUG;
 
+	if (ctx->no_mail_sync)
+		brain_flags |= DSYNC_BRAIN_FLAG_NO_MAIL_SYNC;
+	else if (ctx->parallel > 1) {
+		/* The main brain syncs only the mailbox tree and the mails
+		   are synced afterwards by the partition brains. Don't use
+		   DSYNC_BRAIN_FLAG_NO_MAIL_SYNC, because the mailboxes
+		   (especially the autocreated INBOX) must be created with
+		   the correct GUIDs before the partitions start. */
+		set.sync_partition_count = ctx->parallel;
+		set.sync_partition_idx = ctx->parallel;
+	}
+
 	child_wait_init();
 	brain = dsync_brain_master_init(user, ibc, ctx->sync_type,
 					brain_flags, &set);
@@ -818,26 +1207,23 @@ cmd_dsync_run(struct doveadm_mail_cmd_context *_ctx, struct mail_user *user)
 		break;
 	}
 
-	if (ctx->state_input != NULL) {
+	/* With parallel syncing the mails are synced only after the mailbox
+	   tree has been fully synced and the main connection is closed. */
+	tree_synced = ctx->parallel > 1 && ret == 0 &&
+		!dsync_brain_has_failed(brain) &&
+		dsync_brain_has_finished(brain);
+
+	if (ctx->state_input != NULL && ctx->parallel <= 1) {
 		string_t *state_str = t_str_new(128);
 		dsync_brain_get_state(brain, state_str);
 		doveadm_print(str_c(state_str));
 	}
 
-	changes_during_sync = dsync_brain_get_unexpected_changes_reason(brain, &remote_only_changes);
-	if (changes_during_sync != NULL || changes_during_sync2 != NULL) {
-		/* don't log a warning when running via doveadm server
-		   (e.g. called by replicator) */
-		if (cctx->conn_type == DOVEADM_CONNECTION_TYPE_CLI) {
-			e_warning(cctx->event,
-			 	  "Mailbox changes caused a desync. "
-				  "You may want to run dsync again: %s",
-				  changes_during_sync == NULL ||
-				  (remote_only_changes && changes_during_sync2 != NULL) ?
-				  changes_during_sync2 : changes_during_sync);
-		}
-		ctx->ctx.exit_code = 2;
-	}
+	changes_during_sync = t_strdup(
+		dsync_brain_get_unexpected_changes_reason(brain,
+							  &remote_only_changes));
+	if (tree_synced)
+		ctx->tree_lock = dsync_brain_take_lock(brain);
 	if (dsync_brain_deinit(&brain, &mail_error2) < 0)
 		ret = -1;
 	if (ret < 0) {
@@ -877,6 +1263,24 @@ cmd_dsync_run(struct doveadm_mail_cmd_context *_ctx, struct mail_user *user)
 		cmd_dsync_wait_remote(ctx);
 	dsync_errors_finish(ctx);
 
+	if (tree_synced && ret == 0) {
+		const char *changes_during_sync3;
+
+		mail_error = 0;
+		if (cmd_dsync_run_partitions(ctx, user, &set, brain_flags,
+					     &changes_during_sync3,
+					     &mail_error) < 0) {
+			ret = -1;
+			if (mail_error != 0)
+				doveadm_mail_failed_error(&ctx->ctx, mail_error);
+		}
+		if (changes_during_sync2 == NULL)
+			changes_during_sync2 = changes_during_sync3;
+	}
+	dsync_brain_lock_free(&ctx->tree_lock);
+	cmd_dsync_warn_changes(ctx, changes_during_sync, remote_only_changes,
+			       changes_during_sync2);
+
 	if (ctx->child_wait != NULL)
 		child_wait_free(&ctx->child_wait);
 	child_wait_deinit();
@@ -1125,6 +1529,8 @@ static int cmd_dsync_prerun(struct doveadm_mail_cmd_context *_ctx,
 	if (ctx->sync_visible_namespaces &&
 	    ctx->run_type == DSYNC_RUN_TYPE_LOCAL)
 		i_fatal("-N parameter requires syncing with remote host");
+	if (ctx->parallel > 1 && ctx->run_type == DSYNC_RUN_TYPE_STREAM)
+		i_fatal("-j parameter isn't supported with tcp destinations");
 	return 0;
 }
 
@@ -1144,6 +1550,12 @@ static void cmd_dsync_init(struct doveadm_mail_cmd_context *_ctx)
 	}
 	if (array_count(&ctx->exclude_mailboxes) > 0)
 		array_append_zero(&ctx->exclude_mailboxes);
+	if (ctx->parallel > 1 &&
+	    (ctx->no_mail_sync || ctx->mailbox != NULL ||
+	     !guid_128_is_empty(ctx->mailbox_guid))) {
+		/* syncing only a single mailbox or no mails at all */
+		ctx->parallel = 1;
+	}
 
 	lib_signals_ignore(SIGHUP, TRUE);
 }
@@ -1190,6 +1602,11 @@ static void cmd_dsync_preinit(struct doveadm_mail_cmd_context *_ctx)
 
 	ctx->lock = doveadm_cmd_param_uint32(
 		cctx, "lock-timeout", &ctx->lock_timeout);
+	if (doveadm_cmd_param_uint32(cctx, "parallel", &ctx->parallel) &&
+	    ctx->parallel > DSYNC_MAX_PARALLEL) {
+		i_fatal("Invalid -j parameter: %u (max %u)",
+			ctx->parallel, DSYNC_MAX_PARALLEL);
+	}
 	if (doveadm_cmd_param_str(cctx, "mailbox", &value_str)) {
 		if (*value_str == '\0')
 			ctx->no_mail_sync = TRUE;
@@ -1392,6 +1809,7 @@ DOVEADM_CMD_PARAM('P', "purge-remote", CMD_PARAM_BOOL, 0) \
 DOVEADM_CMD_PARAM('R', "reverse-sync", CMD_PARAM_BOOL, 0) \
 DOVEADM_CMD_PARAM('U', "replicator-notify", CMD_PARAM_BOOL, 0) \
 DOVEADM_CMD_PARAM('l', "lock-timeout", CMD_PARAM_INT64, CMD_PARAM_FLAG_UNSIGNED) \
+DOVEADM_CMD_PARAM('j', "parallel", CMD_PARAM_INT64, CMD_PARAM_FLAG_UNSIGNED) \
 DOVEADM_CMD_PARAM('r', "rawlog", CMD_PARAM_STR, 0) \
 DOVEADM_CMD_PARAM('m', "mailbox", CMD_PARAM_STR, 0) \
 DOVEADM_CMD_PARAM('g', "mailbox-guid", CMD_PARAM_STR, 0) \
@@ -1410,7 +1828,7 @@ DOVEADM_CMD_PARAM('E', "legacy-dsync", CMD_PARAM_BOOL, 0) \
 DOVEADM_CMD_PARAM('\0', "destination", CMD_PARAM_ARRAY, CMD_PARAM_FLAG_POSITIONAL)
 
 #define DSYNC_COMMON_USAGE \
-	"[-l <secs>] [-r <rawlog path>] " \
+	"[-l <secs>] [-j <parallel, max 64>] [-r <rawlog path>] " \
 	"[-m <mailbox>] [-g <mailbox guid>] [-n <namespace> | -N] " \
 	"[-x <exclude>] [-a <all mailbox>] [-s <state>] [-T <secs>] " \
 	"[-t <start date>] [-e <end date>] [-O <sync flag>] [-I <max size>] " \
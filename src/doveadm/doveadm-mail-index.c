@@ -24,21 +24,70 @@ struct index_cmd_context {
 	struct istream *queue_input;
 	struct ostream *queue_output;
 	unsigned int max_recent_msgs;
+	unsigned int batch_size;
 	bool queue:1;
 	bool have_wildcards:1;
 };
 
-static int cmd_index_box_precache(struct doveadm_mail_cmd_context *dctx,
-				  struct mailbox *box)
+static int
+cmd_index_box_precache_range(struct index_cmd_context *ctx,
+			     struct mailbox *box,
+			     const struct mailbox_metadata *metadata,
+			     uint32_t seq1, uint32_t seq2,
+			     unsigned int *counter, unsigned int max)
 {
+	struct doveadm_mail_cmd_context *dctx = &ctx->ctx;
 	struct event *event = dctx->cctx->event;
-	struct mailbox_status status;
 	struct mailbox_transaction_context *trans;
 	struct mail_search_args *search_args;
-	struct mail_search_context *ctx;
+	struct mail_search_context *search_ctx;
 	struct mail *mail;
+	int ret = 0;
+
+	trans = mailbox_transaction_begin(box, MAILBOX_TRANSACTION_FLAG_NO_CACHE_DEC |
+					  dctx->transaction_flags, __func__);
+	search_args = mail_search_build_init();
+	mail_search_build_add_seqset(search_args, seq1, seq2);
+	search_ctx = mailbox_search_init(trans, search_args, NULL,
+					 metadata->precache_fields, NULL);
+	mail_search_args_unref(&search_args);
+
+	while (mailbox_search_next(search_ctx, &mail)) {
+		if (mail_precache(mail) < 0) {
+			e_error(event,
+				"Mailbox %s: Precache for UID=%u failed: %s",
+				mailbox_get_vname(box), mail->uid,
+				mailbox_get_last_internal_error(box, NULL));
+			ret = -1;
+			break;
+		}
+		if (doveadm_verbose && ++(*counter) % 100 == 0) {
+			printf("\r%u/%u", *counter, max);
+			fflush(stdout);
+		}
+	}
+	if (mailbox_search_deinit(&search_ctx) < 0) {
+		e_error(event, "Mailbox %s: Mail search failed: %s",
+			mailbox_get_vname(box),
+			mailbox_get_last_internal_error(box, NULL));
+		ret = -1;
+	}
+	if (mailbox_transaction_commit(&trans) < 0) {
+		e_error(event, "Mailbox %s: Transaction commit failed: %s",
+			mailbox_get_vname(box),
+			mailbox_get_last_internal_error(box, NULL));
+		ret = -1;
+	}
+	return ret;
+}
+
+static int cmd_index_box_precache(struct index_cmd_context *ctx,
+				  struct mailbox *box)
+{
+	struct event *event = ctx->ctx.cctx->event;
+	struct mailbox_status status;
 	struct mailbox_metadata metadata;
-	uint32_t seq;
+	uint32_t seq, seq2;
 	unsigned int counter = 0, max;
 	int ret = 0;
 
@@ -69,43 +118,22 @@ static int cmd_index_box_precache(struct doveadm_mail_cmd_context *dctx,
 		       mailbox_get_vname(box), seq, status.messages);
 	}
 
-	trans = mailbox_transaction_begin(box, MAILBOX_TRANSACTION_FLAG_NO_CACHE_DEC |
-					  dctx->transaction_flags, __func__);
-	search_args = mail_search_build_init();
-	mail_search_build_add_seqset(search_args, seq, status.messages);
-	ctx = mailbox_search_init(trans, search_args, NULL,
-				  metadata.precache_fields, NULL);
-	mail_search_args_unref(&search_args);
-
+	/* With a batch size each batch is committed separately. This way
+	   an interrupted backfill of a large mailbox doesn't lose the mails
+	   that were already cached, and the cached fields (e.g. snippets)
+	   become visible to the other sessions while it's running. The
+	   sequences stay the same, because the mailbox isn't synced in
+	   between. */
 	max = status.messages - seq + 1;
-	while (mailbox_search_next(ctx, &mail)) {
-		if (mail_precache(mail) < 0) {
-			e_error(event,
-				"Mailbox %s: Precache for UID=%u failed: %s",
-				mailbox_get_vname(box), mail->uid,
-				mailbox_get_last_internal_error(box, NULL));
-			ret = -1;
-			break;
-		}
-		if (doveadm_verbose && ++counter % 100 == 0) {
-			printf("\r%u/%u", counter, max);
-			fflush(stdout);
-		}
+	for (; seq <= status.messages && ret == 0; seq = seq2 + 1) {
+		seq2 = ctx->batch_size == 0 ||
+			status.messages - seq < ctx->batch_size ?
+			status.messages : seq + ctx->batch_size - 1;
+		ret = cmd_index_box_precache_range(ctx, box, &metadata,
+						   seq, seq2, &counter, max);
 	}
 	if (doveadm_verbose)
 		printf("\r%u/%u\n", counter, max);
-	if (mailbox_search_deinit(&ctx) < 0) {
-		e_error(event, "Mailbox %s: Mail search failed: %s",
-			mailbox_get_vname(box),
-			mailbox_get_last_internal_error(box, NULL));
-		ret = -1;
-	}
-	if (mailbox_transaction_commit(&trans) < 0) {
-		e_error(event, "Mailbox %s: Transaction commit failed: %s",
-			mailbox_get_vname(box),
-			mailbox_get_last_internal_error(box, NULL));
-		ret = -1;
-	}
 	return ret;
 }
 
@@ -145,7 +173,7 @@ cmd_index_box(struct index_cmd_context *ctx, const struct mailbox_info *info)
 		doveadm_mail_failed_mailbox(&ctx->ctx, box);
 		ret = -1;
 	} else {
-		if (cmd_index_box_precache(&ctx->ctx, box) < 0) {
+		if (cmd_index_box_precache(ctx, box) < 0) {
 			doveadm_mail_failed_mailbox(&ctx->ctx, box);
 			ret = -1;
 		}
@@ -255,6 +283,7 @@ static void cmd_index_init(struct doveadm_mail_cmd_context *_ctx)
 
 	ctx->queue = doveadm_cmd_param_flag(cctx, "queue");
 	(void)doveadm_cmd_param_uint32(cctx, "max-recent", &ctx->max_recent_msgs);
+	(void)doveadm_cmd_param_uint32(cctx, "batch-size", &ctx->batch_size);
 
 	if (!doveadm_cmd_param_array(cctx, "mailbox-mask", &ctx->mailboxes))
 		doveadm_mail_help_name("index");
@@ -288,12 +317,13 @@ static struct doveadm_mail_cmd_context *cmd_index_alloc(void)
 
 struct doveadm_cmd_ver2 doveadm_cmd_index_ver2 = {
 	.name = "index",
-	.usage = DOVEADM_CMD_MAIL_USAGE_PREFIX"[-q] [-n <max recent>] <mailbox mask>",
+	.usage = DOVEADM_CMD_MAIL_USAGE_PREFIX"[-q] [-n <max recent>] [-b <batch size>] <mailbox mask>",
 	.mail_cmd = cmd_index_alloc,
 DOVEADM_CMD_PARAMS_START
 DOVEADM_CMD_MAIL_COMMON
 DOVEADM_CMD_PARAM('q',"queue",CMD_PARAM_BOOL,0)
 DOVEADM_CMD_PARAM('n',"max-recent",CMD_PARAM_INT64,CMD_PARAM_FLAG_UNSIGNED)
+DOVEADM_CMD_PARAM('b',"batch-size",CMD_PARAM_INT64,CMD_PARAM_FLAG_UNSIGNED)
 DOVEADM_CMD_PARAM('\0',"mailbox-mask",CMD_PARAM_ARRAY,CMD_PARAM_FLAG_POSITIONAL)
 DOVEADM_CMD_PARAMS_END
 };
@@ -84,6 +84,7 @@ static const struct setting_define doveadm_setting_defines[] = {
 	DEF(UINT, dsync_commit_msgs_interval),
 	DEF(STR, doveadm_http_rawlog_dir),
 	DEF(STR, dsync_hashed_headers),
+	DEF(STR, dsync_compression),
 
 	{ .type = SET_STRLIST, .key = "plugin",
 	  .offset = offsetof(struct doveadm_settings, plugin_envs) },
@@ -110,6 +111,7 @@ const struct doveadm_settings doveadm_default_settings = {
 	.dsync_remote_cmd = "ssh -l%{login} %{host} doveadm dsync-server -u%u -U",
 	.dsync_features = "",
 	.dsync_hashed_headers = "Date Message-ID",
+	.dsync_compression = "zstd lz4 deflate",
 	.dsync_commit_msgs_interval = 100,
 	.doveadm_api_key = "",
 	.doveadm_http_rawlog_dir = "",
@@ -495,7 +495,8 @@ dsync_brain_try_next_mailbox(struct dsync_brain *brain, struct mailbox **box_r,
 
 	while (dsync_mailbox_tree_iter_next(brain->local_tree_iter, &vname, &node)) {
 		if (node->existence == DSYNC_MAILBOX_NODE_EXISTS &&
-		    !guid_128_is_empty(node->mailbox_guid))
+		    !guid_128_is_empty(node->mailbox_guid) &&
+		    dsync_brain_want_mailbox_guid(brain, node->mailbox_guid))
 			break;
 		vname = NULL;
 	}
@@ -67,6 +67,7 @@ struct dsync_brain {
 	char alt_char;
 	unsigned int import_commit_msgs_interval;
 	unsigned int hdr_hash_version;
+	unsigned int sync_partition_count, sync_partition_idx;
 
 	unsigned int lock_timeout;
 	int lock_fd;
@@ -130,6 +131,9 @@ struct dsync_brain {
 
 extern const char *dsync_box_state_names[DSYNC_BOX_STATE_DONE+1];
 
+bool dsync_brain_want_mailbox_guid(struct dsync_brain *brain,
+				   const guid_128_t guid);
+
 void dsync_brain_mailbox_trees_init(struct dsync_brain *brain);
 void dsync_brain_send_mailbox_tree(struct dsync_brain *brain);
 void dsync_brain_send_mailbox_tree_deletes(struct dsync_brain *brain);
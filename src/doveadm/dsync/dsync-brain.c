@@ -240,6 +240,11 @@ dsync_brain_master_init(struct mail_user *user, struct dsync_ibc *ibc,
 		brain->mailbox_lock_timeout_secs =
 			DSYNC_MAILBOX_DEFAULT_LOCK_TIMEOUT_SECS;
 	brain->import_commit_msgs_interval = set->import_commit_msgs_interval;
+	if (set->sync_partition_count > 1) {
+		i_assert(set->sync_partition_idx <= set->sync_partition_count);
+		brain->sync_partition_count = set->sync_partition_count;
+		brain->sync_partition_idx = set->sync_partition_idx;
+	}
 	brain->hashed_headers =
 		(const char*const*)p_strarray_dup(brain->pool, set->hashed_headers);
 	dsync_brain_set_flags(brain, flags);
@@ -349,6 +354,44 @@ static void dsync_brain_purge(struct dsync_brain *brain)
 	}
 }
 
+struct dsync_brain_lock {
+	char *path;
+	int fd;
+	struct file_lock *lock;
+};
+
+struct dsync_brain_lock *dsync_brain_take_lock(struct dsync_brain *brain)
+{
+	struct dsync_brain_lock *lock;
+
+	if (brain->lock_fd == -1)
+		return NULL;
+
+	lock = i_new(struct dsync_brain_lock, 1);
+	lock->path = i_strdup(brain->lock_path);
+	lock->fd = brain->lock_fd;
+	lock->lock = brain->lock;
+	brain->lock_fd = -1;
+	brain->lock = NULL;
+	return lock;
+}
+
+void dsync_brain_lock_free(struct dsync_brain_lock **_lock)
+{
+	struct dsync_brain_lock *lock = *_lock;
+
+	if (lock == NULL)
+		return;
+	*_lock = NULL;
+
+	/* unlink the lock file before it gets unlocked */
+	i_unlink(lock->path);
+	file_lock_free(&lock->lock);
+	i_close_fd(&lock->fd);
+	i_free(lock->path);
+	i_free(lock);
+}
+
 int dsync_brain_deinit(struct dsync_brain **_brain, enum mail_error *error_r)
 {
 	struct dsync_brain *brain = *_brain;
@@ -800,7 +843,8 @@ void dsync_brain_get_state(struct dsync_brain *brain, string_t *output)
 			dsync_mailbox_state_add(brain, new_state);
 	}
 
-	/* remove nonexistent mailboxes */
+	/* remove nonexistent mailboxes, and with partitioned sync the
+	   mailboxes that belong to the other partitions */
 	iter = hash_table_iterate_init(brain->mailbox_states);
 	while (hash_table_iterate(iter, brain->mailbox_states, &guid, &state)) {
 		node = dsync_mailbox_tree_lookup_guid(brain->local_mailbox_tree,
@@ -811,6 +855,8 @@ void dsync_brain_get_state(struct dsync_brain *brain, string_t *output)
 				"Removed state for deleted mailbox %s",
 				guid_128_to_string(guid));
 			hash_table_remove(brain->mailbox_states, guid);
+		} else if (!dsync_brain_want_mailbox_guid(brain, guid)) {
+			hash_table_remove(brain->mailbox_states, guid);
 		}
 	}
 	hash_table_iterate_deinit(&iter);
@@ -830,6 +876,49 @@ bool dsync_brain_has_failed(struct dsync_brain *brain)
 	return brain->failed;
 }
 
+bool dsync_brain_has_finished(struct dsync_brain *brain)
+{
+	return brain->state == DSYNC_STATE_DONE;
+}
+
+bool dsync_brain_want_mailbox_guid(struct dsync_brain *brain,
+				   const guid_128_t guid)
+{
+	if (brain->sync_partition_count <= 1)
+		return TRUE;
+	return guid_128_hash(guid) % brain->sync_partition_count ==
+		brain->sync_partition_idx;
+}
+
+int dsync_brain_join_partition_states(const char *const *states,
+				      string_t *output, const char **error_r)
+{
+	HASH_TABLE_TYPE(dsync_mailbox_state) joined;
+	pool_t pool;
+	unsigned int i;
+	int ret = 0;
+
+	for (i = 0; states[i] != NULL; i++) {
+		if (states[i][0] == '\0') {
+			/* full resync required */
+			return 0;
+		}
+	}
+
+	pool = pool_alloconly_create("dsync joined states", 1024);
+	hash_table_create(&joined, pool, 0, guid_128_hash, guid_128_cmp);
+	for (i = 0; states[i] != NULL && ret == 0; i++) {
+		/* the partitions have no mailboxes in common */
+		ret = dsync_mailbox_states_import(joined, pool, states[i],
+						  error_r);
+	}
+	if (ret == 0)
+		dsync_mailbox_states_export(joined, output);
+	hash_table_destroy(&joined);
+	pool_unref(&pool);
+	return ret;
+}
+
 const char *dsync_brain_get_unexpected_changes_reason(struct dsync_brain *brain,
 						      bool *remote_only_r)
 {
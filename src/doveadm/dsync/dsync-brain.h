@@ -9,6 +9,7 @@
 struct mail_namespace;
 struct mail_user;
 struct dsync_ibc;
+struct dsync_brain_lock;
 
 enum dsync_brain_flags {
 	DSYNC_BRAIN_FLAG_SEND_MAIL_REQUESTS	= 0x01,
@@ -91,6 +92,17 @@ struct dsync_brain_settings {
 	unsigned int import_commit_msgs_interval;
 	/* Input state for DSYNC_BRAIN_SYNC_TYPE_STATE */
 	const char *state;
+
+	/* If sync_partition_count > 1, sync mails only in the mailboxes that
+	   belong to partition sync_partition_idx. The mailboxes are split
+	   into partitions by their GUIDs, so multiple brains can sync
+	   different mailboxes of the same user in parallel. The mailbox tree
+	   should have already been synced, since all the brains still sync
+	   it. The exported state contains only the partition's mailboxes.
+	   sync_partition_idx == sync_partition_count selects none of the
+	   mailboxes, which can be used to sync the mailbox tree first. */
+	unsigned int sync_partition_count;
+	unsigned int sync_partition_idx;
 };
 
 #define DSYNC_LIST_CONTEXT(obj) \
@@ -119,9 +131,22 @@ int dsync_brain_deinit(struct dsync_brain **brain, enum mail_error *error_r);
 bool dsync_brain_run(struct dsync_brain *brain, bool *changed_r);
 /* Returns TRUE if brain has failed, and there's no point in continuing. */
 bool dsync_brain_has_failed(struct dsync_brain *brain);
+/* Returns TRUE if brain has finished syncing. */
+bool dsync_brain_has_finished(struct dsync_brain *brain);
+/* Take over the brain's user lock, so that it's kept after the brain is
+   deinitialized. Returns NULL if the brain isn't locked. */
+struct dsync_brain_lock *dsync_brain_take_lock(struct dsync_brain *brain);
+/* Unlock and free the lock returned by dsync_brain_take_lock(). */
+void dsync_brain_lock_free(struct dsync_brain_lock **lock);
 /* Returns the current sync state string, which can be given as parameter to
    dsync_brain_master_init() to quickly sync only the new changes. */
 void dsync_brain_get_state(struct dsync_brain *brain, string_t *output);
+/* Join the states returned by dsync_brain_get_state() for each sync
+   partition into a single state. Returns 0 on success, -1 if any of the
+   states is invalid. An empty state in input results in an empty output
+   state, since it means a full resync is required. */
+int dsync_brain_join_partition_states(const char *const *states,
+				      string_t *output, const char **error_r);
 /* Returns the sync type that was used. Mainly useful with slave brain. */
 enum dsync_brain_sync_type dsync_brain_get_sync_type(struct dsync_brain *brain);
 /* If there were any unexpected changes during the sync, return the reason
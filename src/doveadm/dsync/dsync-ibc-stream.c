@@ -10,6 +10,7 @@
 #include "ostream.h"
 #include "str.h"
 #include "strescape.h"
+#include "compression.h"
 #include "master-service.h"
 #include "mail-cache.h"
 #include "mail-storage-private.h"
@@ -25,14 +26,25 @@
 #define DSYNC_IBC_STREAM_OUTBUF_THROTTLE_SIZE (1024*128)
 
 #define DSYNC_PROTOCOL_VERSION_MAJOR 3
-#define DSYNC_PROTOCOL_VERSION_MINOR 5
-#define DSYNC_HANDSHAKE_VERSION "VERSION\tdsync\t3\t5\n"
+#define DSYNC_PROTOCOL_VERSION_MINOR 6
+#define DSYNC_HANDSHAKE_VERSION "VERSION\tdsync\t3\t6\n"
 
 #define DSYNC_PROTOCOL_MINOR_HAVE_ATTRIBUTES 1
 #define DSYNC_PROTOCOL_MINOR_HAVE_SAVE_GUID 2
 #define DSYNC_PROTOCOL_MINOR_HAVE_FINISH 3
 #define DSYNC_PROTOCOL_MINOR_HAVE_HDR_HASH_V2 4
 #define DSYNC_PROTOCOL_MINOR_HAVE_HDR_HASH_V3 5
+#define DSYNC_PROTOCOL_MINOR_HAVE_COMPRESSION 6
+
+/* In the handshake this line lists the compression algorithms that we're
+   able to decompress. After the handshake it tells that the rest of the
+   stream is compressed with the given algorithm. */
+#define DSYNC_COMPRESSION_CHR 'Z'
+/* Compression algorithms that can be flushed in the middle of the stream
+   without finishing it, so they can be used in the dsync protocol. */
+static const char *const dsync_ibc_stream_compression_algos[] = {
+	"zstd", "lz4", "deflate", NULL
+};
 
 enum item_type {
 	ITEM_NONE,
@@ -151,6 +163,10 @@ struct dsync_ibc_stream {
 	struct timeout *to;
 
 	unsigned int minor_version;
+	/* our supported compression algorithms in the order of preference */
+	const char **compression_algos;
+	/* compression algorithms that the remote can decompress */
+	const char **remote_compression_algos;
 	struct dsync_serializer *serializers[ITEM_END_OF_LIST];
 	struct dsync_deserializer *deserializers[ITEM_END_OF_LIST];
 
@@ -161,6 +177,8 @@ struct dsync_ibc_stream {
 	struct dsync_mail *cur_mail;
 	struct dsync_mailbox_attribute *cur_attr;
 	char value_output_last;
+	/* previous mail_change uid sent/received, used for delta encoding */
+	uint32_t last_sent_change_uid, last_recv_change_uid;
 
 	enum item_type last_recv_item, last_sent_item;
 	bool last_recv_item_eol:1;
@@ -172,6 +190,8 @@ struct dsync_ibc_stream {
 	bool finish_received:1;
 	bool done_received:1;
 	bool stopped:1;
+	bool input_compressed:1;
+	bool output_compressed:1;
 };
 
 static const char *dsync_ibc_stream_get_state(struct dsync_ibc_stream *ibc)
@@ -233,6 +253,15 @@ static void dsync_ibc_stream_input(struct dsync_ibc_stream *ibc)
 	o_stream_uncork(ibc->output);
 }
 
+static void dsync_ibc_stream_output_sent(struct dsync_ibc_stream *ibc)
+{
+	/* Compression ostreams don't necessarily flush the data when they're
+	   uncorked. Flush everything that was sent during this ioloop run
+	   once the connection is writable again. */
+	if (ibc->output_compressed)
+		o_stream_set_flush_pending(ibc->output, TRUE);
+}
+
 static int dsync_ibc_stream_send_value_stream(struct dsync_ibc_stream *ibc)
 {
 	const unsigned char *data;
@@ -289,6 +318,7 @@ static int dsync_ibc_stream_send_value_stream(struct dsync_ibc_stream *ibc)
 	/* finished sending the stream. use "CRLF." instead of "LF." just in
 	   case we're sending binary data that ends with CR. */
 	o_stream_nsend_str(ibc->output, "\r\n.\r\n");
+	dsync_ibc_stream_output_sent(ibc);
 	i_stream_unref(&ibc->value_output);
 	return 1;
 }
@@ -349,6 +379,13 @@ static void dsync_ibc_stream_init(struct dsync_ibc_stream *ibc)
 				dsync_serializer_encode_header_line(ibc->serializers[i]));
 		}
 	} T_END;
+	if (ibc->compression_algos[0] != NULL) T_BEGIN {
+		/* tell remote which compression algorithms we can
+		   decompress. old versions ignore unknown handshake lines. */
+		o_stream_nsend_str(ibc->output, t_strdup_printf("%c%s\n",
+			DSYNC_COMPRESSION_CHR,
+			t_strarray_join(ibc->compression_algos, "\t")));
+	} T_END;
 	o_stream_nsend_str(ibc->output, ".\n");
 	o_stream_uncork(ibc->output);
 }
@@ -393,6 +430,8 @@ static void dsync_ibc_stream_deinit(struct dsync_ibc *_ibc)
 	i_stream_destroy(&ibc->input);
 	o_stream_destroy(&ibc->output);
 	pool_unref(&ibc->ret_pool);
+	i_free(ibc->compression_algos);
+	i_free(ibc->remote_compression_algos);
 	i_free(ibc->temp_path_prefix);
 	i_free(ibc->name);
 	i_free(ibc);
@@ -464,6 +503,7 @@ dsync_ibc_stream_send_string(struct dsync_ibc_stream *ibc,
 {
 	i_assert(ibc->value_output == NULL);
 	o_stream_nsend(ibc->output, str_data(str), str_len(str));
+	dsync_ibc_stream_output_sent(ibc);
 }
 
 static int seekable_fd_callback(const char **path_r, void *context)
@@ -525,6 +565,68 @@ dsync_ibc_check_missing_deserializers(struct dsync_ibc_stream *ibc)
 	return ret;
 }
 
+static void dsync_ibc_stream_start_compression(struct dsync_ibc_stream *ibc)
+{
+	const struct compression_handler *handler;
+	struct ostream *output;
+	unsigned int i;
+
+	if (ibc->remote_compression_algos == NULL ||
+	    ibc->minor_version < DSYNC_PROTOCOL_MINOR_HAVE_COMPRESSION)
+		return;
+
+	for (i = 0; ibc->compression_algos[i] != NULL; i++) {
+		if (str_array_find(ibc->remote_compression_algos,
+				   ibc->compression_algos[i]))
+			break;
+	}
+	if (ibc->compression_algos[i] == NULL)
+		return;
+	if (compression_lookup_handler(ibc->compression_algos[i], &handler) <= 0)
+		i_unreached();
+
+	/* the rest of our output is compressed */
+	o_stream_nsend_str(ibc->output, t_strdup_printf("%c%s\n",
+		DSYNC_COMPRESSION_CHR, handler->name));
+	output = handler->create_ostream(ibc->output,
+					 handler->get_default_level());
+	o_stream_unref(&ibc->output);
+	ibc->output = output;
+	o_stream_set_no_error_handling(ibc->output, TRUE);
+	o_stream_set_flush_callback(ibc->output, dsync_ibc_stream_output, ibc);
+	ibc->output_compressed = TRUE;
+	dsync_ibc_stream_output_sent(ibc);
+}
+
+static bool
+dsync_ibc_stream_input_compression(struct dsync_ibc_stream *ibc,
+				   const char *line)
+{
+	const struct compression_handler *handler;
+	struct istream *input;
+
+	if (line[0] != DSYNC_COMPRESSION_CHR)
+		return FALSE;
+
+	if (ibc->input_compressed ||
+	    !str_array_find(ibc->compression_algos, line + 1) ||
+	    compression_lookup_handler(line + 1, &handler) <= 0) {
+		dsync_ibc_input_error(ibc, NULL,
+			"Remote started unexpected compression: %s", line + 1);
+		return TRUE;
+	}
+
+	/* the rest of the input is compressed */
+	io_remove(&ibc->io);
+	input = handler->create_istream(ibc->input);
+	i_stream_unref(&ibc->input);
+	ibc->input = input;
+	ibc->io = io_add_istream(ibc->input, dsync_ibc_stream_input, ibc);
+	io_set_pending(ibc->io);
+	ibc->input_compressed = TRUE;
+	return TRUE;
+}
+
 static bool
 dsync_ibc_stream_handshake(struct dsync_ibc_stream *ibc, const char *line)
 {
@@ -553,6 +655,15 @@ dsync_ibc_stream_handshake(struct dsync_ibc_stream *ibc, const char *line)
 			return FALSE;
 		ibc->handshake_received = TRUE;
 		ibc->last_recv_item = ITEM_HANDSHAKE;
+		dsync_ibc_stream_start_compression(ibc);
+		return FALSE;
+	}
+	if (line[0] == DSYNC_COMPRESSION_CHR) {
+		if (ibc->remote_compression_algos == NULL) {
+			ibc->remote_compression_algos =
+				p_strarray_dup(default_pool,
+					       t_strsplit_tabescaped(line + 1));
+		}
 		return FALSE;
 	}
 
@@ -594,7 +705,8 @@ dsync_ibc_stream_input_next(struct dsync_ibc_stream *ibc, enum item_type item,
 	do {
 		if (dsync_ibc_stream_next_line(ibc, &line) <= 0)
 			return DSYNC_IBC_RECV_RET_TRYAGAIN;
-	} while (!dsync_ibc_stream_handshake(ibc, line));
+	} while (!dsync_ibc_stream_handshake(ibc, line) ||
+		 dsync_ibc_stream_input_compression(ibc, line));
 
 	ibc->last_recv_item = item;
 	ibc->last_recv_item_eol = FALSE;
@@ -920,6 +1032,7 @@ dsync_ibc_stream_send_end_of_list(struct dsync_ibc *_ibc,
 
 	ibc->last_sent_item_eol = TRUE;
 	o_stream_nsend_str(ibc->output, END_OF_LIST_LINE"\n");
+	dsync_ibc_stream_output_sent(ibc);
 }
 
 static void
@@ -1656,7 +1769,18 @@ dsync_ibc_stream_send_change(struct dsync_ibc *_ibc,
 	}
 	i_assert(type[0] != '\0');
 	dsync_serializer_encode_add(encoder, "type", type);
-	dsync_serializer_encode_add(encoder, "uid", dec2str(change->uid));
+	if (ibc->minor_version >= DSYNC_PROTOCOL_MINOR_HAVE_COMPRESSION &&
+	    ibc->last_sent_change_uid != 0 &&
+	    change->uid > ibc->last_sent_change_uid) {
+		/* changes are mostly sorted by uid, so send only the
+		   (usually very short) difference to the previous one */
+		dsync_serializer_encode_add(encoder, "uid", t_strdup_printf("+%u",
+			change->uid - ibc->last_sent_change_uid));
+	} else {
+		dsync_serializer_encode_add(encoder, "uid",
+					    dec2str(change->uid));
+	}
+	ibc->last_sent_change_uid = change->uid;
 	if (change->guid != NULL)
 		dsync_serializer_encode_add(encoder, "guid", change->guid);
 	if (change->hdr_hash != NULL) {
@@ -1751,10 +1875,19 @@ dsync_ibc_stream_recv_change(struct dsync_ibc *_ibc,
 	}
 
 	value = dsync_deserializer_decode_get(decoder, "uid");
-	if (str_to_uint32(value, &change->uid) < 0) {
+	if (value[0] == '+') {
+		if (str_to_uint32(value + 1, &uintval) < 0 || uintval == 0 ||
+		    ibc->last_recv_change_uid == 0 ||
+		    uintval > (uint32_t)-1 - ibc->last_recv_change_uid) {
+			dsync_ibc_input_error(ibc, decoder, "Invalid uid");
+			return DSYNC_IBC_RECV_RET_TRYAGAIN;
+		}
+		change->uid = ibc->last_recv_change_uid + uintval;
+	} else if (str_to_uint32(value, &change->uid) < 0) {
 		dsync_ibc_input_error(ibc, decoder, "Invalid uid");
 		return DSYNC_IBC_RECV_RET_TRYAGAIN;
 	}
+	ibc->last_recv_change_uid = change->uid;
 
 	if (dsync_deserializer_decode_try(decoder, "guid", &value))
 		change->guid = p_strdup(pool, value);
@@ -2119,9 +2252,12 @@ static const struct dsync_ibc_vfuncs dsync_ibc_stream_vfuncs = {
 struct dsync_ibc *
 dsync_ibc_init_stream(struct istream *input, struct ostream *output,
 		      const char *name, const char *temp_path_prefix,
-		      unsigned int timeout_secs)
+		      unsigned int timeout_secs, const char *compression)
 {
+	const char *const *algos = t_strsplit_spaces(compression, " ,");
 	struct dsync_ibc_stream *ibc;
+	ARRAY_TYPE(const_string) supported;
+	unsigned int i;
 
 	ibc = i_new(struct dsync_ibc_stream, 1);
 	ibc->ibc.v = dsync_ibc_stream_vfuncs;
@@ -2132,6 +2268,20 @@ dsync_ibc_init_stream(struct istream *input, struct ostream *output,
 	ibc->name = i_strdup(name);
 	ibc->temp_path_prefix = i_strdup(temp_path_prefix);
 	ibc->timeout_secs = timeout_secs;
+
+	t_array_init(&supported, 4);
+	for (i = 0; algos[i] != NULL; i++) {
+		const struct compression_handler *handler;
+
+		/* silently skip algorithms that aren't compiled in */
+		if (str_array_find(dsync_ibc_stream_compression_algos,
+				   algos[i]) &&
+		    compression_lookup_handler(algos[i], &handler) > 0)
+			array_push_back(&supported, &algos[i]);
+	}
+	array_append_zero(&supported);
+	ibc->compression_algos = p_strarray_dup(default_pool,
+						array_front(&supported));
 	ibc->ret_pool = pool_alloconly_create("ibc stream data", 2048);
 	dsync_ibc_stream_init(ibc);
 	return &ibc->ibc;
@@ -78,10 +78,13 @@ struct dsync_ibc_settings {
 
 void dsync_ibc_init_pipe(struct dsync_ibc **ibc1_r,
 			 struct dsync_ibc **ibc2_r);
+/* compression is a space-separated list of compression algorithms in the
+   order of preference. The first one that the remote also supports is used
+   to compress the data sent to it. Empty string disables compression. */
 struct dsync_ibc *
 dsync_ibc_init_stream(struct istream *input, struct ostream *output,
 		      const char *name, const char *temp_path_prefix,
-		      unsigned int timeout_secs);
+		      unsigned int timeout_secs, const char *compression);
 void dsync_ibc_deinit(struct dsync_ibc **ibc);
 
 /* I/O callback is called whenever new data is available. It's also called on
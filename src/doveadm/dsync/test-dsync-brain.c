@@ -0,0 +1,444 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "str.h"
+#include "istream.h"
+#include "master-service.h"
+#include "test-common.h"
+#include "test-mail-storage-common.h"
+#include "dsync-ibc.h"
+#include "dsync-mailbox-state.h"
+#include "dsync-brain-private.h"
+
+#include <sys/stat.h>
+
+#define TEST_PARTITION_COUNT 3
+#define TEST_MAILS_PER_MAILBOX 3
+
+static const char *const test_mailboxes[] = {
+	"INBOX", "box0", "box1", "box2", "box3", "box4", "box5", "box6"
+};
+static const char *const test_hashed_headers[] = {
+	"Date", "Message-ID", NULL
+};
+
+static void test_mail_save(struct mailbox *box, const char *mail_input)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	int ret;
+
+	input = i_stream_create_from_data(mail_input, strlen(mail_input));
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	save_ctx = mailbox_save_alloc(trans);
+	ret = mailbox_save_begin(&save_ctx, input);
+	while (ret == 0 && (ret = i_stream_read(input)) > 0) {
+		if (mailbox_save_continue(save_ctx) < 0)
+			ret = -1;
+	}
+	if (ret < -1 || input->stream_errno != 0) {
+		mailbox_save_cancel(&save_ctx);
+		ret = -1;
+	} else {
+		ret = mailbox_save_finish(&save_ctx);
+	}
+	if (ret == 0)
+		ret = mailbox_transaction_commit(&trans);
+	else
+		mailbox_transaction_rollback(&trans);
+	if (ret < 0) {
+		i_fatal("Failed to save mail: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+	i_stream_unref(&input);
+}
+
+static void test_mailboxes_create(struct mail_user *user)
+{
+	struct mailbox *box;
+	unsigned int i, j;
+
+	for (i = 0; i < N_ELEMENTS(test_mailboxes); i++) {
+		box = mailbox_alloc(user->namespaces->list,
+				    test_mailboxes[i], 0);
+		if ((i > 0 && mailbox_create(box, NULL, FALSE) < 0) ||
+		    mailbox_open(box) < 0) {
+			i_fatal("Failed to create mailbox: %s",
+				mailbox_get_last_internal_error(box, NULL));
+		}
+		for (j = 0; j < TEST_MAILS_PER_MAILBOX; j++) T_BEGIN {
+			test_mail_save(box, t_strdup_printf(
+				"Message-ID: <%u.%u@example.com>\r\n"
+				"Subject: mail %u in %s\r\n"
+				"\r\n"
+				"body %u\r\n", i, j, j, test_mailboxes[i], j));
+		} T_END;
+		mailbox_free(&box);
+	}
+}
+
+static void
+test_mailbox_get_guid(struct mail_user *user, const char *vname,
+		      guid_128_t guid_r, unsigned int *messages_r)
+{
+	struct mailbox_metadata metadata;
+	struct mailbox_status status;
+	struct mailbox *box;
+
+	box = mailbox_alloc(user->namespaces->list, vname, 0);
+	if (mailbox_get_metadata(box, MAILBOX_METADATA_GUID, &metadata) < 0 ||
+	    mailbox_get_status(box, STATUS_MESSAGES, &status) < 0) {
+		guid_128_empty(guid_r);
+		*messages_r = 0;
+	} else {
+		memcpy(guid_r, metadata.guid, GUID_128_SIZE);
+		*messages_r = status.messages;
+	}
+	mailbox_free(&box);
+}
+
+static struct dsync_brain *
+test_brain_master_init(struct mail_user *user, struct dsync_ibc *ibc,
+		       enum dsync_brain_sync_type sync_type,
+		       const char *state, unsigned int lock_timeout_secs,
+		       unsigned int partition_count, unsigned int partition_idx)
+{
+	struct dsync_brain_settings set;
+
+	i_zero(&set);
+	t_array_init(&set.sync_namespaces, 1);
+	set.hashed_headers = test_hashed_headers;
+	set.state = state;
+	set.lock_timeout_secs = lock_timeout_secs;
+	set.sync_partition_count = partition_count;
+	set.sync_partition_idx = partition_idx;
+	return dsync_brain_master_init(user, ibc, sync_type,
+				       DSYNC_BRAIN_FLAG_SEND_MAIL_REQUESTS,
+				       &set);
+}
+
+static bool
+test_brains_run(struct dsync_brain *brain, struct dsync_brain *brain2)
+{
+	bool running1, running2, changed1, changed2;
+
+	if (dsync_brain_has_failed(brain) || dsync_brain_has_failed(brain2))
+		return FALSE;
+	running1 = dsync_brain_run(brain, &changed1);
+	running2 = dsync_brain_run(brain2, &changed2);
+	return running1 || running2;
+}
+
+static void test_dsync_brain_want_mailbox_guid(void)
+{
+	struct dsync_brain brain;
+	guid_128_t guid;
+	unsigned int i, idx, wanted;
+
+	test_begin("dsync brain want mailbox guid");
+	i_zero(&brain);
+	for (i = 0; i < 100; i++) {
+		guid_128_generate(guid);
+
+		brain.sync_partition_count = 0;
+		brain.sync_partition_idx = 0;
+		test_assert_idx(dsync_brain_want_mailbox_guid(&brain, guid), i);
+
+		/* each mailbox belongs to exactly one partition */
+		brain.sync_partition_count = TEST_PARTITION_COUNT;
+		wanted = 0;
+		for (idx = 0; idx < TEST_PARTITION_COUNT; idx++) {
+			brain.sync_partition_idx = idx;
+			if (dsync_brain_want_mailbox_guid(&brain, guid))
+				wanted++;
+		}
+		test_assert_idx(wanted == 1, i);
+
+		/* the mailbox tree sync selects none of them */
+		brain.sync_partition_idx = TEST_PARTITION_COUNT;
+		test_assert_idx(!dsync_brain_want_mailbox_guid(&brain, guid), i);
+	}
+	test_end();
+}
+
+static void
+test_states_add(HASH_TABLE_TYPE(dsync_mailbox_state) states, pool_t pool,
+		uint32_t uid)
+{
+	struct dsync_mailbox_state *state;
+	uint8_t *guid_p;
+
+	state = p_new(pool, struct dsync_mailbox_state, 1);
+	guid_128_generate(state->mailbox_guid);
+	state->last_uidvalidity = 1000 + uid;
+	state->last_common_uid = uid;
+	state->last_common_modseq = 10 * uid;
+	state->last_messages_count = uid;
+	guid_p = state->mailbox_guid;
+	hash_table_insert(states, guid_p, state);
+}
+
+static void test_dsync_brain_join_partition_states(void)
+{
+	HASH_TABLE_TYPE(dsync_mailbox_state) states, joined;
+	struct hash_iterate_context *iter;
+	struct dsync_mailbox_state *state, *joined_state;
+	const char *part_states[TEST_PARTITION_COUNT + 1], *error;
+	uint8_t *guid;
+	string_t *str;
+	pool_t pool;
+	unsigned int i;
+
+	test_begin("dsync brain join partition states");
+	pool = pool_alloconly_create("test states", 1024);
+	hash_table_create(&states, pool, 0, guid_128_hash, guid_128_cmp);
+	for (i = 0; i < TEST_PARTITION_COUNT; i++) {
+		HASH_TABLE_TYPE(dsync_mailbox_state) part;
+
+		/* the last partition has no mailboxes */
+		hash_table_create(&part, pool, 0, guid_128_hash, guid_128_cmp);
+		if (i < TEST_PARTITION_COUNT - 1) {
+			test_states_add(part, pool, i * 2 + 1);
+			test_states_add(part, pool, i * 2 + 2);
+		}
+		str = t_str_new(128);
+		dsync_mailbox_states_export(part, str);
+		part_states[i] = str_c(str);
+
+		iter = hash_table_iterate_init(part);
+		while (hash_table_iterate(iter, part, &guid, &state))
+			hash_table_insert(states, guid, state);
+		hash_table_iterate_deinit(&iter);
+		hash_table_destroy(&part);
+	}
+	part_states[i] = NULL;
+
+	str = t_str_new(128);
+	test_assert(dsync_brain_join_partition_states(part_states, str,
+						      &error) == 0);
+	hash_table_create(&joined, pool, 0, guid_128_hash, guid_128_cmp);
+	test_assert(dsync_mailbox_states_import(joined, pool, str_c(str),
+						&error) == 0);
+	test_assert(hash_table_count(joined) == hash_table_count(states));
+	iter = hash_table_iterate_init(states);
+	while (hash_table_iterate(iter, states, &guid, &state)) {
+		joined_state = hash_table_lookup(joined, guid);
+		test_assert(joined_state != NULL &&
+			    joined_state->last_uidvalidity ==
+			    state->last_uidvalidity &&
+			    joined_state->last_common_uid ==
+			    state->last_common_uid &&
+			    joined_state->last_common_modseq ==
+			    state->last_common_modseq &&
+			    joined_state->last_messages_count ==
+			    state->last_messages_count);
+	}
+	hash_table_iterate_deinit(&iter);
+
+	/* a partition that requires a full resync makes all of it full */
+	part_states[1] = "";
+	str_truncate(str, 0);
+	test_assert(dsync_brain_join_partition_states(part_states, str,
+						      &error) == 0);
+	test_assert(str_len(str) == 0);
+
+	part_states[1] = "broken";
+	test_assert(dsync_brain_join_partition_states(part_states, str,
+						      &error) < 0);
+
+	hash_table_destroy(&joined);
+	hash_table_destroy(&states);
+	pool_unref(&pool);
+	test_end();
+}
+
+static void
+test_dsync_partitions_run(struct mail_user *user, struct mail_user *user2,
+			  ARRAY_TYPE(const_string) *states)
+{
+	struct dsync_ibc *ibc[TEST_PARTITION_COUNT], *ibc2[TEST_PARTITION_COUNT];
+	struct dsync_brain *brain[TEST_PARTITION_COUNT];
+	struct dsync_brain *brain2[TEST_PARTITION_COUNT];
+	enum mail_error error;
+	const char *state;
+	unsigned int i;
+	bool running;
+
+	/* the same way as cmd_dsync_partitions_run_local() */
+	for (i = 0; i < TEST_PARTITION_COUNT; i++) {
+		dsync_ibc_init_pipe(&ibc[i], &ibc2[i]);
+		brain[i] = test_brain_master_init(user, ibc[i],
+			DSYNC_BRAIN_SYNC_TYPE_FULL, NULL, 0,
+			TEST_PARTITION_COUNT, i);
+		brain2[i] = dsync_brain_slave_init(user2, ibc2[i], TRUE, "",
+						   '_');
+	}
+	do {
+		running = FALSE;
+		for (i = 0; i < TEST_PARTITION_COUNT; i++) {
+			if (test_brains_run(brain[i], brain2[i]))
+				running = TRUE;
+		}
+	} while (running);
+
+	for (i = 0; i < TEST_PARTITION_COUNT; i++) {
+		string_t *str = t_str_new(128);
+
+		test_assert_idx(!dsync_brain_has_failed(brain[i]), i);
+		test_assert_idx(dsync_brain_has_finished(brain[i]), i);
+		dsync_brain_get_state(brain[i], str);
+		state = str_c(str);
+		array_push_back(states, &state);
+
+		test_assert_idx(dsync_brain_deinit(&brain2[i], &error) == 0, i);
+		test_assert_idx(dsync_brain_deinit(&brain[i], &error) == 0, i);
+		dsync_ibc_deinit(&ibc[i]);
+		dsync_ibc_deinit(&ibc2[i]);
+	}
+}
+
+static void test_dsync_brain_partitions(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+	};
+	struct mail_storage_service_user *service_user;
+	struct mail_user *user, *user2;
+	struct dsync_ibc *ibc, *ibc2;
+	struct dsync_brain *brain, *brain2;
+	struct dsync_brain_lock *lock;
+	ARRAY_TYPE(const_string) states;
+	HASH_TABLE_TYPE(dsync_mailbox_state) joined;
+	enum mail_error error;
+	guid_128_t guid, guid2;
+	const char *home, *lock_path, *errstr;
+	unsigned int i, messages, messages2;
+	bool remote_only;
+	struct stat st;
+	string_t *state;
+	pool_t pool;
+
+	test_begin("dsync brain partitions");
+	ctx = test_mail_storage_init();
+	set.username = "user1";
+	test_mail_storage_init_user(ctx, &set);
+	user = ctx->user;
+	service_user = ctx->service_user;
+	set.username = "user2";
+	test_mail_storage_init_user(ctx, &set);
+	user2 = ctx->user;
+	user->dsyncing = TRUE;
+	user2->dsyncing = TRUE;
+	test_assert(mail_user_get_home(user, &home) > 0);
+	lock_path = t_strconcat(home, "/"DSYNC_LOCK_FILENAME, NULL);
+
+	test_mailboxes_create(user);
+
+	/* sync only the mailbox tree first. within the same server only the
+	   master brain locks. */
+	dsync_ibc_init_pipe(&ibc, &ibc2);
+	brain = test_brain_master_init(user, ibc, DSYNC_BRAIN_SYNC_TYPE_FULL,
+				       NULL, 10, TEST_PARTITION_COUNT,
+				       TEST_PARTITION_COUNT);
+	brain2 = dsync_brain_slave_init(user2, ibc2, TRUE, "", '_');
+	while (test_brains_run(brain, brain2)) ;
+	test_assert(!dsync_brain_has_failed(brain) &&
+		    !dsync_brain_has_failed(brain2));
+	test_assert(dsync_brain_has_finished(brain));
+
+	/* the lock is kept over the partitions */
+	lock = dsync_brain_take_lock(brain);
+	test_assert(lock != NULL);
+	test_assert(dsync_brain_take_lock(brain2) == NULL);
+	test_assert(dsync_brain_deinit(&brain2, &error) == 0);
+	test_assert(dsync_brain_deinit(&brain, &error) == 0);
+	dsync_ibc_deinit(&ibc);
+	dsync_ibc_deinit(&ibc2);
+	test_assert(stat(lock_path, &st) == 0);
+
+	/* the mailboxes exist with the same GUIDs, but without mails */
+	for (i = 0; i < N_ELEMENTS(test_mailboxes); i++) {
+		test_mailbox_get_guid(user, test_mailboxes[i],
+				      guid, &messages);
+		test_mailbox_get_guid(user2, test_mailboxes[i],
+				      guid2, &messages2);
+		test_assert_idx(!guid_128_is_empty(guid) &&
+				guid_128_equals(guid, guid2), i);
+		test_assert_idx(messages == TEST_MAILS_PER_MAILBOX, i);
+		test_assert_idx(messages2 == 0, i);
+	}
+
+	t_array_init(&states, TEST_PARTITION_COUNT + 1);
+	test_dsync_partitions_run(user, user2, &states);
+	test_assert(stat(lock_path, &st) == 0);
+	dsync_brain_lock_free(&lock);
+	test_assert(stat(lock_path, &st) < 0 && errno == ENOENT);
+
+	for (i = 0; i < N_ELEMENTS(test_mailboxes); i++) {
+		test_mailbox_get_guid(user2, test_mailboxes[i],
+				      guid2, &messages2);
+		test_assert_idx(messages2 == TEST_MAILS_PER_MAILBOX, i);
+	}
+
+	/* the joined state has all the mailboxes */
+	array_append_zero(&states);
+	state = t_str_new(256);
+	test_assert(dsync_brain_join_partition_states(array_front(&states),
+						      state, &errstr) == 0);
+	pool = pool_alloconly_create("test states", 1024);
+	hash_table_create(&joined, pool, 0, guid_128_hash, guid_128_cmp);
+	test_assert(dsync_mailbox_states_import(joined, pool, str_c(state),
+						&errstr) == 0);
+	test_assert(hash_table_count(joined) == N_ELEMENTS(test_mailboxes));
+	hash_table_destroy(&joined);
+	pool_unref(&pool);
+
+	/* an incremental sync with the joined state finds nothing to do */
+	dsync_ibc_init_pipe(&ibc, &ibc2);
+	brain = test_brain_master_init(user, ibc, DSYNC_BRAIN_SYNC_TYPE_STATE,
+				       str_c(state), 0, 0, 0);
+	brain2 = dsync_brain_slave_init(user2, ibc2, TRUE, "", '_');
+	while (test_brains_run(brain, brain2)) ;
+	test_assert(dsync_brain_get_sync_type(brain) ==
+		    DSYNC_BRAIN_SYNC_TYPE_STATE);
+	test_assert(dsync_brain_get_unexpected_changes_reason(brain,
+		&remote_only) == NULL);
+	test_assert(dsync_brain_deinit(&brain2, &error) == 0);
+	test_assert(dsync_brain_deinit(&brain, &error) == 0);
+	dsync_ibc_deinit(&ibc);
+	dsync_ibc_deinit(&ibc2);
+
+	test_mail_storage_deinit_user(ctx);
+	ctx->user = user;
+	ctx->service_user = service_user;
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+int main(int argc, char **argv)
+{
+	void (*const tests[])(void) = {
+		test_dsync_brain_want_mailbox_guid,
+		test_dsync_brain_join_partition_states,
+		test_dsync_brain_partitions,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-dsync-brain",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+	ret = test_run(tests);
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -0,0 +1,381 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "ioloop.h"
+#include "str.h"
+#include "net.h"
+#include "istream.h"
+#include "ostream.h"
+#include "write-full.h"
+#include "compression.h"
+#include "test-common.h"
+#include "dsync-mail.h"
+#include "dsync-ibc.h"
+
+#include <unistd.h>
+
+#define TEST_COMPRESSION_ALGOS "zstd lz4 deflate"
+#define TEST_IBC_TIMEOUT_SECS 60
+#define TEST_WAIT_TIMEOUT_SECS 10
+#define TEST_GUID_PREFIX "testguid"
+
+/* Data flowing from one dsync_ibc to the other through the test. */
+struct test_relay {
+	struct io *io;
+	int fd_in, fd_out;
+	/* what the receiving side got */
+	string_t *received;
+	/* rewrite the handshake to look like it came from protocol 3.5 */
+	bool old_peer;
+	bool handshake_forwarded;
+	string_t *handshake;
+};
+
+static struct test_relay relays[2];
+static struct dsync_ibc *ibcs[2];
+static int ibc_fds[2];
+static bool test_timed_out;
+
+static const char *test_compression_algo(void)
+{
+	const char *const *algos =
+		t_strsplit_spaces(TEST_COMPRESSION_ALGOS, " ");
+	const struct compression_handler *handler;
+	unsigned int i;
+
+	for (i = 0; algos[i] != NULL; i++) {
+		if (compression_lookup_handler(algos[i], &handler) > 0)
+			return algos[i];
+	}
+	i_unreached();
+}
+
+static void test_relay_send(struct test_relay *relay,
+			    const void *data, size_t size)
+{
+	str_append_data(relay->received, data, size);
+	if (write_full(relay->fd_out, data, size) < 0)
+		i_fatal("write() failed: %m");
+}
+
+static void test_relay_handshake(struct test_relay *relay)
+{
+	const char *const *lines;
+	string_t *str;
+	const char *p;
+	unsigned int i;
+
+	p = strstr(str_c(relay->handshake), "\n.\n");
+	if (p == NULL)
+		return;
+
+	/* drop the compression line and downgrade the version */
+	str = t_str_new(str_len(relay->handshake));
+	lines = t_strsplit(t_strdup_until(str_c(relay->handshake), p + 1),
+			   "\n");
+	for (i = 0; lines[i] != NULL; i++) {
+		if (i == 0) {
+			test_assert_strcmp(lines[i], "VERSION\tdsync\t3\t6");
+			str_append(str, "VERSION\tdsync\t3\t5\n");
+		} else if (lines[i][0] != 'Z' && lines[i][0] != '\0') {
+			str_printfa(str, "%s\n", lines[i]);
+		}
+	}
+	str_append(str, p + 1);
+	test_relay_send(relay, str_data(str), str_len(str));
+	relay->handshake_forwarded = TRUE;
+}
+
+static void test_relay_input(struct test_relay *relay)
+{
+	unsigned char buf[IO_BLOCK_SIZE];
+	ssize_t ret;
+
+	ret = read(relay->fd_in, buf, sizeof(buf));
+	if (ret <= 0) {
+		if (ret < 0)
+			i_fatal("read() failed: %m");
+		io_remove(&relay->io);
+		return;
+	}
+	if (!relay->old_peer || relay->handshake_forwarded)
+		test_relay_send(relay, buf, ret);
+	else {
+		str_append_data(relay->handshake, buf, ret);
+		test_relay_handshake(relay);
+	}
+}
+
+/* Returns TRUE if the relayed data switched to the given compression after
+   the handshake. */
+static bool test_relay_compressed(struct test_relay *relay, const char *algo)
+{
+	const char *p = strstr(str_c(relay->received), "\n.\n");
+
+	return p != NULL &&
+		strstr(p + 2, t_strdup_printf("\nZ%s\n", algo)) != NULL;
+}
+
+static struct dsync_ibc *
+test_ibc_init(const char *name, int fd, const char *compression)
+{
+	struct istream *input;
+	struct ostream *output;
+	struct dsync_ibc *ibc;
+
+	fd_set_nonblock(fd, TRUE);
+	input = i_stream_create_fd(fd, SIZE_MAX);
+	output = o_stream_create_fd(fd, SIZE_MAX);
+	ibc = dsync_ibc_init_stream(input, output, name, ".test-dsync-ibc",
+				    TEST_IBC_TIMEOUT_SECS, compression);
+	i_stream_unref(&input);
+	o_stream_unref(&output);
+	return ibc;
+}
+
+static void
+test_ibcs_init(const char *compression1, const char *compression2,
+	       bool old_peer)
+{
+	int fd1[2], fd2[2];
+	unsigned int i;
+
+	/* ibcs[0] <-> fd1 <-> relays <-> fd2 <-> ibcs[1]. The relay fds are
+	   blocking, but they're read only when there's input and the test
+	   data fits into the socket buffers. */
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd1) < 0 ||
+	    socketpair(AF_UNIX, SOCK_STREAM, 0, fd2) < 0)
+		i_fatal("socketpair() failed: %m");
+	relays[0].fd_in = fd1[1];
+	relays[0].fd_out = fd2[1];
+	relays[1].fd_in = fd2[1];
+	relays[1].fd_out = fd1[1];
+	for (i = 0; i < N_ELEMENTS(relays); i++) {
+		relays[i].received = str_new(default_pool, 1024);
+		relays[i].handshake = str_new(default_pool, 1024);
+		relays[i].old_peer = old_peer;
+		relays[i].handshake_forwarded = FALSE;
+		relays[i].io = io_add(relays[i].fd_in, IO_READ,
+				      test_relay_input, &relays[i]);
+	}
+	ibc_fds[0] = fd1[0];
+	ibc_fds[1] = fd2[0];
+	ibcs[0] = test_ibc_init("ibc1", fd1[0], compression1);
+	ibcs[1] = test_ibc_init("ibc2", fd2[0], compression2);
+}
+
+static void test_ibcs_deinit(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(ibcs); i++) {
+		dsync_ibc_deinit(&ibcs[i]);
+		i_close_fd(&ibc_fds[i]);
+	}
+	for (i = 0; i < N_ELEMENTS(relays); i++) {
+		io_remove(&relays[i].io);
+		str_free(&relays[i].received);
+		str_free(&relays[i].handshake);
+	}
+	i_close_fd(&relays[0].fd_in);
+	i_close_fd(&relays[1].fd_in);
+}
+
+static void test_ibc_input(void *context ATTR_UNUSED)
+{
+	io_loop_stop(current_ioloop);
+}
+
+static void test_wait_timeout(void *context ATTR_UNUSED)
+{
+	test_timed_out = TRUE;
+	io_loop_stop(current_ioloop);
+}
+
+/* Returns TRUE if the receive should be retried. */
+static bool test_ibc_wait(struct dsync_ibc *ibc, enum dsync_ibc_recv_ret ret)
+{
+	struct timeout *to;
+
+	if (ret != DSYNC_IBC_RECV_RET_TRYAGAIN)
+		return FALSE;
+	if (dsync_ibc_has_failed(ibc) || test_timed_out) {
+		test_assert(FALSE);
+		return FALSE;
+	}
+	to = timeout_add(TEST_WAIT_TIMEOUT_SECS * 1000,
+			 test_wait_timeout, NULL);
+	io_loop_run(current_ioloop);
+	timeout_remove(&to);
+	return TRUE;
+}
+
+static void test_ibcs_handshake(void)
+{
+	struct dsync_ibc_settings set;
+	const struct dsync_ibc_settings *remote_set;
+	enum dsync_ibc_recv_ret ret;
+	unsigned int i;
+
+	i_zero(&set);
+	set.hostname = "localhost";
+	for (i = 0; i < N_ELEMENTS(ibcs); i++) {
+		dsync_ibc_set_io_callback(ibcs[i], test_ibc_input, NULL);
+		dsync_ibc_send_handshake(ibcs[i], &set);
+	}
+	for (i = 0; i < N_ELEMENTS(ibcs); i++) {
+		do {
+			ret = dsync_ibc_recv_handshake(ibcs[i], &remote_set);
+		} while (test_ibc_wait(ibcs[i], ret));
+		test_assert_idx(ret == DSYNC_IBC_RECV_RET_OK, i);
+	}
+}
+
+static const char *test_change_guid(uint32_t uid)
+{
+	return t_strdup_printf(TEST_GUID_PREFIX"%u", uid);
+}
+
+/* Send changes with the given UIDs from ibcs[0] to ibcs[1] and verify that
+   they're received correctly. */
+static void test_ibcs_send_changes(const uint32_t *uids, unsigned int count)
+{
+	struct dsync_mail_change change;
+	const struct dsync_mail_change *recv_change;
+	enum dsync_ibc_recv_ret ret;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		i_zero(&change);
+		change.type = (i % 2) == 0 ? DSYNC_MAIL_CHANGE_TYPE_SAVE :
+			DSYNC_MAIL_CHANGE_TYPE_FLAG_CHANGE;
+		change.uid = uids[i];
+		change.guid = test_change_guid(uids[i]);
+		change.modseq = i + 1;
+		(void)dsync_ibc_send_change(ibcs[0], &change);
+	}
+	(void)dsync_ibc_send_end_of_list(ibcs[0], DSYNC_IBC_EOL_MAIL_CHANGES);
+
+	for (i = 0;; i++) {
+		do {
+			ret = dsync_ibc_recv_change(ibcs[1], &recv_change);
+		} while (test_ibc_wait(ibcs[1], ret));
+		if (ret != DSYNC_IBC_RECV_RET_OK)
+			break;
+		if (i >= count) {
+			test_assert(FALSE);
+			continue;
+		}
+		test_assert_idx(recv_change->uid == uids[i], i);
+		test_assert_strcmp_idx(recv_change->guid,
+				       test_change_guid(uids[i]), i);
+		test_assert_idx(recv_change->modseq == i + 1, i);
+	}
+	test_assert(ret == DSYNC_IBC_RECV_RET_FINISHED);
+	test_assert(i == count);
+}
+
+static const uint32_t test_uids[] = {
+	5, 6, 7, 10, 3, 4, 4, 100000, (uint32_t)-1, 1
+};
+
+static void test_dsync_ibc_stream_compression(void)
+{
+	const char *algo = test_compression_algo();
+	unsigned int i;
+
+	test_begin("dsync ibc stream compression");
+	test_ibcs_init(TEST_COMPRESSION_ALGOS, TEST_COMPRESSION_ALGOS, FALSE);
+	test_ibcs_handshake();
+	test_ibcs_send_changes(test_uids, N_ELEMENTS(test_uids));
+
+	/* both sides compress their output after the handshake */
+	for (i = 0; i < N_ELEMENTS(relays); i++)
+		test_assert_idx(test_relay_compressed(&relays[i], algo), i);
+	test_assert(strstr(str_c(relays[0].received),
+			   TEST_GUID_PREFIX) == NULL);
+	test_ibcs_deinit();
+
+	/* compression is disabled on the other side: it can't decompress,
+	   and it doesn't compress its own output */
+	test_ibcs_init(TEST_COMPRESSION_ALGOS, "", FALSE);
+	test_ibcs_handshake();
+	test_ibcs_send_changes(test_uids, N_ELEMENTS(test_uids));
+	for (i = 0; i < N_ELEMENTS(relays); i++)
+		test_assert_idx(!test_relay_compressed(&relays[i], algo), i);
+	test_assert(strstr(str_c(relays[0].received),
+			   TEST_GUID_PREFIX) != NULL);
+	test_ibcs_deinit();
+	test_end();
+}
+
+static void test_dsync_ibc_stream_old_peer(void)
+{
+	const char *line;
+	unsigned int i;
+
+	test_begin("dsync ibc stream old peer");
+	test_ibcs_init(TEST_COMPRESSION_ALGOS, TEST_COMPRESSION_ALGOS, TRUE);
+	test_ibcs_handshake();
+	test_ibcs_send_changes(test_uids, N_ELEMENTS(test_uids));
+
+	/* neither compression nor uid deltas are sent to old versions */
+	for (i = 0; i < N_ELEMENTS(relays); i++) {
+		test_assert_idx(strstr(str_c(relays[i].received), "\nZ") == NULL, i);
+		test_assert_idx(strstr(str_c(relays[i].received), "\t+") == NULL, i);
+	}
+	for (i = 0; i < N_ELEMENTS(test_uids); i++) {
+		line = t_strdup_printf("\t%u\t"TEST_GUID_PREFIX"%u\t",
+				       test_uids[i], test_uids[i]);
+		test_assert_idx(strstr(str_c(relays[0].received), line) != NULL, i);
+	}
+	test_ibcs_deinit();
+	test_end();
+}
+
+static void test_dsync_ibc_stream_change_uid_delta(void)
+{
+	static const char *const expected_uids[] = {
+		"5", "+1", "+1", "+3", "3", "+1", "4", "+99996",
+		"+4294867295", "1"
+	};
+	const char *line;
+	unsigned int i;
+
+	test_begin("dsync ibc stream change uid delta");
+	/* no compression, so the records can be seen */
+	test_ibcs_init("", "", FALSE);
+	test_ibcs_handshake();
+	test_ibcs_send_changes(test_uids, N_ELEMENTS(test_uids));
+
+	for (i = 0; i < N_ELEMENTS(test_uids); i++) {
+		line = t_strdup_printf("\t%s\t"TEST_GUID_PREFIX"%u\t",
+				       expected_uids[i], test_uids[i]);
+		test_assert_idx(strstr(str_c(relays[0].received), line) != NULL, i);
+	}
+
+	/* the deltas continue from the previous list's last uid */
+	test_ibcs_send_changes(test_uids + 1, 2);
+	test_assert(strstr(str_c(relays[0].received),
+			   "\t+5\t"TEST_GUID_PREFIX"6\t") != NULL);
+	test_ibcs_deinit();
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_dsync_ibc_stream_compression,
+		test_dsync_ibc_stream_old_peer,
+		test_dsync_ibc_stream_change_uid_delta,
+		NULL
+	};
+	struct ioloop *ioloop;
+	int ret;
+
+	ioloop = io_loop_create();
+	ret = test_run(test_functions);
+	io_loop_destroy(&ioloop);
+	return ret;
+}
@@ -10,6 +10,7 @@
 #include "ostream.h"
 #include "str.h"
 #include "strescape.h"
+#include "strnum.h"
 #include "connection.h"
 #include "auth-client-interface.h"
 #include "master-interface.h"
@@ -17,6 +18,7 @@
 #include "auth-master.h"
 
 #include <unistd.h>
+#include <dirent.h>
 
 #define AUTH_MASTER_IDLE_SECS 60
 
@@ -153,6 +155,54 @@ const char *auth_master_get_socket_path(struct auth_master_connection *conn)
 	return conn->auth_socket_path;
 }
 
+const char *
+auth_master_get_pid_socket_path(const char *auth_socket_path, pid_t pid)
+{
+	return t_strdup_printf("%s.%s", auth_socket_path, dec2str(pid));
+}
+
+int auth_master_find_pid_sockets(const char *auth_socket_path,
+				 ARRAY_TYPE(uint) *pids,
+				 const char **error_r)
+{
+	const char *dir, *prefix, *p, *suffix;
+	struct dirent *d;
+	unsigned int pid;
+	DIR *dirp;
+	int ret = 0;
+
+	p = strrchr(auth_socket_path, '/');
+	if (p == NULL) {
+		dir = ".";
+		prefix = t_strconcat(auth_socket_path, ".", NULL);
+	} else {
+		dir = t_strdup_until(auth_socket_path, p);
+		prefix = t_strconcat(p + 1, ".", NULL);
+	}
+
+	dirp = opendir(dir);
+	if (dirp == NULL) {
+		*error_r = t_strdup_printf("opendir(%s) failed: %m", dir);
+		return -1;
+	}
+	errno = 0;
+	while ((d = readdir(dirp)) != NULL) {
+		if (str_begins(d->d_name, prefix, &suffix) &&
+		    str_to_uint(suffix, &pid) == 0 && pid > 0)
+			array_push_back(pids, &pid);
+		errno = 0;
+	}
+	if (errno != 0) {
+		*error_r = t_strdup_printf("readdir(%s) failed: %m", dir);
+		ret = -1;
+	}
+	if (closedir(dirp) < 0 && ret == 0) {
+		*error_r = t_strdup_printf("closedir(%s) failed: %m", dir);
+		ret = -1;
+	}
+	return ret;
+}
+
 static void auth_request_lookup_abort(struct auth_master_connection *conn)
 {
 	io_loop_stop(conn->ioloop);
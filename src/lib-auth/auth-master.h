@@ -40,6 +40,18 @@ void auth_master_set_timeout(struct auth_master_connection *conn,
 /* Returns the auth_socket_path */
 const char *auth_master_get_socket_path(struct auth_master_connection *conn);
 
+/* When the auth service has multiple processes, each of them also listens on
+   a socket that reaches only that process. Returns the path of the process's
+   socket for the given auth-master socket path. */
+const char *
+auth_master_get_pid_socket_path(const char *auth_socket_path, pid_t pid);
+/* Find the pids of the auth processes that have a per-process socket for
+   the given auth-master socket path. The sockets may be left behind by
+   processes that no longer exist. Returns 0 on success, -1 on error. */
+int auth_master_find_pid_sockets(const char *auth_socket_path,
+				 ARRAY_TYPE(uint) *pids,
+				 const char **error_r);
+
 /* Do a USER lookup. Returns -2 = user-specific error, -1 = internal error,
    0 = user not found, 1 = ok. When returning -1 and fields[0] isn't NULL, it
    contains an error message that should be shown to user. */
@@ -1,6 +1,7 @@
 /* Copyright (c) 2016-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "str.h"
 #include "strescape.h"
 #include "hostpid.h"
@@ -20,6 +21,7 @@
 #include "auth-master.h"
 
 #include <unistd.h>
+#include <fcntl.h>
 
 #define TEST_SOCKET "./auth-master-test"
 #define SERVER_KILL_TIMEOUT_SECS    20
@@ -141,6 +143,46 @@ static void test_auth_user_info_export(void)
 	test_end();
 }
 
+static void test_create_file(const char *path)
+{
+	int fd = creat(path, 0600);
+
+	if (fd == -1)
+		i_fatal("creat(%s) failed: %m", path);
+	i_close_fd(&fd);
+}
+
+static void test_auth_master_find_pid_sockets(void)
+{
+	ARRAY_TYPE(uint) pids;
+	const char *path, *error;
+	const unsigned int *pidp;
+	unsigned int sum = 0;
+
+	test_begin("auth_master_find_pid_sockets()");
+	path = auth_master_get_pid_socket_path(TEST_SOCKET, 123);
+	test_assert_strcmp(path, TEST_SOCKET".123");
+	test_create_file(path);
+	test_create_file(auth_master_get_pid_socket_path(TEST_SOCKET, 4567));
+	/* these are ignored */
+	test_create_file(TEST_SOCKET".foo");
+	test_create_file(TEST_SOCKET"-other.1");
+
+	t_array_init(&pids, 4);
+	test_assert(auth_master_find_pid_sockets(TEST_SOCKET, &pids,
+						 &error) == 0);
+	test_assert(array_count(&pids) == 2);
+	array_foreach(&pids, pidp)
+		sum += *pidp;
+	test_assert(sum == 123 + 4567);
+
+	i_unlink(TEST_SOCKET".123");
+	i_unlink(TEST_SOCKET".4567");
+	i_unlink(TEST_SOCKET".foo");
+	i_unlink(TEST_SOCKET"-other.1");
+	test_end();
+}
+
 /*
  * Connection refused
  */
@@ -1104,6 +1146,7 @@ static void test_user_list(void)
 
 static void (*const test_functions[])(void) = {
 	test_auth_user_info_export,
+	test_auth_master_find_pid_sockets,
 	test_connection_refused,
 	test_connection_timed_out,
 	test_bad_version,
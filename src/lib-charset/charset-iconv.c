@@ -11,6 +11,7 @@
 
 struct charset_translation {
 	iconv_t cd;
+	enum charset_8bit native_8bit;
 	normalizer_func_t *normalizer;
 };
 
@@ -19,11 +20,15 @@ iconv_charset_to_utf8_begin(const char *charset, normalizer_func_t *normalizer,
 			    struct charset_translation **t_r)
 {
 	struct charset_translation *t;
+	enum charset_8bit native_8bit = CHARSET_8BIT_NONE;
 	iconv_t cd;
 
 	if (charset_is_utf8(charset))
 		cd = (iconv_t)-1;
-	else {
+	else if ((native_8bit = charset_8bit_find(charset)) != CHARSET_8BIT_NONE) {
+		/* common single byte charsets are converted without iconv */
+		cd = (iconv_t)-1;
+	} else {
 		if (strcmp(charset, "UTF-8//TEST") == 0)
 			charset = "UTF-8";
 		cd = iconv_open("UTF-8", charset);
@@ -33,6 +38,7 @@ iconv_charset_to_utf8_begin(const char *charset, normalizer_func_t *normalizer,
 
 	t = i_new(struct charset_translation, 1);
 	t->cd = cd;
+	t->native_8bit = native_8bit;
 	t->normalizer = normalizer;
 	*t_r = t;
 	return 0;
@@ -109,6 +115,11 @@ iconv_charset_to_utf8(struct charset_translation *t,
 	size_t prev_invalid_pos = SIZE_MAX;
 	bool ret;
 
+	if (t->native_8bit != CHARSET_8BIT_NONE) {
+		return charset_8bit_to_utf8(t->native_8bit, t->normalizer,
+					    src, src_size, dest);
+	}
+
 	for (pos = 0;;) {
 		i_assert(pos <= *src_size);
 		size = *src_size - pos;
@@ -4,6 +4,7 @@
 #include "charset-utf8-private.h"
 
 struct charset_translation {
+	enum charset_8bit native_8bit;
 	normalizer_func_t *normalizer;
 };
 
@@ -13,13 +14,16 @@ utf8only_charset_to_utf8_begin(const char *charset,
 			       struct charset_translation **t_r)
 {
 	struct charset_translation *t;
+	enum charset_8bit native_8bit = CHARSET_8BIT_NONE;
 
-	if (!charset_is_utf8(charset)) {
-		/* no support for charsets that need translation */
+	if (!charset_is_utf8(charset) &&
+	    (native_8bit = charset_8bit_find(charset)) == CHARSET_8BIT_NONE) {
+		/* no support for other charsets that need translation */
 		return -1;
 	}
 
 	t = i_new(struct charset_translation, 1);
+	t->native_8bit = native_8bit;
 	t->normalizer = normalizer;
 	*t_r = t;
 	return 0;
@@ -40,6 +44,10 @@ utf8only_charset_to_utf8(struct charset_translation *t,
 			 const unsigned char *src, size_t *src_size,
 			 buffer_t *dest)
 {
+	if (t->native_8bit != CHARSET_8BIT_NONE) {
+		return charset_8bit_to_utf8(t->native_8bit, t->normalizer,
+					    src, src_size, dest);
+	}
 	return charset_utf8_to_utf8(t->normalizer, src, src_size, dest);
 }
 
@@ -15,6 +15,22 @@ struct charset_utf8_vfuncs {
 				       size_t *src_size, buffer_t *dest);
 };
 
+/* Single byte charsets that are converted without iconv */
+enum charset_8bit {
+	CHARSET_8BIT_NONE = 0,
+	CHARSET_8BIT_LATIN1,
+	CHARSET_8BIT_WINDOWS_1252,
+};
+
+/* Returns the natively supported single byte charset matching the name, or
+   CHARSET_8BIT_NONE if there is none. */
+enum charset_8bit charset_8bit_find(const char *charset);
+/* Translate single byte charset to UTF-8. The input is never incomplete. */
+enum charset_result
+charset_8bit_to_utf8(enum charset_8bit charset, normalizer_func_t *normalizer,
+		     const unsigned char *src, size_t *src_size,
+		     buffer_t *dest);
+
 extern const struct charset_utf8_vfuncs charset_utf8only;
 extern const struct charset_utf8_vfuncs charset_iconv;
 
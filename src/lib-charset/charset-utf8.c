@@ -13,6 +13,15 @@ const struct charset_utf8_vfuncs *charset_utf8_vfuncs = &charset_iconv;
 const struct charset_utf8_vfuncs *charset_utf8_vfuncs = &charset_utf8only;
 #endif
 
+/* windows-1252 characters 0x80..0x9f, which differ from ISO-8859-1.
+   0 means the character is undefined. */
+static const uint16_t windows_1252_map[32] = {
+	0x20ac, 0, 0x201a, 0x0192, 0x201e, 0x2026, 0x2020, 0x2021,
+	0x02c6, 0x2030, 0x0160, 0x2039, 0x0152, 0, 0x017d, 0,
+	0, 0x2018, 0x2019, 0x201c, 0x201d, 0x2022, 0x2013, 0x2014,
+	0x02dc, 0x2122, 0x0161, 0x203a, 0x0153, 0, 0x017e, 0x0178
+};
+
 bool charset_is_utf8(const char *charset)
 {
 	return strcasecmp(charset, "us-ascii") == 0 ||
@@ -21,6 +30,80 @@ bool charset_is_utf8(const char *charset)
 		strcasecmp(charset, "UTF8") == 0;
 }
 
+enum charset_8bit charset_8bit_find(const char *charset)
+{
+	if (strcasecmp(charset, "iso-8859-1") == 0 ||
+	    strcasecmp(charset, "iso8859-1") == 0 ||
+	    strcasecmp(charset, "iso_8859-1") == 0 ||
+	    strcasecmp(charset, "latin1") == 0)
+		return CHARSET_8BIT_LATIN1;
+	if (strcasecmp(charset, "windows-1252") == 0 ||
+	    strcasecmp(charset, "cp1252") == 0)
+		return CHARSET_8BIT_WINDOWS_1252;
+	return CHARSET_8BIT_NONE;
+}
+
+static bool
+charset_8bit_to_utf8_buf(enum charset_8bit charset,
+			 const unsigned char *src, size_t size,
+			 buffer_t *dest)
+{
+	size_t i, prev_invalid_pos = SIZE_MAX;
+	unichar_t chr;
+
+	for (i = 0; i < size; ) {
+		size_t len = uni_utf8_ascii_prefix_len(src + i, size - i);
+
+		buffer_append(dest, src + i, len);
+		i += len;
+		if (i == size)
+			break;
+
+		chr = src[i++];
+		if (charset == CHARSET_8BIT_WINDOWS_1252 && chr < 0xa0) {
+			chr = windows_1252_map[chr - 0x80];
+			if (chr == 0) {
+				/* add only a single replacement character
+				   for a sequence of invalid input, the same
+				   as with iconv */
+				if (prev_invalid_pos != dest->used) {
+					buffer_append(dest, UNICODE_REPLACEMENT_CHAR_UTF8,
+						      strlen(UNICODE_REPLACEMENT_CHAR_UTF8));
+					prev_invalid_pos = dest->used;
+				}
+				continue;
+			}
+		}
+		uni_ucs4_to_utf8_c(chr, dest);
+	}
+	return prev_invalid_pos == SIZE_MAX;
+}
+
+enum charset_result
+charset_8bit_to_utf8(enum charset_8bit charset, normalizer_func_t *normalizer,
+		     const unsigned char *src, size_t *src_size,
+		     buffer_t *dest)
+{
+	enum charset_result result = CHARSET_RET_OK;
+
+	i_assert(charset != CHARSET_8BIT_NONE);
+
+	if (normalizer == NULL) {
+		if (!charset_8bit_to_utf8_buf(charset, src, *src_size, dest))
+			result = CHARSET_RET_INVALID_INPUT;
+		return result;
+	}
+	T_BEGIN {
+		buffer_t *tmp = t_buffer_create(*src_size * 2);
+
+		if (!charset_8bit_to_utf8_buf(charset, src, *src_size, tmp))
+			result = CHARSET_RET_INVALID_INPUT;
+		if (normalizer(tmp->data, tmp->used, dest) < 0)
+			result = CHARSET_RET_INVALID_INPUT;
+	} T_END;
+	return result;
+}
+
 int charset_to_utf8_str(const char *charset, normalizer_func_t *normalizer,
 			const char *input, string_t *output,
 			enum charset_result *result_r)
@@ -52,9 +135,22 @@ charset_utf8_to_utf8(normalizer_func_t *normalizer,
 		     const unsigned char *src, size_t *src_size, buffer_t *dest)
 {
 	enum charset_result res = CHARSET_RET_OK;
-	size_t pos;
+	size_t ascii_len, pos;
+
+	ascii_len = uni_utf8_ascii_prefix_len(src, *src_size);
+	if (ascii_len == *src_size) {
+		/* only ASCII - no need to validate it */
+		if (normalizer != NULL) {
+			if (normalizer(src, *src_size, dest) < 0)
+				return CHARSET_RET_INVALID_INPUT;
+		} else {
+			buffer_append(dest, src, *src_size);
+		}
+		return CHARSET_RET_OK;
+	}
 
-	uni_utf8_partial_strlen_n(src, *src_size, &pos);
+	uni_utf8_partial_strlen_n(src + ascii_len, *src_size - ascii_len, &pos);
+	pos += ascii_len;
 	if (pos < *src_size) {
 		i_assert(*src_size - pos <= CHARSET_MAX_PENDING_BUF_SIZE);
 		*src_size = pos;
@@ -7,6 +7,9 @@
 #include "charset-utf8.h"
 
 #include <unistd.h>
+#ifdef HAVE_ICONV
+#  include <iconv.h>
+#endif
 
 static void test_charset_is_utf8(void)
 {
@@ -60,6 +63,71 @@ static void test_charset_utf8(void)
 	test_end();
 }
 
+static void test_charset_8bit(void)
+{
+	static const char *const charsets[] = {
+		"ISO-8859-1", "windows-1252"
+	};
+	string_t *str = t_str_new(128), *str2 = t_str_new(128);
+	enum charset_result result;
+	unsigned int i, j;
+
+	test_begin("charset 8bit");
+	for (i = 0; i < N_ELEMENTS(charsets); i++) {
+#ifdef HAVE_ICONV
+		iconv_t cd = iconv_open("UTF-8", charsets[i]);
+		i_assert(cd != (iconv_t)-1);
+#endif
+		for (j = 1; j < 256; j++) {
+			char input[2] = { j, '\0' };
+
+			str_truncate(str, 0);
+			test_assert_idx(charset_to_utf8_str(charsets[i], NULL,
+					input, str, &result) == 0, j);
+#ifdef HAVE_ICONV
+			/* the results must be the same as with iconv */
+			char outbuf[8], *outp = outbuf;
+			ICONV_CONST char *inp = input;
+			size_t inleft = 1, outleft = sizeof(outbuf);
+
+			if (iconv(cd, &inp, &inleft, &outp, &outleft) == SIZE_MAX) {
+				test_assert_idx(result == CHARSET_RET_INVALID_INPUT, j);
+				test_assert_strcmp_idx(str_c(str),
+					UNICODE_REPLACEMENT_CHAR_UTF8, j);
+			} else {
+				test_assert_idx(result == CHARSET_RET_OK, j);
+				test_assert_idx(str_len(str) == sizeof(outbuf) - outleft &&
+					memcmp(str_data(str), outbuf, str_len(str)) == 0, j);
+			}
+#endif
+		}
+#ifdef HAVE_ICONV
+		iconv_close(cd);
+#endif
+	}
+
+	/* only a single replacement character for a sequence of invalid
+	   input */
+	str_truncate(str, 0);
+	test_assert(charset_to_utf8_str("cp1252", NULL, "a\x81\x8D\x80" "b\x90",
+					str, &result) == 0);
+	test_assert_strcmp(str_c(str), "a"UNICODE_REPLACEMENT_CHAR_UTF8
+			   "\xE2\x82\xAC" "b"UNICODE_REPLACEMENT_CHAR_UTF8);
+	test_assert(result == CHARSET_RET_INVALID_INPUT);
+
+	/* normalizer gets the converted UTF-8 */
+	str_truncate(str, 0);
+	test_assert(charset_to_utf8_str("latin1", uni_utf8_to_decomposed_titlecase,
+					"p\xE4\xE4 0123456789abcdefghijklmn", str,
+					&result) == 0);
+	test_assert(result == CHARSET_RET_OK);
+	str_truncate(str2, 0);
+	test_assert(uni_utf8_to_decomposed_titlecase(
+		"p\xC3\xA4\xC3\xA4 0123456789abcdefghijklmn", 35, str2) == 0);
+	test_assert_strcmp(str_c(str), str_c(str2));
+	test_end();
+}
+
 #ifdef HAVE_ICONV
 static void test_charset_iconv(void)
 {
@@ -215,6 +283,7 @@ int main(int argc, char *argv[])
 	static void (*const test_functions[])(void) = {
 		test_charset_is_utf8,
 		test_charset_utf8,
+		test_charset_8bit,
 #ifdef HAVE_ICONV
 		test_charset_iconv,
 		test_charset_iconv_crashes,
@@ -0,0 +1,229 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "istream.h"
+#include "ostream.h"
+#include "randgen.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "unlink-directory.h"
+#include "fs-api.h"
+
+#include <stdio.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/**
+ * Writes a corpus of files through the dedup fs and reports how much space
+ * was saved and how fast the files can be read back. Without a corpus
+ * directory, a synthetic corpus is generated where each file is a slightly
+ * modified copy of a few base documents, like a forwarded and re-edited
+ * attachment.
+ */
+
+#define BENCH_DIR "bench-fs-dedup.tmp"
+#define SYNTHETIC_DOC_COUNT 4
+#define SYNTHETIC_FILE_COUNT 64
+#define SYNTHETIC_FILE_SIZE (1024*1024)
+
+struct bench_stats {
+	uoff_t logical_bytes, stored_bytes;
+	unsigned int file_count;
+	uint64_t write_nsecs, read_nsecs;
+};
+
+static void bench_write(struct fs *fs, struct bench_stats *stats,
+			const char *path, const void *data, size_t size)
+{
+	struct fs_file *file = fs_file_init(fs, path, FS_OPEN_MODE_REPLACE);
+	struct ostream *output;
+	uint64_t ts = i_nanoseconds();
+
+	output = fs_write_stream(file);
+	o_stream_nsend(output, data, size);
+	if (fs_write_stream_finish(file, &output) < 0)
+		i_fatal("write(%s) failed: %s", path, fs_file_last_error(file));
+	fs_file_deinit(&file);
+
+	stats->write_nsecs += i_nanoseconds() - ts;
+	stats->logical_bytes += size;
+	stats->file_count++;
+}
+
+static void bench_read_all(struct fs *fs, struct bench_stats *stats)
+{
+	const unsigned char *data;
+	size_t size;
+	unsigned int i;
+	uint64_t ts = i_nanoseconds();
+
+	for (i = 0; i < stats->file_count; i++) {
+		const char *path = t_strdup_printf("file%u", i);
+		struct fs_file *file = fs_file_init(fs, path,
+						    FS_OPEN_MODE_READONLY);
+		struct istream *input = fs_read_stream(file, IO_BLOCK_SIZE);
+
+		while (i_stream_read_more(input, &data, &size) > 0)
+			i_stream_skip(input, size);
+		if (input->stream_errno != 0) {
+			i_fatal("read(%s) failed: %s", path,
+				i_stream_get_error(input));
+		}
+		i_stream_unref(&input);
+		fs_file_deinit(&file);
+	}
+	stats->read_nsecs = i_nanoseconds() - ts;
+}
+
+static uoff_t bench_dir_size(const char *path)
+{
+	struct dirent *d;
+	struct stat st;
+	uoff_t size = 0;
+	DIR *dir;
+
+	if ((dir = opendir(path)) == NULL)
+		i_fatal("opendir(%s) failed: %m", path);
+	while ((d = readdir(dir)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+		const char *subpath = t_strconcat(path, "/", d->d_name, NULL);
+		if (lstat(subpath, &st) < 0)
+			i_fatal("lstat(%s) failed: %m", subpath);
+		if (S_ISDIR(st.st_mode))
+			size += bench_dir_size(subpath);
+		else if (strchr(d->d_name, '-') == NULL) {
+			/* chunk references are hard links to the same data,
+			   so count only the chunks themselves and the
+			   manifests */
+			size += st.st_size;
+		}
+	}
+	(void)closedir(dir);
+	return size;
+}
+
+static void bench_corpus_dir(struct fs *fs, struct bench_stats *stats,
+			     const char *path)
+{
+	struct dirent *d;
+	struct stat st;
+	buffer_t *buf;
+	DIR *dir;
+
+	if ((dir = opendir(path)) == NULL)
+		i_fatal("opendir(%s) failed: %m", path);
+	buf = buffer_create_dynamic(default_pool, 1024*1024);
+	while ((d = readdir(dir)) != NULL) T_BEGIN {
+		const char *subpath = t_strconcat(path, "/", d->d_name, NULL);
+		const char *error;
+
+		if (d->d_name[0] != '.' && stat(subpath, &st) == 0) {
+			if (S_ISDIR(st.st_mode))
+				bench_corpus_dir(fs, stats, subpath);
+			else if (S_ISREG(st.st_mode)) {
+				buffer_set_used_size(buf, 0);
+				if (buffer_append_full_file(buf, subpath, SIZE_MAX,
+						&error) != BUFFER_APPEND_OK)
+					i_fatal("%s", error);
+				bench_write(fs, stats,
+					    t_strdup_printf("file%u", stats->file_count),
+					    buf->data, buf->used);
+			}
+		}
+	} T_END;
+	buffer_free(&buf);
+	(void)closedir(dir);
+}
+
+static void bench_synthetic(struct fs *fs, struct bench_stats *stats)
+{
+	buffer_t *docs[SYNTHETIC_DOC_COUNT], *buf;
+	unsigned int i, j;
+
+	for (i = 0; i < SYNTHETIC_DOC_COUNT; i++) {
+		docs[i] = buffer_create_dynamic(default_pool,
+						SYNTHETIC_FILE_SIZE);
+		random_fill(buffer_append_space_unsafe(docs[i],
+				SYNTHETIC_FILE_SIZE), SYNTHETIC_FILE_SIZE);
+	}
+	buf = buffer_create_dynamic(default_pool, SYNTHETIC_FILE_SIZE + 1024);
+	for (i = 0; i < SYNTHETIC_FILE_COUNT; i++) T_BEGIN {
+		buffer_set_used_size(buf, 0);
+		buffer_append_buf(buf, docs[i % SYNTHETIC_DOC_COUNT], 0, SIZE_MAX);
+		/* a few small edits at random positions */
+		for (j = 0; j < 3; j++) {
+			unsigned char edit[16];
+
+			random_fill(edit, sizeof(edit));
+			buffer_insert(buf, i_rand_limit(buf->used), edit,
+				      i_rand_minmax(1, sizeof(edit)));
+		}
+		bench_write(fs, stats, t_strdup_printf("file%u", i),
+			    buf->data, buf->used);
+	} T_END;
+	buffer_free(&buf);
+	for (i = 0; i < SYNTHETIC_DOC_COUNT; i++)
+		buffer_free(&docs[i]);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [corpus dir [avg chunk size]]\n", prog);
+	fprintf(stderr, "Uses a synthetic corpus if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	struct fs_settings fs_set;
+	struct bench_stats stats;
+	struct fs *fs;
+	unsigned int avg_size = 64*1024;
+	const char *error, *args;
+
+	lib_init();
+	if (argc > 3)
+		print_usage(argv[0]);
+	if (argc == 3 && (str_to_uint(argv[2], &avg_size) < 0)) {
+		fprintf(stderr, "Invalid parameters\n");
+		print_usage(argv[0]);
+	}
+
+	if (unlink_directory(BENCH_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error) < 0)
+		i_fatal("unlink_directory(%s) failed: %s", BENCH_DIR, error);
+	if (mkdir(BENCH_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", BENCH_DIR);
+
+	args = t_strdup_printf("min-chunk-size=%u,avg-chunk-size=%u,"
+			       "max-chunk-size=%u:posix:prefix="BENCH_DIR"/",
+			       avg_size / 4, avg_size, avg_size * 4);
+	i_zero(&fs_set);
+	if (fs_init("dedup", args, &fs_set, &fs, &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+
+	i_zero(&stats);
+	if (argc >= 2)
+		bench_corpus_dir(fs, &stats, argv[1]);
+	else
+		bench_synthetic(fs, &stats);
+	bench_read_all(fs, &stats);
+	fs_deinit(&fs);
+
+	stats.stored_bytes = bench_dir_size(BENCH_DIR);
+	printf("Files: %u, average chunk size %u\n", stats.file_count, avg_size);
+	printf("\tLogical size: %"PRIuUOFF_T" bytes\n", stats.logical_bytes);
+	printf("\tStored size: %"PRIuUOFF_T" bytes\n", stats.stored_bytes);
+	printf("\tDedup ratio: %0.02lf\n", stats.stored_bytes == 0 ? 0.0 :
+	       (double)stats.logical_bytes / (double)stats.stored_bytes);
+	printf("\tWrite: %0.02lf MB/s\n", stats.write_nsecs == 0 ? 0.0 :
+	       (double)stats.logical_bytes * 1000.0 / stats.write_nsecs);
+	printf("\tRead: %0.02lf MB/s\n", stats.read_nsecs == 0 ? 0.0 :
+	       (double)stats.logical_bytes * 1000.0 / stats.read_nsecs);
+
+	if (unlink_directory(BENCH_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error) < 0)
+		i_error("unlink_directory(%s) failed: %s", BENCH_DIR, error);
+	lib_deinit();
+	return 0;
+}
@@ -166,6 +166,7 @@ struct fs_iter {
 	void *async_context;
 };
 
+extern const struct fs fs_class_dedup;
 extern const struct fs fs_class_dict;
 extern const struct fs fs_class_posix;
 extern const struct fs fs_class_randomfail;
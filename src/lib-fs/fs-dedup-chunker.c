@@ -0,0 +1,90 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "bits.h"
+#include "fs-dedup-chunker.h"
+
+#define FS_DEDUP_CHUNK_MIN_AVG_SIZE 64
+
+static uint64_t gear_table[256];
+static bool gear_table_initialized = FALSE;
+
+static void fs_dedup_gear_table_init(void)
+{
+	/* The table must never change, or previously stored chunks can't
+	   be deduplicated anymore. Generate it with splitmix64 using a fixed
+	   seed rather than embedding 256 constants. */
+	uint64_t seed = 0x6a09e667f3bcc908ULL;
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(gear_table); i++) {
+		uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gear_table[i] = z ^ (z >> 31);
+	}
+	gear_table_initialized = TRUE;
+}
+
+static inline uint64_t fs_dedup_mask(unsigned int bits)
+{
+	/* gear hash mixes the most recent bytes into the highest bits */
+	return ((1ULL << bits) - 1) << (64 - bits);
+}
+
+int fs_dedup_chunker_settings_check(const struct fs_dedup_chunker_settings *set,
+				    const char **error_r)
+{
+	if (set->avg_size < FS_DEDUP_CHUNK_MIN_AVG_SIZE ||
+	    !bits_is_power_of_two(set->avg_size)) {
+		*error_r = t_strdup_printf(
+			"Average chunk size must be a power of two and at least %u",
+			FS_DEDUP_CHUNK_MIN_AVG_SIZE);
+		return -1;
+	}
+	if (set->min_size == 0 || set->min_size > set->avg_size ||
+	    set->avg_size > set->max_size) {
+		*error_r = "Chunk sizes must be 0 < min <= avg <= max";
+		return -1;
+	}
+	return 0;
+}
+
+size_t fs_dedup_chunker_find_boundary(const struct fs_dedup_chunker_settings *set,
+				      const unsigned char *data, size_t size,
+				      bool eof)
+{
+	unsigned int bits;
+	uint64_t hash = 0, mask_small, mask_large;
+	size_t i, limit, normal_size;
+
+	if (size <= set->min_size)
+		return eof ? size : 0;
+
+	if (!gear_table_initialized)
+		fs_dedup_gear_table_init();
+
+	/* Normalized chunking: use a stricter mask before the average size
+	   and a looser one after it. This narrows the chunk size distribution
+	   without hurting the deduplication ratio. */
+	bits = bits_required64(set->avg_size) - 1;
+	mask_small = fs_dedup_mask(bits + 1);
+	mask_large = fs_dedup_mask(bits - 1);
+
+	limit = I_MIN(size, set->max_size);
+	normal_size = I_MIN(limit, set->avg_size);
+	for (i = set->min_size; i < normal_size; i++) {
+		hash = (hash << 1) + gear_table[data[i]];
+		if ((hash & mask_small) == 0)
+			return i + 1;
+	}
+	for (; i < limit; i++) {
+		hash = (hash << 1) + gear_table[data[i]];
+		if ((hash & mask_large) == 0)
+			return i + 1;
+	}
+	if (limit == set->max_size)
+		return limit;
+	return eof ? size : 0;
+}
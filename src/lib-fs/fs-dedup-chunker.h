@@ -0,0 +1,30 @@
+#ifndef FS_DEDUP_CHUNKER_H
+#define FS_DEDUP_CHUNKER_H
+
+#define FS_DEDUP_CHUNK_DEFAULT_MIN_SIZE (16*1024)
+#define FS_DEDUP_CHUNK_DEFAULT_AVG_SIZE (64*1024)
+#define FS_DEDUP_CHUNK_DEFAULT_MAX_SIZE (256*1024)
+
+struct fs_dedup_chunker_settings {
+	size_t min_size;
+	/* Must be a power of two */
+	size_t avg_size;
+	size_t max_size;
+};
+
+/* Content-defined chunking using a gear rolling hash. Chunk boundaries
+   depend only on the data near them, so inserting or removing bytes only
+   changes the chunks around the modification. The gear table is fixed,
+   so the same data always results in the same chunks across processes. */
+
+int fs_dedup_chunker_settings_check(const struct fs_dedup_chunker_settings *set,
+				    const char **error_r);
+/* Returns the length of the next chunk that begins at data[0]. If eof is
+   FALSE and no boundary is found before the end of data, returns 0 to
+   indicate that more data is needed. The caller should provide at least
+   max_size bytes of data whenever possible. */
+size_t fs_dedup_chunker_find_boundary(const struct fs_dedup_chunker_settings *set,
+				      const unsigned char *data, size_t size,
+				      bool eof);
+
+#endif
@@ -0,0 +1,902 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "guid.h"
+#include "hex-binary.h"
+#include "sha2.h"
+#include "str.h"
+#include "strnum.h"
+#include "istream.h"
+#include "istream-private.h"
+#include "ostream.h"
+#include "iostream-temp.h"
+#include "fs-dedup-chunker.h"
+#include "fs-api-private.h"
+
+#include <sys/stat.h>
+
+/* The dedup fs splits written files into content-defined chunks and stores
+   each distinct chunk only once under <chunk-dir>/<hh>/<hash>. The file
+   itself is replaced with a small manifest listing its chunks.
+
+   Chunks are reference counted with hard links in the same way as fs-sis:
+   each file that uses a chunk links it to <hash>-<file guid>, and reads go
+   through that link. The unsuffixed <hash> file is only used to find
+   existing chunks for new files, so it can be deleted once its link count
+   drops to 1 without affecting any existing files. */
+
+#define FS_DEDUP_REQUIRED_PROPS \
+	(FS_PROPERTY_FASTCOPY | FS_PROPERTY_STAT)
+#define FS_DEDUP_DEFAULT_CHUNK_DIR "chunks"
+#define FS_DEDUP_DEFAULT_READAHEAD_CHUNKS 4
+#define FS_DEDUP_MANIFEST_HEADER "DEDUP1"
+
+struct dedup_chunk {
+	unsigned char hash[SHA256_RESULTLEN];
+	uoff_t offset, size;
+};
+ARRAY_DEFINE_TYPE(dedup_chunk, struct dedup_chunk);
+
+struct dedup_fs {
+	struct fs fs;
+	struct fs_dedup_chunker_settings chunk_set;
+	char *chunk_dir;
+	unsigned int readahead_chunks;
+};
+
+struct dedup_fs_file {
+	struct fs_file file;
+	struct dedup_fs *fs;
+	enum fs_open_mode open_mode;
+
+	struct ostream *temp_output;
+
+	/* manifest */
+	guid_128_t guid;
+	uoff_t size;
+	ARRAY_TYPE(dedup_chunk) chunks;
+	bool manifest_read;
+};
+
+struct dedup_istream {
+	struct istream_private istream;
+
+	struct fs *chunk_fs;
+	struct event *event;
+	char *chunk_dir;
+	guid_128_t guid;
+	uoff_t size;
+	ARRAY_TYPE(dedup_chunk) chunks;
+	unsigned int readahead_chunks;
+
+	/* opened (and prefetched) chunk files, indexed like chunks */
+	struct fs_file **chunk_files;
+	unsigned int chunk_idx;
+	struct istream *chunk_input;
+};
+
+#define DEDUP_FS(ptr)	container_of((ptr), struct dedup_fs, fs)
+#define DEDUP_FILE(ptr)	container_of((ptr), struct dedup_fs_file, file)
+
+static const char *
+fs_dedup_chunk_path(const char *chunk_dir, const unsigned char *hash)
+{
+	const char *hex = binary_to_hex(hash, SHA256_RESULTLEN);
+
+	return t_strdup_printf("%s/%c%c/%s", chunk_dir, hex[0], hex[1], hex);
+}
+
+static const char *
+fs_dedup_chunk_ref_path(const char *chunk_dir, const unsigned char *hash,
+			const guid_128_t guid)
+{
+	return t_strdup_printf("%s-%s", fs_dedup_chunk_path(chunk_dir, hash),
+			       guid_128_to_string(guid));
+}
+
+static struct fs *fs_dedup_alloc(void)
+{
+	struct dedup_fs *fs;
+
+	fs = i_new(struct dedup_fs, 1);
+	fs->fs = fs_class_dedup;
+	fs->chunk_set.min_size = FS_DEDUP_CHUNK_DEFAULT_MIN_SIZE;
+	fs->chunk_set.avg_size = FS_DEDUP_CHUNK_DEFAULT_AVG_SIZE;
+	fs->chunk_set.max_size = FS_DEDUP_CHUNK_DEFAULT_MAX_SIZE;
+	fs->chunk_dir = i_strdup(FS_DEDUP_DEFAULT_CHUNK_DIR);
+	fs->readahead_chunks = FS_DEDUP_DEFAULT_READAHEAD_CHUNKS;
+	return &fs->fs;
+}
+
+static int
+fs_dedup_parse_size(const char *value, size_t *size_r, const char **error_r)
+{
+	unsigned int num;
+
+	if (str_to_uint(value, &num) < 0 || num == 0) {
+		*error_r = t_strdup_printf("Invalid size: %s", value);
+		return -1;
+	}
+	*size_r = num;
+	return 0;
+}
+
+static int fs_dedup_parse_params(struct dedup_fs *fs, const char *params,
+				 const char **error_r)
+{
+	const char *const *tmp;
+	int ret = 0;
+
+	for (tmp = t_strsplit_spaces(params, ","); *tmp != NULL; tmp++) {
+		const char *key = *tmp;
+		const char *value = strchr(key, '=');
+
+		if (value == NULL) {
+			*error_r = "Missing '='";
+			return -1;
+		}
+		key = t_strdup_until(key, value++);
+		if (strcmp(key, "chunk-dir") == 0) {
+			if (*value == '\0') {
+				*error_r = "chunk-dir is empty";
+				return -1;
+			}
+			i_free(fs->chunk_dir);
+			fs->chunk_dir = i_strdup(value);
+		} else if (strcmp(key, "min-chunk-size") == 0) {
+			ret = fs_dedup_parse_size(value, &fs->chunk_set.min_size,
+						  error_r);
+		} else if (strcmp(key, "avg-chunk-size") == 0) {
+			ret = fs_dedup_parse_size(value, &fs->chunk_set.avg_size,
+						  error_r);
+		} else if (strcmp(key, "max-chunk-size") == 0) {
+			ret = fs_dedup_parse_size(value, &fs->chunk_set.max_size,
+						  error_r);
+		} else if (strcmp(key, "readahead-chunks") == 0) {
+			if (str_to_uint(value, &fs->readahead_chunks) < 0) {
+				*error_r = t_strdup_printf(
+					"Invalid readahead-chunks: %s", value);
+				return -1;
+			}
+		} else {
+			*error_r = t_strdup_printf("Unknown key '%s'", key);
+			return -1;
+		}
+		if (ret < 0)
+			return -1;
+	}
+	return fs_dedup_chunker_settings_check(&fs->chunk_set, error_r);
+}
+
+static int
+fs_dedup_init(struct fs *_fs, const char *args, const struct fs_settings *set,
+	      const char **error_r)
+{
+	struct dedup_fs *fs = DEDUP_FS(_fs);
+	enum fs_properties props;
+	const char *p, *parent_name, *parent_args, *error;
+
+	/* dedup:[<params>:]<parent fs>[:<parent args>] - the params are
+	   recognized by the first segment containing '=' */
+	p = strchr(args, ':');
+	if (p != NULL && memchr(args, '=', p - args) != NULL) {
+		if (fs_dedup_parse_params(fs, t_strdup_until(args, p),
+					  &error) < 0) {
+			*error_r = t_strdup_printf(
+				"Invalid dedup parameters: %s", error);
+			return -1;
+		}
+		args = p + 1;
+	}
+
+	if (*args == '\0') {
+		*error_r = "Parent filesystem not given as parameter";
+		return -1;
+	}
+
+	parent_args = strchr(args, ':');
+	if (parent_args == NULL) {
+		parent_name = args;
+		parent_args = "";
+	} else {
+		parent_name = t_strdup_until(args, parent_args);
+		parent_args++;
+	}
+	if (fs_init(parent_name, parent_args, set, &_fs->parent, error_r) < 0)
+		return -1;
+	props = fs_get_properties(_fs->parent);
+	if ((props & FS_DEDUP_REQUIRED_PROPS) != FS_DEDUP_REQUIRED_PROPS) {
+		*error_r = t_strdup_printf("%s backend can't be used with dedup",
+					   parent_name);
+		return -1;
+	}
+	return 0;
+}
+
+static void fs_dedup_free(struct fs *_fs)
+{
+	struct dedup_fs *fs = DEDUP_FS(_fs);
+
+	i_free(fs->chunk_dir);
+	i_free(fs);
+}
+
+static enum fs_properties fs_dedup_get_properties(struct fs *_fs)
+{
+	/* copying needs to add chunk references, so it's never fast.
+	   the chunks are accessed synchronously. */
+	return fs_get_properties(_fs->parent) &
+		ENUM_NEGATE(FS_PROPERTY_FASTCOPY | FS_PROPERTY_ASYNC);
+}
+
+static struct fs_file *fs_dedup_file_alloc(void)
+{
+	struct dedup_fs_file *file = i_new(struct dedup_fs_file, 1);
+	return &file->file;
+}
+
+static void
+fs_dedup_file_init(struct fs_file *_file, const char *path,
+		   enum fs_open_mode mode, enum fs_open_flags flags)
+{
+	struct dedup_fs_file *file = DEDUP_FILE(_file);
+
+	file->file.path = i_strdup(path);
+	file->fs = DEDUP_FS(_file->fs);
+	file->open_mode = mode;
+	i_array_init(&file->chunks, 16);
+	if (mode == FS_OPEN_MODE_APPEND) {
+		fs_set_error(_file->event, ENOTSUP, "APPEND mode not supported");
+		return;
+	}
+
+	/* the manifest is small and parsed synchronously */
+	flags &= ENUM_NEGATE(FS_OPEN_FLAG_ASYNC | FS_OPEN_FLAG_SEEKABLE);
+	file->file.parent = fs_file_init_parent(_file, path, mode, flags);
+}
+
+static void fs_dedup_file_deinit(struct fs_file *_file)
+{
+	struct dedup_fs_file *file = DEDUP_FILE(_file);
+
+	fs_file_free(_file);
+	array_free(&file->chunks);
+	i_free(file->file.path);
+	i_free(file);
+}
+
+static void fs_dedup_file_close(struct fs_file *_file)
+{
+	struct dedup_fs_file *file = DEDUP_FILE(_file);
+
+	o_stream_destroy(&file->temp_output);
+	fs_file_close(_file->parent);
+}
+
+static int
+fs_dedup_manifest_parse_line(ARRAY_TYPE(dedup_chunk) *chunks, const char *line,
+			     uoff_t *offset)
+{
+	struct dedup_chunk *chunk;
+	const char *const *args = t_strsplit(line, " ");
+	buffer_t hash_buf;
+
+	if (str_array_length(args) != 2)
+		return -1;
+
+	chunk = array_append_space(chunks);
+	buffer_create_from_data(&hash_buf, chunk->hash, sizeof(chunk->hash));
+	if (strlen(args[0]) != SHA256_RESULTLEN*2 ||
+	    hex_to_binary(args[0], &hash_buf) < 0 ||
+	    str_to_uoff(args[1], &chunk->size) < 0 || chunk->size == 0)
+		return -1;
+	chunk->offset = *offset;
+	*offset += chunk->size;
+	return 0;
+}
+
+static int
+fs_dedup_manifest_parse(struct dedup_fs_file *file, struct fs_file *parent,
+			guid_128_t guid_r, uoff_t *size_r,
+			ARRAY_TYPE(dedup_chunk) *chunks)
+{
+	struct istream *input;
+	const char *line, *const *args;
+	uoff_t offset = 0;
+	int ret = 0;
+
+	input = fs_read_stream(parent, IO_BLOCK_SIZE);
+	if ((line = i_stream_read_next_line(input)) == NULL) {
+		if (input->stream_errno != 0) {
+			/* keep the parent's error as-is */
+			fs_set_error(file->file.event, input->stream_errno,
+				     "%s", i_stream_get_error(input));
+			i_stream_unref(&input);
+			return -1;
+		}
+		ret = -1;
+	} else T_BEGIN {
+		args = t_strsplit(line, " ");
+		if (str_array_length(args) != 3 ||
+		    strcmp(args[0], FS_DEDUP_MANIFEST_HEADER) != 0 ||
+		    guid_128_from_string(args[1], guid_r) < 0 ||
+		    str_to_uoff(args[2], size_r) < 0)
+			ret = -1;
+	} T_END;
+
+	array_clear(chunks);
+	while (ret == 0 && (line = i_stream_read_next_line(input)) != NULL) T_BEGIN {
+		ret = fs_dedup_manifest_parse_line(chunks, line, &offset);
+	} T_END;
+	if (input->stream_errno != 0) {
+		fs_set_error(file->file.event, input->stream_errno,
+			     "%s", i_stream_get_error(input));
+		ret = -1;
+	} else if (ret < 0 || offset != *size_r) {
+		fs_set_error(file->file.event, EINVAL,
+			     "Corrupted dedup manifest %s",
+			     i_stream_get_name(input));
+		ret = -1;
+	}
+	i_stream_unref(&input);
+	return ret;
+}
+
+static int fs_dedup_manifest_read(struct dedup_fs_file *file)
+{
+	if (file->manifest_read)
+		return 0;
+	if (file->file.parent == NULL)
+		return -1;
+
+	if (fs_dedup_manifest_parse(file, file->file.parent, file->guid,
+				    &file->size, &file->chunks) < 0)
+		return -1;
+	file->manifest_read = TRUE;
+	return 0;
+}
+
+static void
+i_stream_dedup_close_chunk_file(struct dedup_istream *dstream,
+				unsigned int idx)
+{
+	if (idx == dstream->chunk_idx)
+		i_stream_unref(&dstream->chunk_input);
+	fs_file_deinit(&dstream->chunk_files[idx]);
+}
+
+static void i_stream_dedup_destroy(struct iostream_private *stream)
+{
+	struct dedup_istream *dstream =
+		container_of(stream, struct dedup_istream, istream.iostream);
+	unsigned int i, count = array_count(&dstream->chunks);
+
+	for (i = 0; i < count; i++)
+		i_stream_dedup_close_chunk_file(dstream, i);
+	i_free(dstream->chunk_files);
+	array_free(&dstream->chunks);
+	event_unref(&dstream->event);
+	i_free(dstream->chunk_dir);
+	i_stream_free_buffer(&dstream->istream);
+}
+
+static unsigned int
+i_stream_dedup_find_chunk(struct dedup_istream *dstream, uoff_t offset)
+{
+	const struct dedup_chunk *chunks;
+	unsigned int idx, left_idx, right_idx, count;
+
+	chunks = array_get(&dstream->chunks, &count);
+	idx = left_idx = 0;
+	right_idx = count;
+	while (left_idx < right_idx) {
+		idx = (left_idx + right_idx) / 2;
+		if (offset < chunks[idx].offset)
+			right_idx = idx;
+		else if (offset >= chunks[idx].offset + chunks[idx].size)
+			left_idx = idx + 1;
+		else
+			return idx;
+	}
+	i_unreached();
+}
+
+static void
+i_stream_dedup_open_chunk(struct dedup_istream *dstream, unsigned int idx)
+{
+	const struct dedup_chunk *chunk;
+	unsigned int i, count = array_count(&dstream->chunks);
+	unsigned int readahead_end = I_MIN(idx + 1 + dstream->readahead_chunks,
+					   count);
+
+	/* close the previous chunk unless it's still in the readahead
+	   window (i.e. we seeked backwards) */
+	if (dstream->chunk_input != NULL) {
+		if (dstream->chunk_idx < idx ||
+		    dstream->chunk_idx >= readahead_end)
+			i_stream_dedup_close_chunk_file(dstream, dstream->chunk_idx);
+		else
+			i_stream_unref(&dstream->chunk_input);
+	}
+
+	/* Open the wanted chunk and start prefetching the following ones,
+	   so the backend can read them while we're still returning data
+	   from the current chunk. */
+	for (i = idx; i < readahead_end; i++) {
+		if (dstream->chunk_files[i] != NULL)
+			continue;
+		chunk = array_idx(&dstream->chunks, i);
+		T_BEGIN {
+			dstream->chunk_files[i] =
+				fs_file_init_with_event(dstream->chunk_fs,
+					dstream->event,
+					fs_dedup_chunk_ref_path(dstream->chunk_dir,
+								chunk->hash,
+								dstream->guid),
+					FS_OPEN_MODE_READONLY);
+		} T_END;
+		if (i != idx)
+			(void)fs_prefetch(dstream->chunk_files[i], chunk->size);
+	}
+	dstream->chunk_idx = idx;
+	dstream->chunk_input =
+		fs_read_stream(dstream->chunk_files[idx],
+			       dstream->istream.max_buffer_size);
+}
+
+static ssize_t i_stream_dedup_read(struct istream_private *stream)
+{
+	struct dedup_istream *dstream =
+		container_of(stream, struct dedup_istream, istream);
+	const struct dedup_chunk *chunk = NULL;
+	const unsigned char *data;
+	size_t size, avail;
+	uoff_t offset;
+	ssize_t ret;
+
+	offset = stream->istream.v_offset + (stream->pos - stream->skip);
+	if (offset >= dstream->size) {
+		stream->istream.eof = TRUE;
+		return -1;
+	}
+
+	if (dstream->chunk_input != NULL) {
+		chunk = array_idx(&dstream->chunks, dstream->chunk_idx);
+		if (offset < chunk->offset ||
+		    offset >= chunk->offset + chunk->size)
+			chunk = NULL;
+	}
+	if (chunk == NULL) {
+		unsigned int idx = i_stream_dedup_find_chunk(dstream, offset);
+
+		i_stream_dedup_open_chunk(dstream, idx);
+		chunk = array_idx(&dstream->chunks, idx);
+	}
+
+	i_stream_seek(dstream->chunk_input, offset - chunk->offset);
+	ret = i_stream_read_more(dstream->chunk_input, &data, &size);
+	if (ret == -1) {
+		if (dstream->chunk_input->stream_errno != 0) {
+			io_stream_set_error(&stream->iostream,
+				"read(%s) failed: %s",
+				i_stream_get_name(dstream->chunk_input),
+				i_stream_get_error(dstream->chunk_input));
+			stream->istream.stream_errno =
+				dstream->chunk_input->stream_errno;
+		} else {
+			io_stream_set_error(&stream->iostream,
+				"Chunk %s is smaller than expected "
+				"(%"PRIuUOFF_T" < %"PRIuUOFF_T")",
+				i_stream_get_name(dstream->chunk_input),
+				dstream->chunk_input->v_offset, chunk->size);
+			stream->istream.stream_errno = EIO;
+		}
+		return -1;
+	}
+	if (ret == 0)
+		return 0;
+
+	if (!i_stream_try_alloc(stream, size, &avail))
+		return -2;
+	size = I_MIN(size, avail);
+	size = I_MIN(size, chunk->offset + chunk->size - offset);
+	memcpy(stream->w_buffer + stream->pos, data, size);
+	i_stream_skip(dstream->chunk_input, size);
+	stream->pos += size;
+	return size;
+}
+
+static void
+i_stream_dedup_seek(struct istream_private *stream,
+		    uoff_t v_offset, bool mark ATTR_UNUSED)
+{
+	/* the next read() finds the chunk */
+	stream->istream.v_offset = v_offset;
+	stream->skip = stream->pos = 0;
+}
+
+static int
+i_stream_dedup_stat(struct istream_private *stream, bool exact ATTR_UNUSED)
+{
+	struct dedup_istream *dstream =
+		container_of(stream, struct dedup_istream, istream);
+
+	stream->statbuf.st_size = dstream->size;
+	return 0;
+}
+
+static struct istream *
+i_stream_create_dedup(struct dedup_fs_file *file, size_t max_buffer_size)
+{
+	struct dedup_istream *dstream;
+
+	dstream = i_new(struct dedup_istream, 1);
+	dstream->chunk_fs = file->file.parent->fs;
+	dstream->event = file->file.event;
+	event_ref(dstream->event);
+	dstream->chunk_dir = i_strdup(file->fs->chunk_dir);
+	guid_128_copy(dstream->guid, file->guid);
+	dstream->size = file->size;
+	i_array_init(&dstream->chunks, I_MAX(array_count(&file->chunks), 1));
+	array_append_array(&dstream->chunks, &file->chunks);
+	dstream->chunk_files = i_new(struct fs_file *,
+				     I_MAX(array_count(&file->chunks), 1));
+	dstream->readahead_chunks = file->fs->readahead_chunks;
+
+	dstream->istream.max_buffer_size = max_buffer_size;
+	dstream->istream.iostream.destroy = i_stream_dedup_destroy;
+	dstream->istream.read = i_stream_dedup_read;
+	dstream->istream.seek = i_stream_dedup_seek;
+	dstream->istream.stat = i_stream_dedup_stat;
+
+	dstream->istream.istream.readable_fd = FALSE;
+	dstream->istream.istream.blocking = TRUE;
+	dstream->istream.istream.seekable = TRUE;
+	return i_stream_create(&dstream->istream, NULL, -1, 0);
+}
+
+static struct istream *
+fs_dedup_read_stream(struct fs_file *_file, size_t max_buffer_size)
+{
+	struct dedup_fs_file *file = DEDUP_FILE(_file);
+	struct istream *input;
+
+	if (fs_dedup_manifest_read(file) < 0) {
+		return i_stream_create_error_str(errno, "%s",
+						 fs_file_last_error(_file));
+	}
+	input = i_stream_create_dedup(file, max_buffer_size);
+	i_stream_set_name(input, fs_file_path(_file));
+	return input;
+}
+
+static void
+fs_dedup_chunk_unref(struct dedup_fs_file *file, const guid_128_t guid,
+		     const struct dedup_chunk *chunk)
+{
+	struct fs_file *ref_file, *hash_file;
+	struct stat st;
+
+	ref_file = fs_file_init_parent(&file->file,
+		fs_dedup_chunk_ref_path(file->fs->chunk_dir, chunk->hash,
+					guid),
+		FS_OPEN_MODE_READONLY, 0);
+	if (fs_delete(ref_file) < 0) {
+		/* the same chunk may be used multiple times by a file */
+		if (errno != ENOENT)
+			e_error(file->file.event, "%s", fs_file_last_error(ref_file));
+		else
+			(void)fs_file_last_error(ref_file);
+	}
+	fs_file_deinit(&ref_file);
+
+	/* If only the hash file itself is left, nothing else uses the chunk.
+	   A racing writer may still link to it after our stat(), but it then
+	   has its own reference that keeps the data. */
+	hash_file = fs_file_init_parent(&file->file,
+		fs_dedup_chunk_path(file->fs->chunk_dir, chunk->hash),
+		FS_OPEN_MODE_READONLY, 0);
+	if (fs_stat(hash_file, &st) < 0) {
+		if (errno != ENOENT)
+			e_error(file->file.event, "%s", fs_file_last_error(hash_file));
+		else
+			(void)fs_file_last_error(hash_file);
+	} else if (st.st_nlink == 1) {
+		if (fs_delete(hash_file) < 0) {
+			if (errno != ENOENT)
+				e_error(file->file.event, "%s",
+					fs_file_last_error(hash_file));
+			else
+				(void)fs_file_last_error(hash_file);
+		}
+	}
+	fs_file_deinit(&hash_file);
+}
+
+static void
+fs_dedup_chunks_unref(struct dedup_fs_file *file, const guid_128_t guid,
+		      const ARRAY_TYPE(dedup_chunk) *chunks)
+{
+	const struct dedup_chunk *chunk;
+
+	array_foreach(chunks, chunk) T_BEGIN {
+		fs_dedup_chunk_unref(file, guid, chunk);
+	} T_END;
+}
+
+static int
+fs_dedup_chunk_store(struct dedup_fs_file *file,
+		     const unsigned char *data, size_t size)
+{
+	struct dedup_chunk *chunk;
+	struct fs_file *ref_file, *hash_file;
+	int ret = 0;
+
+	chunk = array_append_space(&file->chunks);
+	chunk->offset = file->size;
+	chunk->size = size;
+	sha256_get_digest(data, size, chunk->hash);
+	file->size += size;
+
+	ref_file = fs_file_init_parent(&file->file,
+		fs_dedup_chunk_ref_path(file->fs->chunk_dir, chunk->hash,
+					file->guid),
+		FS_OPEN_MODE_REPLACE, 0);
+	hash_file = fs_file_init_parent(&file->file,
+		fs_dedup_chunk_path(file->fs->chunk_dir, chunk->hash),
+		FS_OPEN_MODE_READONLY, 0);
+
+	if (fs_copy(hash_file, ref_file) == 0) {
+		/* chunk already exists - we just added a reference to it */
+	} else if (errno != ENOENT) {
+		fs_set_error(file->file.event, errno, "%s",
+			     fs_file_last_error(hash_file));
+		ret = -1;
+	} else {
+		/* new chunk */
+		(void)fs_file_last_error(hash_file);
+		if (fs_write(ref_file, data, size) < 0) {
+			fs_set_error(file->file.event, errno, "%s",
+				     fs_file_last_error(ref_file));
+			ret = -1;
+		} else if (fs_copy(ref_file, hash_file) < 0) {
+			if (errno == EEXIST) {
+				/* the same chunk was just created by someone
+				   else. it's too much trouble to try to
+				   deduplicate it anymore. */
+				(void)fs_file_last_error(ref_file);
+			} else {
+				e_error(file->file.event, "%s",
+					fs_file_last_error(ref_file));
+			}
+		}
+	}
+	fs_file_deinit(&ref_file);
+	fs_file_deinit(&hash_file);
+	return ret;
+}
+
+static int
+fs_dedup_write_chunks(struct dedup_fs_file *file, struct istream *input)
+{
+	const struct fs_dedup_chunker_settings *set = &file->fs->chunk_set;
+	const unsigned char *data;
+	buffer_t *buf;
+	size_t size, pos, chunk_size;
+	bool eof = FALSE;
+	int ret = 0;
+
+	buf = buffer_create_dynamic(default_pool, set->max_size);
+	while (!eof && ret == 0) {
+		/* fill the buffer so that a whole max-sized chunk fits */
+		while (buf->used < set->max_size &&
+		       i_stream_read_more(input, &data, &size) > 0) {
+			size = I_MIN(size, set->max_size - buf->used);
+			buffer_append(buf, data, size);
+			i_stream_skip(input, size);
+		}
+		if (input->stream_errno != 0) {
+			fs_set_error(file->file.event, input->stream_errno,
+				     "read(%s) failed: %s",
+				     i_stream_get_name(input),
+				     i_stream_get_error(input));
+			ret = -1;
+			break;
+		}
+		eof = input->eof && i_stream_get_data_size(input) == 0;
+
+		pos = 0;
+		while (ret == 0 && pos < buf->used &&
+		       (chunk_size = fs_dedup_chunker_find_boundary(set,
+				CONST_PTR_OFFSET(buf->data, pos),
+				buf->used - pos, eof)) > 0) T_BEGIN {
+			ret = fs_dedup_chunk_store(file,
+				CONST_PTR_OFFSET(buf->data, pos), chunk_size);
+			pos += chunk_size;
+		} T_END;
+		buffer_delete(buf, 0, pos);
+	}
+	buffer_free(&buf);
+	return ret;
+}
+
+static int fs_dedup_write_manifest(struct dedup_fs_file *file)
+{
+	const struct dedup_chunk *chunk;
+	string_t *str;
+
+	str = t_str_new(128 + array_count(&file->chunks) *
+			(SHA256_RESULTLEN*2 + 12));
+	str_printfa(str, "%s %s %"PRIuUOFF_T"\n", FS_DEDUP_MANIFEST_HEADER,
+		    guid_128_to_string(file->guid), file->size);
+	array_foreach(&file->chunks, chunk) {
+		binary_to_hex_append(str, chunk->hash, sizeof(chunk->hash));
+		str_printfa(str, " %"PRIuUOFF_T"\n", chunk->size);
+	}
+	return fs_write(file->file.parent, str_data(str), str_len(str));
+}
+
+static void fs_dedup_write_stream(struct fs_file *_file)
+{
+	struct dedup_fs_file *file = DEDUP_FILE(_file);
+
+	i_assert(_file->output == NULL);
+
+	if (_file->parent == NULL) {
+		_file->output = o_stream_create_error_str(EINVAL, "%s",
+						fs_file_last_error(_file));
+	} else {
+		/* the whole file needs to be chunked before the manifest
+		   can be written */
+		file->temp_output =
+			iostream_temp_create_named(_file->fs->temp_path_prefix,
+						   0, fs_file_path(_file));
+		_file->output = file->temp_output;
+		o_stream_ref(_file->output);
+	}
+	o_stream_set_name(_file->output, _file->path);
+}
+
+/* Read the manifest of the file that is being replaced. Returns 1 if it was
+   read, 0 if there's no such file, -1 on error. */
+static int
+fs_dedup_old_manifest_read(struct dedup_fs_file *file, guid_128_t guid_r,
+			   ARRAY_TYPE(dedup_chunk) *chunks)
+{
+	struct fs_file *old_file;
+	uoff_t size;
+	int ret;
+
+	old_file = fs_file_init_parent(&file->file, file->file.path,
+				       FS_OPEN_MODE_READONLY, 0);
+	if (fs_dedup_manifest_parse(file, old_file, guid_r, &size, chunks) == 0)
+		ret = 1;
+	else if (errno == ENOENT) {
+		(void)fs_file_last_error(&file->file);
+		ret = 0;
+	} else if (errno == EINVAL) {
+		/* don't prevent replacing a corrupted file */
+		e_error(file->file.event, "%s - leaking its chunks",
+			fs_file_last_error(&file->file));
+		ret = 0;
+	} else {
+		ret = -1;
+	}
+	fs_file_deinit(&old_file);
+	return ret;
+}
+
+static int fs_dedup_write_stream_finish(struct fs_file *_file, bool success)
+{
+	struct dedup_fs_file *file = DEDUP_FILE(_file);
+	ARRAY_TYPE(dedup_chunk) old_chunks;
+	guid_128_t old_guid;
+	struct istream *input;
+	int ret;
+
+	o_stream_unref(&_file->output);
+	if (!success) {
+		o_stream_destroy(&file->temp_output);
+		return -1;
+	}
+
+	/* The replaced file's chunk references are dropped only after the
+	   new manifest is written, so a failed write leaves the old file
+	   readable. */
+	i_array_init(&old_chunks, 16);
+	if (fs_dedup_old_manifest_read(file, old_guid, &old_chunks) < 0) {
+		array_free(&old_chunks);
+		o_stream_destroy(&file->temp_output);
+		return -1;
+	}
+
+	input = iostream_temp_finish(&file->temp_output, IO_BLOCK_SIZE);
+	guid_128_generate(file->guid);
+	file->size = 0;
+	array_clear(&file->chunks);
+	file->manifest_read = FALSE;
+
+	ret = fs_dedup_write_chunks(file, input);
+	i_stream_unref(&input);
+	if (ret == 0 && fs_dedup_write_manifest(file) < 0)
+		ret = -1;
+	if (ret < 0) {
+		/* drop the references that were already added */
+		fs_dedup_chunks_unref(file, file->guid, &file->chunks);
+		array_clear(&file->chunks);
+	} else {
+		file->manifest_read = TRUE;
+		fs_dedup_chunks_unref(file, old_guid, &old_chunks);
+	}
+	array_free(&old_chunks);
+	return ret < 0 ? -1 : 1;
+}
+
+static int fs_dedup_stat(struct fs_file *_file, struct stat *st_r)
+{
+	struct dedup_fs_file *file = DEDUP_FILE(_file);
+
+	if (fs_stat(_file->parent, st_r) < 0)
+		return -1;
+	if (fs_dedup_manifest_read(file) < 0)
+		return -1;
+	st_r->st_size = file->size;
+	return 0;
+}
+
+static int fs_dedup_delete(struct fs_file *_file)
+{
+	struct dedup_fs_file *file = DEDUP_FILE(_file);
+
+	if (fs_dedup_manifest_read(file) < 0)
+		return -1;
+	/* delete the manifest first - leaking chunk references on a crash is
+	   better than having a manifest pointing to deleted chunks */
+	if (fs_delete(_file->parent) < 0)
+		return -1;
+	fs_dedup_chunks_unref(file, file->guid, &file->chunks);
+	array_clear(&file->chunks);
+	file->manifest_read = FALSE;
+	return 0;
+}
+
+const struct fs fs_class_dedup = {
+	.name = "dedup",
+	.v = {
+		.alloc = fs_dedup_alloc,
+		.init = fs_dedup_init,
+		.deinit = NULL,
+		.free = fs_dedup_free,
+		.get_properties = fs_dedup_get_properties,
+		.file_alloc = fs_dedup_file_alloc,
+		.file_init = fs_dedup_file_init,
+		.file_deinit = fs_dedup_file_deinit,
+		.file_close = fs_dedup_file_close,
+		.get_path = fs_wrapper_file_get_path,
+		.set_async_callback = fs_wrapper_set_async_callback,
+		.wait_async = fs_wrapper_wait_async,
+		.set_metadata = fs_wrapper_set_metadata,
+		.get_metadata = fs_wrapper_get_metadata,
+		.prefetch = fs_wrapper_prefetch,
+		.read = NULL,
+		.read_stream = fs_dedup_read_stream,
+		.write = NULL,
+		.write_stream = fs_dedup_write_stream,
+		.write_stream_finish = fs_dedup_write_stream_finish,
+		.lock = fs_wrapper_lock,
+		.unlock = fs_wrapper_unlock,
+		.exists = fs_wrapper_exists,
+		.stat = fs_dedup_stat,
+		.copy = fs_default_copy,
+		.rename = fs_wrapper_rename,
+		.delete_file = fs_dedup_delete,
+		.iter_alloc = fs_wrapper_iter_alloc,
+		.iter_init = fs_wrapper_iter_init,
+		.iter_next = fs_wrapper_iter_next,
+		.iter_deinit = fs_wrapper_iter_deinit,
+		.switch_ioloop = NULL,
+		.get_nlinks = NULL,
+	}
+};
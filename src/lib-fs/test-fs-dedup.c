@@ -0,0 +1,335 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "istream.h"
+#include "ostream.h"
+#include "safe-mkdir.h"
+#include "unlink-directory.h"
+#include "fs-api.h"
+#include "fs-dedup-chunker.h"
+#include "test-common.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define TEST_DIR ".test-fs-dedup"
+#define TEST_FS_ARGS \
+	"min-chunk-size=256,avg-chunk-size=1024,max-chunk-size=4096:" \
+	"posix:prefix="TEST_DIR"/"
+
+static const struct fs_dedup_chunker_settings test_chunk_set = {
+	.min_size = 256,
+	.avg_size = 1024,
+	.max_size = 4096,
+};
+
+static void test_data_fill(buffer_t *buf, size_t size, uint32_t seed)
+{
+	unsigned char *data = buffer_append_space_unsafe(buf, size);
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed >> 16;
+	}
+}
+
+static int uint64_cmp(const uint64_t *a, const uint64_t *b)
+{
+	return *a < *b ? -1 : (*a > *b ? 1 : 0);
+}
+
+static void
+test_chunks_get(const buffer_t *buf, ARRAY_TYPE(uint64_t) *chunk_ends)
+{
+	uint64_t pos = 0;
+	size_t len;
+
+	while (pos < buf->used) {
+		len = fs_dedup_chunker_find_boundary(&test_chunk_set,
+			CONST_PTR_OFFSET(buf->data, pos), buf->used - pos, TRUE);
+		test_assert(len > 0);
+		if (len == 0)
+			break;
+		test_assert(len <= test_chunk_set.max_size);
+		test_assert(len >= test_chunk_set.min_size ||
+			    pos + len == buf->used);
+		pos += len;
+		array_push_back(chunk_ends, &pos);
+	}
+}
+
+static void test_fs_dedup_chunker(void)
+{
+	ARRAY_TYPE(uint64_t) ends1, ends2;
+	const uint64_t *end;
+	buffer_t *buf;
+	unsigned int shared = 0;
+	const char *error;
+
+	test_begin("fs dedup chunker");
+	test_assert(fs_dedup_chunker_settings_check(&test_chunk_set, &error) == 0);
+
+	buf = t_buffer_create(128*1024);
+	test_data_fill(buf, 128*1024, 1);
+	t_array_init(&ends1, 128);
+	t_array_init(&ends2, 128);
+	test_chunks_get(buf, &ends1);
+
+	/* not enough data to find a boundary */
+	test_assert(fs_dedup_chunker_find_boundary(&test_chunk_set, buf->data,
+						   test_chunk_set.min_size,
+						   FALSE) == 0);
+
+	/* insert some bytes near the beginning - the following boundaries
+	   must be found at the same (shifted) positions */
+	buffer_insert(buf, 1000, "inserted", 8);
+	test_chunks_get(buf, &ends2);
+	array_foreach(&ends1, end) {
+		uint64_t shifted_end = *end + 8;
+
+		if (*end > 1000 &&
+		    array_lsearch(&ends2, &shifted_end, uint64_cmp) != NULL)
+			shared++;
+	}
+	test_assert(array_count(&ends1) > 50);
+	test_assert(shared + 3 >= array_count(&ends1));
+	test_end();
+}
+
+static unsigned int test_count_chunk_files(bool refs)
+{
+	const char *chunk_dir = TEST_DIR"/chunks";
+	struct dirent *d, *d2;
+	DIR *dir, *dir2;
+	unsigned int count = 0;
+
+	if ((dir = opendir(chunk_dir)) == NULL)
+		return 0;
+	while ((d = readdir(dir)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+		const char *path = t_strconcat(chunk_dir, "/", d->d_name, NULL);
+		if ((dir2 = opendir(path)) == NULL)
+			continue;
+		while ((d2 = readdir(dir2)) != NULL) {
+			if (d2->d_name[0] == '.')
+				continue;
+			if ((strchr(d2->d_name, '-') != NULL) == refs)
+				count++;
+		}
+		closedir(dir2);
+	}
+	closedir(dir);
+	return count;
+}
+
+static void test_fs_dedup_write(struct fs *fs, const char *path,
+				const buffer_t *data)
+{
+	struct fs_file *file = fs_file_init(fs, path, FS_OPEN_MODE_REPLACE);
+	struct ostream *output = fs_write_stream(file);
+
+	o_stream_nsend(output, data->data, data->used);
+	test_assert(fs_write_stream_finish(file, &output) == 1);
+	fs_file_deinit(&file);
+}
+
+static bool test_fs_dedup_read_equals(struct fs *fs, const char *path,
+				      const buffer_t *data, uoff_t seek_offset)
+{
+	struct fs_file *file = fs_file_init(fs, path, FS_OPEN_MODE_READONLY);
+	struct istream *input = fs_read_stream(file, 512);
+	buffer_t *buf = t_buffer_create(data->used);
+	const unsigned char *rdata;
+	size_t size;
+	bool ret;
+
+	i_stream_seek(input, seek_offset);
+	while (i_stream_read_more(input, &rdata, &size) > 0) {
+		buffer_append(buf, rdata, size);
+		i_stream_skip(input, size);
+	}
+	ret = input->stream_errno == 0 &&
+		buf->used == data->used - seek_offset &&
+		memcmp(buf->data, CONST_PTR_OFFSET(data->data, seek_offset),
+		       buf->used) == 0;
+	i_stream_unref(&input);
+	fs_file_deinit(&file);
+	return ret;
+}
+
+static void test_fs_dedup_posix(void)
+{
+	struct fs_settings fs_set;
+	struct fs_file *file;
+	struct fs *fs;
+	struct stat st;
+	buffer_t *data1, *data2;
+	const char *error;
+	unsigned int chunk_count;
+
+	test_begin("fs dedup posix");
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error) < 0)
+		i_fatal("unlink_directory(%s) failed: %s", TEST_DIR, error);
+	if (safe_mkdir(TEST_DIR, 0700, (uid_t)-1, (gid_t)-1) != 1)
+		i_fatal("safe_mkdir(%s) failed", TEST_DIR);
+
+	i_zero(&fs_set);
+	if (fs_init("dedup", TEST_FS_ARGS, &fs_set, &fs, &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+	test_assert((fs_get_properties(fs) & FS_PROPERTY_FASTCOPY) == 0);
+
+	data1 = t_buffer_create(64*1024);
+	test_data_fill(data1, 64*1024, 2);
+	data2 = t_buffer_create(data1->used + 8);
+	buffer_append_buf(data2, data1, 0, SIZE_MAX);
+	buffer_insert(data2, 30000, "modified", 8);
+
+	/* write the first file and read it back */
+	test_fs_dedup_write(fs, "file1", data1);
+	test_assert(test_fs_dedup_read_equals(fs, "file1", data1, 0));
+	test_assert(test_fs_dedup_read_equals(fs, "file1", data1, 40000));
+	chunk_count = test_count_chunk_files(FALSE);
+	test_assert(chunk_count > 10);
+	test_assert(test_count_chunk_files(TRUE) == chunk_count);
+
+	file = fs_file_init(fs, "file1", FS_OPEN_MODE_READONLY);
+	test_assert(fs_stat(file, &st) == 0 &&
+		    st.st_size == (off_t)data1->used);
+	fs_file_deinit(&file);
+
+	/* the modified file shares most of its chunks */
+	test_fs_dedup_write(fs, "file2", data2);
+	test_assert(test_fs_dedup_read_equals(fs, "file2", data2, 0));
+	test_assert(test_count_chunk_files(FALSE) <= chunk_count + 3);
+
+	/* deleting the first file keeps the second one readable */
+	file = fs_file_init(fs, "file1", FS_OPEN_MODE_READONLY);
+	test_assert(fs_delete(file) == 0);
+	test_assert(fs_exists(file) == 0);
+	fs_file_deinit(&file);
+	test_assert(test_fs_dedup_read_equals(fs, "file2", data2, 12345));
+
+	/* deleting the last file drops all chunks */
+	file = fs_file_init(fs, "file2", FS_OPEN_MODE_READONLY);
+	test_assert(fs_delete(file) == 0);
+	fs_file_deinit(&file);
+	test_assert(test_count_chunk_files(FALSE) == 0);
+	test_assert(test_count_chunk_files(TRUE) == 0);
+
+	/* missing file */
+	file = fs_file_init(fs, "file1", FS_OPEN_MODE_READONLY);
+	test_assert(fs_stat(file, &st) < 0 && errno == ENOENT);
+	fs_file_deinit(&file);
+
+	/* empty file */
+	buffer_set_used_size(data1, 0);
+	test_fs_dedup_write(fs, "empty", data1);
+	test_assert(test_fs_dedup_read_equals(fs, "empty", data1, 0));
+
+	fs_deinit(&fs);
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error) < 0)
+		i_error("unlink_directory(%s) failed: %s", TEST_DIR, error);
+	test_end();
+}
+
+static void test_fs_dedup_replace(void)
+{
+	struct fs_settings fs_set;
+	struct fs_file *file;
+	struct fs *fs, *posix_fs;
+	buffer_t *data1, *data2;
+	const char *error;
+
+	test_begin("fs dedup replace");
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error) < 0)
+		i_fatal("unlink_directory(%s) failed: %s", TEST_DIR, error);
+	if (safe_mkdir(TEST_DIR, 0700, (uid_t)-1, (gid_t)-1) != 1)
+		i_fatal("safe_mkdir(%s) failed", TEST_DIR);
+
+	i_zero(&fs_set);
+	if (fs_init("dedup", TEST_FS_ARGS, &fs_set, &fs, &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+
+	data1 = t_buffer_create(64*1024);
+	test_data_fill(data1, 64*1024, 3);
+	data2 = t_buffer_create(64*1024);
+	test_data_fill(data2, 64*1024, 4);
+
+	test_fs_dedup_write(fs, "file", data1);
+	test_assert(test_count_chunk_files(TRUE) > 10);
+
+	/* replacing the file drops the old chunks after the new manifest
+	   is written */
+	test_fs_dedup_write(fs, "file", data2);
+	test_assert(test_fs_dedup_read_equals(fs, "file", data2, 0));
+	test_assert(test_count_chunk_files(TRUE) ==
+		    test_count_chunk_files(FALSE));
+
+	/* replacing with the same content keeps the shared chunks */
+	test_fs_dedup_write(fs, "file", data2);
+	test_assert(test_fs_dedup_read_equals(fs, "file", data2, 0));
+	test_assert(test_count_chunk_files(TRUE) ==
+		    test_count_chunk_files(FALSE));
+
+	file = fs_file_init(fs, "file", FS_OPEN_MODE_READONLY);
+	test_assert(fs_delete(file) == 0);
+	fs_file_deinit(&file);
+	test_assert(test_count_chunk_files(TRUE) == 0);
+
+	/* a corrupted manifest can still be replaced */
+	if (fs_init("posix", "prefix="TEST_DIR"/", &fs_set, &posix_fs,
+		    &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+	file = fs_file_init(posix_fs, "file", FS_OPEN_MODE_REPLACE);
+	test_assert(fs_write(file, "garbage\n", 8) == 0);
+	fs_file_deinit(&file);
+	fs_deinit(&posix_fs);
+	test_expect_error_string("Corrupted dedup manifest");
+	test_fs_dedup_write(fs, "file", data1);
+	test_expect_no_more_errors();
+	test_assert(test_fs_dedup_read_equals(fs, "file", data1, 0));
+
+	file = fs_file_init(fs, "file", FS_OPEN_MODE_READONLY);
+	test_assert(fs_delete(file) == 0);
+	fs_file_deinit(&file);
+	test_assert(test_count_chunk_files(FALSE) == 0);
+	test_assert(test_count_chunk_files(TRUE) == 0);
+
+	fs_deinit(&fs);
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR, &error) < 0)
+		i_error("unlink_directory(%s) failed: %s", TEST_DIR, error);
+	test_end();
+}
+
+static void test_fs_dedup_init_errors(void)
+{
+	struct fs_settings fs_set;
+	struct fs *fs;
+	const char *error;
+
+	test_begin("fs dedup init errors");
+	i_zero(&fs_set);
+	test_assert(fs_init("dedup", "", &fs_set, &fs, &error) < 0);
+	test_assert(fs_init("dedup", "avg-chunk-size=1000:posix",
+			    &fs_set, &fs, &error) < 0);
+	test_assert(fs_init("dedup", "foo=bar:posix",
+			    &fs_set, &fs, &error) < 0);
+	test_assert(fs_init("dedup", "test", &fs_set, &fs, &error) < 0);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_fs_dedup_chunker,
+		test_fs_dedup_posix,
+		test_fs_dedup_replace,
+		test_fs_dedup_init_errors,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -0,0 +1,217 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "fts-language.h"
+#include "fts-filter.h"
+#include "fts-filter-private.h"
+#include "fts-tokenizer.h"
+
+#include <stdio.h>
+
+/**
+ * Measures tokenizing and filtering throughput on a generated English and
+ * German text corpus. The words are picked with a Zipf-like distribution,
+ * so that the most common words repeat the way they do in real mails. The
+ * filter chains are run both with and without the token cache.
+ */
+
+#define BENCH_MIN_NSECS (500ULL*1000*1000)
+
+static const char *const bench_words_en[] = {
+	"the", "of", "and", "to", "a", "in", "is", "you", "that", "it",
+	"for", "on", "with", "as", "this", "was", "be", "have", "are", "not",
+	"meeting", "tomorrow", "please", "attached", "report", "thanks",
+	"regards", "project", "schedule", "review", "customer's", "invoice",
+	"deadline", "discussed", "shipping", "quarterly", "implementation",
+	"requirements", "availability", "conference", "presentation",
+	"unfortunately", "approximately", "responsibilities", "acknowledged",
+	"infrastructure", "configuration", "documentation", "maintenance",
+	"Café", "naïve", "résumé", "don't", "it's", "we'll", "O'Brien",
+};
+
+static const char *const bench_words_de[] = {
+	"der", "die", "und", "in", "den", "von", "zu", "das", "mit", "sich",
+	"des", "auf", "für", "ist", "im", "dem", "nicht", "ein", "eine", "als",
+	"Besprechung", "morgen", "bitte", "Anhang", "Bericht", "danke",
+	"Grüße", "Projekt", "Zeitplan", "Überprüfung", "Kunden", "Rechnung",
+	"Frist", "besprochen", "Versand", "vierteljährlich", "Umsetzung",
+	"Anforderungen", "Verfügbarkeit", "Konferenz", "Präsentation",
+	"leider", "ungefähr", "Verantwortlichkeiten", "bestätigt",
+	"Infrastruktur", "Konfiguration", "Dokumentation", "Wartung",
+	"Straße", "Größe", "Müller", "Fußball", "schön", "Mädchen",
+};
+
+struct bench_chain {
+	const char *name;
+	const struct fts_language *lang;
+	char *text;
+	size_t text_size;
+};
+
+static unsigned int bench_rand(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed / 65536) % 32768;
+}
+
+static const char *
+bench_generate_text(const char *const *words, unsigned int words_count,
+		    unsigned int word_count, unsigned int seed)
+{
+	string_t *str = t_str_new(word_count * 8);
+	unsigned int i, n;
+
+	for (i = 0; i < word_count; i++) {
+		/* roughly Zipf: low indexes are much more common */
+		n = bench_rand(&seed) % words_count;
+		n = n * (bench_rand(&seed) % words_count) / words_count;
+		str_append(str, words[n]);
+		if (bench_rand(&seed) % 12 == 0)
+			str_append(str, ".\n");
+		else if (bench_rand(&seed) % 8 == 0)
+			str_append(str, ", ");
+		else
+			str_append_c(str, ' ');
+	}
+	return str_c(str);
+}
+
+static struct fts_filter *
+bench_filter_create(const struct fts_language *lang)
+{
+	const char *const stopword_settings[] = {
+		"stopwords_dir", TEST_STOPWORDS_DIR, NULL
+	};
+	const char *const snowball_settings[] = { "lang", lang->name, NULL };
+	struct fts_filter *filter, *parent;
+	const char *error;
+
+#ifdef HAVE_LIBICU
+	if (fts_filter_create(fts_filter_normalizer_icu, NULL, lang, NULL,
+			      &parent, &error) < 0)
+		i_fatal("normalizer-icu: %s", error);
+#else
+	if (fts_filter_create(fts_filter_lowercase, NULL, lang, NULL,
+			      &parent, &error) < 0)
+		i_fatal("lowercase: %s", error);
+#endif
+	if (fts_filter_create(fts_filter_stopwords, parent, lang,
+			      stopword_settings, &filter, &error) < 0)
+		i_fatal("stopwords: %s", error);
+	fts_filter_unref(&parent);
+#ifdef HAVE_FTS_STEMMER
+	parent = filter;
+	if (fts_filter_create(fts_filter_stemmer_snowball, parent, lang,
+			      snowball_settings, &filter, &error) < 0)
+		i_fatal("snowball: %s", error);
+	fts_filter_unref(&parent);
+#else
+	(void)snowball_settings;
+#endif
+	return filter;
+}
+
+static unsigned int
+bench_tokenize(struct fts_tokenizer *tokenizer, struct fts_filter *filter,
+	       const char *text, size_t text_size)
+{
+	const char *token, *error;
+	unsigned int count = 0;
+	int ret, ret2;
+
+	while ((ret = fts_tokenizer_next(tokenizer, (const void *)text,
+					 text_size, &token, &error)) > 0) {
+		ret2 = filter == NULL ? 1 :
+			fts_filter_filter(filter, &token, &error);
+		if (ret2 < 0)
+			i_fatal("fts_filter_filter() failed: %s", error);
+		count += ret2;
+	}
+	if (ret < 0)
+		i_fatal("fts_tokenizer_next() failed: %s", error);
+	while (fts_tokenizer_final(tokenizer, &token, &error) > 0)
+		count++;
+	return count;
+}
+
+static void
+bench_run(const char *name, const struct bench_chain *chain,
+	  const char *algorithm, bool use_filter, unsigned int cache_size)
+{
+	const char *const settings[] = { "algorithm", algorithm, NULL };
+	struct fts_tokenizer *tokenizer;
+	struct fts_filter *filter = NULL;
+	const char *error;
+	uint64_t start, nsecs, bytes = 0;
+	unsigned int tokens = 0;
+
+	if (fts_tokenizer_create(fts_tokenizer_generic, NULL, settings,
+				 &tokenizer, &error) < 0)
+		i_fatal("fts_tokenizer_create() failed: %s", error);
+	if (use_filter) {
+		filter = bench_filter_create(chain->lang);
+		fts_filter_set_cache_size(filter, cache_size);
+	}
+
+	start = i_nanoseconds();
+	do {
+		T_BEGIN {
+			tokens += bench_tokenize(tokenizer, filter, chain->text,
+						 chain->text_size);
+		} T_END;
+		bytes += chain->text_size;
+		nsecs = i_nanoseconds() - start;
+	} while (nsecs < BENCH_MIN_NSECS);
+
+	printf("%-4s %-28s %10.1f MB/s %12u tokens\n", chain->name, name,
+	       bytes * 1000.0 / nsecs, tokens);
+	if (filter != NULL)
+		fts_filter_unref(&filter);
+	fts_tokenizer_unref(&tokenizer);
+}
+
+int main(int argc, const char *argv[])
+{
+	const struct fts_language lang_en = { .name = "en" };
+	const struct fts_language lang_de = { .name = "de" };
+	struct bench_chain chains[2];
+	unsigned int i, word_count = 100000;
+
+	lib_init();
+	if (argc > 2 ||
+	    (argc == 2 && (str_to_uint(argv[1], &word_count) < 0 ||
+			   word_count == 0))) {
+		fprintf(stderr, "Usage: %s [word count]\n", argv[0]);
+		return 1;
+	}
+	fts_filters_init();
+	fts_tokenizers_init();
+
+	chains[0].name = "en";
+	chains[0].lang = &lang_en;
+	chains[0].text = i_strdup(bench_generate_text(bench_words_en,
+		N_ELEMENTS(bench_words_en), word_count, 1));
+	chains[1].name = "de";
+	chains[1].lang = &lang_de;
+	chains[1].text = i_strdup(bench_generate_text(bench_words_de,
+		N_ELEMENTS(bench_words_de), word_count, 2));
+
+	for (i = 0; i < N_ELEMENTS(chains); i++) {
+		chains[i].text_size = strlen(chains[i].text);
+		bench_run("simple", &chains[i], "simple", FALSE, 0);
+		bench_run("tr29", &chains[i], "tr29", FALSE, 0);
+		bench_run("simple + filters", &chains[i], "simple", TRUE, 0);
+		bench_run("simple + filters + cache", &chains[i], "simple",
+			  TRUE, FTS_FILTER_CACHE_DEFAULT_SIZE);
+	}
+	for (i = 0; i < N_ELEMENTS(chains); i++)
+		i_free_and_null(chains[i].text);
+
+	fts_tokenizers_deinit();
+	fts_filters_deinit();
+	lib_deinit();
+	return 0;
+}
@@ -5,6 +5,9 @@
 
 #define FTS_FILTER_CLASSES_NR 6
 
+/* Number of tokens whose filtering results are cached by default */
+#define FTS_FILTER_CACHE_DEFAULT_SIZE 10000
+
 /*
  API that stemming providers (classes) must provide: The create()
  function is called to get an instance of a registered filter class.
@@ -30,6 +33,12 @@ struct fts_filter {
 	string_t *token;
 	size_t max_length;
 	int refcount;
+
+	/* Filtering results of the most recently used tokens when the
+	   filter is called via fts_filter_filter(). Created lazily, so the
+	   parent filters won't have it. */
+	struct fts_filter_cache *cache;
+	unsigned int cache_size;
 };
 
 #endif
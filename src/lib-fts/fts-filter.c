@@ -2,6 +2,8 @@
 
 #include "lib.h"
 #include "array.h"
+#include "hash.h"
+#include "llist.h"
 #include "str.h"
 #include "fts-language.h"
 #include "fts-filter-private.h"
@@ -10,6 +12,21 @@
 #  include "fts-icu.h"
 #endif
 
+struct fts_filter_cache_entry {
+	struct fts_filter_cache_entry *prev, *next;
+
+	const char *token;
+	/* NULL if the token was filtered out */
+	const char *result;
+};
+
+struct fts_filter_cache {
+	HASH_TABLE(const char *, struct fts_filter_cache_entry *) entries;
+	/* head is the most recently used entry */
+	struct fts_filter_cache_entry *head, *tail;
+	unsigned int count;
+};
+
 static ARRAY(const struct fts_filter *) fts_filter_classes;
 
 void fts_filters_init(void)
@@ -81,6 +98,8 @@ int fts_filter_create(const struct fts_filter *filter_class,
 	}
 	fp->refcount = 1;
 	fp->parent = parent;
+	fp->cache = NULL;
+	fp->cache_size = FTS_FILTER_CACHE_DEFAULT_SIZE;
 	if (parent != NULL) {
 		fts_filter_ref(parent);
 	}
@@ -94,6 +113,87 @@ void fts_filter_ref(struct fts_filter *fp)
 	fp->refcount++;
 }
 
+static void fts_filter_cache_remove_tail(struct fts_filter_cache *cache)
+{
+	struct fts_filter_cache_entry *entry = cache->tail;
+
+	hash_table_remove(cache->entries, entry->token);
+	DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+	cache->count--;
+	i_free(entry);
+}
+
+static void fts_filter_cache_free(struct fts_filter_cache **_cache)
+{
+	struct fts_filter_cache *cache = *_cache;
+
+	*_cache = NULL;
+	while (cache->tail != NULL)
+		fts_filter_cache_remove_tail(cache);
+	hash_table_destroy(&cache->entries);
+	i_free(cache);
+}
+
+static struct fts_filter_cache_entry *
+fts_filter_cache_lookup(struct fts_filter_cache *cache, const char *token)
+{
+	struct fts_filter_cache_entry *entry;
+
+	entry = hash_table_lookup(cache->entries, token);
+	if (entry != NULL && entry != cache->head) {
+		DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+		DLLIST2_PREPEND(&cache->head, &cache->tail, entry);
+	}
+	return entry;
+}
+
+static void
+fts_filter_cache_add(struct fts_filter *filter, const char *token,
+		     const char *result)
+{
+	struct fts_filter_cache *cache = filter->cache;
+	struct fts_filter_cache_entry *entry;
+	size_t token_size = strlen(token) + 1;
+	size_t result_size = result == NULL ? 0 : strlen(result) + 1;
+	char *p;
+
+	if (cache == NULL) {
+		cache = filter->cache = i_new(struct fts_filter_cache, 1);
+		hash_table_create(&cache->entries, default_pool, 0,
+				  str_hash, strcmp);
+	}
+	while (cache->count >= filter->cache_size)
+		fts_filter_cache_remove_tail(cache);
+
+	/* the strings are allocated right after the entry */
+	entry = i_malloc(MALLOC_ADD(sizeof(*entry),
+				    MALLOC_ADD(token_size, result_size)));
+	p = PTR_OFFSET(entry, sizeof(*entry));
+	memcpy(p, token, token_size);
+	entry->token = p;
+	if (result != NULL) {
+		memcpy(p + token_size, result, result_size);
+		entry->result = p + token_size;
+	}
+	hash_table_insert(cache->entries, entry->token, entry);
+	DLLIST2_PREPEND(&cache->head, &cache->tail, entry);
+	cache->count++;
+}
+
+void fts_filter_set_cache_size(struct fts_filter *filter,
+			       unsigned int cache_size)
+{
+	filter->cache_size = cache_size;
+	if (filter->cache == NULL)
+		return;
+	if (cache_size == 0) {
+		fts_filter_cache_free(&filter->cache);
+		return;
+	}
+	while (filter->cache->count > cache_size)
+		fts_filter_cache_remove_tail(filter->cache);
+}
+
 void fts_filter_unref(struct fts_filter **_fpp)
 {
 	struct fts_filter *fp = *_fpp;
@@ -106,6 +206,8 @@ void fts_filter_unref(struct fts_filter **_fpp)
 
 	if (fp->parent != NULL)
 		fts_filter_unref(&fp->parent);
+	if (fp->cache != NULL)
+		fts_filter_cache_free(&fp->cache);
 	if (fp->v.destroy != NULL)
 		fp->v.destroy(fp);
 	else {
@@ -115,16 +217,15 @@ void fts_filter_unref(struct fts_filter **_fpp)
 	}
 }
 
-int fts_filter_filter(struct fts_filter *filter, const char **token,
-		      const char **error_r)
+static int
+fts_filter_filter_chain(struct fts_filter *filter, const char **token,
+			const char **error_r)
 {
 	int ret = 0;
 
-	i_assert((*token)[0] != '\0');
-
 	/* Recurse to parent. */
 	if (filter->parent != NULL)
-		ret = fts_filter_filter(filter->parent, token, error_r);
+		ret = fts_filter_filter_chain(filter->parent, token, error_r);
 
 	/* Parent returned token or no parent. */
 	if (ret > 0 || filter->parent == NULL)
@@ -138,3 +239,31 @@ int fts_filter_filter(struct fts_filter *filter, const char **token,
 	}
 	return ret;
 }
+
+int fts_filter_filter(struct fts_filter *filter, const char **token,
+		      const char **error_r)
+{
+	struct fts_filter_cache_entry *entry;
+	const char *orig_token = *token;
+	int ret;
+
+	i_assert((*token)[0] != '\0');
+
+	if (filter->cache_size == 0)
+		return fts_filter_filter_chain(filter, token, error_r);
+
+	/* The same words are seen over and over again, so remember what the
+	   whole chain returned for them. The filters are language-specific,
+	   so this is also a per-language cache. */
+	if (filter->cache != NULL) {
+		entry = fts_filter_cache_lookup(filter->cache, orig_token);
+		if (entry != NULL) {
+			*token = entry->result;
+			return entry->result == NULL ? 0 : 1;
+		}
+	}
+	ret = fts_filter_filter_chain(filter, token, error_r);
+	if (ret >= 0)
+		fts_filter_cache_add(filter, orig_token, *token);
+	return ret;
+}
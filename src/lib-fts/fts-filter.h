@@ -61,6 +61,12 @@ int fts_filter_create(const struct fts_filter *filter_class,
 void fts_filter_ref(struct fts_filter *filter);
 void fts_filter_unref(struct fts_filter **filter);
 
+/* Set the maximum number of tokens whose filtering results are remembered,
+   so that filtering them again doesn't need to go through the filter chain.
+   0 disables the cache. */
+void fts_filter_set_cache_size(struct fts_filter *filter,
+			       unsigned int cache_size);
+
 /* Returns 1 if token is returned in *token, 0 if token was filtered
    out (*token is also set to NULL) and -1 on error.
    Input is also given via *token.
@@ -32,6 +32,8 @@ static unsigned char fts_ascii_word_breaks[128] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0  /* 112-127: {|}~ */
 };
 
+static void fts_ascii_letter_types_init(void);
+
 static int
 fts_tokenizer_generic_create(const char *const *settings,
 			     struct fts_tokenizer **tokenizer_r,
@@ -92,10 +94,12 @@ fts_tokenizer_generic_create(const char *const *settings,
 	}
 
 	tok = i_new(struct generic_fts_tokenizer, 1);
-	if (algo == BOUNDARY_ALGORITHM_TR29)
+	if (algo == BOUNDARY_ALGORITHM_TR29) {
+		fts_ascii_letter_types_init();
 		tok->tokenizer.v = &generic_tokenizer_vfuncs_tr29;
-	else
+	} else {
 		tok->tokenizer.v = &generic_tokenizer_vfuncs_simple;
+	}
 	tok->max_length = max_length;
 	tok->algorithm = algo;
 	tok->wb5a = wb5a;
@@ -347,16 +351,40 @@ fts_tokenizer_generic_simple_next(struct fts_tokenizer *_tok,
 {
 	struct generic_fts_tokenizer *tok =
 		container_of(_tok, struct generic_fts_tokenizer, tokenizer);
-	size_t i, start;
-	int char_size;
+	size_t i, start, char_size;
 	unichar_t c;
 	bool apostrophe;
 	enum fts_break_type break_type;
 
 	start = tok->token->used > 0 ? 0 : skip_base64(data, size);
 	for (i = start; i < size; i += char_size) {
-		char_size = uni_utf8_get_char_n(data + i, size - i, &c);
-		i_assert(char_size > 0);
+		if (data[i] < 0x80 &&
+		    (tok->prev_type == LETTER_TYPE_ALETTER ||
+		     tok->prev_type == LETTER_TYPE_SINGLE_QUOTE)) {
+			/* Fast path: Continuing a word with ASCII letters
+			   doesn't need any of the checks below. */
+			size_t word_end = i;
+
+			while (word_end < size && data[word_end] < 0x80 &&
+			       fts_ascii_word_breaks[data[word_end]] == 0 &&
+			       data[word_end] != '\'')
+				word_end++;
+			if (word_end > i) {
+				if (word_end - i > 1)
+					shift_prev_type(tok, LETTER_TYPE_ALETTER);
+				shift_prev_type(tok, LETTER_TYPE_ALETTER);
+				char_size = word_end - i;
+				continue;
+			}
+		}
+		if (data[i] < 0x80) {
+			c = data[i];
+			char_size = 1;
+		} else {
+			int ret = uni_utf8_get_char_n(data + i, size - i, &c);
+			i_assert(ret > 0);
+			char_size = ret;
+		}
 
 		apostrophe = IS_APOSTROPHE(c);
 		if ((tok->prefixsplat && IS_PREFIX_SPLAT(c)) &&
@@ -458,6 +486,20 @@ static enum letter_type letter_type(unichar_t c)
 	return LETTER_TYPE_OTHER;
 }
 
+/* letter_type() for ASCII characters, filled on the first
+   fts_tokenizer_generic_create() call */
+static enum letter_type fts_ascii_letter_types[128];
+
+static void fts_ascii_letter_types_init(void)
+{
+	unichar_t c;
+
+	if (fts_ascii_letter_types['a'] != LETTER_TYPE_NONE)
+		return;
+	for (c = 0; c < N_ELEMENTS(fts_ascii_letter_types); c++)
+		fts_ascii_letter_types[c] = letter_type(c);
+}
+
 static bool letter_panic(struct generic_fts_tokenizer *tok ATTR_UNUSED)
 {
 	i_panic("Letter type should not be used.");
@@ -812,10 +854,16 @@ fts_tokenizer_generic_tr29_next(struct fts_tokenizer *_tok,
 	start_pos = tok->token->used > 0 ? 0 : skip_base64(data, size);
 	for (i = start_pos; i < size; ) {
 		char_start_i = i;
-		char_size = uni_utf8_get_char_n(data + i, size - i, &c);
-		i_assert(char_size > 0);
-		i += char_size;
-		lt = letter_type(c);
+		if (data[i] < 0x80) {
+			c = data[i];
+			lt = fts_ascii_letter_types[c];
+			i++;
+		} else {
+			char_size = uni_utf8_get_char_n(data + i, size - i, &c);
+			i_assert(char_size > 0);
+			i += char_size;
+			lt = letter_type(c);
+		}
 
 		/* The WB5a break is detected only when the "after
 		   break" char is inspected. That char needs to be
@@ -179,6 +179,12 @@ void fts_tokenizer_reset(struct fts_tokenizer *tok)
 {
 	tok->v->reset(tok);
 	fts_tokenizer_self_reset(tok);
+	/* the parent may be in the middle of returning tokens, e.g. if the
+	   caller stopped after a failure */
+	tok->parent_state = FTS_TOKENIZER_PARENT_STATE_ADD_DATA;
+	tok->finalize_parent_pending = FALSE;
+	if (tok->parent != NULL)
+		fts_tokenizer_reset(tok->parent);
 }
 
 int fts_tokenizer_next(struct fts_tokenizer *tok,
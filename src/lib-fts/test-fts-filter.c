@@ -7,6 +7,7 @@
 #include "test-common.h"
 #include "fts-language.h"
 #include "fts-filter.h"
+#include "fts-filter-private.h"
 
 #include <stdio.h>
 
@@ -973,6 +974,82 @@ static void test_fts_filter_english_possessive(void)
 	test_end();
 }
 
+static unsigned int test_filter_call_count;
+
+static int
+test_fts_filter_counting_filter(struct fts_filter *filter ATTR_UNUSED,
+				const char **token,
+				const char **error_r ATTR_UNUSED)
+{
+	test_filter_call_count++;
+	if (strcmp(*token, "drop") == 0)
+		return 0;
+	*token = t_str_ucase(*token);
+	return 1;
+}
+
+static const struct fts_filter test_fts_filter_counting = {
+	.class_name = "test-counting",
+	.v = {
+		NULL,
+		test_fts_filter_counting_filter,
+		NULL
+	}
+};
+
+static void test_fts_filter_cache(void)
+{
+	static const struct {
+		const char *input;
+		const char *output;
+		bool cached;
+	} tests[] = {
+		{ "foo", "FOO", FALSE },
+		{ "foo", "FOO", TRUE },
+		{ "drop", NULL, FALSE },
+		{ "drop", NULL, TRUE },
+		{ "foo's", "FOO", FALSE },
+		/* "foo" was the least recently used and got dropped */
+		{ "foo", "FOO", FALSE },
+		{ "foo's", "FOO", TRUE },
+		{ "bar", "BAR", FALSE },
+		{ "foo's", "FOO", TRUE },
+		{ "foo", "FOO", FALSE },
+	};
+	struct fts_filter *parent, *filter;
+	const char *token, *error;
+	unsigned int i, prev_count;
+	int ret;
+
+	test_begin("fts filter cache");
+	test_assert(fts_filter_create(fts_filter_english_possessive, NULL, NULL,
+				      NULL, &parent, &error) == 0);
+	test_assert(fts_filter_create(&test_fts_filter_counting, parent,
+				      NULL, NULL, &filter, &error) == 0);
+	fts_filter_unref(&parent);
+	fts_filter_set_cache_size(filter, 2);
+
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		prev_count = test_filter_call_count;
+		token = tests[i].input;
+		ret = fts_filter_filter(filter, &token, &error);
+		test_assert_idx(ret == (tests[i].output == NULL ? 0 : 1), i);
+		test_assert_idx(null_strcmp(token, tests[i].output) == 0, i);
+		test_assert_idx((test_filter_call_count == prev_count) ==
+				tests[i].cached, i);
+	}
+
+	/* disabling the cache filters every token again */
+	fts_filter_set_cache_size(filter, 0);
+	prev_count = test_filter_call_count;
+	token = "foo";
+	test_assert(fts_filter_filter(filter, &token, &error) == 1);
+	test_assert(null_strcmp(token, "FOO") == 0);
+	test_assert(test_filter_call_count == prev_count + 1);
+	fts_filter_unref(&filter);
+	test_end();
+}
+
 /* TODO: Functions to test 1. ref-unref pairs 2. multiple registers +
   an unregister + find */
 
@@ -1014,6 +1091,7 @@ int main(void)
 #endif
 #endif
 		test_fts_filter_english_possessive,
+		test_fts_filter_cache,
 		NULL
 	};
 	int ret;
@@ -570,6 +570,64 @@ static void test_imapc_reconnect_resend_commands(void)
 	test_end();
 }
 
+/*
+ * imapc pipelined commands
+ */
+
+static void test_imapc_pipelined_cmds_client(void)
+{
+	struct imapc_command *cmd;
+	unsigned int i;
+
+	/* login to server */
+	imapc_client_set_login_callback(imapc_client,
+					imapc_login_callback, NULL);
+	imapc_client_login(imapc_client);
+	imapc_client_run(imapc_client);
+	test_assert(imapc_login_last_reply == IMAPC_COMMAND_STATE_OK);
+	imapc_login_last_reply = IMAPC_COMMAND_STATE_INVALID;
+
+	/* the server won't reply before it has received all the commands */
+	for (i = 1; i <= 3; i++) {
+		cmd = imapc_client_cmd(imapc_client,
+				       imapc_command_callback, NULL);
+		imapc_command_sendf(cmd, "PIPELINED%u", i);
+	}
+	test_assert(test_imapc_cmd_last_reply_expect(IMAPC_COMMAND_STATE_OK));
+	test_assert(test_imapc_cmd_last_reply_expect(IMAPC_COMMAND_STATE_NO));
+	test_assert(test_imapc_cmd_last_reply_expect(IMAPC_COMMAND_STATE_OK));
+}
+
+static void test_imapc_pipelined_cmds_server(void)
+{
+	test_server_wait_connection(&server, TRUE);
+	test_assert(test_imapc_server_expect(
+		"1 LOGIN \"testuser\" \"testpass\""));
+	o_stream_nsend_str(server.output, "1 OK \r\n");
+
+	test_assert(test_imapc_server_expect("2 PIPELINED1"));
+	test_assert(test_imapc_server_expect("3 PIPELINED2"));
+	test_assert(test_imapc_server_expect("4 PIPELINED3"));
+	/* reply in a different order than the commands were sent */
+	o_stream_nsend_str(server.output,
+			   "4 OK \r\n3 NO \r\n2 OK \r\n");
+
+	test_assert(test_imapc_server_expect("5 LOGOUT"));
+	o_stream_nsend_str(server.output, "5 OK \r\n");
+
+	test_assert(i_stream_read_next_line(server.input) == NULL);
+}
+
+static void test_imapc_pipelined_commands(void)
+{
+	struct imapc_client_settings set = test_imapc_default_settings;
+
+	test_begin("imapc pipelined commands");
+	test_run_client_server(&set, test_imapc_pipelined_cmds_client,
+			       test_imapc_pipelined_cmds_server);
+	test_end();
+}
+
 /*
  * imapc reconnect resend commands failed
  */
@@ -862,6 +920,7 @@ int main(int argc ATTR_UNUSED, char *argv[])
 		test_imapc_login_fails,
 		test_imapc_reconnect,
 		test_imapc_reconnect_resend_commands,
+		test_imapc_pipelined_commands,
 		test_imapc_reconnect_resend_commands_failed,
 		test_imapc_reconnect_mailbox,
 		test_imapc_client_get_capabilities,
@@ -10,16 +10,20 @@
 #include "llist.h"
 #include "hex-binary.h"
 #include "hash.h"
+#include "array.h"
 #include "str.h"
 #include "strescape.h"
 #include "time-util.h"
 #include "connection.h"
 #include "auth-client-private.h"
+#include "auth-master.h"
 #include "master-interface.h"
 #include "master-service.h"
 #include "login-interface.h"
 #include "login-server-auth.h"
 
+#include <signal.h>
+#include <sys/stat.h>
 
 #define AUTH_MAX_INBUF_SIZE 8192
 
@@ -63,6 +67,12 @@ struct login_server_auth {
 
 	unsigned int timeout_msecs;
 
+	/* auth_pid => connection to the auth process's own socket. These are
+	   used when the auth service has multiple processes. */
+	HASH_TABLE(void *, struct login_server_auth *) pid_auths;
+	/* Set for the connections in pid_auths */
+	struct login_server_auth *parent;
+
 	bool connected:1;
 	bool request_auth_token:1;
 };
@@ -96,9 +106,11 @@ static const struct connection_settings login_server_auth_set = {
 
 static int
 login_server_auth_connect(struct login_server_auth *auth);
+static struct login_server_auth *
+login_server_auth_pid_init(struct login_server_auth *auth, pid_t auth_pid);
 
-struct login_server_auth *
-login_server_auth_init(const char *auth_socket_path, bool request_auth_token)
+static struct login_server_auth *
+login_server_auth_create(const char *auth_socket_path, bool request_auth_token)
 {
 	struct login_server_auth *auth;
 	pool_t pool;
@@ -110,6 +122,7 @@ login_server_auth_init(const char *auth_socket_path, bool request_auth_token)
 	auth->request_auth_token = request_auth_token;
 	auth->refcount = 1;
 	hash_table_create_direct(&auth->requests, pool, 0);
+	hash_table_create_direct(&auth->pid_auths, pool, 0);
 	auth->id_counter = i_rand_limit(32767) * 131072U;
 
 	auth->clist = connection_list_init(&login_server_auth_set,
@@ -128,6 +141,46 @@ login_server_auth_init(const char *auth_socket_path, bool request_auth_token)
 	return auth;
 }
 
+static void login_server_auth_pids_init(struct login_server_auth *auth)
+{
+	ARRAY_TYPE(uint) pids, live_pids;
+	const char *error;
+	unsigned int pid;
+
+	/* With multiple auth processes connect to all of their own sockets
+	   already now. After dropping privileges we can no longer connect to
+	   them. */
+	t_array_init(&pids, 8);
+	if (auth_master_find_pid_sockets(auth->auth_socket_path, &pids,
+					 &error) < 0) {
+		e_error(auth->event, "%s", error);
+		return;
+	}
+	t_array_init(&live_pids, array_count(&pids) + 1);
+	array_foreach_elem(&pids, pid) {
+		if (kill((pid_t)pid, 0) == 0 || errno != ESRCH)
+			array_push_back(&live_pids, &pid);
+	}
+	if (array_count(&live_pids) <= 1) {
+		/* a single auth process is reached via the shared socket */
+		return;
+	}
+	array_foreach_elem(&live_pids, pid)
+		(void)login_server_auth_pid_init(auth, (pid_t)pid);
+}
+
+struct login_server_auth *
+login_server_auth_init(const char *auth_socket_path, bool request_auth_token)
+{
+	struct login_server_auth *auth;
+
+	auth = login_server_auth_create(auth_socket_path, request_auth_token);
+	T_BEGIN {
+		login_server_auth_pids_init(auth);
+	} T_END;
+	return auth;
+}
+
 static void request_failure(struct login_server_auth *auth,
 			    struct login_server_auth_request *request,
 			    const char *log_reason, const char *client_reason)
@@ -202,6 +255,15 @@ login_server_auth_fail(struct login_server_auth *auth,
 
 void login_server_auth_disconnect(struct login_server_auth *auth)
 {
+	struct hash_iterate_context *iter;
+	struct login_server_auth *pid_auth;
+	void *key;
+
+	iter = hash_table_iterate_init(auth->pid_auths);
+	while (hash_table_iterate(iter, auth->pid_auths, &key, &pid_auth))
+		login_server_auth_fail(pid_auth, NULL);
+	hash_table_iterate_deinit(&iter);
+
 	login_server_auth_fail(auth, NULL);
 }
 
@@ -217,6 +279,7 @@ static void login_server_auth_unref(struct login_server_auth **_auth)
 		return;
 
 	hash_table_destroy(&auth->requests);
+	hash_table_destroy(&auth->pid_auths);
 	connection_deinit(&auth->conn);
 	connection_list_deinit(&clist);
 	event_unref(&auth->event);
@@ -226,9 +289,18 @@ static void login_server_auth_unref(struct login_server_auth **_auth)
 void login_server_auth_deinit(struct login_server_auth **_auth)
 {
 	struct login_server_auth *auth = *_auth;
+	struct hash_iterate_context *iter;
+	struct login_server_auth *pid_auth;
+	void *key;
 
 	*_auth = NULL;
 
+	iter = hash_table_iterate_init(auth->pid_auths);
+	while (hash_table_iterate(iter, auth->pid_auths, &key, &pid_auth))
+		login_server_auth_deinit(&pid_auth);
+	hash_table_iterate_deinit(&iter);
+	hash_table_clear(auth->pid_auths, FALSE);
+
 	login_server_auth_disconnect(auth);
 	login_server_auth_unref(&auth);
 }
@@ -236,7 +308,16 @@ void login_server_auth_deinit(struct login_server_auth **_auth)
 void login_server_auth_set_timeout(struct login_server_auth *auth,
 				   unsigned int msecs)
 {
+	struct hash_iterate_context *iter;
+	struct login_server_auth *pid_auth;
+	void *key;
+
 	auth->timeout_msecs = msecs;
+
+	iter = hash_table_iterate_init(auth->pid_auths);
+	while (hash_table_iterate(iter, auth->pid_auths, &key, &pid_auth))
+		pid_auth->timeout_msecs = msecs;
+	hash_table_iterate_deinit(&iter);
 }
 
 static void login_server_auth_destroy(struct connection *_conn)
@@ -255,6 +336,11 @@ static void login_server_auth_destroy(struct connection *_conn)
 		login_server_auth_fail(auth, NULL);
 		break;
 	default:
+		if (auth->parent != NULL) {
+			/* only this auth process went away */
+			login_server_auth_fail(auth, NULL);
+			break;
+		}
 		/* disconnected. stop accepting new connections, because in
 		   default configuration we no longer have permissions to
 		   connect back to auth-master */
@@ -565,6 +651,71 @@ login_server_auth_send_request(struct login_server_auth *auth,
 	o_stream_nsend(auth->conn.output, str_data(str), str_len(str));
 }
 
+static struct login_server_auth *
+login_server_auth_pid_init(struct login_server_auth *auth, pid_t auth_pid)
+{
+	struct login_server_auth *pid_auth;
+	const char *path;
+
+	path = auth_master_get_pid_socket_path(auth->auth_socket_path,
+					       auth_pid);
+	pid_auth = login_server_auth_create(path, auth->request_auth_token);
+	if (!pid_auth->connected) {
+		login_server_auth_deinit(&pid_auth);
+		return NULL;
+	}
+	pid_auth->parent = auth;
+	pid_auth->timeout_msecs = auth->timeout_msecs;
+	hash_table_insert(auth->pid_auths, POINTER_CAST(auth_pid), pid_auth);
+	return pid_auth;
+}
+
+static struct login_server_auth *
+login_server_auth_get_pid(struct login_server_auth *auth, pid_t auth_pid)
+{
+	struct login_server_auth *pid_auth;
+	const char *path;
+	struct stat st;
+
+	if (auth_pid == 0 ||
+	    (auth->conn.handshake_received && auth->auth_server_pid == auth_pid))
+		return auth;
+
+	pid_auth = hash_table_lookup(auth->pid_auths, POINTER_CAST(auth_pid));
+	if (pid_auth != NULL) {
+		if (pid_auth->connected ||
+		    login_server_auth_connect(pid_auth) == 0)
+			return pid_auth;
+		/* the auth process is gone */
+		hash_table_remove(auth->pid_auths, POINTER_CAST(auth_pid));
+		login_server_auth_deinit(&pid_auth);
+		return NULL;
+	}
+
+	/* The auth process has its own socket only if the auth service has
+	   multiple processes. */
+	path = auth_master_get_pid_socket_path(auth->auth_socket_path,
+					       auth_pid);
+	if (stat(path, &st) < 0) {
+		if (errno != ENOENT)
+			e_error(auth->event, "stat(%s) failed: %m", path);
+		return auth;
+	}
+	if (kill(auth_pid, 0) < 0 && errno == ESRCH) {
+		/* auth process was already destroyed */
+		return NULL;
+	}
+	/* The auth process was started after us. This works only if we
+	   haven't dropped privileges yet. */
+	pid_auth = login_server_auth_pid_init(auth, auth_pid);
+	if (pid_auth == NULL) {
+		/* we probably can't connect to the new auth processes in
+		   future either. */
+		master_service_stop_new_connections(master_service);
+	}
+	return pid_auth;
+}
+
 void login_server_auth_request(struct login_server_auth *auth,
 			       const struct login_request *req,
 			       login_server_auth_request_callback_t *callback,
@@ -573,6 +724,11 @@ void login_server_auth_request(struct login_server_auth *auth,
 	struct login_server_auth_request *login_req;
 	unsigned int id;
 
+	auth = login_server_auth_get_pid(auth, req->auth_pid);
+	if (auth == NULL) {
+		callback(NULL, LOGIN_REQUEST_ERRMSG_INTERNAL_FAILURE, context);
+		return;
+	}
 	if (!auth->connected) {
 		if (login_server_auth_connect(auth) < 0) {
 			/* we couldn't connect to auth now,
@@ -638,5 +794,14 @@ void login_server_auth_request(struct login_server_auth *auth,
 
 unsigned int login_server_auth_request_count(struct login_server_auth *auth)
 {
-	return hash_table_count(auth->requests);
+	struct hash_iterate_context *iter;
+	struct login_server_auth *pid_auth;
+	unsigned int count = hash_table_count(auth->requests);
+	void *key;
+
+	iter = hash_table_iterate_init(auth->pid_auths);
+	while (hash_table_iterate(iter, auth->pid_auths, &key, &pid_auth))
+		count += hash_table_count(pid_auth->requests);
+	hash_table_iterate_deinit(&iter);
+	return count;
 }
@@ -23,6 +23,9 @@
 #include "login-server-auth.h"
 
 #define TEST_SOCKET "./login-server-auth-test"
+/* the per-process auth sockets are for our own pid and init's pid, so that
+   both look like they belong to existing processes */
+#define TEST_PID_SOCKET_COUNT 2
 #define SERVER_KILL_TIMEOUT_SECS    20
 
 static void main_deinit(void);
@@ -35,6 +38,8 @@ struct server_connection {
 	struct connection conn;
 
 	void *context;
+	/* auth process pid of the per-process socket, 0 for the shared one */
+	pid_t socket_pid;
 
 	pool_t pool;
 };
@@ -53,6 +58,10 @@ static bool debug = FALSE;
 /* server */
 static struct io *io_listen;
 static int fd_listen = -1;
+static struct io *io_listen_pid[TEST_PID_SOCKET_COUNT];
+static int fd_listen_pid[TEST_PID_SOCKET_COUNT] = { -1, -1 };
+static pid_t listen_pids[TEST_PID_SOCKET_COUNT];
+static bool test_pid_sockets = FALSE;
 static struct connection_list *server_conn_list;
 static void (*test_server_input)(struct server_connection *conn);
 static void (*test_server_init)(struct server_connection *conn);
@@ -646,6 +655,173 @@ static void test_request_login(void)
 	test_end();
 }
 
+/*
+ * REQUEST routing
+ */
+
+/* server */
+
+enum _request_route_state {
+	REQUEST_ROUTE_STATE_VERSION = 0,
+	REQUEST_ROUTE_STATE_REQUEST
+};
+
+struct _request_route_server {
+	enum _request_route_state state;
+};
+
+static void test_request_route_input(struct server_connection *conn)
+{
+	struct _request_route_server *ctx =
+		(struct _request_route_server *)conn->context;
+	const char *const *args;
+	unsigned int id;
+	const char *line;
+
+	for (;;) {
+		line = i_stream_read_next_line(conn->conn.input);
+		if (line == NULL) {
+			if (conn->conn.input->eof)
+				server_connection_deinit(&conn);
+			return;
+		}
+		switch (ctx->state) {
+		case REQUEST_ROUTE_STATE_VERSION:
+			if (!str_begins_with(line, "VERSION\t")) {
+				i_error("Bad VERSION");
+				server_connection_deinit(&conn);
+				return;
+			}
+			ctx->state = REQUEST_ROUTE_STATE_REQUEST;
+			continue;
+		case REQUEST_ROUTE_STATE_REQUEST:
+			args = t_strsplit_tabescaped(line);
+			if (strcmp(args[0], "REQUEST") != 0 ||
+			    args[1] == NULL || str_to_uint(args[1], &id) < 0) {
+				i_error("Bad REQUEST");
+				server_connection_deinit(&conn);
+				return;
+			}
+			/* tell which socket the request came from */
+			line = t_strdup_printf("USER\t%u\tpid%ld\n", id,
+				(long)(conn->socket_pid == 0 ? 23234 :
+				       conn->socket_pid));
+			o_stream_nsend_str(conn->conn.output, line);
+			continue;
+		}
+		i_unreached();
+	}
+}
+
+static void test_request_route_init(struct server_connection *conn)
+{
+	struct _request_route_server *ctx;
+
+	ctx = p_new(conn->pool, struct _request_route_server, 1);
+	conn->context = (void*)ctx;
+
+	o_stream_nsend_str(conn->conn.output, "VERSION\t1\t0\n");
+	o_stream_nsend_str(conn->conn.output, t_strdup_printf("SPID\t%ld\n",
+		(long)(conn->socket_pid == 0 ? 23234 : conn->socket_pid)));
+}
+
+static void test_server_request_route(void)
+{
+	test_server_init = test_request_route_init;
+	test_server_input = test_request_route_input;
+	test_server_run();
+}
+
+/* client */
+
+struct route_test {
+	char *user;
+	unsigned int pending_requests;
+	struct ioloop *ioloop;
+};
+
+static void
+test_client_request_route_callback(const char *const *auth_args,
+				   const char *errormsg ATTR_UNUSED,
+				   void *context)
+{
+	struct route_test *route_test = context;
+
+	route_test->user = auth_args == NULL ? NULL :
+		i_strdup(auth_args[0]);
+	if (--route_test->pending_requests == 0)
+		io_loop_stop(route_test->ioloop);
+}
+
+static const char *
+test_client_request_route_run(struct login_server_auth *auth, pid_t auth_pid)
+{
+	struct login_request login_req;
+	struct route_test route_test;
+	const char *user;
+
+	i_zero(&login_req);
+	login_req.auth_pid = auth_pid;
+	login_req.auth_id = 45521;
+	login_req.client_pid = 2323;
+	random_fill(login_req.cookie, sizeof(login_req.cookie));
+
+	i_zero(&route_test);
+	route_test.ioloop = current_ioloop;
+	route_test.pending_requests = 1;
+	login_server_auth_request(auth, &login_req,
+				  test_client_request_route_callback,
+				  &route_test);
+	if (route_test.pending_requests > 0)
+		io_loop_run(current_ioloop);
+	user = t_strdup(route_test.user);
+	i_free(route_test.user);
+	return user;
+}
+
+static bool test_client_request_route(void)
+{
+	struct login_server_auth *auth;
+	const char *user;
+	unsigned int i;
+
+	auth = login_server_auth_init(TEST_SOCKET, TRUE);
+	login_server_auth_set_timeout(auth, 1000);
+
+	/* the connections to the per-process sockets were created already
+	   at init. they must keep working when the sockets can no longer be
+	   connected to, like after dropping privileges. */
+	for (i = 0; i < TEST_PID_SOCKET_COUNT; i++) {
+		i_unlink(t_strdup_printf(TEST_SOCKET".%ld",
+					 (long)listen_pids[i]));
+	}
+
+	for (i = 0; i < TEST_PID_SOCKET_COUNT; i++) {
+		user = test_client_request_route_run(auth, listen_pids[i]);
+		test_assert_strcmp_idx(user, t_strdup_printf("pid%ld",
+			(long)listen_pids[i]), i);
+	}
+	/* a process without its own socket is reached via the shared one */
+	user = test_client_request_route_run(auth, 23234);
+	test_assert_strcmp(user, "pid23234");
+	test_assert(login_server_auth_request_count(auth) == 0);
+
+	login_server_auth_deinit(&auth);
+	return FALSE;
+}
+
+/* test */
+
+static void test_request_route(void)
+{
+	test_begin("request routing to auth processes");
+	test_pid_sockets = TRUE;
+	test_run_client_server(test_client_request_route,
+			       test_server_request_route);
+	test_pid_sockets = FALSE;
+	test_end();
+}
+
 /*
  * All tests
  */
@@ -658,6 +834,7 @@ static void (*const test_functions[])(void) = {
 	test_changed_spid,
 	test_request_fail,
 	test_request_login,
+	test_request_route,
 	NULL
 };
 
@@ -780,7 +957,7 @@ static void server_connection_input(struct connection *_conn)
 	test_server_input(conn);
 }
 
-static void server_connection_init(int fd)
+static void server_connection_init(int fd, pid_t socket_pid)
 {
 	struct server_connection *conn;
 	pool_t pool;
@@ -790,6 +967,7 @@ static void server_connection_init(int fd)
 	pool = pool_alloconly_create("server connection", 256);
 	conn = p_new(pool, struct server_connection, 1);
 	conn->pool = pool;
+	conn->socket_pid = socket_pid;
 
 	connection_init_server(server_conn_list, &conn->conn,
 			       "server connection", fd, fd);
@@ -831,7 +1009,22 @@ static void server_connection_accept(void *context ATTR_UNUSED)
 		i_fatal("test server: accept() failed: %m");
 	}
 
-	server_connection_init(fd);
+	server_connection_init(fd, 0);
+}
+
+static void server_connection_accept_pid(int *fdp)
+{
+	unsigned int idx = fdp - fd_listen_pid;
+	int fd;
+
+	fd = net_accept(*fdp, NULL, NULL);
+	if (fd == -1)
+		return;
+	if (fd == -2) {
+		i_fatal("test server: accept() failed: %m");
+	}
+
+	server_connection_init(fd, listen_pids[idx]);
 }
 
 /* */
@@ -849,9 +1042,18 @@ static const struct connection_vfuncs server_connection_vfuncs = {
 
 static void test_server_run(void)
 {
+	unsigned int i;
+
 	/* open server socket */
 	io_listen = io_add(fd_listen,
 		IO_READ, server_connection_accept, NULL);
+	for (i = 0; i < TEST_PID_SOCKET_COUNT; i++) {
+		if (fd_listen_pid[i] == -1)
+			continue;
+		io_listen_pid[i] = io_add(fd_listen_pid[i], IO_READ,
+					  server_connection_accept_pid,
+					  &fd_listen_pid[i]);
+	}
 
 	server_conn_list = connection_list_init(&server_connection_set,
 						&server_connection_vfuncs);
@@ -860,6 +1062,8 @@ static void test_server_run(void)
 
 	/* close server socket */
 	io_remove(&io_listen);
+	for (i = 0; i < TEST_PID_SOCKET_COUNT; i++)
+		io_remove(&io_listen_pid[i]);
 
 	connection_list_deinit(&server_conn_list);
 }
@@ -880,6 +1084,32 @@ static int test_open_server_fd(void)
 	return fd;
 }
 
+static void test_open_server_pid_fds(void)
+{
+	const char *path;
+	unsigned int i;
+
+	listen_pids[0] = getpid();
+	listen_pids[1] = 1;
+	for (i = 0; i < TEST_PID_SOCKET_COUNT; i++) {
+		path = t_strdup_printf(TEST_SOCKET".%ld", (long)listen_pids[i]);
+		i_unlink_if_exists(path);
+		fd_listen_pid[i] = net_listen_unix(path, 128);
+		if (fd_listen_pid[i] == -1)
+			i_fatal("listen(%s) failed: %m", path);
+	}
+}
+
+static void test_close_server_pid_fds(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < TEST_PID_SOCKET_COUNT; i++) {
+		if (fd_listen_pid[i] != -1)
+			i_close_fd(&fd_listen_pid[i]);
+	}
+}
+
 static int test_run_server(test_server_init_t *server_test)
 {
 	main_deinit();
@@ -898,6 +1128,7 @@ static int test_run_server(test_server_init_t *server_test)
 		i_debug("Terminated");
 
 	i_close_fd(&fd_listen);
+	test_close_server_pid_fds();
 	return 0;
 }
 
@@ -927,8 +1158,11 @@ test_run_client_server(test_client_init_t *client_test,
 	if (server_test != NULL) {
 		/* Fork server */
 		fd_listen = test_open_server_fd();
+		if (test_pid_sockets)
+			test_open_server_pid_fds();
 		test_subprocess_fork(test_run_server, server_test, FALSE);
 		i_close_fd(&fd_listen);
+		test_close_server_pid_fds();
 	}
 
 	/* Run client */
@@ -944,7 +1178,17 @@ test_run_client_server(test_client_init_t *client_test,
 
 static void main_cleanup(void)
 {
+	char path[sizeof(TEST_SOCKET) + MAX_INT_STRLEN + 1];
+	unsigned int i;
+
 	i_unlink_if_exists(TEST_SOCKET);
+	/* this may be called at exit, so don't use data stack */
+	for (i = 0; i < TEST_PID_SOCKET_COUNT; i++) {
+		if (listen_pids[i] != 0 &&
+		    i_snprintf(path, sizeof(path), TEST_SOCKET".%ld",
+			       (long)listen_pids[i]) == 0)
+			i_unlink_if_exists(path);
+	}
 }
 
 static void main_init(void)
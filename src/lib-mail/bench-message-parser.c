@@ -0,0 +1,183 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "istream.h"
+#include "time-util.h"
+#include "message-parser.h"
+#include "message-scan.h"
+
+#include <stdio.h>
+
+/**
+ * Measures the message parser throughput with multipart mails. The mails
+ * can be given as file paths, otherwise a set of multipart mails with text
+ * and base64 encoded attachments is generated. The body scanning is also
+ * compared against the memchr() loops that the parser used before.
+ */
+
+#define BENCH_MIN_NSECS (500ULL*1000*1000)
+#define BENCH_GENERATED_MAIL_COUNT 20
+
+ARRAY_DEFINE_TYPE(buffer_p, buffer_t *);
+typedef unsigned int bench_scan_func_t(const unsigned char *data, size_t size);
+
+/* keeps the compiler from optimizing out the scans */
+static unsigned int bench_scan_sum;
+
+static void bench_generate_mail(buffer_t *buf, unsigned int n)
+{
+	string_t *str = t_str_new(1024*64);
+	unsigned int i, j, parts = 2 + n % 4;
+
+	str_printfa(str, "From: user%u@example.com\r\n"
+		    "To: rcpt@example.com\r\n"
+		    "Subject: bench mail %u\r\n"
+		    "MIME-Version: 1.0\r\n"
+		    "Content-Type: multipart/mixed; boundary=\"b%u\"\r\n\r\n"
+		    "This is a multi-part message in MIME format.\r\n", n, n, n);
+	for (i = 0; i < parts; i++) {
+		str_printfa(str, "--b%u\r\n", n);
+		if (i % 2 == 0) {
+			str_append(str, "Content-Type: text/plain; charset=utf-8\r\n\r\n");
+			for (j = 0; j < 50 + n * 10; j++) {
+				str_append(str, "Lorem ipsum dolor sit amet, consectetur "
+					   "adipiscing elit - sed do eiusmod.\r\n");
+			}
+		} else {
+			str_append(str, "Content-Type: application/octet-stream\r\n"
+				   "Content-Transfer-Encoding: base64\r\n\r\n");
+			for (j = 0; j < 200 + n * 50; j++) {
+				str_append(str, "QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVphYmNkZWZn"
+					   "aGlqa2xtbm9wcXJzdHV2d3h5ejAxMjM0\r\n");
+			}
+		}
+	}
+	str_printfa(str, "--b%u--\r\n", n);
+	buffer_append(buf, str_data(str), str_len(str));
+}
+
+static void bench_parse(const buffer_t *mail)
+{
+	const struct message_parser_settings set = {
+		.flags = MESSAGE_PARSER_FLAG_INCLUDE_MULTIPART_BLOCKS,
+	};
+	struct message_parser_ctx *parser;
+	struct message_block block;
+	struct message_part *parts;
+	struct istream *input;
+	pool_t pool = pool_alloconly_create("bench message parser", 4096);
+
+	input = i_stream_create_from_data(mail->data, mail->used);
+	parser = message_parser_init(pool, input, &set);
+	while (message_parser_parse_next_block(parser, &block) > 0) ;
+	message_parser_deinit(&parser, &parts);
+	i_stream_unref(&input);
+	pool_unref(&pool);
+}
+
+static unsigned int
+bench_memchr_lines(const unsigned char *data, size_t size)
+{
+	const unsigned char *cur = data + 1, *next;
+	unsigned int lines = 0, missing_cr_count = 0;
+
+	if (size == 0)
+		return 0;
+	if (memchr(data, '\0', size) != NULL)
+		lines++;
+	while ((next = memchr(cur, '\n', size - (cur - data))) != NULL) {
+		lines++;
+		if (next[-1] != '\r')
+			missing_cr_count++;
+		cur = next + 1;
+	}
+	return lines + missing_cr_count;
+}
+
+static unsigned int
+bench_scan_lines(const unsigned char *data, size_t size)
+{
+	unsigned int lines, missing_cr_count;
+
+	if (message_scan_lines(data, size, '\0', &lines, &missing_cr_count))
+		lines++;
+	return lines + missing_cr_count;
+}
+
+static double
+bench_run(ARRAY_TYPE(buffer_p) *mails, bench_scan_func_t *scan,
+	  size_t total_size)
+{
+	buffer_t *const *mailp;
+	uint64_t start, nsecs, bytes = 0;
+
+	start = i_nanoseconds();
+	do {
+		array_foreach(mails, mailp) {
+			if (scan == NULL)
+				bench_parse(*mailp);
+			else
+				bench_scan_sum += scan((*mailp)->data,
+						       (*mailp)->used);
+		}
+		bytes += total_size;
+		nsecs = i_nanoseconds() - start;
+	} while (nsecs < BENCH_MIN_NSECS);
+	return bytes * 1000.0 / nsecs;
+}
+
+int main(int argc, const char *argv[])
+{
+	ARRAY_TYPE(buffer_p) mails;
+	struct istream *input;
+	const unsigned char *data;
+	size_t size, total_size = 0;
+	buffer_t *mail;
+	unsigned int i;
+
+	lib_init();
+	i_array_init(&mails, 32);
+	if (argc > 1) {
+		for (i = 1; i < (unsigned int)argc; i++) {
+			input = i_stream_create_file(argv[i], IO_BLOCK_SIZE);
+			mail = buffer_create_dynamic(default_pool, 1024*64);
+			while (i_stream_read_more(input, &data, &size) > 0) {
+				buffer_append(mail, data, size);
+				i_stream_skip(input, size);
+			}
+			if (input->stream_errno != 0) {
+				i_fatal("read(%s) failed: %s", argv[i],
+					i_stream_get_error(input));
+			}
+			i_stream_unref(&input);
+			array_push_back(&mails, &mail);
+		}
+	} else {
+		for (i = 0; i < BENCH_GENERATED_MAIL_COUNT; i++) {
+			mail = buffer_create_dynamic(default_pool, 1024*64);
+			T_BEGIN {
+				bench_generate_mail(mail, i);
+			} T_END;
+			array_push_back(&mails, &mail);
+		}
+	}
+	array_foreach_elem(&mails, mail)
+		total_size += mail->used;
+
+	printf("%u mails, %zu bytes\n", array_count(&mails), total_size);
+	printf("%-20s %10.1f MB/s\n", "parse",
+	       bench_run(&mails, NULL, total_size));
+	printf("%-20s %10.1f MB/s\n", "lines (memchr)",
+	       bench_run(&mails, bench_memchr_lines, total_size));
+	printf("%-20s %10.1f MB/s\n", "lines (scan)",
+	       bench_run(&mails, bench_scan_lines, total_size));
+
+	array_foreach_elem(&mails, mail)
+		buffer_free(&mail);
+	array_free(&mails);
+	lib_deinit();
+	return 0;
+}
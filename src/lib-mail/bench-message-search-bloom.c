@@ -0,0 +1,255 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "strnum.h"
+#include "istream.h"
+#include "time-util.h"
+#include "unichar.h"
+#include "message-search.h"
+#include "message-search-bloom.h"
+
+#include <stdio.h>
+
+/**
+ * Shows how many mails the search bloom filters let SEARCH BODY/TEXT skip
+ * for typical queries with different filter sizes. The mails are generated
+ * from a vocabulary whose words are picked with a Zipf distribution, and the
+ * body lengths vary from a few lines to long threads. For each query the
+ * fraction of skipped mails is compared against the fraction of mails that
+ * really don't match, which is the best any filter could do.
+ */
+
+#define BENCH_VOCABULARY_SIZE 20000
+#define BENCH_DEFAULT_MAIL_COUNT 2000
+
+static const unsigned int bench_filter_sizes[] = { 128, 256, 512, 1024, 4096 };
+
+static const char *const bench_syllables[] = {
+	"ka", "lo", "min", "der", "sa", "ten", "ro", "vi", "pel", "an",
+	"tor", "ne", "mu", "ri", "gal", "so", "ber", "ti", "fon", "el",
+	"ma", "dus", "ke", "ran", "po", "li", "sen", "ho", "qua", "ex",
+};
+
+struct bench_query {
+	const char *name;
+	char *key;
+};
+
+static unsigned int bench_rand(unsigned int *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed / 65536) % 32768;
+}
+
+static const char *bench_word(unsigned int n)
+{
+	string_t *str = t_str_new(16);
+
+	/* unique pseudo words, the common ones are the shortest */
+	do {
+		str_append(str, bench_syllables[n % N_ELEMENTS(bench_syllables)]);
+		n /= N_ELEMENTS(bench_syllables);
+	} while (n > 0);
+	return str_c(str);
+}
+
+static unsigned int
+bench_zipf_word(const double *cumulative, unsigned int *seed)
+{
+	double r = (bench_rand(seed) * 32768.0 + bench_rand(seed)) /
+		(32768.0 * 32768.0) * cumulative[BENCH_VOCABULARY_SIZE-1];
+	unsigned int left = 0, right = BENCH_VOCABULARY_SIZE - 1;
+
+	while (left < right) {
+		unsigned int mid = (left + right) / 2;
+		if (cumulative[mid] < r)
+			left = mid + 1;
+		else
+			right = mid;
+	}
+	return left;
+}
+
+static void
+bench_generate_mail(string_t *str, const double *cumulative, unsigned int n,
+		    unsigned int *seed)
+{
+	unsigned int i, words, r = bench_rand(seed) % 100;
+
+	/* mostly short mails, some long threads */
+	if (r < 70)
+		words = 30 + bench_rand(seed) % 270;
+	else if (r < 95)
+		words = 300 + bench_rand(seed) % 1200;
+	else
+		words = 1500 + bench_rand(seed) % 3500;
+
+	str_printfa(str, "From: %s <user%u@example.com>\n"
+		    "To: team@example.com\n"
+		    "Subject: %s %s\n"
+		    "Message-ID: <%u@example.com>\n"
+		    "MIME-Version: 1.0\n"
+		    "Content-Type: text/plain; charset=utf-8\n\n",
+		    bench_word(bench_zipf_word(cumulative, seed)),
+		    n % 50, bench_word(bench_zipf_word(cumulative, seed)),
+		    bench_word(bench_zipf_word(cumulative, seed)), n);
+	for (i = 0; i < words; i++) {
+		str_append(str, bench_word(bench_zipf_word(cumulative, seed)));
+		str_append_c(str, (i % 12) == 11 ? '\n' : ' ');
+	}
+	str_append_c(str, '\n');
+}
+
+static bool bench_search(const char *mail, const char *key)
+{
+	struct message_search_context *ctx;
+	struct istream *input;
+	const char *error;
+	int ret;
+
+	input = i_stream_create_from_data(mail, strlen(mail));
+	ctx = message_search_init(key, uni_utf8_to_decomposed_titlecase, 0);
+	ret = message_search_msg(ctx, input, NULL, &error);
+	message_search_deinit(&ctx);
+	i_stream_unref(&input);
+	return ret > 0;
+}
+
+int main(int argc, const char *argv[])
+{
+	ARRAY(char *) mails;
+	ARRAY(buffer_t *) filters;
+	struct bench_query queries[7];
+	double *cumulative;
+	unsigned int i, j, q, seed = 1, mail_count = BENCH_DEFAULT_MAIL_COUNT;
+	uint64_t start, nsecs, total_size = 0;
+
+	lib_init();
+	if (argc > 2 ||
+	    (argc == 2 && (str_to_uint(argv[1], &mail_count) < 0 ||
+			   mail_count == 0))) {
+		fprintf(stderr, "Usage: %s [mail count]\n", argv[0]);
+		return 1;
+	}
+
+	cumulative = i_new(double, BENCH_VOCABULARY_SIZE);
+	for (i = 0; i < BENCH_VOCABULARY_SIZE; i++) {
+		cumulative[i] = (i == 0 ? 0 : cumulative[i-1]) +
+			1.0 / (i + 1);
+	}
+
+	i_array_init(&mails, mail_count);
+	for (i = 0; i < mail_count; i++) T_BEGIN {
+		string_t *str = t_str_new(1024*16);
+		char *mail;
+
+		bench_generate_mail(str, cumulative, i, &seed);
+		mail = i_strdup(str_c(str));
+		total_size += str_len(str);
+		array_push_back(&mails, &mail);
+	} T_END;
+
+	/* the keys are already normalized */
+	queries[0].name = "common word";
+	queries[0].key = i_strdup(t_str_ucase(bench_word(20)));
+	queries[1].name = "medium word";
+	queries[1].key = i_strdup(t_str_ucase(bench_word(500)));
+	queries[2].name = "rare word";
+	queries[2].key = i_strdup(t_str_ucase(bench_word(8000)));
+	queries[3].name = "missing word";
+	queries[3].key = i_strdup(t_str_ucase(bench_word(100000)));
+	queries[4].name = "part of a word";
+	queries[4].key = i_strdup(t_str_ucase(bench_word(6000) + 1));
+	queries[5].name = "two words";
+	queries[5].key = i_strdup(t_strdup_printf("%s %s",
+		t_str_ucase(bench_word(300)), t_str_ucase(bench_word(30))));
+	queries[6].name = "address";
+	queries[6].key = i_strdup("USER7@EXAMPLE.COM");
+
+	printf("%u mails, %"PRIu64" bytes\n\n", mail_count, total_size);
+	printf("%-12s %12s %10s %10s\n", "filter size", "build MB/s",
+	       "avg fill", "");
+	i_array_init(&filters, N_ELEMENTS(bench_filter_sizes) * mail_count);
+	for (i = 0; i < N_ELEMENTS(bench_filter_sizes); i++) {
+		uint64_t bits_set = 0;
+
+		start = i_nanoseconds();
+		for (j = 0; j < mail_count; j++) {
+			char *const *mail = array_idx(&mails, j);
+			buffer_t *filter = buffer_create_dynamic(default_pool,
+							bench_filter_sizes[i]);
+			struct istream *input =
+				i_stream_create_from_data(*mail, strlen(*mail));
+
+			if (message_search_bloom_build(input,
+					uni_utf8_to_decomposed_titlecase,
+					bench_filter_sizes[i], filter) < 0)
+				i_unreached();
+			i_stream_unref(&input);
+			array_push_back(&filters, &filter);
+		}
+		nsecs = i_nanoseconds() - start;
+		for (j = 0; j < mail_count; j++) {
+			buffer_t *const *filter = array_idx(&filters,
+				i * mail_count + j);
+			const unsigned char *data = (*filter)->data;
+			size_t k;
+
+			for (k = 0; k < (*filter)->used; k++)
+				bits_set += __builtin_popcount(data[k]);
+		}
+		printf("%-12u %12.1f %9.1f%%\n", bench_filter_sizes[i],
+		       total_size * 1000.0 / nsecs,
+		       bits_set * 100.0 / (mail_count * 8.0 *
+					   bench_filter_sizes[i]));
+	}
+
+	printf("\n%-16s %-24s %10s", "query", "key", "no match");
+	for (i = 0; i < N_ELEMENTS(bench_filter_sizes); i++)
+		printf(" %7u B", bench_filter_sizes[i]);
+	printf("\n");
+	for (q = 0; q < N_ELEMENTS(queries); q++) {
+		unsigned int nonmatches = 0;
+
+		for (j = 0; j < mail_count; j++) {
+			char *const *mail = array_idx(&mails, j);
+			if (!bench_search(*mail, queries[q].key))
+				nonmatches++;
+		}
+		printf("%-16s %-24s %9.1f%%", queries[q].name, queries[q].key,
+		       nonmatches * 100.0 / mail_count);
+		for (i = 0; i < N_ELEMENTS(bench_filter_sizes); i++) {
+			unsigned int skipped = 0;
+
+			for (j = 0; j < mail_count; j++) {
+				buffer_t *const *filter = array_idx(&filters,
+					i * mail_count + j);
+				if (!message_search_bloom_may_contain(
+					(*filter)->data, (*filter)->used,
+					queries[q].key))
+					skipped++;
+			}
+			printf(" %8.1f%%", skipped * 100.0 / mail_count);
+		}
+		printf("\n");
+	}
+
+	for (q = 0; q < N_ELEMENTS(queries); q++)
+		i_free(queries[q].key);
+	for (i = 0; i < array_count(&filters); i++) {
+		buffer_t **filter = array_idx_modifiable(&filters, i);
+		buffer_free(filter);
+	}
+	array_free(&filters);
+	for (i = 0; i < array_count(&mails); i++) {
+		char **mail = array_idx_modifiable(&mails, i);
+		i_free(*mail);
+	}
+	array_free(&mails);
+	i_free(cumulative);
+	lib_deinit();
+	return 0;
+}
@@ -6,9 +6,45 @@
 #include "test-common.h"
 #include "fuzzer.h"
 #include "message-parser.h"
+#include "message-scan.h"
+
+static void fuzz_message_scan(const unsigned char *data, size_t size)
+{
+	unsigned int lines = 0, missing_cr_count = 0, lines2, missing_cr_count2;
+	const unsigned char *boundary_lf = NULL;
+	size_t i, name_end = size, value_end = size;
+	bool have_nuls = FALSE;
+
+	/* the scanners must give the same results as plain loops */
+	for (i = size; i > 0; i--) {
+		const unsigned char *p = data + i - 1;
+
+		if (*p == '\n' && (size - i < 2 || p[1] == '-'))
+			boundary_lf = p;
+		if (*p == '\n' || *p == '\0')
+			name_end = value_end = i - 1;
+		else if (*p == ':')
+			name_end = i - 1;
+		if (*p == '\0')
+			have_nuls = TRUE;
+		else if (*p == '\n') {
+			lines++;
+			if (i == 1 || p[-1] != '\r')
+				missing_cr_count++;
+		}
+	}
+	i_assert(message_scan_boundary_lf(data, size) == boundary_lf);
+	i_assert(message_scan_header_name(data, size) == name_end);
+	i_assert(message_scan_header_value(data, size) == value_end);
+	i_assert(message_scan_lines(data, size, '\0', &lines2,
+				    &missing_cr_count2) == have_nuls);
+	i_assert(lines2 == lines && missing_cr_count2 == missing_cr_count);
+}
 
 FUZZ_BEGIN_DATA(const unsigned char *data, size_t size)
 {
+	fuzz_message_scan(data, size);
+
 	struct istream *input = test_istream_create_data(data, size);
 	const struct message_parser_settings set = {
 		.hdr_flags = 0,
@@ -7,6 +7,7 @@
 #include "strfuncs.h"
 #include "unichar.h"
 #include "message-size.h"
+#include "message-scan.h"
 #include "message-header-parser.h"
 
 /* RFC 5322 2.1.1 and 2.2 */
@@ -170,8 +171,10 @@ int message_parse_header_next(struct message_header_parser_ctx *ctx,
 		/* find ':' */
 		if (colon_pos == UINT_MAX) {
 			for (i = startpos; i < parse_size; i++) {
-				if (msg[i] > ':')
-					continue;
+				i += message_scan_header_name(msg + i,
+							      parse_size - i);
+				if (i == parse_size)
+					break;
 
 				if (msg[i] == ':' && !ctx->skip_line) {
 					colon_pos = i;
@@ -193,12 +196,11 @@ int message_parse_header_next(struct message_header_parser_ctx *ctx,
 
 		/* find '\n' */
 		for (; i < parse_size; i++) {
-			if (msg[i] <= '\n') {
-				if (msg[i] == '\n')
-					break;
-				if (msg[i] == '\0')
-					ctx->has_nuls = TRUE;
-			}
+			i += message_scan_header_value(msg + i, parse_size - i);
+			if (i == parse_size || msg[i] == '\n')
+				break;
+			/* NUL */
+			ctx->has_nuls = TRUE;
 		}
 
 		if (i < parse_size && i+1 == size && ret == -2) {
@@ -6,6 +6,7 @@
 #include "istream.h"
 #include "rfc822-parser.h"
 #include "rfc2231-parser.h"
+#include "message-scan.h"
 #include "message-parser-private.h"
 
 message_part_header_callback_t *null_message_part_header_callback = NULL;
@@ -53,32 +54,18 @@ boundary_find(struct message_boundary *boundaries,
 static void parse_body_add_block(struct message_parser_ctx *ctx,
 				 struct message_block *block)
 {
-	unsigned int missing_cr_count = 0;
-	const unsigned char *cur, *next, *data = block->data;
+	unsigned int lines, missing_cr_count;
+	const unsigned char *data = block->data;
 
 	i_assert(block->size > 0);
 
 	block->hdr = NULL;
 
-	/* check if we have NULs */
-	if (memchr(data, '\0', block->size) != NULL)
+	/* check if we have NULs and count number of lines and missing CRs */
+	if (message_scan_lines(data, block->size, ctx->last_chr,
+			       &lines, &missing_cr_count))
 		ctx->part->flags |= MESSAGE_PART_FLAG_HAS_NULS;
-
-	/* count number of lines and missing CRs */
-	if (*data == '\n') {
-		ctx->part->body_size.lines++;
-		if (ctx->last_chr != '\r')
-			missing_cr_count++;
-	}
-
-	cur = data + 1;
-	while ((next = memchr(cur, '\n', block->size - (cur - data))) != NULL) {
-		ctx->part->body_size.lines++;
-		if (next[-1] != '\r')
-			missing_cr_count++;
-
-		cur = next + 1;
-	}
+	ctx->part->body_size.lines += lines;
 	ctx->last_chr = data[block->size - 1];
 	ctx->skip += block->size;
 
@@ -421,7 +408,8 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 	/* skip to beginning of the next line. the first line was
 	   handled already. */
 	cur = data; end = data + block_r->size;
-	while ((next = memchr(cur, '\n', end - cur)) != NULL) {
+	while ((next = message_scan_boundary_lf(cur, end - cur)) != NULL) {
+		/* the skipped LFs can't begin a boundary line */
 		cur = next + 1;
 
 		boundary_start = next - data;
@@ -442,6 +430,18 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 			break;
 		}
 	}
+	if (next == NULL) {
+		/* continue from the last LF the next time */
+		for (next = end; next > cur; ) {
+			if (*--next == '\n') {
+				boundary_start = next - data;
+				if (next > data && next[-1] == '\r')
+					boundary_start--;
+				break;
+			}
+		}
+		next = NULL;
+	}
 
 	if (next != NULL) {
 		/* found / need more data */
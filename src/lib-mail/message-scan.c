@@ -0,0 +1,167 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "message-scan.h"
+
+#ifdef __SSE2__
+/* SSE2 is part of the x86-64 baseline, so there's no need to check for it
+   at runtime. */
+#  include <emmintrin.h>
+#  define MESSAGE_SCAN_VECTOR_SIZE 16
+
+static inline unsigned int scan_mask(__m128i v, char chr)
+{
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(chr)));
+}
+#endif
+
+const unsigned char *
+message_scan_boundary_lf(const unsigned char *data, size_t size)
+{
+	size_t i = 0;
+
+#ifdef MESSAGE_SCAN_VECTOR_SIZE
+	/* look for "\n-" pairs. The LFs in the last 2 bytes are always
+	   returned, so they're left for the loop below. */
+	for (; i + MESSAGE_SCAN_VECTOR_SIZE + 2 <= size;
+	     i += MESSAGE_SCAN_VECTOR_SIZE) {
+		__m128i v = _mm_loadu_si128((const void *)(data + i));
+		__m128i next = _mm_loadu_si128((const void *)(data + i + 1));
+		unsigned int mask = scan_mask(v, '\n') & scan_mask(next, '-');
+
+		if (mask != 0)
+			return data + i + __builtin_ctz(mask);
+	}
+	for (; i < size; i++) {
+		if (data[i] == '\n' && (i + 2 >= size || data[i+1] == '-'))
+			return data + i;
+	}
+#else
+	const unsigned char *lf;
+
+	while ((lf = memchr(data + i, '\n', size - i)) != NULL) {
+		i = lf - data;
+		if (i + 2 >= size || data[i+1] == '-')
+			return lf;
+		i++;
+	}
+#endif
+	return NULL;
+}
+
+bool message_scan_lines(const unsigned char *data, size_t size,
+			unsigned char prev_chr, unsigned int *lines_r,
+			unsigned int *missing_cr_count_r)
+{
+	unsigned int lines = 0, missing_cr_count = 0;
+	bool have_nuls = FALSE;
+	size_t i = 1;
+
+	if (size == 0) {
+		*lines_r = *missing_cr_count_r = 0;
+		return FALSE;
+	}
+
+	if (data[0] == '\n') {
+		lines++;
+		if (prev_chr != '\r')
+			missing_cr_count++;
+	} else if (data[0] == '\0') {
+		have_nuls = TRUE;
+	}
+
+#ifdef MESSAGE_SCAN_VECTOR_SIZE
+	/* The lines are usually long enough that most of the vectors don't
+	   have any LFs, so handle the LFs one by one. */
+	__m128i nuls = _mm_setzero_si128();
+	for (; i + MESSAGE_SCAN_VECTOR_SIZE*2 <= size;
+	     i += MESSAGE_SCAN_VECTOR_SIZE*2) {
+		__m128i v1 = _mm_loadu_si128((const void *)(data + i));
+		__m128i v2 = _mm_loadu_si128((const void *)
+			(data + i + MESSAGE_SCAN_VECTOR_SIZE));
+		unsigned int lf_mask = scan_mask(v1, '\n') |
+			(scan_mask(v2, '\n') << MESSAGE_SCAN_VECTOR_SIZE);
+
+		/* the minimum byte is NUL if either of the vectors has it */
+		nuls = _mm_or_si128(nuls, _mm_cmpeq_epi8(
+			_mm_min_epu8(v1, v2), _mm_setzero_si128()));
+		while (lf_mask != 0) {
+			lines++;
+			if (data[i + __builtin_ctz(lf_mask) - 1] != '\r')
+				missing_cr_count++;
+			lf_mask &= lf_mask - 1;
+		}
+	}
+	unsigned int nul_mask = _mm_movemask_epi8(nuls);
+	if (nul_mask != 0)
+		have_nuls = TRUE;
+	for (; i < size; i++) {
+		if (data[i] == '\n') {
+			lines++;
+			if (data[i-1] != '\r')
+				missing_cr_count++;
+		} else if (data[i] == '\0') {
+			have_nuls = TRUE;
+		}
+	}
+#else
+	const unsigned char *lf;
+
+	if (!have_nuls && memchr(data, '\0', size) != NULL)
+		have_nuls = TRUE;
+	while ((lf = memchr(data + i, '\n', size - i)) != NULL) {
+		lines++;
+		if (lf[-1] != '\r')
+			missing_cr_count++;
+		i = lf - data + 1;
+	}
+#endif
+	*lines_r = lines;
+	*missing_cr_count_r = missing_cr_count;
+	return have_nuls;
+}
+
+size_t message_scan_header_name(const unsigned char *data, size_t size)
+{
+	size_t i = 0;
+
+#ifdef MESSAGE_SCAN_VECTOR_SIZE
+	for (; i + MESSAGE_SCAN_VECTOR_SIZE <= size;
+	     i += MESSAGE_SCAN_VECTOR_SIZE) {
+		__m128i v = _mm_loadu_si128((const void *)(data + i));
+		unsigned int mask = scan_mask(v, ':') | scan_mask(v, '\n') |
+			scan_mask(v, '\0');
+
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+	for (; i < size; i++) {
+		if (data[i] > ':')
+			continue;
+		if (data[i] == ':' || data[i] == '\n' || data[i] == '\0')
+			break;
+	}
+	return i;
+}
+
+size_t message_scan_header_value(const unsigned char *data, size_t size)
+{
+	size_t i = 0;
+
+#ifdef MESSAGE_SCAN_VECTOR_SIZE
+	for (; i + MESSAGE_SCAN_VECTOR_SIZE <= size;
+	     i += MESSAGE_SCAN_VECTOR_SIZE) {
+		__m128i v = _mm_loadu_si128((const void *)(data + i));
+		unsigned int mask = scan_mask(v, '\n') | scan_mask(v, '\0');
+
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+	for (; i < size; i++) {
+		if (data[i] <= '\n' && (data[i] == '\n' || data[i] == '\0'))
+			break;
+	}
+	return i;
+}
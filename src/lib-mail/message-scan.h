@@ -0,0 +1,28 @@
+#ifndef MESSAGE_SCAN_H
+#define MESSAGE_SCAN_H
+
+/* Byte scanners used by the message and header parsers. These process 16
+   bytes at a time when SSE2 is available and otherwise fall back to
+   memchr() and plain loops. The results are always the same. */
+
+/* Returns the first LF in data that may begin a "--boundary" line: it's
+   followed by '-' or there are less than 2 bytes after it. Returns NULL if
+   there are no such LFs. */
+const unsigned char *
+message_scan_boundary_lf(const unsigned char *data, size_t size);
+
+/* Count the LFs in data and how many of them aren't preceded by CR.
+   prev_chr is the character before data (or '\0' if there is none).
+   Returns TRUE if data contains NULs. */
+bool message_scan_lines(const unsigned char *data, size_t size,
+			unsigned char prev_chr, unsigned int *lines_r,
+			unsigned int *missing_cr_count_r);
+
+/* Returns the offset of the first ':', LF or NUL in data, or size if there
+   are none. */
+size_t message_scan_header_name(const unsigned char *data, size_t size);
+/* Returns the offset of the first LF or NUL in data, or size if there are
+   none. */
+size_t message_scan_header_value(const unsigned char *data, size_t size);
+
+#endif
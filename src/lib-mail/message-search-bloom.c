@@ -0,0 +1,221 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "str.h"
+#include "istream.h"
+#include "unichar.h"
+#include "rfc822-parser.h"
+#include "message-decoder.h"
+#include "message-parser.h"
+#include "message-search-bloom.h"
+
+#include <ctype.h>
+
+/* Number of bits set for each trigram. The filters are small compared to the
+   number of trigrams in a typical mail, so more than 2 would only fill them
+   up faster. */
+#define BLOOM_HASH_COUNT 2
+
+struct message_search_bloom {
+	struct message_decoder_context *decoder;
+	struct message_part *prev_part;
+
+	unsigned char *filter;
+	unsigned int filter_bits;
+
+	/* the last bytes of the current word */
+	uint32_t trigram;
+	unsigned int word_len;
+
+	bool content_type_text:1; /* text/any or message/any */
+};
+
+static inline bool bloom_is_word_byte(unsigned char c)
+{
+	return i_isalnum(c) || c >= 0x80;
+}
+
+static inline unsigned int
+bloom_hash(uint32_t trigram, unsigned int i, unsigned int filter_bits)
+{
+	/* the trigrams are 24bit, so the seeds keep the inputs of the
+	   different hashes apart */
+	uint32_t h = (trigram ^ (i << 24)) * 0x9e3779b1U;
+
+	h ^= h >> 15;
+	h *= 0x85ebca77U;
+	h ^= h >> 13;
+	return h % filter_bits;
+}
+
+static void
+bloom_add_data(struct message_search_bloom *bloom,
+	       const unsigned char *data, size_t size)
+{
+	unsigned int i, bit;
+	size_t pos;
+
+	for (pos = 0; pos < size; pos++) {
+		if (!bloom_is_word_byte(data[pos])) {
+			bloom->word_len = 0;
+			continue;
+		}
+		bloom->trigram = ((bloom->trigram << 8) | data[pos]) & 0xffffff;
+		if (++bloom->word_len < 3)
+			continue;
+		for (i = 0; i < BLOOM_HASH_COUNT; i++) {
+			bit = bloom_hash(bloom->trigram, i, bloom->filter_bits);
+			bloom->filter[bit / 8] |= 1 << (bit % 8);
+		}
+	}
+}
+
+struct message_search_bloom *
+message_search_bloom_init(normalizer_func_t *normalizer,
+			  size_t filter_size, buffer_t *dest)
+{
+	struct message_search_bloom *bloom;
+
+	i_assert(filter_size > 0);
+
+	bloom = i_new(struct message_search_bloom, 1);
+	bloom->decoder = message_decoder_init(normalizer, 0);
+	bloom->filter = buffer_append_space_unsafe(dest, filter_size);
+	memset(bloom->filter, 0, filter_size);
+	bloom->filter_bits = filter_size * 8;
+	bloom->content_type_text = TRUE;
+	return bloom;
+}
+
+void message_search_bloom_deinit(struct message_search_bloom **_bloom)
+{
+	struct message_search_bloom *bloom = *_bloom;
+
+	*_bloom = NULL;
+	message_decoder_deinit(&bloom->decoder);
+	i_free(bloom);
+}
+
+static void parse_content_type(struct message_search_bloom *bloom,
+			       struct message_header_line *hdr)
+{
+	struct rfc822_parser_context parser;
+	string_t *content_type;
+
+	rfc822_parser_init(&parser, hdr->full_value, hdr->full_value_len, NULL);
+	rfc822_skip_lwsp(&parser);
+
+	content_type = t_str_new(64);
+	(void)rfc822_parse_content_type(&parser, content_type);
+	bloom->content_type_text =
+		str_begins_icase_with(str_c(content_type), "text/") ||
+		str_begins_icase_with(str_c(content_type), "message/");
+	rfc822_parser_deinit(&parser);
+}
+
+void message_search_bloom_more(struct message_search_bloom *bloom,
+			       struct message_block *raw_block)
+{
+	static const unsigned char crlf[2] = { '\r', '\n' };
+	struct message_header_line *hdr = raw_block->hdr;
+	struct message_block block;
+
+	/* Add exactly the same data that message_search_more() would look
+	   at, so that anything it could find has its trigrams added. */
+	if (raw_block->part != bloom->prev_part) {
+		/* the searches don't continue across parts */
+		bloom->content_type_text = TRUE;
+		bloom->word_len = 0;
+		message_decoder_decode_reset(bloom->decoder);
+		bloom->prev_part = raw_block->part;
+
+		if (hdr == NULL) {
+			/* we're returning to a multipart message. */
+			bloom->content_type_text = FALSE;
+		}
+	}
+
+	if (hdr != NULL) {
+		if (hdr->name_len == 12 &&
+		    strcasecmp(hdr->name, "Content-Type") == 0) {
+			if (hdr->continues) {
+				hdr->use_full_value = TRUE;
+				return;
+			}
+			T_BEGIN {
+				parse_content_type(bloom, hdr);
+			} T_END;
+		}
+	} else if (!bloom->content_type_text) {
+		return;
+	}
+	if (!message_decoder_decode_next_block(bloom->decoder, raw_block,
+					       &block))
+		return;
+
+	if (block.hdr != NULL) {
+		bloom_add_data(bloom, (const unsigned char *)block.hdr->name,
+			       block.hdr->name_len);
+		bloom_add_data(bloom, block.hdr->middle, block.hdr->middle_len);
+		bloom_add_data(bloom, block.hdr->full_value,
+			       block.hdr->full_value_len);
+		if (!block.hdr->no_newline)
+			bloom_add_data(bloom, crlf, sizeof(crlf));
+	} else {
+		bloom_add_data(bloom, block.data, block.size);
+	}
+}
+
+int message_search_bloom_build(struct istream *input,
+			       normalizer_func_t *normalizer,
+			       size_t filter_size, buffer_t *dest)
+{
+	const struct message_parser_settings parser_set = {
+		.hdr_flags = MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE,
+	};
+	struct message_search_bloom *bloom;
+	struct message_parser_ctx *parser;
+	struct message_block raw_block;
+	struct message_part *parts;
+
+	bloom = message_search_bloom_init(normalizer, filter_size, dest);
+	T_BEGIN {
+		parser = message_parser_init(pool_datastack_create(), input,
+					     &parser_set);
+		while (message_parser_parse_next_block(parser, &raw_block) > 0)
+			message_search_bloom_more(bloom, &raw_block);
+		message_parser_deinit(&parser, &parts);
+	} T_END;
+	message_search_bloom_deinit(&bloom);
+	return input->stream_errno != 0 ? -1 : 0;
+}
+
+bool message_search_bloom_may_contain(const unsigned char *filter,
+				      size_t filter_size,
+				      const char *normalized_key_utf8)
+{
+	const unsigned char *key = (const unsigned char *)normalized_key_utf8;
+	unsigned int filter_bits = filter_size * 8;
+	unsigned int i, bit, word_len = 0;
+	uint32_t trigram = 0;
+
+	if (filter_size == 0)
+		return TRUE;
+
+	for (; *key != '\0'; key++) {
+		if (!bloom_is_word_byte(*key)) {
+			word_len = 0;
+			continue;
+		}
+		trigram = ((trigram << 8) | *key) & 0xffffff;
+		if (++word_len < 3)
+			continue;
+		for (i = 0; i < BLOOM_HASH_COUNT; i++) {
+			bit = bloom_hash(trigram, i, filter_bits);
+			if ((filter[bit / 8] & (1 << (bit % 8))) == 0)
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
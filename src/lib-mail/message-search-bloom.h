@@ -0,0 +1,33 @@
+#ifndef MESSAGE_SEARCH_BLOOM_H
+#define MESSAGE_SEARCH_BLOOM_H
+
+struct message_block;
+struct message_search_bloom;
+
+/* Bloom filter of the text that message_search_msg() matches keys against.
+   The filter contains the trigrams of the decoded and normalized headers and
+   text bodies. Only trigrams of "word" bytes (ASCII alphanumerics and
+   non-ASCII UTF-8 bytes) are added, which keeps the filters sparser. A key
+   that doesn't have any such trigrams can't be filtered. */
+
+/* Build a filter_size bytes long filter into dest. */
+struct message_search_bloom *
+message_search_bloom_init(normalizer_func_t *normalizer,
+			  size_t filter_size, buffer_t *dest);
+void message_search_bloom_more(struct message_search_bloom *bloom,
+			       struct message_block *raw_block);
+void message_search_bloom_deinit(struct message_search_bloom **bloom);
+
+/* Build the filter for the full message. Returns 0 if ok, -1 if the input
+   stream failed. */
+int message_search_bloom_build(struct istream *input,
+			       normalizer_func_t *normalizer,
+			       size_t filter_size, buffer_t *dest);
+
+/* Returns FALSE if the normalized key certainly can't be found from the text
+   that the filter was built from, TRUE if it might be. */
+bool message_search_bloom_may_contain(const unsigned char *filter,
+				      size_t filter_size,
+				      const char *normalized_key_utf8);
+
+#endif
@@ -0,0 +1,144 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "message-scan.h"
+#include "test-common.h"
+
+#define TEST_SCAN_MAX_SIZE 100
+
+static const unsigned char *
+ref_boundary_lf(const unsigned char *data, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		if (data[i] == '\n' && (size - (i + 1) < 2 || data[i+1] == '-'))
+			return data + i;
+	}
+	return NULL;
+}
+
+static bool
+ref_lines(const unsigned char *data, size_t size, unsigned char prev_chr,
+	  unsigned int *lines_r, unsigned int *missing_cr_count_r)
+{
+	bool have_nuls = FALSE;
+
+	*lines_r = *missing_cr_count_r = 0;
+	for (size_t i = 0; i < size; i++) {
+		if (data[i] == '\0')
+			have_nuls = TRUE;
+		else if (data[i] == '\n') {
+			(*lines_r)++;
+			if ((i == 0 ? prev_chr : data[i-1]) != '\r')
+				(*missing_cr_count_r)++;
+		}
+	}
+	return have_nuls;
+}
+
+static size_t ref_header(const unsigned char *data, size_t size, bool colon)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (data[i] == '\n' || data[i] == '\0' ||
+		    (colon && data[i] == ':'))
+			break;
+	}
+	return i;
+}
+
+static void test_message_scan_fill(unsigned char *data, size_t size)
+{
+	/* mostly characters that the scanners care about */
+	static const char chars[] = "\n\r-:\0a;\x80";
+
+	for (size_t i = 0; i < size; i++) {
+		if (i_rand_limit(4) == 0)
+			data[i] = chars[i_rand_limit(sizeof(chars)-1)];
+		else
+			data[i] = 'a' + i_rand_limit(26);
+	}
+}
+
+static void test_message_scan_random(void)
+{
+	unsigned char buf[TEST_SCAN_MAX_SIZE + 16];
+	unsigned int lines, missing, ref_lines_count, ref_missing;
+	unsigned char prev_chr;
+	bool nuls, ref_nuls;
+
+	test_begin("message scan random");
+	for (unsigned int n = 0; n < 20000; n++) {
+		/* test also unaligned data */
+		unsigned char *data = buf + i_rand_limit(16);
+		size_t size = i_rand_limit(TEST_SCAN_MAX_SIZE + 1);
+
+		test_message_scan_fill(data, size);
+		test_assert_idx(message_scan_boundary_lf(data, size) ==
+				ref_boundary_lf(data, size), n);
+
+		prev_chr = i_rand_limit(2) == 0 ? '\r' : 'a';
+		nuls = message_scan_lines(data, size, prev_chr,
+					  &lines, &missing);
+		ref_nuls = ref_lines(data, size, prev_chr,
+				     &ref_lines_count, &ref_missing);
+		test_assert_idx(nuls == ref_nuls, n);
+		test_assert_idx(lines == ref_lines_count, n);
+		test_assert_idx(missing == ref_missing, n);
+
+		test_assert_idx(message_scan_header_name(data, size) ==
+				ref_header(data, size, TRUE), n);
+		test_assert_idx(message_scan_header_value(data, size) ==
+				ref_header(data, size, FALSE), n);
+	}
+	test_end();
+}
+
+static void test_message_scan_boundary_lf(void)
+{
+	const unsigned char *data;
+
+	test_begin("message scan boundary lf");
+	data = (const unsigned char *)"line1\nline2\r\nline3\n--boundary\n";
+	test_assert(message_scan_boundary_lf(data, strlen((const char *)data)) ==
+		    data + 18);
+	/* LF near the end of the data is always returned */
+	data = (const unsigned char *)"0123456789abcdefghijklmnopqrstuvwxyz\na";
+	test_assert(message_scan_boundary_lf(data, strlen((const char *)data)) ==
+		    data + 36);
+	data = (const unsigned char *)"0123456789abcdefghijklmnopqrstuvwxyz\nab";
+	test_assert(message_scan_boundary_lf(data, strlen((const char *)data)) ==
+		    NULL);
+	test_assert(message_scan_boundary_lf(data, 0) == NULL);
+	test_end();
+}
+
+static void test_message_scan_lines(void)
+{
+	const unsigned char *data;
+	unsigned int lines, missing;
+
+	test_begin("message scan lines");
+	data = (const unsigned char *)"\nfoo\r\nbar\n\r\n\n0123456789abcdef\n";
+	test_assert(!message_scan_lines(data, strlen((const char *)data), '\r',
+					&lines, &missing));
+	test_assert(lines == 6 && missing == 3);
+	test_assert(!message_scan_lines(data, strlen((const char *)data), 'x',
+					&lines, &missing));
+	test_assert(lines == 6 && missing == 4);
+	test_assert(message_scan_lines((const unsigned char *)"0123456789abcdef\0",
+				       17, 'x', &lines, &missing));
+	test_assert(lines == 0 && missing == 0);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_message_scan_random,
+		test_message_scan_boundary_lf,
+		test_message_scan_lines,
+		NULL
+	};
+	return test_run(test_functions);
+}
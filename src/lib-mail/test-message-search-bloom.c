@@ -0,0 +1,192 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "istream.h"
+#include "str.h"
+#include "unichar.h"
+#include "message-parser.h"
+#include "message-search.h"
+#include "message-search-bloom.h"
+#include "test-common.h"
+
+static const char *test_mails[] = {
+	"Subject: Hello, World\n"
+	"MIME-Version: 1.0\n"
+	"Content-Type: text/plain\n"
+	"\n"
+	"Meeting tomorrow at the conference room.\n",
+
+	"Subject: =?UTF-8?B?SGVsbG8sIFdvcmxk?=\n"
+	"From: =?ISO-8859-1?Q?Andr=E9?= <andre@example.com>\n"
+	"Content-Type: text/plain; charset=utf-8\n"
+	"Content-Transfer-Encoding: quoted-printable\n"
+	"\n"
+	"Gr=C3=BC=C3=9Fe aus M=C3=BCnchen, the invoice is at=\n"
+	"tached.\n",
+
+	"Subject: multipart\n"
+	"Content-Type: multipart/mixed; boundary=1\n"
+	"\n--1\n"
+	"Content-Type: text/html; charset=us-ascii\n\n"
+	"<p>Quarterly report</p>\n"
+	"\n--1\n"
+	"Content-Type: application/octet-stream\n"
+	"Content-Transfer-Encoding: base64\n"
+	"\n"
+	"c2VjcmV0IGJpbmFyeQ==\n"
+	"\n--1\n"
+	"Content-Type: message/rfc822\n"
+	"\n"
+	"Subject: forwarded\n"
+	"\n"
+	"Nested body text\n"
+	"\n--1--\n",
+
+	"X-Long: first line\n"
+	" continued line\n"
+	"Content-Type: text/plain;\n"
+	" charset=iso-8859-1\n"
+	"Content-Transfer-Encoding: base64\n"
+	"\n"
+	"U2No9m5lIEdy/N9lIGF1cyBCZXJsaW4=\n",
+};
+
+static void
+test_build(const char *mail, size_t filter_size, buffer_t *filter)
+{
+	struct istream *input;
+
+	input = test_istream_create(mail);
+	test_assert(message_search_bloom_build(input,
+		uni_utf8_to_decomposed_titlecase, filter_size, filter) == 0);
+	test_assert(filter->used == filter_size);
+	i_stream_unref(&input);
+}
+
+static bool test_search(const char *mail, const char *key)
+{
+	struct message_search_context *ctx;
+	struct istream *input;
+	const char *error;
+	string_t *dtc = t_str_new(64);
+	int ret;
+
+	if (uni_utf8_to_decomposed_titlecase(key, strlen(key), dtc) < 0 ||
+	    str_len(dtc) == 0)
+		return FALSE;
+	input = test_istream_create(mail);
+	ctx = message_search_init(str_c(dtc), uni_utf8_to_decomposed_titlecase,
+				  0);
+	ret = message_search_msg(ctx, input, NULL, &error);
+	message_search_deinit(&ctx);
+	i_stream_unref(&input);
+	return ret > 0;
+}
+
+static bool
+test_may_contain(const buffer_t *filter, const char *key)
+{
+	string_t *dtc = t_str_new(64);
+
+	if (uni_utf8_to_decomposed_titlecase(key, strlen(key), dtc) < 0)
+		i_unreached();
+	return message_search_bloom_may_contain(filter->data, filter->used,
+						str_c(dtc));
+}
+
+static void test_message_search_bloom_found(void)
+{
+	static const char *keys[] = {
+		"hello", "WORLD", "hello, world", "meeting tomorrow",
+		"ference", "andré", "grüße", "münchen", "attached",
+		"quarterly", "<p>", "forwarded", "nested body", "first line",
+		"line continued", "schöne", "berlin", "text/plain",
+	};
+	buffer_t *filter = t_buffer_create(256);
+	unsigned int i, j, found = 0;
+
+	test_begin("message search bloom found keys");
+	for (i = 0; i < N_ELEMENTS(test_mails); i++) {
+		buffer_set_used_size(filter, 0);
+		test_build(test_mails[i], 64, filter);
+		for (j = 0; j < N_ELEMENTS(keys); j++) {
+			if (!test_search(test_mails[i], keys[j]))
+				continue;
+			found++;
+			test_assert_idx(test_may_contain(filter, keys[j]),
+					i * 100 + j);
+		}
+	}
+	/* make sure the keys are actually tested */
+	test_assert(found > N_ELEMENTS(keys) / 2);
+	test_end();
+}
+
+static void test_message_search_bloom_substrings(void)
+{
+	buffer_t *filter = t_buffer_create(256);
+	unsigned int i, len;
+	size_t pos, mail_len;
+
+	test_begin("message search bloom all substrings");
+	/* Anything in the mail that can be found must be in the filter. Use
+	   a small filter, so that it's not always full of false positives. */
+	for (i = 0; i < N_ELEMENTS(test_mails); i++) {
+		buffer_set_used_size(filter, 0);
+		test_build(test_mails[i], 512, filter);
+		mail_len = strlen(test_mails[i]);
+		for (pos = 0; pos < mail_len; pos++) {
+			for (len = 3; len <= 8 && pos + len <= mail_len; len++) T_BEGIN {
+				const char *key = t_strndup(test_mails[i] + pos, len);
+
+				if (uni_utf8_str_is_valid(key) &&
+				    test_search(test_mails[i], key))
+					test_assert_idx(test_may_contain(filter, key),
+							pos);
+			} T_END;
+		}
+	}
+	test_end();
+}
+
+static void test_message_search_bloom_not_found(void)
+{
+	static const char *keys[] = {
+		"zebra", "unicorn", "quux", "octet-stream binary",
+		/* base64 data of non-text parts isn't searched */
+		"secret",
+	};
+	buffer_t *filter = t_buffer_create(4096);
+	unsigned int i, j;
+
+	test_begin("message search bloom missing keys");
+	for (i = 0; i < N_ELEMENTS(test_mails); i++) {
+		buffer_set_used_size(filter, 0);
+		test_build(test_mails[i], 4096, filter);
+		for (j = 0; j < N_ELEMENTS(keys); j++) {
+			test_assert_idx(!test_search(test_mails[i], keys[j]),
+					i * 100 + j);
+			/* the filter is large, so there shouldn't be false
+			   positives */
+			test_assert_idx(!test_may_contain(filter, keys[j]),
+					i * 100 + j);
+		}
+		/* keys without 3 consecutive word characters can't be
+		   filtered */
+		test_assert(test_may_contain(filter, "x y"));
+		test_assert(test_may_contain(filter, "--"));
+	}
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_message_search_bloom_found,
+		test_message_search_bloom_substrings,
+		test_message_search_bloom_not_found,
+		NULL
+	};
+	return test_run(test_functions);
+}
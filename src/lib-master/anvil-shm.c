@@ -0,0 +1,552 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "md5.h"
+#include "net.h"
+#include "strescape.h"
+#include "mmap-util.h"
+#include "anvil-shm.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* The file contains a header followed by ANVIL_SHM_TABLE_COUNT open addressing
+   hash tables. Only anvil writes to the file. Readers don't take any locks:
+
+    - Each slot has a sequence number, which is odd while the writer is
+      changing the slot. Readers retry if the sequence is odd or it changed
+      while the slot was being read.
+    - Each table has a sequence number, which is odd while the writer is
+      rebuilding the table. Readers fall back to asking anvil if the table
+      sequence is odd or it changed during the lookup.
+    - If a key couldn't be inserted within ANVIL_SHM_MAX_PROBES slots, the
+      table's overflow flag is set and readers fall back to asking anvil for
+      keys that weren't found. The writer doesn't know when the keys that
+      didn't fit are gone, so the flag stays set until anvil restarts.
+    - The writer updates refresh_stamp every second. If it's 0 or too old,
+      anvil isn't running and readers fall back to asking anvil (which
+      fails the same way it did before).
+
+   Keys are stored as MD5 hashes of the key strings. This keeps the slots
+   fixed size and doesn't expose the usernames to readers that don't already
+   know them. */
+#define ANVIL_SHM_MAGIC 0x41564d53
+#define ANVIL_SHM_VERSION 1
+#define ANVIL_SHM_SLOT_COUNT 65536
+#define ANVIL_SHM_MAX_PROBES 32
+#define ANVIL_SHM_MAX_SLOT_RETRIES 16
+#define ANVIL_SHM_STALE_SECS 5
+
+/* Limit the number of used slots so that the probe sequences stay short. */
+#define ANVIL_SHM_MAX_USED_COUNT (ANVIL_SHM_SLOT_COUNT / 4 * 3)
+/* Rebuild the table when there are too many tombstones. */
+#define ANVIL_SHM_MAX_TOMBSTONE_COUNT (ANVIL_SHM_SLOT_COUNT / 4)
+
+#define ANVIL_SHM_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define ANVIL_SHM_STORE(ptr, value) \
+	__atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#define ANVIL_SHM_READ_FENCE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define ANVIL_SHM_WRITE_FENCE() __atomic_thread_fence(__ATOMIC_RELEASE)
+
+enum anvil_shm_slot_state {
+	ANVIL_SHM_SLOT_EMPTY = 0,
+	ANVIL_SHM_SLOT_USED,
+	ANVIL_SHM_SLOT_TOMBSTONE,
+};
+
+struct anvil_shm_slot {
+	uint32_t seq;
+	uint32_t state;
+	uint8_t key[MD5_RESULTLEN];
+	uint32_t value1, value2;
+};
+
+struct anvil_shm_table_header {
+	uint32_t seq;
+	uint32_t overflow;
+};
+
+struct anvil_shm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t slot_count;
+
+	uint32_t writer_pid;
+	/* ioloop_time of the last anvil_shm_refresh() call, 0 = closed */
+	uint32_t refresh_stamp;
+
+	struct anvil_shm_table_header tables[ANVIL_SHM_TABLE_COUNT];
+};
+
+struct anvil_shm_writer_table {
+	unsigned int used_count;
+	unsigned int tombstone_count;
+};
+
+struct anvil_shm {
+	char *path;
+	int fd;
+	void *mmap_base;
+	size_t mmap_size;
+
+	struct anvil_shm_header *hdr;
+	struct anvil_shm_slot *slots;
+
+	bool writer;
+	struct anvil_shm_writer_table tables[ANVIL_SHM_TABLE_COUNT];
+};
+
+static size_t anvil_shm_get_file_size(void)
+{
+	return sizeof(struct anvil_shm_header) +
+		sizeof(struct anvil_shm_slot) *
+		ANVIL_SHM_SLOT_COUNT * ANVIL_SHM_TABLE_COUNT;
+}
+
+static struct anvil_shm_slot *
+anvil_shm_table_slots(struct anvil_shm *shm, enum anvil_shm_table table)
+{
+	i_assert(table < ANVIL_SHM_TABLE_COUNT);
+	return shm->slots + ANVIL_SHM_SLOT_COUNT * table;
+}
+
+static unsigned int anvil_shm_key_idx(const uint8_t key[MD5_RESULTLEN])
+{
+	uint32_t hash;
+
+	memcpy(&hash, key, sizeof(hash));
+	return hash % ANVIL_SHM_SLOT_COUNT;
+}
+
+static bool anvil_shm_header_is_valid(const struct anvil_shm_header *hdr)
+{
+	return hdr->magic == ANVIL_SHM_MAGIC &&
+		hdr->version == ANVIL_SHM_VERSION &&
+		hdr->header_size == sizeof(*hdr) &&
+		hdr->slot_count == ANVIL_SHM_SLOT_COUNT;
+}
+
+static int
+anvil_shm_mmap(struct anvil_shm *shm, bool writer, const char **error_r)
+{
+	struct stat st;
+
+	if (fstat(shm->fd, &st) < 0) {
+		*error_r = t_strdup_printf("fstat(%s) failed: %m", shm->path);
+		return -1;
+	}
+	if ((uoff_t)st.st_size != anvil_shm_get_file_size()) {
+		*error_r = t_strdup_printf("%s: Unexpected file size %"PRIuUOFF_T,
+					   shm->path, (uoff_t)st.st_size);
+		return 0;
+	}
+	shm->mmap_size = anvil_shm_get_file_size();
+	shm->mmap_base = writer ?
+		mmap_rw_file(shm->fd, &shm->mmap_size) :
+		mmap_ro_file(shm->fd, &shm->mmap_size);
+	if (shm->mmap_base == MAP_FAILED) {
+		shm->mmap_base = NULL;
+		*error_r = t_strdup_printf("mmap(%s) failed: %m", shm->path);
+		return -1;
+	}
+	shm->hdr = shm->mmap_base;
+	shm->slots = PTR_OFFSET(shm->mmap_base, sizeof(*shm->hdr));
+	return 1;
+}
+
+static void anvil_shm_free(struct anvil_shm *shm)
+{
+	if (shm->mmap_base != NULL) {
+		if (munmap(shm->mmap_base, shm->mmap_size) < 0)
+			i_error("munmap(%s) failed: %m", shm->path);
+	}
+	i_close_fd_path(&shm->fd, shm->path);
+	i_free(shm->path);
+	i_free(shm);
+}
+
+static int
+anvil_shm_create_file(struct anvil_shm *shm, const char **error_r)
+{
+	struct stat st;
+
+	/* Reuse the existing file if possible, so readers that still have the
+	   previous anvil's file mapped see the new anvil's changes. */
+	shm->fd = open(shm->path, O_RDWR | O_CREAT, 0600);
+	if (shm->fd == -1) {
+		*error_r = t_strdup_printf("open(%s) failed: %m", shm->path);
+		return -1;
+	}
+	if (fstat(shm->fd, &st) < 0) {
+		*error_r = t_strdup_printf("fstat(%s) failed: %m", shm->path);
+		return -1;
+	}
+	if (st.st_size == 0) {
+		if (ftruncate(shm->fd, anvil_shm_get_file_size()) < 0) {
+			*error_r = t_strdup_printf("ftruncate(%s) failed: %m",
+						   shm->path);
+			return -1;
+		}
+	}
+	return anvil_shm_mmap(shm, TRUE, error_r);
+}
+
+static void anvil_shm_init_header(struct anvil_shm *shm)
+{
+	struct anvil_shm_header *hdr = shm->hdr;
+	unsigned int i;
+
+	if (!anvil_shm_header_is_valid(hdr)) {
+		/* new file - it's all zeros */
+		hdr->header_size = sizeof(*hdr);
+		hdr->slot_count = ANVIL_SHM_SLOT_COUNT;
+		hdr->version = ANVIL_SHM_VERSION;
+		ANVIL_SHM_STORE(&hdr->magic, ANVIL_SHM_MAGIC);
+	}
+	hdr->writer_pid = getpid();
+
+	/* Clear the tables. Readers may still be using them, so do it within
+	   the table sequence. */
+	for (i = 0; i < ANVIL_SHM_TABLE_COUNT; i++) {
+		struct anvil_shm_table_header *thdr = &hdr->tables[i];
+		uint32_t seq = thdr->seq | 1;
+
+		ANVIL_SHM_STORE(&thdr->seq, seq);
+		ANVIL_SHM_WRITE_FENCE();
+		memset(anvil_shm_table_slots(shm, i), 0,
+		       sizeof(struct anvil_shm_slot) * ANVIL_SHM_SLOT_COUNT);
+		thdr->overflow = 0;
+		ANVIL_SHM_STORE(&thdr->seq, seq + 1);
+	}
+	anvil_shm_refresh(shm);
+}
+
+int anvil_shm_create(const char *path, struct anvil_shm **shm_r,
+		     const char **error_r)
+{
+	struct anvil_shm *shm;
+	int ret;
+
+	shm = i_new(struct anvil_shm, 1);
+	shm->path = i_strdup(path);
+	shm->writer = TRUE;
+
+	ret = anvil_shm_create_file(shm, error_r);
+	if (ret == 0) {
+		/* Incompatible file, probably from a different version.
+		   Replace it. Readers using the old file notice that it's no
+		   longer being refreshed. */
+		i_close_fd_path(&shm->fd, shm->path);
+		if (unlink(path) < 0 && errno != ENOENT) {
+			*error_r = t_strdup_printf("unlink(%s) failed: %m",
+						   path);
+			ret = -1;
+		} else {
+			ret = anvil_shm_create_file(shm, error_r);
+		}
+	}
+	if (ret <= 0) {
+		if (ret == 0)
+			*error_r = t_strdup_printf("%s: File changed", path);
+		anvil_shm_free(shm);
+		return -1;
+	}
+	anvil_shm_init_header(shm);
+	*shm_r = shm;
+	return 0;
+}
+
+int anvil_shm_open(const char *path, struct anvil_shm **shm_r,
+		   const char **error_r)
+{
+	struct anvil_shm *shm;
+	int ret;
+
+	*shm_r = NULL;
+
+	shm = i_new(struct anvil_shm, 1);
+	shm->path = i_strdup(path);
+	shm->fd = open(path, O_RDONLY);
+	if (shm->fd == -1) {
+		if (errno == ENOENT) {
+			i_free(shm->path);
+			i_free(shm);
+			return 0;
+		}
+		*error_r = t_strdup_printf("open(%s) failed: %m", path);
+		ret = -1;
+	} else {
+		ret = anvil_shm_mmap(shm, FALSE, error_r);
+	}
+	if (ret > 0 && !anvil_shm_header_is_valid(shm->hdr)) {
+		*error_r = t_strdup_printf("%s: Incompatible file", path);
+		ret = 0;
+	}
+	if (ret <= 0) {
+		anvil_shm_free(shm);
+		return ret < 0 ? -1 : 0;
+	}
+	*shm_r = shm;
+	return 1;
+}
+
+void anvil_shm_close(struct anvil_shm **_shm)
+{
+	struct anvil_shm *shm = *_shm;
+
+	if (shm == NULL)
+		return;
+	*_shm = NULL;
+
+	if (shm->writer)
+		ANVIL_SHM_STORE(&shm->hdr->refresh_stamp, 0);
+	anvil_shm_free(shm);
+}
+
+void anvil_shm_refresh(struct anvil_shm *shm)
+{
+	uint32_t stamp = ioloop_time <= 0 ? 1 : (uint32_t)ioloop_time;
+
+	i_assert(shm->writer);
+	ANVIL_SHM_STORE(&shm->hdr->refresh_stamp, stamp);
+}
+
+static void anvil_shm_get_key(const char *key, uint8_t hash_r[MD5_RESULTLEN])
+{
+	md5_get_digest(key, strlen(key), hash_r);
+}
+
+static void
+anvil_shm_slot_write(struct anvil_shm_slot *slot,
+		     enum anvil_shm_slot_state state,
+		     const uint8_t key[MD5_RESULTLEN],
+		     unsigned int value1, unsigned int value2)
+{
+	uint32_t seq = slot->seq;
+
+	ANVIL_SHM_STORE(&slot->seq, seq + 1);
+	ANVIL_SHM_WRITE_FENCE();
+	slot->state = state;
+	if (key != NULL)
+		memcpy(slot->key, key, MD5_RESULTLEN);
+	slot->value1 = value1;
+	slot->value2 = value2;
+	ANVIL_SHM_STORE(&slot->seq, seq + 2);
+}
+
+static struct anvil_shm_slot *
+anvil_shm_writer_find(struct anvil_shm *shm, enum anvil_shm_table table,
+		      const uint8_t key[MD5_RESULTLEN],
+		      struct anvil_shm_slot **free_slot_r)
+{
+	struct anvil_shm_slot *slots = anvil_shm_table_slots(shm, table);
+	unsigned int i, idx = anvil_shm_key_idx(key);
+
+	*free_slot_r = NULL;
+	for (i = 0; i < ANVIL_SHM_MAX_PROBES; i++) {
+		struct anvil_shm_slot *slot =
+			&slots[(idx + i) % ANVIL_SHM_SLOT_COUNT];
+
+		switch (slot->state) {
+		case ANVIL_SHM_SLOT_EMPTY:
+			if (*free_slot_r == NULL)
+				*free_slot_r = slot;
+			return NULL;
+		case ANVIL_SHM_SLOT_USED:
+			if (memcmp(slot->key, key, MD5_RESULTLEN) == 0)
+				return slot;
+			break;
+		case ANVIL_SHM_SLOT_TOMBSTONE:
+			if (*free_slot_r == NULL)
+				*free_slot_r = slot;
+			break;
+		}
+	}
+	return NULL;
+}
+
+static void
+anvil_shm_table_rebuild(struct anvil_shm *shm, enum anvil_shm_table table)
+{
+	struct anvil_shm_table_header *thdr = &shm->hdr->tables[table];
+	struct anvil_shm_writer_table *wtable = &shm->tables[table];
+	struct anvil_shm_slot *slots = anvil_shm_table_slots(shm, table);
+	struct anvil_shm_slot *old_slots, *free_slot;
+	unsigned int i;
+	uint32_t seq = thdr->seq;
+
+	old_slots = i_new(struct anvil_shm_slot, ANVIL_SHM_SLOT_COUNT);
+	memcpy(old_slots, slots, sizeof(*slots) * ANVIL_SHM_SLOT_COUNT);
+
+	ANVIL_SHM_STORE(&thdr->seq, seq + 1);
+	ANVIL_SHM_WRITE_FENCE();
+	memset(slots, 0, sizeof(*slots) * ANVIL_SHM_SLOT_COUNT);
+	wtable->used_count = 0;
+	wtable->tombstone_count = 0;
+	for (i = 0; i < ANVIL_SHM_SLOT_COUNT; i++) {
+		if (old_slots[i].state != ANVIL_SHM_SLOT_USED)
+			continue;
+		if (anvil_shm_writer_find(shm, table, old_slots[i].key,
+					  &free_slot) != NULL)
+			i_unreached();
+		if (free_slot == NULL) {
+			thdr->overflow = 1;
+			continue;
+		}
+		*free_slot = old_slots[i];
+		free_slot->seq = 0;
+		wtable->used_count++;
+	}
+	ANVIL_SHM_STORE(&thdr->seq, seq + 2);
+	i_free(old_slots);
+}
+
+void anvil_shm_set(struct anvil_shm *shm, enum anvil_shm_table table,
+		   const char *key, unsigned int value1, unsigned int value2)
+{
+	struct anvil_shm_writer_table *wtable = &shm->tables[table];
+	struct anvil_shm_slot *slot, *free_slot;
+	uint8_t hash[MD5_RESULTLEN];
+
+	i_assert(shm->writer);
+
+	anvil_shm_get_key(key, hash);
+	slot = anvil_shm_writer_find(shm, table, hash, &free_slot);
+	if (slot != NULL) {
+		anvil_shm_slot_write(slot, ANVIL_SHM_SLOT_USED, NULL,
+				     value1, value2);
+		return;
+	}
+	if (free_slot == NULL || wtable->used_count >= ANVIL_SHM_MAX_USED_COUNT) {
+		/* Readers must ask anvil about missing keys from now on. */
+		ANVIL_SHM_STORE(&shm->hdr->tables[table].overflow, 1);
+		return;
+	}
+	if (free_slot->state == ANVIL_SHM_SLOT_TOMBSTONE)
+		wtable->tombstone_count--;
+	anvil_shm_slot_write(free_slot, ANVIL_SHM_SLOT_USED, hash,
+			     value1, value2);
+	wtable->used_count++;
+}
+
+void anvil_shm_unset(struct anvil_shm *shm, enum anvil_shm_table table,
+		     const char *key)
+{
+	struct anvil_shm_writer_table *wtable = &shm->tables[table];
+	struct anvil_shm_slot *slot, *free_slot;
+	uint8_t hash[MD5_RESULTLEN];
+
+	i_assert(shm->writer);
+
+	anvil_shm_get_key(key, hash);
+	slot = anvil_shm_writer_find(shm, table, hash, &free_slot);
+	if (slot == NULL)
+		return;
+
+	anvil_shm_slot_write(slot, ANVIL_SHM_SLOT_TOMBSTONE, NULL, 0, 0);
+	i_assert(wtable->used_count > 0);
+	wtable->used_count--;
+	if (++wtable->tombstone_count > ANVIL_SHM_MAX_TOMBSTONE_COUNT)
+		anvil_shm_table_rebuild(shm, table);
+}
+
+static bool anvil_shm_is_fresh(const struct anvil_shm_header *hdr)
+{
+	uint32_t stamp = ANVIL_SHM_LOAD(&hdr->refresh_stamp);
+
+	if (stamp == 0)
+		return FALSE;
+	if (ioloop_time >= (time_t)stamp)
+		return ioloop_time - (time_t)stamp <= ANVIL_SHM_STALE_SECS;
+	/* ioloop_time may be a bit behind */
+	return (time_t)stamp - ioloop_time <= ANVIL_SHM_STALE_SECS;
+}
+
+static int
+anvil_shm_slot_read(const struct anvil_shm_slot *slot,
+		    const uint8_t key[MD5_RESULTLEN],
+		    unsigned int *value1_r, unsigned int *value2_r)
+{
+	struct anvil_shm_slot copy;
+	unsigned int i;
+	uint32_t seq;
+
+	for (i = 0; i < ANVIL_SHM_MAX_SLOT_RETRIES; i++) {
+		seq = ANVIL_SHM_LOAD(&slot->seq);
+		if ((seq & 1) != 0)
+			continue;
+		memcpy(&copy, slot, sizeof(copy));
+		ANVIL_SHM_READ_FENCE();
+		if (ANVIL_SHM_LOAD(&slot->seq) != seq)
+			continue;
+
+		switch (copy.state) {
+		case ANVIL_SHM_SLOT_EMPTY:
+			return 0;
+		case ANVIL_SHM_SLOT_USED:
+			if (memcmp(copy.key, key, MD5_RESULTLEN) != 0)
+				return 2;
+			*value1_r = copy.value1;
+			*value2_r = copy.value2;
+			return 1;
+		case ANVIL_SHM_SLOT_TOMBSTONE:
+			return 2;
+		default:
+			return -1;
+		}
+	}
+	return -1;
+}
+
+int anvil_shm_lookup(struct anvil_shm *shm, enum anvil_shm_table table,
+		     const char *key, unsigned int *value1_r,
+		     unsigned int *value2_r)
+{
+	const struct anvil_shm_table_header *thdr;
+	const struct anvil_shm_slot *slots;
+	uint8_t hash[MD5_RESULTLEN];
+	unsigned int i, idx;
+	uint32_t table_seq;
+	int ret = 2;
+
+	*value1_r = 0;
+	*value2_r = 0;
+
+	if (!anvil_shm_is_fresh(shm->hdr))
+		return -1;
+	thdr = &shm->hdr->tables[table];
+	table_seq = ANVIL_SHM_LOAD(&thdr->seq);
+	if ((table_seq & 1) != 0)
+		return -1;
+
+	anvil_shm_get_key(key, hash);
+	slots = anvil_shm_table_slots(shm, table);
+	idx = anvil_shm_key_idx(hash);
+	for (i = 0; i < ANVIL_SHM_MAX_PROBES && ret == 2; i++) {
+		ret = anvil_shm_slot_read(&slots[(idx + i) % ANVIL_SHM_SLOT_COUNT],
+					  hash, value1_r, value2_r);
+	}
+	if (ret == 2)
+		ret = 0;
+	if (ret == 0 && ANVIL_SHM_LOAD(&thdr->overflow) != 0)
+		ret = -1;
+
+	ANVIL_SHM_READ_FENCE();
+	if (ANVIL_SHM_LOAD(&thdr->seq) != table_seq)
+		ret = -1;
+	if (ret <= 0) {
+		*value1_r = 0;
+		*value2_r = 0;
+	}
+	return ret;
+}
+
+const char *anvil_shm_userip_key(const char *username, const char *service,
+				 const struct ip_addr *ip)
+{
+	return t_strdup_printf("%s\t%s\t%s", str_tabescape(username),
+			       t_strcut(service, '-'),
+			       ip->family == 0 ? "" : net_ip2addr(ip));
+}
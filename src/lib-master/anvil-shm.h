@@ -0,0 +1,58 @@
+#ifndef ANVIL_SHM_H
+#define ANVIL_SHM_H
+
+/* Shared memory copy of anvil's connect-limit and penalty tables. Only the
+   anvil process writes to it, while the other processes can look up values
+   without sending a query to anvil. The keys are stored only as hashes.
+
+   The file is created in the same directory as anvil's sockets. Readers
+   must open it while they still have the privileges to access anvil's
+   sockets. */
+#define ANVIL_SHM_FILE_NAME "anvil-shm"
+
+struct ip_addr;
+struct anvil_shm;
+
+enum anvil_shm_table {
+	/* "LOOKUP" - value1 = number of connections */
+	ANVIL_SHM_TABLE_USERIP,
+	/* "PENALTY-GET" - value1 = penalty, value2 = last_penalty */
+	ANVIL_SHM_TABLE_PENALTY,
+
+	ANVIL_SHM_TABLE_COUNT
+};
+
+/* Create (or reuse) the shared memory file for writing. All the tables are
+   cleared. */
+int anvil_shm_create(const char *path, struct anvil_shm **shm_r,
+		     const char **error_r);
+/* Open the shared memory file for reading. Returns 1 if opened, 0 if the
+   file doesn't exist (anvil isn't running or is too old) and -1 on error. */
+int anvil_shm_open(const char *path, struct anvil_shm **shm_r,
+		   const char **error_r);
+/* Close the file. When called by the writer, readers stop using it. */
+void anvil_shm_close(struct anvil_shm **shm);
+
+/* Set the values for the key. */
+void anvil_shm_set(struct anvil_shm *shm, enum anvil_shm_table table,
+		   const char *key, unsigned int value1, unsigned int value2);
+/* Remove the key. */
+void anvil_shm_unset(struct anvil_shm *shm, enum anvil_shm_table table,
+		     const char *key);
+/* Tell readers that the writer is still alive. This must be called at least
+   once per second. */
+void anvil_shm_refresh(struct anvil_shm *shm);
+
+/* Look up the key. Returns 1 if found, 0 if the key doesn't exist (values
+   are set to 0) and -1 if the shared memory can't be trusted currently and
+   the lookup must be done via anvil. */
+int anvil_shm_lookup(struct anvil_shm *shm, enum anvil_shm_table table,
+		     const char *key, unsigned int *value1_r,
+		     unsigned int *value2_r);
+
+/* Returns the key used for ANVIL_SHM_TABLE_USERIP. The service name is
+   truncated at the first '-' the same way as anvil does. */
+const char *anvil_shm_userip_key(const char *username, const char *service,
+				 const struct ip_addr *ip);
+
+#endif
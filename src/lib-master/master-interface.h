@@ -74,6 +74,12 @@ enum master_login_state {
    if dovecot was started with -p parameter. */
 #define MASTER_SSL_KEY_PASSWORD_ENV "SSL_KEY_PASSWORD"
 
+/* getenv(MASTER_SSL_TICKET_KEY_SECRET_ENV) returns space-separated
+   hex-encoded secrets, newest first, that are the same for all the processes
+   started by the same master at the same time. TLS session ticket keys are
+   derived from them, so that sessions can be resumed with any process. */
+#define MASTER_SSL_TICKET_KEY_SECRET_ENV "SSL_TICKET_KEY_SECRET"
+
 /* getenv(DOVECOT_PRESERVE_ENVS_ENV) returns a space separated list of
    environments that should be preserved. */
 #define DOVECOT_PRESERVE_ENVS_ENV "DOVECOT_PRESERVE_ENVS"
@@ -250,4 +250,7 @@ void master_service_ssl_server_settings_to_iostream_set(
 	/* ssl_require_crl is used only for checking client-provided SSL
 	   certificate's CRL. */
 	set_r->skip_crl_check = !ssl_set->ssl_require_crl;
+	/* shared by all the processes started by the same master */
+	set_r->ticket_key_secret =
+		p_strdup_empty(pool, getenv(MASTER_SSL_TICKET_KEY_SECRET_ENV));
 }
@@ -0,0 +1,193 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "net.h"
+#include "test-common.h"
+#include "anvil-shm.h"
+
+#include <unistd.h>
+
+#define TEST_ANVIL_SHM_PATH ".test-anvil-shm"
+
+static void test_anvil_shm_open(struct anvil_shm **writer_r,
+				struct anvil_shm **reader_r)
+{
+	const char *error;
+
+	test_assert(anvil_shm_create(TEST_ANVIL_SHM_PATH, writer_r, &error) == 0);
+	test_assert(anvil_shm_open(TEST_ANVIL_SHM_PATH, reader_r, &error) == 1);
+}
+
+static void test_anvil_shm_set_lookup(void)
+{
+	struct anvil_shm *writer, *reader;
+	unsigned int value1, value2;
+
+	test_begin("anvil shm set and lookup");
+	ioloop_time = 1000000;
+	test_anvil_shm_open(&writer, &reader);
+
+	test_assert(anvil_shm_lookup(reader, ANVIL_SHM_TABLE_PENALTY, "key1",
+				     &value1, &value2) == 0);
+	anvil_shm_set(writer, ANVIL_SHM_TABLE_PENALTY, "key1", 3, 123);
+	test_assert(anvil_shm_lookup(reader, ANVIL_SHM_TABLE_PENALTY, "key1",
+				     &value1, &value2) == 1);
+	test_assert(value1 == 3 && value2 == 123);
+	/* tables are separate */
+	test_assert(anvil_shm_lookup(reader, ANVIL_SHM_TABLE_USERIP, "key1",
+				     &value1, &value2) == 0);
+	test_assert(value1 == 0 && value2 == 0);
+
+	anvil_shm_set(writer, ANVIL_SHM_TABLE_PENALTY, "key1", 4, 124);
+	test_assert(anvil_shm_lookup(reader, ANVIL_SHM_TABLE_PENALTY, "key1",
+				     &value1, &value2) == 1);
+	test_assert(value1 == 4 && value2 == 124);
+
+	anvil_shm_unset(writer, ANVIL_SHM_TABLE_PENALTY, "key1");
+	test_assert(anvil_shm_lookup(reader, ANVIL_SHM_TABLE_PENALTY, "key1",
+				     &value1, &value2) == 0);
+	/* unsetting a nonexistent key is ignored */
+	anvil_shm_unset(writer, ANVIL_SHM_TABLE_PENALTY, "key1");
+
+	anvil_shm_close(&reader);
+	anvil_shm_close(&writer);
+	i_unlink(TEST_ANVIL_SHM_PATH);
+	test_end();
+}
+
+static void test_anvil_shm_many_keys(void)
+{
+	struct anvil_shm *writer, *reader;
+	unsigned int i, value1, value2;
+	bool ok = TRUE;
+
+	test_begin("anvil shm many keys");
+	ioloop_time = 1000000;
+	test_anvil_shm_open(&writer, &reader);
+
+	/* enough unsets to trigger rebuilding the table */
+	for (i = 0; i < 40000; i++) {
+		anvil_shm_set(writer, ANVIL_SHM_TABLE_USERIP, dec2str(i), i, 0);
+		if (i % 2 == 0)
+			anvil_shm_unset(writer, ANVIL_SHM_TABLE_USERIP, dec2str(i));
+	}
+	for (i = 0; i < 40000 && ok; i++) {
+		int ret = anvil_shm_lookup(reader, ANVIL_SHM_TABLE_USERIP,
+					   dec2str(i), &value1, &value2);
+		if (i % 2 == 0)
+			ok = ret == 0;
+		else
+			ok = ret == 1 && value1 == i;
+	}
+	test_assert(ok);
+
+	anvil_shm_close(&reader);
+	anvil_shm_close(&writer);
+	i_unlink(TEST_ANVIL_SHM_PATH);
+	test_end();
+}
+
+static void test_anvil_shm_overflow(void)
+{
+	struct anvil_shm *writer, *reader;
+	unsigned int i, value1, value2;
+
+	test_begin("anvil shm overflow");
+	ioloop_time = 1000000;
+	test_anvil_shm_open(&writer, &reader);
+
+	for (i = 0; i < 65536; i++)
+		anvil_shm_set(writer, ANVIL_SHM_TABLE_PENALTY, dec2str(i), 1, 0);
+	/* existing keys can still be found, but missing keys must be
+	   looked up from anvil */
+	test_assert(anvil_shm_lookup(reader, ANVIL_SHM_TABLE_PENALTY, "1",
+				     &value1, &value2) == 1);
+	test_assert(anvil_shm_lookup(reader, ANVIL_SHM_TABLE_PENALTY, "nokey",
+				     &value1, &value2) == -1);
+	/* the other table isn't affected */
+	test_assert(anvil_shm_lookup(reader, ANVIL_SHM_TABLE_USERIP, "nokey",
+				     &value1, &value2) == 0);
+
+	/* a new anvil process starts with empty tables */
+	anvil_shm_close(&reader);
+	anvil_shm_close(&writer);
+	test_anvil_shm_open(&writer, &reader);
+	test_assert(anvil_shm_lookup(reader, ANVIL_SHM_TABLE_PENALTY, "nokey",
+				     &value1, &value2) == 0);
+
+	anvil_shm_close(&reader);
+	anvil_shm_close(&writer);
+	i_unlink(TEST_ANVIL_SHM_PATH);
+	test_end();
+}
+
+static void test_anvil_shm_stale(void)
+{
+	struct anvil_shm *writer, *reader, *reader2;
+	unsigned int value1, value2;
+	const char *error;
+
+	test_begin("anvil shm stale");
+	ioloop_time = 1000000;
+	test_anvil_shm_open(&writer, &reader);
+	anvil_shm_set(writer, ANVIL_SHM_TABLE_PENALTY, "key", 1, 2);
+
+	/* writer hasn't refreshed */
+	ioloop_time += 60;
+	test_assert(anvil_shm_lookup(reader, ANVIL_SHM_TABLE_PENALTY, "key",
+				     &value1, &value2) == -1);
+	anvil_shm_refresh(writer);
+	test_assert(anvil_shm_lookup(reader, ANVIL_SHM_TABLE_PENALTY, "key",
+				     &value1, &value2) == 1);
+
+	/* writer closed */
+	anvil_shm_close(&writer);
+	test_assert(anvil_shm_lookup(reader, ANVIL_SHM_TABLE_PENALTY, "key",
+				     &value1, &value2) == -1);
+
+	/* writer restarted - the old reader sees the new writer's changes */
+	test_assert(anvil_shm_create(TEST_ANVIL_SHM_PATH, &writer, &error) == 0);
+	test_assert(anvil_shm_lookup(reader, ANVIL_SHM_TABLE_PENALTY, "key",
+				     &value1, &value2) == 0);
+	anvil_shm_set(writer, ANVIL_SHM_TABLE_PENALTY, "key", 5, 6);
+	test_assert(anvil_shm_lookup(reader, ANVIL_SHM_TABLE_PENALTY, "key",
+				     &value1, &value2) == 1);
+	test_assert(value1 == 5 && value2 == 6);
+	anvil_shm_close(&reader);
+	anvil_shm_close(&writer);
+
+	i_unlink(TEST_ANVIL_SHM_PATH);
+	test_assert(anvil_shm_open(TEST_ANVIL_SHM_PATH, &reader2, &error) == 0);
+	test_assert(reader2 == NULL);
+	test_end();
+}
+
+static void test_anvil_shm_userip_key(void)
+{
+	struct ip_addr ip;
+
+	test_begin("anvil shm userip key");
+	test_assert(net_addr2ip("1.2.3.4", &ip) == 0);
+	test_assert_strcmp(anvil_shm_userip_key("user", "imap-hibernate", &ip),
+			   "user\timap\t1.2.3.4");
+	test_assert_strcmp(anvil_shm_userip_key("us\ter", "imap", &ip),
+			   "us\001ter\timap\t1.2.3.4");
+	i_zero(&ip);
+	test_assert_strcmp(anvil_shm_userip_key("user", "pop3", &ip),
+			   "user\tpop3\t");
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_anvil_shm_set_lookup,
+		test_anvil_shm_many_keys,
+		test_anvil_shm_overflow,
+		test_anvil_shm_stale,
+		test_anvil_shm_userip_key,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -4,6 +4,7 @@
 #include "array.h"
 #include "ioloop.h"
 #include "hex-binary.h"
+#include "hash.h"
 #include "str.h"
 #include "time-util.h"
 #include "sql-api-private.h"
@@ -13,6 +14,9 @@
 #include <libpq-fe.h>
 
 #define PGSQL_DNS_WARN_MSECS 500
+/* Maximum number of prepared statements kept in a single connection.
+   Statements beyond this are sent without caching them. */
+#define PGSQL_MAX_PREPARED_STATEMENTS 256
 
 struct pgsql_db {
 	struct sql_db api;
@@ -37,6 +41,14 @@ struct pgsql_db {
 	char *error;
 	const char *connect_state;
 
+	/* Use server-side prepared statements (prepared_statements=yes in
+	   connect string). */
+	bool prepared_statements;
+	/* query with $n parameters -> prepared statement name. The statements
+	   exist only for the lifetime of the connection. */
+	HASH_TABLE(char *, char *) prepared_stmts;
+	unsigned int prepared_stmt_counter;
+
 	bool fatal_error:1;
 };
 
@@ -59,12 +71,22 @@ struct pgsql_result {
 	const char **values;
 	char *query;
 
+	/* Statement query with $n parameters, or NULL for plain queries */
+	char *stmt_query;
+	/* Prepared statement name, or NULL to send the statement unnamed */
+	char *stmt_name;
+	unsigned int param_count;
+	const char **param_values;
+	int *param_lengths, *param_formats;
+
 	ARRAY(struct pgsql_binary_value) binary_values;
 
 	sql_query_callback_t *callback;
 	void *context;
 
 	bool timeout:1;
+	/* The statement is being prepared before executing it */
+	bool preparing:1;
 };
 
 struct pgsql_transaction_context {
@@ -84,6 +106,7 @@ extern const struct sql_db driver_pgsql_db;
 extern const struct sql_result driver_pgsql_result;
 
 static void result_finish(struct pgsql_result *result);
+static void prepare_finished(struct pgsql_result *result);
 static void
 transaction_update_callback(struct sql_result *result,
 			    struct sql_transaction_query *query);
@@ -133,12 +156,27 @@ static void driver_pgsql_stop_io(struct pgsql_db *db)
 	}
 }
 
+static void driver_pgsql_prepared_stmts_clear(struct pgsql_db *db)
+{
+	struct hash_iterate_context *iter;
+	char *query, *name;
+
+	iter = hash_table_iterate_init(db->prepared_stmts);
+	while (hash_table_iterate(iter, db->prepared_stmts, &query, &name)) {
+		i_free(query);
+		i_free(name);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_clear(db->prepared_stmts, FALSE);
+}
+
 static void driver_pgsql_close(struct pgsql_db *db)
 {
 	db->io_dir = 0;
 	db->fatal_error = FALSE;
 
 	driver_pgsql_stop_io(db);
+	driver_pgsql_prepared_stmts_clear(db);
 
 	PQfinish(db->pg);
 	db->pg = NULL;
@@ -293,6 +331,8 @@ static void driver_pgsql_free(struct pgsql_db **_db)
 	struct pgsql_db *db = *_db;
 	*_db = NULL;
 
+	driver_pgsql_prepared_stmts_clear(db);
+	hash_table_destroy(&db->prepared_stmts);
 	event_unref(&db->api.event);
 	i_free(db->connect_string);
 	i_free(db->host);
@@ -321,29 +361,54 @@ static enum sql_db_flags driver_pgsql_get_flags(struct sql_db *db)
 }
 
 static int driver_pgsql_init_full_v(const struct sql_settings *set,
-				    struct sql_db **db_r, const char **error_r ATTR_UNUSED)
+				    struct sql_db **db_r, const char **error_r)
 {
 	struct pgsql_db *db;
 	const char *value;
+	char *error = NULL;
 
 	db = i_new(struct pgsql_db, 1);
-	db->connect_string = i_strdup(set->connect_string);
 	db->api = driver_pgsql_db;
 	db->api.event = event_create(set->event_parent);
 	event_add_category(db->api.event, &event_category_pgsql);
+	hash_table_create(&db->prepared_stmts, default_pool, 0,
+			  str_hash, strcmp);
 
 	/* NOTE: Connection string will be parsed by pgsql itself
-		 We only pick the host part here */
+		 We only pick the host part here, and remove our own
+		 prepared_statements setting, which pgsql doesn't know. */
 	T_BEGIN {
-		const char *const *arg = t_strsplit(db->connect_string, " ");
+		const char *const *arg = t_strsplit(set->connect_string, " ");
+		string_t *connect_string = t_str_new(128);
 
 		for (; *arg != NULL; arg++) {
+			if (str_begins(*arg, "prepared_statements=", &value)) {
+				if (strcmp(value, "yes") == 0)
+					db->prepared_statements = TRUE;
+				else if (strcmp(value, "no") != 0) {
+					error = i_strdup_printf(
+						"Invalid boolean: %s", value);
+				}
+				continue;
+			}
 			if (str_begins(*arg, "host=", &value))
 				db->host = i_strdup(value);
-
+			if (str_len(connect_string) > 0)
+				str_append_c(connect_string, ' ');
+			str_append(connect_string, *arg);
 		}
+		db->connect_string = i_strdup(str_c(connect_string));
 	} T_END;
 
+	if (error != NULL) {
+		*error_r = t_strdup(error);
+		i_free(error);
+		driver_pgsql_free(&db);
+		return -1;
+	}
+	if (db->prepared_statements)
+		db->api.flags |= SQL_DB_FLAG_PREP_STATEMENTS;
+
 	event_set_append_log_prefix(db->api.event, t_strdup_printf("pgsql(%s): ", db->host));
 
 	*db_r = &db->api;
@@ -432,6 +497,11 @@ static void driver_pgsql_result_free(struct sql_result *_result)
 
 	event_unref(&result->api.event);
 	i_free(result->query);
+	i_free(result->stmt_query);
+	i_free(result->stmt_name);
+	i_free(result->param_values);
+	i_free(result->param_lengths);
+	i_free(result->param_formats);
 	i_free(result->fields);
 	i_free(result->values);
 	i_free(result);
@@ -510,7 +580,10 @@ static void get_result(struct pgsql_result *result)
 	}
 
 	result->pgres = PQgetResult(db->pg);
-	result_finish(result);
+	if (result->preparing)
+		prepare_finished(result);
+	else
+		result_finish(result);
 }
 
 static void flush_callback(struct pgsql_result *result)
@@ -546,23 +619,39 @@ static void query_timeout(struct pgsql_result *result)
 	result_finish(result);
 }
 
-static void do_query(struct pgsql_result *result, const char *query)
+static bool do_query_send(struct pgsql_result *result)
 {
         struct pgsql_db *db = (struct pgsql_db *)result->api.db;
 	int ret;
 
-	i_assert(SQL_DB_IS_READY(&db->api));
-	i_assert(db->cur_result == NULL);
-	i_assert(db->io == NULL);
+	if (result->stmt_query == NULL)
+		ret = PQsendQuery(db->pg, result->query);
+	else if (result->stmt_name == NULL) {
+		ret = PQsendQueryParams(db->pg, result->stmt_query,
+					result->param_count, NULL,
+					result->param_values,
+					result->param_lengths,
+					result->param_formats, 0);
+	} else if (result->preparing) {
+		ret = PQsendPrepare(db->pg, result->stmt_name,
+				    result->stmt_query, result->param_count,
+				    NULL);
+	} else {
+		ret = PQsendQueryPrepared(db->pg, result->stmt_name,
+					  result->param_count,
+					  result->param_values,
+					  result->param_lengths,
+					  result->param_formats, 0);
+	}
+	return ret != 0;
+}
 
-	driver_pgsql_set_state(db, SQL_DB_STATE_BUSY);
-	db->cur_result = result;
-	DLLIST_PREPEND(&db->pending_results, result);
-	result->to = timeout_add(SQL_QUERY_TIMEOUT_SECS * 1000,
-				 query_timeout, result);
-	result->query = i_strdup(query);
+static void do_query_flush(struct pgsql_result *result)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+	int ret;
 
-	if (PQsendQuery(db->pg, query) == 0 ||
+	if (!do_query_send(result) ||
 	    (ret = PQflush(db->pg)) < 0) {
 		/* failed to send query */
 		result_finish(result);
@@ -579,6 +668,67 @@ static void do_query(struct pgsql_result *result, const char *query)
 	}
 }
 
+static void prepare_consume_results(struct pgsql_result *result)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+	PGresult *pgres;
+
+	driver_pgsql_stop_io(db);
+
+	/* read the rest of the PREPARE results before sending the query */
+	for (;;) {
+		if (PQconsumeInput(db->pg) == 0) {
+			result_finish(result);
+			return;
+		}
+		if (PQisBusy(db->pg) != 0) {
+			db->io = io_add(PQsocket(db->pg), IO_READ,
+					prepare_consume_results, result);
+			db->io_dir = IO_READ;
+			return;
+		}
+		pgres = PQgetResult(db->pg);
+		if (pgres == NULL)
+			break;
+		PQclear(pgres);
+	}
+
+	hash_table_insert(db->prepared_stmts, i_strdup(result->stmt_query),
+			  i_strdup(result->stmt_name));
+	result->preparing = FALSE;
+	do_query_flush(result);
+}
+
+static void prepare_finished(struct pgsql_result *result)
+{
+	if (result->pgres == NULL ||
+	    PQresultStatus(result->pgres) != PGRES_COMMAND_OK) {
+		/* PREPARE failed - the query would fail the same way */
+		result_finish(result);
+		return;
+	}
+	PQclear(result->pgres);
+	result->pgres = NULL;
+	prepare_consume_results(result);
+}
+
+static void do_query(struct pgsql_result *result, const char *query)
+{
+        struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+
+	i_assert(SQL_DB_IS_READY(&db->api));
+	i_assert(db->cur_result == NULL);
+	i_assert(db->io == NULL);
+
+	driver_pgsql_set_state(db, SQL_DB_STATE_BUSY);
+	db->cur_result = result;
+	DLLIST_PREPEND(&db->pending_results, result);
+	result->to = timeout_add(SQL_QUERY_TIMEOUT_SECS * 1000,
+				 query_timeout, result);
+	result->query = i_strdup(query);
+	do_query_flush(result);
+}
+
 static const char *
 driver_pgsql_escape_string(struct sql_db *_db, const char *string)
 {
@@ -641,6 +791,66 @@ static void driver_pgsql_query(struct sql_db *db, const char *query,
 	do_query(result, query);
 }
 
+static void
+driver_pgsql_result_set_statement(struct pgsql_result *result,
+				  struct sql_statement *stmt)
+{
+	struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+	const struct sql_statement_param *params;
+	const char *query, *name;
+	unsigned int i, count;
+
+	query = sql_statement_get_numbered_query(stmt);
+	if (query == NULL) {
+		/* shouldn't happen, since sql_statement_get_query() already
+		   verified the binds. send the expanded query instead. */
+		return;
+	}
+	params = array_get(&stmt->params, &count);
+
+	result->stmt_query = i_strdup(query);
+	result->param_count = count;
+	result->param_values = i_new(const char *, count);
+	result->param_lengths = i_new(int, count);
+	result->param_formats = i_new(int, count);
+	for (i = 0; i < count; i++) {
+		result->param_values[i] = params[i].value;
+		result->param_lengths[i] = params[i].value_size;
+		result->param_formats[i] = params[i].binary ? 1 : 0;
+	}
+
+	name = hash_table_lookup(db->prepared_stmts, result->stmt_query);
+	if (name != NULL)
+		result->stmt_name = i_strdup(name);
+	else if (hash_table_count(db->prepared_stmts) <
+		 PGSQL_MAX_PREPARED_STATEMENTS) {
+		result->stmt_name = i_strdup_printf("dovecot_%u",
+			++db->prepared_stmt_counter);
+		result->preparing = TRUE;
+	}
+}
+
+static void
+driver_pgsql_connection_statement_query(struct sql_db *db,
+					struct sql_statement *stmt,
+					sql_query_callback_t *callback,
+					void *context)
+{
+	struct pgsql_result *result;
+	const char *query = sql_statement_get_query(stmt);
+
+	result = i_new(struct pgsql_result, 1);
+	result->api = driver_pgsql_result;
+	result->api.db = db;
+	result->api.refcount = 1;
+	result->api.event = event_create(db->event);
+	result->callback = callback;
+	result->context = context;
+	if (((struct pgsql_db *)db)->prepared_statements)
+		driver_pgsql_result_set_statement(result, stmt);
+	do_query(result, query);
+}
+
 static void pgsql_query_s_callback(struct sql_result *result, void *context)
 {
         struct pgsql_db *db = context;
@@ -1307,6 +1517,8 @@ const struct sql_db driver_pgsql_db = {
 		.exec = driver_pgsql_exec,
 		.query = driver_pgsql_query,
 		.query_s = driver_pgsql_query_s,
+		.connection_statement_query =
+			driver_pgsql_connection_statement_query,
 		.wait = driver_pgsql_wait,
 
 		.transaction_begin = driver_pgsql_transaction_begin,
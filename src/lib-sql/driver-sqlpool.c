@@ -59,6 +59,9 @@ struct sqlpool_request {
 
 	/* requests are a) queries */
 	char *query;
+	/* statement the query was generated from, if it can be sent to the
+	   connection as-is */
+	struct sql_statement *stmt;
 	sql_query_callback_t *callback;
 	void *context;
 
@@ -110,11 +113,28 @@ sqlpool_request_free(struct sqlpool_request **_request)
 	*_request = NULL;
 
 	i_assert(request->prev == NULL && request->next == NULL);
+	if (request->stmt != NULL)
+		pool_unref(&request->stmt->pool);
 	event_unref(&request->event);
 	i_free(request->query);
 	i_free(request);
 }
 
+static void
+sqlpool_request_send_query(struct sqlpool_request *request,
+			   struct sql_db *conndb)
+{
+	if (request->stmt != NULL &&
+	    conndb->v.connection_statement_query != NULL) {
+		conndb->v.connection_statement_query(conndb, request->stmt,
+			(sql_query_callback_t *)driver_sqlpool_query_callback,
+			request);
+	} else {
+		sql_query(conndb, request->query,
+			  driver_sqlpool_query_callback, request);
+	}
+}
+
 static void
 sqlpool_request_abort(struct sqlpool_request **_request)
 {
@@ -174,8 +194,7 @@ sqlpool_request_send_next(struct sqlpool_db *db, struct sql_db *conndb)
 	timeout_reset(db->request_to);
 
 	if (request->query != NULL) {
-		sql_query(conndb, request->query,
-			  driver_sqlpool_query_callback, request);
+		sqlpool_request_send_query(request, conndb);
 	} else if (request->trans != NULL) {
 		sqlpool_request_handle_transaction(conndb, request->trans);
 	} else {
@@ -749,6 +768,27 @@ driver_sqlpool_query(struct sql_db *_db, const char *query,
 	}
 }
 
+static void
+driver_sqlpool_statement_query(struct sql_statement *stmt,
+			       sql_query_callback_t *callback, void *context)
+{
+	struct sqlpool_db *db = (struct sqlpool_db *)stmt->db;
+	struct sqlpool_request *request;
+	const struct sqlpool_connection *conn;
+
+	request = sqlpool_request_new(db, sql_statement_get_query(stmt));
+	request->stmt = stmt;
+	request->callback = callback;
+	request->context = context;
+
+	if (!driver_sqlpool_get_connection(db, UINT_MAX, &conn))
+		driver_sqlpool_append_request(db, request);
+	else {
+		request->host_idx = conn->host_idx;
+		sqlpool_request_send_query(request, conn->db);
+	}
+}
+
 static void driver_sqlpool_exec(struct sql_db *_db, const char *query)
 {
 	driver_sqlpool_query(_db, query, NULL, NULL);
@@ -918,6 +958,7 @@ struct sql_db driver_sqlpool_db = {
 		.exec = driver_sqlpool_exec,
 		.query = driver_sqlpool_query,
 		.query_s = driver_sqlpool_query_s,
+		.statement_query = driver_sqlpool_statement_query,
 		.wait = driver_sqlpool_wait,
 
 		.transaction_begin = driver_sqlpool_transaction_begin,
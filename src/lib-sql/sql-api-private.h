@@ -124,6 +124,13 @@ struct sql_db_vfuncs {
 	void (*update_stmt)(struct sql_transaction_context *ctx,
 			    struct sql_statement *stmt,
 			    unsigned int *affected_rows);
+	/* Send a statement created for another sql_db (e.g. sqlpool) via
+	   this connection. The statement is left for the caller to free, but
+	   it must stay valid until the callback is called. */
+	void (*connection_statement_query)(struct sql_db *db,
+					   struct sql_statement *stmt,
+					   sql_query_callback_t *callback,
+					   void *context);
 
 	/* Returns a schema/keyspace followed by a dot '.' OR an empty string
 	   if none is required (in order remove the requirement for further
@@ -193,12 +200,22 @@ struct sql_prepared_statement {
 	char *query_template;
 };
 
+struct sql_statement_param {
+	/* NUL-terminated text value, or binary data if binary=TRUE */
+	const void *value;
+	size_t value_size;
+	bool binary;
+};
+
 struct sql_statement {
 	struct sql_db *db;
 
 	pool_t pool;
 	const char *query_template;
+	/* escaped values, which can be placed directly into the query */
 	ARRAY_TYPE(const_string) args;
+	/* unescaped values, for drivers that send them separately */
+	ARRAY(struct sql_statement_param) params;
 };
 
 struct sql_field_map {
@@ -252,7 +269,10 @@ inline static const char *sql_db_table_prefix(struct sql_db *db) {
 
 void sql_transaction_add_query(struct sql_transaction_context *ctx, pool_t pool,
 			       const char *query, unsigned int *affected_rows);
-const char *sql_statement_get_query(struct sql_statement *stmt);
+/* Returns the statement's query template with the '?' placeholders replaced
+   by $1, $2, ... for sending the bound parameters separately. Returns NULL if
+   the placeholders don't match the bound parameters. */
+const char *sql_statement_get_numbered_query(struct sql_statement *stmt);
 
 void sql_connection_log_finished(struct sql_db *db);
 struct event_passthrough *
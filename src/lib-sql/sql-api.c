@@ -248,26 +248,44 @@ default_sql_statement_init_prepared(struct sql_prepared_statement *stmt)
 	return sql_statement_init(stmt->db, stmt->query_template);
 }
 
+static const char *sql_query_template_next_param(const char *p)
+{
+	char quote = '\0';
+
+	/* '?' inside a quoted string or identifier isn't a placeholder */
+	for (; *p != '\0'; p++) {
+		if (quote != '\0') {
+			if (*p == quote)
+				quote = '\0';
+		} else if (*p == '\'' || *p == '"') {
+			quote = *p;
+		} else if (*p == '?') {
+			return p;
+		}
+	}
+	return NULL;
+}
+
 const char *sql_statement_get_query(struct sql_statement *stmt)
 {
 	string_t *query = t_str_new(128);
-	const char *const *args;
-	unsigned int i, args_count, arg_pos = 0;
+	const char *const *args, *p, *param;
+	unsigned int args_count, arg_pos = 0;
 
 	args = array_get(&stmt->args, &args_count);
 
-	for (i = 0; stmt->query_template[i] != '\0'; i++) {
-		if (stmt->query_template[i] == '?') {
-			if (arg_pos >= args_count ||
-			    args[arg_pos] == NULL) {
-				i_panic("lib-sql: Missing bind for arg #%u in statement: %s",
-					arg_pos, stmt->query_template);
-			}
-			str_append(query, args[arg_pos++]);
-		} else {
-			str_append_c(query, stmt->query_template[i]);
+	for (p = stmt->query_template;
+	     (param = sql_query_template_next_param(p)) != NULL;
+	     p = param + 1) {
+		if (arg_pos >= args_count ||
+		    args[arg_pos] == NULL) {
+			i_panic("lib-sql: Missing bind for arg #%u in statement: %s",
+				arg_pos, stmt->query_template);
 		}
+		str_append_data(query, p, param - p);
+		str_append(query, args[arg_pos++]);
 	}
+	str_append(query, p);
 	if (arg_pos != args_count) {
 		i_panic("lib-sql: Too many bind args (%u) for statement: %s",
 			args_count, stmt->query_template);
@@ -275,6 +293,30 @@ const char *sql_statement_get_query(struct sql_statement *stmt)
 	return str_c(query);
 }
 
+const char *sql_statement_get_numbered_query(struct sql_statement *stmt)
+{
+	string_t *query = t_str_new(128);
+	const struct sql_statement_param *params;
+	const char *p, *param;
+	unsigned int params_count, param_pos = 0;
+
+	params = array_get(&stmt->params, &params_count);
+
+	for (p = stmt->query_template;
+	     (param = sql_query_template_next_param(p)) != NULL;
+	     p = param + 1) {
+		if (param_pos >= params_count ||
+		    params[param_pos].value == NULL)
+			return NULL;
+		str_append_data(query, p, param - p);
+		str_printfa(query, "$%u", ++param_pos);
+	}
+	str_append(query, p);
+	if (param_pos != params_count)
+		return NULL;
+	return str_c(query);
+}
+
 static void
 default_sql_statement_query(struct sql_statement *stmt,
 			    sql_query_callback_t *callback, void *context)
@@ -337,6 +379,19 @@ sql_statement_init_fields(struct sql_statement *stmt, struct sql_db *db)
 {
 	stmt->db = db;
 	p_array_init(&stmt->args, stmt->pool, 8);
+	p_array_init(&stmt->params, stmt->pool, 8);
+}
+
+static void
+sql_statement_set_param(struct sql_statement *stmt, unsigned int column_idx,
+			const void *value, size_t value_size, bool binary)
+{
+	struct sql_statement_param *param =
+		array_idx_get_space(&stmt->params, column_idx);
+
+	param->value = value;
+	param->value_size = value_size;
+	param->binary = binary;
 }
 
 struct sql_statement *
@@ -393,6 +448,8 @@ void sql_statement_bind_str(struct sql_statement *stmt,
 		p_strdup_printf(stmt->pool, "'%s'",
 				sql_escape_string(stmt->db, value));
 	array_idx_set(&stmt->args, column_idx, &escaped_value);
+	sql_statement_set_param(stmt, column_idx, p_strdup(stmt->pool, value),
+				strlen(value), FALSE);
 
 	if (stmt->db->v.statement_bind_str != NULL)
 		stmt->db->v.statement_bind_str(stmt, column_idx, value);
@@ -406,6 +463,9 @@ void sql_statement_bind_binary(struct sql_statement *stmt,
 		p_strdup_printf(stmt->pool, "%s",
 				sql_escape_blob(stmt->db, value, value_size));
 	array_idx_set(&stmt->args, column_idx, &value_str);
+	sql_statement_set_param(stmt, column_idx,
+				p_memdup(stmt->pool, value, value_size),
+				value_size, TRUE);
 
 	if (stmt->db->v.statement_bind_binary != NULL) {
 		stmt->db->v.statement_bind_binary(stmt, column_idx,
@@ -418,6 +478,8 @@ void sql_statement_bind_int64(struct sql_statement *stmt,
 {
 	const char *value_str = p_strdup_printf(stmt->pool, "%"PRId64, value);
 	array_idx_set(&stmt->args, column_idx, &value_str);
+	sql_statement_set_param(stmt, column_idx, value_str,
+				strlen(value_str), FALSE);
 
 	if (stmt->db->v.statement_bind_int64 != NULL)
 		stmt->db->v.statement_bind_int64(stmt, column_idx, value);
@@ -428,6 +490,8 @@ void sql_statement_bind_double(struct sql_statement *stmt,
 {
 	const char *value_str = p_strdup_printf(stmt->pool, "%f", value);
 	array_idx_set(&stmt->args, column_idx, &value_str);
+	sql_statement_set_param(stmt, column_idx, value_str,
+				strlen(value_str), FALSE);
 
 	if (stmt->db->v.statement_bind_double != NULL)
 		stmt->db->v.statement_bind_double(stmt, column_idx, value);
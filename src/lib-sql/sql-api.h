@@ -160,6 +160,9 @@ void sql_statement_query(struct sql_statement **stmt,
 		CALLBACK_TYPECHECK(callback, void (*)( \
 			struct sql_result *, typeof(context))))
 struct sql_result *sql_statement_query_s(struct sql_statement **stmt);
+/* Returns the statement's query with the bound values escaped into it,
+   as it would be sent to a database without prepared statements. */
+const char *sql_statement_get_query(struct sql_statement *stmt);
 
 void sql_result_setup_fetch(struct sql_result *result,
 			    const struct sql_field_def *fields,
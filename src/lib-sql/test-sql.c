@@ -2,7 +2,7 @@
 
 #include "lib.h"
 #include "test-common.h"
-#include "sql-api.h"
+#include "sql-api-private.h"
 #include "driver-test.h"
 
 static struct sql_db *setup_sql(void)
@@ -128,11 +128,66 @@ static void test_sql_stmt_prepared_api(void)
 	test_end();
 }
 
+static void test_sql_stmt_bind(void)
+{
+	static const unsigned char blob[] = { 0x00, 0x01, '?' };
+	const struct sql_statement_param *params;
+	unsigned int count;
+
+	test_begin("sql statement bind");
+
+	struct sql_db *sql = setup_sql();
+	struct sql_statement *stmt = sql_statement_init(sql,
+		"SELECT foo FROM bar WHERE a = ? AND b = '?' AND \"c?\" = ? "
+		"AND d = 'it''s?' AND e = ?");
+	/* the parameters aren't converted yet */
+	test_assert(sql_statement_get_numbered_query(stmt) == NULL);
+
+	sql_statement_bind_str(stmt, 0, "it's");
+	sql_statement_bind_int64(stmt, 1, -5);
+	test_assert(sql_statement_get_numbered_query(stmt) == NULL);
+	sql_statement_bind_binary(stmt, 2, blob, sizeof(blob));
+
+	test_assert_strcmp(sql_statement_get_query(stmt),
+		"SELECT foo FROM bar WHERE a = 'it's' AND b = '?' AND \"c?\" = -5 "
+		"AND d = 'it''s?' AND e = X'00013f'");
+	test_assert_strcmp(sql_statement_get_numbered_query(stmt),
+		"SELECT foo FROM bar WHERE a = $1 AND b = '?' AND \"c?\" = $2 "
+		"AND d = 'it''s?' AND e = $3");
+
+	/* the parameters are kept unescaped */
+	params = array_get(&stmt->params, &count);
+	test_assert(count == 3);
+	test_assert_strcmp(params[0].value, "it's");
+	test_assert(params[0].value_size == 4 && !params[0].binary);
+	test_assert_strcmp(params[1].value, "-5");
+	test_assert(params[1].value_size == 2 && !params[1].binary);
+	test_assert(params[2].value_size == sizeof(blob) && params[2].binary &&
+		    memcmp(params[2].value, blob, sizeof(blob)) == 0);
+
+	/* too many parameters */
+	sql_statement_bind_str(stmt, 3, "extra");
+	test_assert(sql_statement_get_numbered_query(stmt) == NULL);
+	sql_statement_abort(&stmt);
+
+	/* no parameters */
+	stmt = sql_statement_init(sql, "SELECT '?' FROM bar");
+	test_assert_strcmp(sql_statement_get_query(stmt),
+			   "SELECT '?' FROM bar");
+	test_assert_strcmp(sql_statement_get_numbered_query(stmt),
+			   "SELECT '?' FROM bar");
+	sql_statement_abort(&stmt);
+
+	deinit_sql(&sql);
+	test_end();
+}
+
 int main(void) {
 	static void (*const test_functions[])(void) = {
 		test_sql_api,
 		test_sql_stmt_api,
 		test_sql_stmt_prepared_api,
+		test_sql_stmt_bind,
 		NULL
 	};
 	return test_run(test_functions);
@@ -1,6 +1,12 @@
 /* Copyright (c) 2009-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "ioloop.h"
+#include "hex-binary.h"
+#include "hmac.h"
+#include "sha2.h"
 #include "safe-memset.h"
 #include "iostream-openssl.h"
 #include "dovecot-openssl-common.h"
@@ -11,13 +17,30 @@
 #include <openssl/bn.h>
 #include <openssl/x509.h>
 #include <openssl/pem.h>
+#include <openssl/rand.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#  include <openssl/core_names.h>
+#endif
 
 #if !defined(OPENSSL_NO_ECDH) && OPENSSL_VERSION_NUMBER >= 0x10000000L
 #  define HAVE_ECDH
 #endif
 
+/* Session ticket keys derived from ticket_key_secret change this often.
+   Tickets encrypted with the previous key are still accepted, so this is
+   also used as the session timeout. */
+#define SSL_TICKET_KEY_ROTATE_SECS (60*60*2)
+#define SSL_TICKET_KEY_NAME_LEN 16
+#define SSL_TICKET_KEY_LEN 32
+
+struct ssl_ticket_key {
+	unsigned char name[SSL_TICKET_KEY_NAME_LEN];
+	unsigned char aes_key[SSL_TICKET_KEY_LEN];
+	unsigned char hmac_key[SSL_TICKET_KEY_LEN];
+};
+
 struct ssl_iostream_password_context {
 	const char *password;
 	const char *error;
@@ -349,6 +372,164 @@ static int ssl_servername_callback(SSL *ssl, int *al ATTR_UNUSED,
 	return SSL_TLSEXT_ERR_OK;
 }
 
+static void
+ssl_ticket_key_derive(const buffer_t *secret, time_t period,
+		      struct ssl_ticket_key *key_r)
+{
+	unsigned char info[sizeof(uint64_t)];
+
+	cpu64_to_be_unaligned(period, info);
+	T_BEGIN {
+		const buffer_t *okm =
+			t_hmac_hkdf(&hash_method_sha256, NULL, 0,
+				    secret->data, secret->used,
+				    info, sizeof(info), sizeof(*key_r));
+		i_assert(okm->used == sizeof(*key_r));
+		memcpy(key_r, okm->data, sizeof(*key_r));
+	} T_END;
+}
+
+static int
+ssl_ticket_key_find(struct ssl_iostream_context *ctx,
+		    const unsigned char *name, bool enc,
+		    struct ssl_ticket_key *key_r)
+{
+	time_t period = ioloop_time / SSL_TICKET_KEY_ROTATE_SECS;
+	buffer_t *const *secrets;
+	unsigned int i, count;
+
+	/* new tickets are encrypted with the newest secret's current key */
+	secrets = array_get(&ctx->ticket_key_secrets, &count);
+	ssl_ticket_key_derive(secrets[0], period, key_r);
+	if (enc || memcmp(name, key_r->name, sizeof(key_r->name)) == 0)
+		return 1;
+	/* accept the older keys, but ask for the ticket to be renewed */
+	for (i = 0; i < count; i++) {
+		if (i > 0) {
+			ssl_ticket_key_derive(secrets[i], period, key_r);
+			if (memcmp(name, key_r->name, sizeof(key_r->name)) == 0)
+				return 2;
+		}
+		ssl_ticket_key_derive(secrets[i], period - 1, key_r);
+		if (memcmp(name, key_r->name, sizeof(key_r->name)) == 0)
+			return 2;
+	}
+	return 0;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int
+ssl_ticket_key_callback(SSL *ssl, unsigned char *name, unsigned char *iv,
+			EVP_CIPHER_CTX *cipher_ctx, EVP_MAC_CTX *mac_ctx,
+			int enc)
+#else
+static int
+ssl_ticket_key_callback(SSL *ssl, unsigned char *name, unsigned char *iv,
+			EVP_CIPHER_CTX *cipher_ctx, HMAC_CTX *mac_ctx, int enc)
+#endif
+{
+	struct ssl_iostream *ssl_io;
+	struct ssl_ticket_key key;
+	int ret;
+
+	ssl_io = SSL_get_ex_data(ssl, dovecot_ssl_extdata_index);
+	if ((ret = ssl_ticket_key_find(ssl_io->ctx, name, enc != 0, &key)) == 0)
+		return 0;
+
+	if (enc != 0) {
+		memcpy(name, key.name, sizeof(key.name));
+		if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) <= 0)
+			ret = -1;
+	}
+	if (ret > 0 &&
+	    EVP_CipherInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL,
+			      key.aes_key, iv, enc) != 1)
+		ret = -1;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+						  key.hmac_key,
+						  sizeof(key.hmac_key)),
+		OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+						 (char *)"sha256", 0),
+		OSSL_PARAM_construct_end()
+	};
+	if (ret > 0 && EVP_MAC_CTX_set_params(mac_ctx, params) != 1)
+		ret = -1;
+#else
+	if (ret > 0 &&
+	    HMAC_Init_ex(mac_ctx, key.hmac_key, sizeof(key.hmac_key),
+			 EVP_sha256(), NULL) != 1)
+		ret = -1;
+#endif
+	safe_memset(&key, 0, sizeof(key));
+	return ret;
+}
+
+static int
+ssl_iostream_context_set_ticket_keys(struct ssl_iostream_context *ctx,
+				     const struct ssl_iostream_settings *set,
+				     const char **error_r)
+{
+	unsigned char sid_ctx[SHA256_RESULTLEN];
+	struct sha256_ctx sha_ctx;
+	const char *const *hex_secrets;
+	buffer_t *secret;
+
+	hex_secrets = t_strsplit_spaces(set->ticket_key_secret, " ");
+	if (hex_secrets[0] == NULL) {
+		*error_r = "Invalid TLS session ticket key secret";
+		return -1;
+	}
+	p_array_init(&ctx->ticket_key_secrets, ctx->pool,
+		     str_array_length(hex_secrets));
+	for (; *hex_secrets != NULL; hex_secrets++) {
+		secret = buffer_create_dynamic(ctx->pool, 32);
+		if (hex_to_binary(*hex_secrets, secret) < 0 ||
+		    secret->used == 0) {
+			*error_r = "Invalid TLS session ticket key secret";
+			return -1;
+		}
+		array_push_back(&ctx->ticket_key_secrets, &secret);
+	}
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	if (SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx->ssl_ctx,
+			ssl_ticket_key_callback) != 1) {
+#else
+	if (SSL_CTX_set_tlsext_ticket_key_cb(ctx->ssl_ctx,
+			ssl_ticket_key_callback) != 1) {
+#endif
+		*error_r = t_strdup_printf(
+			"Can't set TLS session ticket key callback: %s",
+			openssl_iostream_error());
+		return -1;
+	}
+	SSL_CTX_set_timeout(ctx->ssl_ctx, SSL_TICKET_KEY_ROTATE_SECS);
+
+	/* The tickets can now be resumed by any context using the same
+	   secret. Make sure OpenSSL refuses to resume sessions that were
+	   created with different client certificate verification
+	   settings. */
+	sha256_init(&sha_ctx);
+	sha256_loop(&sha_ctx, set->verify_remote_cert ? "1" : "0", 1);
+	sha256_loop(&sha_ctx, set->ca == NULL ? "" : set->ca,
+		    set->ca == NULL ? 1 : strlen(set->ca) + 1);
+	sha256_loop(&sha_ctx, set->ca_file == NULL ? "" : set->ca_file,
+		    set->ca_file == NULL ? 1 : strlen(set->ca_file) + 1);
+	sha256_loop(&sha_ctx, set->ca_dir == NULL ? "" : set->ca_dir,
+		    set->ca_dir == NULL ? 1 : strlen(set->ca_dir) + 1);
+	sha256_result(&sha_ctx, sid_ctx);
+	i_assert(sizeof(sid_ctx) <= SSL_MAX_SID_CTX_LENGTH);
+	if (SSL_CTX_set_session_id_context(ctx->ssl_ctx, sid_ctx,
+					   sizeof(sid_ctx)) != 1) {
+		*error_r = t_strdup_printf(
+			"Can't set TLS session ID context: %s",
+			openssl_iostream_error());
+		return -1;
+	}
+	return 0;
+}
+
 static int
 ssl_iostream_context_load_ca(struct ssl_iostream_context *ctx,
 			     const struct ssl_iostream_settings *set,
@@ -491,6 +672,11 @@ ssl_iostream_context_set(struct ssl_iostream_context *ctx,
 			if (set->verbose)
 				i_debug("OpenSSL library doesn't support SNI");
 		}
+		if (set->tickets && set->ticket_key_secret != NULL) {
+			if (ssl_iostream_context_set_ticket_keys(ctx, set,
+								 error_r) < 0)
+				return -1;
+		}
 	}
 	return 0;
 }
@@ -24,6 +24,8 @@ struct ssl_iostream_context {
 	struct ssl_iostream_settings set;
 
 	int username_nid;
+	/* decoded ssl_iostream_settings.ticket_key_secret, newest first */
+	ARRAY(buffer_t *) ticket_key_secrets;
 
 	bool client_ctx:1;
 };
@@ -26,6 +26,12 @@ struct ssl_iostream_settings {
 	const char *dh; /* context-only */
 	const char *cert_username_field; /* both */
 	const char *crypto_device; /* context-only */
+	/* Space-separated hex-encoded secrets used to derive TLS session
+	   ticket keys, newest first. New tickets use the first secret, the
+	   rest are only used to decrypt tickets. All the server contexts
+	   using the same secrets can resume each others' sessions. If NULL,
+	   OpenSSL uses random per-context keys. */
+	const char *ticket_key_secret; /* context-only */
 
 	bool verbose, verbose_invalid_cert; /* stream-only */
 	bool skip_crl_check; /* context-only */
@@ -548,12 +548,163 @@ static void test_iostream_ssl_small_packets(void)
 	test_end();
 }
 
+static void resume_input_callback(struct test_endpoint *ep)
+{
+	if (i_stream_read(ep->input) < 0 && ep->input->stream_errno != 0) {
+		ep->failed = TRUE;
+		io_loop_stop(current_ioloop);
+	} else if (ep->client && i_stream_get_data_size(ep->input) > 0) {
+		io_loop_stop(current_ioloop);
+	}
+}
+
+static int
+test_iostream_ssl_resume_connect(struct ssl_iostream_context *server_ctx,
+				 struct ssl_iostream_context *client_ctx,
+				 SSL_SESSION **session)
+{
+	struct ssl_iostream_settings set;
+	struct test_endpoint *server, *client;
+	struct timeout *to;
+	const char *error;
+	int fd[2], ret;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
+		i_fatal("socketpair() failed: %m");
+	fd_set_nonblock(fd[0], TRUE);
+	fd_set_nonblock(fd[1], TRUE);
+
+	ssl_iostream_test_settings_server(&set);
+	server = create_test_endpoint(fd[0], &set);
+	ssl_iostream_test_settings_client(&set);
+	set.allow_invalid_cert = TRUE;
+	client = create_test_endpoint(fd[1], &set);
+	client->client = TRUE;
+	client->other = server;
+	server->other = client;
+
+	test_assert(io_stream_create_ssl_server(server_ctx, server->set, NULL,
+						&server->input, &server->output,
+						&server->iostream, &error) == 0);
+	test_assert(io_stream_create_ssl_client(client_ctx, "localhost",
+						client->set, NULL,
+						&client->input, &client->output,
+						&client->iostream, &error) == 0);
+	if (*session != NULL)
+		SSL_set_session(client->iostream->ssl, *session);
+
+	server->io = io_add_istream(server->input, resume_input_callback, server);
+	client->io = io_add_istream(client->input, resume_input_callback, client);
+	/* the client has received the session tickets after it has read
+	   the application data */
+	test_assert(o_stream_send_str(server->output, "x") == 1);
+	test_assert(ssl_iostream_handshake(client->iostream) == 0);
+
+	to = timeout_add(5000, io_loop_stop, current_ioloop);
+	io_loop_run(current_ioloop);
+	timeout_remove(&to);
+
+	if (server->failed || client->failed ||
+	    i_stream_get_data_size(client->input) == 0)
+		ret = -1;
+	else
+		ret = SSL_session_reused(client->iostream->ssl) ? 1 : 0;
+	if (*session != NULL)
+		SSL_SESSION_free(*session);
+	*session = SSL_get1_session(client->iostream->ssl);
+
+	i_stream_unref(&server->input);
+	o_stream_unref(&server->output);
+	i_stream_unref(&client->input);
+	o_stream_unref(&client->output);
+	destroy_test_endpoint(&client);
+	destroy_test_endpoint(&server);
+	return ret;
+}
+
+static void test_iostream_ssl_session_resume(void)
+{
+	struct ssl_iostream_settings server_set, client_set;
+	struct ssl_iostream_context *server1_ctx, *server2_ctx, *server3_ctx;
+	struct ssl_iostream_context *server4_ctx, *server5_ctx;
+	struct ssl_iostream_context *client_ctx;
+	SSL_SESSION *session = NULL;
+	struct ioloop *ioloop;
+	const char *error;
+
+	test_begin("ssl: session resumption with shared ticket keys");
+	ioloop = io_loop_create();
+
+	ssl_iostream_test_settings_server(&server_set);
+	server_set.tickets = TRUE;
+	server_set.ticket_key_secret = "00112233445566778899aabbccddeeff";
+	test_assert(ssl_iostream_context_init_server(&server_set, &server1_ctx,
+						     &error) == 0);
+	test_assert(ssl_iostream_context_init_server(&server_set, &server2_ctx,
+						     &error) == 0);
+	/* the secret has been rotated */
+	server_set.ticket_key_secret =
+		"ffeeddccbbaa99887766554433221100 00112233445566778899aabbccddeeff";
+	test_assert(ssl_iostream_context_init_server(&server_set, &server4_ctx,
+						     &error) == 0);
+	server_set.ticket_key_secret =
+		"0123456789abcdef0123456789abcdef ffeeddccbbaa99887766554433221100";
+	test_assert(ssl_iostream_context_init_server(&server_set, &server5_ctx,
+						     &error) == 0);
+	/* random ticket keys */
+	server_set.ticket_key_secret = NULL;
+	test_assert(ssl_iostream_context_init_server(&server_set, &server3_ctx,
+						     &error) == 0);
+	ssl_iostream_test_settings_client(&client_set);
+	client_set.allow_invalid_cert = TRUE;
+	client_set.tickets = TRUE;
+	test_assert(ssl_iostream_context_init_client(&client_set, &client_ctx,
+						     &error) == 0);
+
+	/* full handshake */
+	test_assert(test_iostream_ssl_resume_connect(server1_ctx, client_ctx,
+						     &session) == 0);
+	/* resumed with another context (process) using the same secret */
+	test_assert(test_iostream_ssl_resume_connect(server2_ctx, client_ctx,
+						     &session) == 1);
+	test_assert(test_iostream_ssl_resume_connect(server1_ctx, client_ctx,
+						     &session) == 1);
+	/* a context with different ticket keys can't resume it */
+	test_assert(test_iostream_ssl_resume_connect(server3_ctx, client_ctx,
+						     &session) == 0);
+
+	/* a ticket from the previous secret is accepted and renewed with
+	   the new secret */
+	test_assert(test_iostream_ssl_resume_connect(server1_ctx, client_ctx,
+						     &session) == 0);
+	test_assert(test_iostream_ssl_resume_connect(server4_ctx, client_ctx,
+						     &session) == 1);
+	/* the context with only the old secret can't decrypt it anymore */
+	test_assert(test_iostream_ssl_resume_connect(server1_ctx, client_ctx,
+						     &session) == 0);
+	/* after the next rotation the oldest secret is no longer accepted */
+	test_assert(test_iostream_ssl_resume_connect(server5_ctx, client_ctx,
+						     &session) == 0);
+
+	if (session != NULL)
+		SSL_SESSION_free(session);
+	ssl_iostream_context_unref(&server1_ctx);
+	ssl_iostream_context_unref(&server2_ctx);
+	ssl_iostream_context_unref(&server3_ctx);
+	ssl_iostream_context_unref(&server4_ctx);
+	ssl_iostream_context_unref(&server5_ctx);
+	ssl_iostream_context_unref(&client_ctx);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_iostream_ssl_handshake,
 		test_iostream_ssl_get_buffer_avail_size,
 		test_iostream_ssl_small_packets,
+		test_iostream_ssl_session_resume,
 		NULL
 	};
 	ssl_iostream_openssl_init();
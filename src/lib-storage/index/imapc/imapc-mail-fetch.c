@@ -6,6 +6,7 @@
 #include "istream.h"
 #include "istream-concat.h"
 #include "istream-header-filter.h"
+#include "seq-set-builder.h"
 #include "message-header-parser.h"
 #include "imap-arg.h"
 #include "imap-util.h"
@@ -140,37 +141,28 @@ headers_merge(pool_t pool, const char *const *h1, const char *const *h2)
 }
 
 static bool
-imapc_mail_try_merge_fetch(struct imapc_mailbox *mbox, string_t *str)
+imapc_mail_try_merge_fetch(struct imapc_mailbox *mbox, uint32_t uid,
+			   const char *args)
 {
-	const char *s1 = str_c(str);
-	const char *s2 = str_c(mbox->pending_fetch_cmd);
-	const char *s1_args, *s2_args, *p1, *p2;
-
-	if (!str_begins(s1, "UID FETCH ", &s1_args))
-		i_unreached();
-	if (!str_begins(s2, "UID FETCH ", &s2_args))
-		i_unreached();
-
-	/* skip over UID range */
-	p1 = strchr(s1_args, ' ');
-	p2 = strchr(s2_args, ' ');
-
-	if (null_strcmp(p1, p2) != 0)
+	if (strcmp(str_c(mbox->pending_fetch_args), args) != 0 ||
+	    str_len(mbox->pending_fetch_args) >= IMAPC_SERVER_CMDLINE_MAX_LEN)
 		return FALSE;
-	/* append the new UID to the pending FETCH UID range */
-	str_truncate(str, p1-s1);
-	str_insert(mbox->pending_fetch_cmd, p2-s2, ",");
-	str_insert(mbox->pending_fetch_cmd, p2-s2+1, str_c(str) + 10);
-	return TRUE;
+	/* append the new UID to the pending FETCH UID set. Consecutive UIDs
+	   are merged into ranges, so the command stays short even for large
+	   batches. */
+	return seqset_builder_try_add(mbox->pending_fetch_request->uidset_builder,
+				      IMAPC_SERVER_CMDLINE_MAX_LEN -
+				      str_len(mbox->pending_fetch_args), uid);
 }
 
 static void
-imapc_mail_delayed_send_or_merge(struct imapc_mail *mail, string_t *str)
+imapc_mail_delayed_send_or_merge(struct imapc_mail *mail, const char *args)
 {
 	struct imapc_mailbox *mbox = IMAPC_MAILBOX(mail->imail.mail.mail.box);
+	uint32_t uid = mail->imail.mail.mail.uid;
 
 	if (mbox->pending_fetch_request != NULL &&
-	    !imapc_mail_try_merge_fetch(mbox, str)) {
+	    !imapc_mail_try_merge_fetch(mbox, uid, args)) {
 		/* send the previous FETCH and create a new one */
 		imapc_mail_fetch_flush(mbox);
 	}
@@ -179,7 +171,12 @@ imapc_mail_delayed_send_or_merge(struct imapc_mail *mail, string_t *str)
 			i_new(struct imapc_fetch_request, 1);
 		i_array_init(&mbox->pending_fetch_request->mails, 4);
 		i_assert(mbox->pending_fetch_cmd->used == 0);
-		str_append_str(mbox->pending_fetch_cmd, str);
+		str_append(mbox->pending_fetch_cmd, "UID FETCH ");
+		mbox->pending_fetch_request->uidset_builder =
+			seqset_builder_init(mbox->pending_fetch_cmd);
+		seqset_builder_add(mbox->pending_fetch_request->uidset_builder,
+				   uid);
+		str_append(mbox->pending_fetch_args, args);
 	}
 	array_push_back(&mbox->pending_fetch_request->mails, &mail);
 
@@ -254,7 +251,7 @@ imapc_mail_send_fetch(struct mail *_mail, enum mail_fetch_field fields,
 		fields |= MAIL_FETCH_STREAM_HEADER;
 
 	str = t_str_new(64);
-	str_printfa(str, "UID FETCH %u (", _mail->uid);
+	str_append(str, " (");
 	if ((fields & MAIL_FETCH_RECEIVED_DATE) != 0)
 		str_append(str, "INTERNALDATE ");
 	if ((fields & MAIL_FETCH_SAVE_DATE) != 0) {
@@ -308,7 +305,7 @@ imapc_mail_send_fetch(struct mail *_mail, enum mail_fetch_field fields,
 	mail->fetch_sent = FALSE;
 	mail->fetch_failed = FALSE;
 
-	imapc_mail_delayed_send_or_merge(mail, str);
+	imapc_mail_delayed_send_or_merge(mail, str_c(str));
 	return 1;
 }
 
@@ -534,11 +531,14 @@ void imapc_mail_fetch_flush(struct imapc_mailbox *mbox)
 	imapc_command_set_flags(cmd, IMAPC_COMMAND_FLAG_RETRIABLE);
 	array_push_back(&mbox->fetch_requests, &mbox->pending_fetch_request);
 
+	seqset_builder_deinit(&mbox->pending_fetch_request->uidset_builder);
+	str_append_str(mbox->pending_fetch_cmd, mbox->pending_fetch_args);
 	imapc_command_send(cmd, str_c(mbox->pending_fetch_cmd));
 
 	mbox->pending_fetch_request = NULL;
 	timeout_remove(&mbox->to_pending_fetch_send);
 	str_truncate(mbox->pending_fetch_cmd, 0);
+	str_truncate(mbox->pending_fetch_args, 0);
 }
 
 static bool imapc_find_lfile_arg(const struct imapc_untagged_reply *reply,
@@ -43,7 +43,6 @@ struct imapc_save_cmd_context {
 };
 
 #define IMAPC_SAVECTX(s)	container_of(s, struct imapc_save_context, ctx)
-#define IMAPC_SERVER_CMDLINE_MAX_LEN 	8000
 
 void imapc_transaction_save_rollback(struct mail_save_context *_ctx);
 static void imapc_mail_copy_bulk_flush(struct imapc_mailbox *mbox);
@@ -542,6 +542,7 @@ imapc_mailbox_alloc(struct mail_storage *storage, struct mailbox_list *list,
 	p_array_init(&mbox->delayed_expunged_uids, pool, 16);
 	p_array_init(&mbox->copy_rollback_expunge_uids, pool, 16);
 	mbox->pending_fetch_cmd = str_new(pool, 128);
+	mbox->pending_fetch_args = str_new(pool, 64);
 	mbox->pending_copy_cmd = str_new(pool, 128);
 	mbox->prev_mail_cache.fd = -1;
 	imapc_mailbox_register_callbacks(mbox);
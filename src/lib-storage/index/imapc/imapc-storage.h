@@ -12,6 +12,9 @@
 #define IMAPC_LIST_FS_NAME_ESCAPE_CHAR '%'
 /* vname separator */
 #define IMAPC_LIST_VNAME_ESCAPE_CHAR '~'
+/* Maximum length for the command lines that we build ourselves, such as
+   UID sets in bulk COPY and FETCH commands */
+#define IMAPC_SERVER_CMDLINE_MAX_LEN 8000
 
 struct imap_arg;
 struct imapc_untagged_reply;
@@ -92,6 +95,9 @@ struct imapc_mail_cache {
 
 struct imapc_fetch_request {
 	ARRAY(struct imapc_mail *) mails;
+	/* Builds the UID set into pending_fetch_cmd while the request is
+	   still pending. NULL after the command has been sent. */
+	struct seqset_builder *uidset_builder;
 };
 
 struct imapc_untagged_fetch_ctx {
@@ -136,6 +142,9 @@ struct imapc_mailbox {
 	   sending soon (but still waiting to see if we can increase its
 	   UID range) */
 	string_t *pending_fetch_cmd;
+	/* The " (fields)" part of pending_fetch_cmd. Only mails fetching
+	   exactly the same fields can be merged into the same FETCH. */
+	string_t *pending_fetch_args;
 	/* if non-empty, contains the latest COPY command we're going to be
 	   sending soon. */
 	string_t *pending_copy_cmd;
@@ -7,12 +7,14 @@
 #include "istream.h"
 #include "hex-binary.h"
 #include "str.h"
+#include "unichar.h"
 #include "mailbox-recent-flags.h"
 #include "message-date.h"
 #include "message-part-data.h"
 #include "message-part-serialize.h"
 #include "message-parser.h"
 #include "message-snippet.h"
+#include "message-search-bloom.h"
 #include "imap-bodystructure.h"
 #include "imap-envelope.h"
 #include "mail-cache.h"
@@ -63,6 +65,8 @@ struct mail_cache_field global_cache_fields[MAIL_INDEX_CACHE_FIELD_COUNT] = {
 	{ .name = "binary.parts",
 	  .type = MAIL_CACHE_FIELD_VARIABLE_SIZE },
 	{ .name = "body.snippet",
+	  .type = MAIL_CACHE_FIELD_VARIABLE_SIZE },
+	{ .name = "search.bloom",
 	  .type = MAIL_CACHE_FIELD_VARIABLE_SIZE }
 	/* FIXME: for now need to update get_metadata_precache_fields() in
 	   index-status.c when adding more fields. those fields should probably
@@ -73,6 +77,8 @@ static void index_mail_init_data(struct index_mail *mail);
 static int index_mail_parse_body(struct index_mail *mail,
 				 enum index_cache_field field);
 static int index_mail_write_body_snippet(struct index_mail *mail);
+static int index_mail_try_cache_search_bloom(struct index_mail *mail,
+					     bool searching);
 
 int index_mail_cache_lookup_field(struct index_mail *mail, buffer_t *buf,
 				  unsigned int field_idx)
@@ -969,7 +975,7 @@ bool index_mail_want_cache(struct index_mail *mail, enum index_cache_field field
 	}
 }
 
-static void index_mail_save_finish_make_snippet(struct index_mail *mail)
+static void index_mail_cache_body_snippet(struct index_mail *mail)
 {
 	if (mail->data.save_body_snippet) {
 		if (index_mail_write_body_snippet(mail) < 0)
@@ -985,6 +991,16 @@ static void index_mail_save_finish_make_snippet(struct index_mail *mail)
 	}
 }
 
+static void index_mail_save_finish_make_search_bloom(struct index_mail *mail)
+{
+	struct mail *_mail = &mail->mail.mail;
+
+	if (_mail->box->storage->set->mail_search_bloom_size == 0 ||
+	    mail->data.no_caching)
+		return;
+	(void)index_mail_try_cache_search_bloom(mail, FALSE);
+}
+
 static void index_mail_cache_sizes(struct index_mail *mail)
 {
 	struct mail *_mail = &mail->mail.mail;
@@ -1154,6 +1170,93 @@ static int index_mail_write_body_snippet(struct index_mail *mail)
 	return ret;
 }
 
+static int index_mail_write_search_bloom(struct index_mail *mail)
+{
+	struct mail *_mail = &mail->mail.mail;
+	size_t size = _mail->box->storage->set->mail_search_bloom_size;
+	struct istream *input;
+	uoff_t old_offset;
+	buffer_t *filter;
+	int ret;
+
+	old_offset = mail->data.stream == NULL ? 0 : mail->data.stream->v_offset;
+	const char *reason = index_mail_cache_reason(_mail, "search bloom");
+	if (mail_get_stream_because(_mail, NULL, NULL, reason, &input) < 0)
+		return -1;
+	i_assert(mail->data.stream != NULL);
+
+	i_stream_seek(input, 0);
+	filter = buffer_create_dynamic(mail->mail.data_pool, size);
+	ret = message_search_bloom_build(input,
+			_mail->box->storage->user->default_normalizer,
+			size, filter);
+	if (ret < 0)
+		index_mail_stream_log_failure_for(mail, input);
+	else
+		mail->data.search_bloom = filter;
+
+	i_stream_seek(mail->data.stream, old_offset);
+	return ret;
+}
+
+static int
+index_mail_try_cache_search_bloom(struct index_mail *mail, bool searching)
+{
+	struct mail *_mail = &mail->mail.mail;
+	struct mail_cache_transaction_ctx *cache_trans =
+		_mail->transaction->cache_trans;
+	unsigned int cache_field =
+		mail->ibox->cache_fields[MAIL_CACHE_SEARCH_BLOOM].idx;
+
+	/* The filters are only useful for searching. A search adds them
+	   whenever possible, which also starts caching them for the new mails
+	   when they're saved. */
+	if (searching) {
+		if (!mail_cache_field_can_add(cache_trans, _mail->seq,
+					      cache_field))
+			return 0;
+	} else {
+		if (!mail_cache_field_want_add(cache_trans, _mail->seq,
+					       cache_field))
+			return 0;
+	}
+	if (mail->data.search_bloom == NULL &&
+	    index_mail_write_search_bloom(mail) < 0)
+		return -1;
+	index_mail_cache_add_idx(mail, cache_field,
+				 mail->data.search_bloom->data,
+				 mail->data.search_bloom->used);
+	return 0;
+}
+
+int index_mail_get_search_bloom(struct index_mail *mail, bool build,
+				const buffer_t **filter_r)
+{
+	struct mail *_mail = &mail->mail.mail;
+	unsigned int cache_field =
+		mail->ibox->cache_fields[MAIL_CACHE_SEARCH_BLOOM].idx;
+	buffer_t *buf;
+
+	if (_mail->box->storage->set->mail_search_bloom_size == 0)
+		return 0;
+
+	if (mail->data.search_bloom == NULL) {
+		/* The filter may have been cached with a different size
+		   setting, but that doesn't matter for using it. */
+		buf = buffer_create_dynamic(mail->mail.data_pool, 128);
+		if (index_mail_cache_lookup_field(mail, buf, cache_field) > 0 &&
+		    buf->used > 0)
+			mail->data.search_bloom = buf;
+		else if (build &&
+			 index_mail_try_cache_search_bloom(mail, TRUE) < 0)
+			return -1;
+		if (mail->data.search_bloom == NULL)
+			return 0;
+	}
+	*filter_r = mail->data.search_bloom;
+	return 1;
+}
+
 void index_mail_parts_reset(struct index_mail *mail)
 {
 	mail->data.parts = NULL;
@@ -2496,8 +2599,23 @@ int index_mail_precache(struct mail *mail)
 	}
 
 	cache = imail->data.wanted_fields;
+	if ((cache & MAIL_FETCH_STREAM_BODY) != 0 &&
+	    index_mail_want_cache(imail, MAIL_CACHE_BODY_SNIPPET)) {
+		/* The snippet needs the parsed BODYSTRUCTURE. Get it from
+		   the same parse as the rest of the body fields, so that the
+		   snippets don't need to be generated later when clients
+		   fetch them. */
+		imail->data.save_bodystructure_header = TRUE;
+		imail->data.save_bodystructure_body = TRUE;
+		imail->data.save_body_snippet = TRUE;
+	}
 	if ((cache & (MAIL_FETCH_STREAM_HEADER | MAIL_FETCH_STREAM_BODY)) != 0)
 		index_mail_parse(mail, (cache & MAIL_FETCH_STREAM_BODY) != 0);
+	if (imail->data.save_body_snippet && imail->data.parsed_bodystructure)
+		index_mail_cache_body_snippet(imail);
+	if ((cache & MAIL_FETCH_STREAM_BODY) != 0 &&
+	    mail->box->storage->set->mail_search_bloom_size > 0)
+		(void)index_mail_try_cache_search_bloom(imail, FALSE);
 	if ((cache & MAIL_FETCH_RECEIVED_DATE) != 0)
 		(void)mail_get_received_date(mail, &date);
 	if ((cache & MAIL_FETCH_SAVE_DATE) != 0)
@@ -2609,7 +2727,8 @@ void index_mail_save_finish(struct mail_save_context *ctx)
 {
 	struct index_mail *imail = INDEX_MAIL(ctx->dest_mail);
 
-	index_mail_save_finish_make_snippet(imail);
+	index_mail_cache_body_snippet(imail);
+	index_mail_save_finish_make_search_bloom(imail);
 
 	if (ctx->data.from_envelope != NULL &&
 	    imail->data.from_envelope == NULL) {
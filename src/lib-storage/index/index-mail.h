@@ -24,6 +24,7 @@ enum index_cache_field {
 	MAIL_CACHE_MESSAGE_PARTS,
 	MAIL_CACHE_BINARY_PARTS,
 	MAIL_CACHE_BODY_SNIPPET,
+	MAIL_CACHE_SEARCH_BLOOM,
 
 	MAIL_INDEX_CACHE_FIELD_COUNT
 };
@@ -85,6 +86,7 @@ struct index_mail_data {
 	struct message_binary_part *bin_parts;
 	const char *envelope, *body, *bodystructure, *guid, *filename;
 	const char *from_envelope, *body_snippet;
+	buffer_t *search_bloom;
 	struct message_part_envelope *envelope_data;
 
 	uint32_t cache_flags;
@@ -268,6 +270,12 @@ bool index_mail_get_cached_virtual_size(struct index_mail *mail,
 bool index_mail_get_cached_body(struct index_mail *mail, const char **value_r);
 bool index_mail_get_cached_bodystructure(struct index_mail *mail,
 					 const char **value_r);
+/* Get the mail's search bloom filter (see message-search-bloom.h). If it's
+   not cached and build=TRUE, build it from the mail stream if the caching
+   decisions say it's wanted. Returns 1 if the filter was returned, 0 if it's
+   not available and -1 if reading the mail failed. */
+int index_mail_get_search_bloom(struct index_mail *mail, bool build,
+				const buffer_t **filter_r);
 const uint32_t *index_mail_get_vsize_extension(struct mail *_mail);
 
 bool index_mail_want_cache(struct index_mail *mail, enum index_cache_field field);
@@ -13,6 +13,7 @@
 #include "message-address.h"
 #include "message-date.h"
 #include "message-search.h"
+#include "message-search-bloom.h"
 #include "message-parser.h"
 #include "mail-index-modseq.h"
 #include "index-storage.h"
@@ -63,6 +64,11 @@ struct search_body_context {
 	struct message_part *part;
 };
 
+struct search_bloom_context {
+	struct index_search_context *index_ctx;
+	const buffer_t *filter;
+};
+
 static void search_parse_msgset_args(unsigned int messages_count,
 				     struct mail_search_arg *args,
 				     uint32_t *seq1_r, uint32_t *seq2_r);
@@ -730,6 +736,54 @@ static void search_body(struct mail_search_arg *arg,
 	ARG_SET_RESULT(arg, ret);
 }
 
+static void search_bloom_arg(struct mail_search_arg *arg,
+			     struct search_bloom_context *ctx)
+{
+	struct message_search_context *msg_search_ctx;
+
+	switch (arg->type) {
+	case SEARCH_BODY:
+	case SEARCH_TEXT:
+	case SEARCH_HEADER:
+	case SEARCH_HEADER_COMPRESS_LWSP:
+		break;
+	default:
+		/* SEARCH_HEADER_ADDRESS matches against the rewritten
+		   addresses, which aren't in the filter. */
+		return;
+	}
+	if (arg->value.str[0] == '\0')
+		return;
+
+	msg_search_ctx = msg_search_arg_context(ctx->index_ctx, arg);
+	if (msg_search_ctx != NULL &&
+	    !message_search_bloom_may_contain(ctx->filter->data,
+					      ctx->filter->used,
+					      message_search_get_key(msg_search_ctx)))
+		ARG_SET_RESULT(arg, 0);
+}
+
+static int search_arg_match_bloom(struct mail_search_arg *args,
+				  struct index_search_context *ctx,
+				  struct index_mail *imail, bool have_body)
+{
+	struct search_bloom_context bloom_ctx;
+	bool build;
+
+	/* Build a missing filter only if the mail is going to be read
+	   anyway. The first search is then slower, but the following ones
+	   can skip the mails that certainly don't match. */
+	build = have_body &&
+		ctx->cur_mail->lookup_abort == MAIL_LOOKUP_ABORT_NEVER;
+
+	i_zero(&bloom_ctx);
+	bloom_ctx.index_ctx = ctx;
+	if (index_mail_get_search_bloom(imail, build, &bloom_ctx.filter) <= 0)
+		return -1;
+	(void)mail_search_args_foreach(args, search_bloom_arg, &bloom_ctx);
+	return mail_search_args_foreach(args, search_none, NULL);
+}
+
 static int search_arg_match_text(struct mail_search_arg *args,
 				 struct index_search_context *ctx)
 {
@@ -762,6 +816,12 @@ static int search_arg_match_text(struct mail_search_arg *args,
 	hdr_ctx.custom_header = TRUE;
 	hdr_ctx.args = args;
 
+	/* see if the search bloom filter can finish the search without
+	   opening the mail */
+	ret = search_arg_match_bloom(args, ctx, hdr_ctx.imail, have_body);
+	if (ret >= 0)
+		return ret;
+
 	headers_ctx = headers == NULL ? NULL :
 		mailbox_header_lookup_init(ctx->box, headers);
 	if (headers != NULL &&
@@ -236,7 +236,8 @@ static void get_metadata_precache_fields(struct mailbox *box,
 			 strcmp(name, "binary.parts") == 0 ||
 			 strcmp(name, "imap.body") == 0 ||
 			 strcmp(name, "imap.bodystructure") == 0 ||
-			 strcmp(name, "body.snippet") == 0)
+			 strcmp(name, "body.snippet") == 0 ||
+			 strcmp(name, "search.bloom") == 0)
 			cache |= MAIL_FETCH_STREAM_BODY;
 		else if (strcmp(name, "date.received") == 0)
 			cache |= MAIL_FETCH_RECEIVED_DATE;
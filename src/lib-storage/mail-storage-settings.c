@@ -64,6 +64,7 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(TIME, mail_temp_scan_interval),
 	DEF(UINT, mail_vsize_bg_after_count),
 	DEF(UINT, mail_sort_max_read_count),
+	DEF(SIZE, mail_search_bloom_size),
 	DEF(BOOL, mail_save_crlf),
 	DEF(ENUM, mail_fsync),
 	DEF(BOOL, mmap_disable),
@@ -120,6 +121,7 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_temp_scan_interval = 7*24*60*60,
 	.mail_vsize_bg_after_count = 0,
 	.mail_sort_max_read_count = 0,
+	.mail_search_bloom_size = 0,
 	.mail_save_crlf = FALSE,
 	.mail_fsync = "optimized:never:always",
 	.mmap_disable = FALSE,
@@ -475,6 +477,11 @@ static bool mail_storage_settings_check(void *_set, pool_t pool,
 		*error_r = "mail_cache_max_size can't be over 1 GB";
 		return FALSE;
 	}
+	if (set->mail_search_bloom_size > set->mail_cache_record_max_size) {
+		*error_r = "mail_search_bloom_size can't be larger than "
+			"mail_cache_record_max_size";
+		return FALSE;
+	}
 	if (set->mail_cache_purge_delete_percentage > 100) {
 		*error_r = "mail_cache_purge_delete_percentage can't be over 100";
 		return FALSE;
@@ -45,6 +45,7 @@ struct mail_storage_settings {
 	unsigned int mail_temp_scan_interval;
 	unsigned int mail_vsize_bg_after_count;
 	unsigned int mail_sort_max_read_count;
+	uoff_t mail_search_bloom_size;
 	bool mail_save_crlf;
 	const char *mail_fsync;
 	bool mmap_disable;
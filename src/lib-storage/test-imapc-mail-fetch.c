@@ -0,0 +1,390 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "net.h"
+#include "istream.h"
+#include "ostream.h"
+#include "write-full.h"
+#include "master-service.h"
+#include "imap-date.h"
+#include "imap-seqset.h"
+#include "test-common.h"
+#include "test-subprocess.h"
+#include "test-mail-storage-common.h"
+
+#include <unistd.h>
+
+#define SERVER_KILL_TIMEOUT_SECS 20
+/* should be the same as IMAPC_SERVER_CMDLINE_MAX_LEN */
+#define TEST_CMDLINE_MAX_LEN 8000
+
+/* The first mails have consecutive UIDs, the rest have gaps between them,
+   so that they can't be merged into ranges. */
+#define TEST_CONSECUTIVE_UID_COUNT 10
+#define TEST_MAIL_COUNT 2010
+#define TEST_DATE_BASE 1000000000
+
+static struct ip_addr bind_ip;
+static in_port_t bind_port;
+static int fd_listen = -1;
+/* the server writes the UID FETCH arguments it receives here, one per line */
+static int fd_fetches[2] = { -1, -1 };
+static bool debug = FALSE;
+
+static uint32_t test_seq_to_uid(uint32_t seq)
+{
+	if (seq <= TEST_CONSECUTIVE_UID_COUNT)
+		return seq;
+	return TEST_CONSECUTIVE_UID_COUNT +
+		(seq - TEST_CONSECUTIVE_UID_COUNT) * 2;
+}
+
+static time_t test_uid_to_date(uint32_t uid)
+{
+	return TEST_DATE_BASE + uid;
+}
+
+/*
+ * Server
+ */
+
+static void
+test_server_fetch(struct ostream *output, const char *tag, const char *args)
+{
+	ARRAY_TYPE(seq_range) uids;
+	const char *p;
+	bool internaldate;
+	uint32_t seq, uid;
+
+	p = strchr(args, ' ');
+	if (p == NULL)
+		i_fatal("Invalid UID FETCH: %s", args);
+	t_array_init(&uids, 16);
+	if (imap_seq_set_parse(t_strdup_until(args, p), &uids) < 0)
+		i_fatal("Invalid UID FETCH set: %s", args);
+	internaldate = strstr(p, "INTERNALDATE") != NULL;
+
+	if (strchr(t_strdup_until(args, p), '*') == NULL) {
+		/* not the mailbox sync */
+		const char *line = t_strconcat(args, "\n", NULL);
+
+		if (write_full(fd_fetches[1], line, strlen(line)) < 0)
+			i_fatal("write(fetches pipe) failed: %m");
+	}
+
+	for (seq = 1; seq <= TEST_MAIL_COUNT; seq++) {
+		uid = test_seq_to_uid(seq);
+		if (!seq_range_exists(&uids, uid))
+			continue;
+		o_stream_nsend_str(output, t_strdup_printf(
+			"* %u FETCH (UID %u FLAGS ()", seq, uid));
+		if (internaldate) {
+			o_stream_nsend_str(output, t_strdup_printf(
+				" INTERNALDATE \"%s\"",
+				imap_to_datetime(test_uid_to_date(uid))));
+		}
+		o_stream_nsend_str(output, ")\r\n");
+	}
+	o_stream_nsend_str(output, t_strdup_printf("%s OK \r\n", tag));
+}
+
+static void test_server_run_commands(struct istream *input,
+				     struct ostream *output)
+{
+	const char *line, *tag, *cmd, *args;
+
+	o_stream_nsend_str(output, "* OK [CAPABILITY IMAP4rev1] ready\r\n");
+	while ((line = i_stream_read_next_line(input)) != NULL) T_BEGIN {
+		if (debug)
+			i_debug("Received: %s", line);
+		tag = t_strcut(line, ' ');
+		cmd = line + strlen(tag);
+		if (*cmd == ' ')
+			cmd++;
+
+		if (str_begins(cmd, "UID FETCH ", &args))
+			test_server_fetch(output, tag, args);
+		else if (str_begins_with(cmd, "SELECT ") ||
+			 str_begins_with(cmd, "EXAMINE ")) {
+			o_stream_nsend_str(output, t_strdup_printf(
+				"* %u EXISTS\r\n"
+				"* OK [UIDVALIDITY 1] \r\n"
+				"* OK [UIDNEXT %u] \r\n"
+				"%s OK [READ-WRITE] \r\n", TEST_MAIL_COUNT,
+				test_seq_to_uid(TEST_MAIL_COUNT) + 1, tag));
+		} else if (strcmp(cmd, "LIST \"\" \"\"") == 0) {
+			/* hierarchy separator lookup */
+			o_stream_nsend_str(output, t_strdup_printf(
+				"* LIST (\\Noselect) \"/\" \"\"\r\n"
+				"%s OK \r\n", tag));
+		} else if (str_begins_with(cmd, "LIST ")) {
+			o_stream_nsend_str(output, t_strdup_printf(
+				"* LIST () \"/\" INBOX\r\n"
+				"%s OK \r\n", tag));
+		} else if (strcmp(cmd, "LOGOUT") == 0) {
+			o_stream_nsend_str(output, t_strdup_printf(
+				"* BYE \r\n%s OK \r\n", tag));
+		} else {
+			o_stream_nsend_str(output, t_strdup_printf(
+				"%s OK \r\n", tag));
+		}
+	} T_END;
+}
+
+static int test_run_server(void *context ATTR_UNUSED)
+{
+	struct istream *input;
+	struct ostream *output;
+	int fd;
+
+	i_set_failure_prefix("SERVER: ");
+
+	fd = net_accept(fd_listen, NULL, NULL);
+	if (fd < 0)
+		i_fatal("accept() failed: %m");
+	fd_set_nonblock(fd, FALSE);
+	input = i_stream_create_fd(fd, SIZE_MAX);
+	output = o_stream_create_fd(fd, SIZE_MAX);
+	o_stream_set_no_error_handling(output, TRUE);
+
+	test_server_run_commands(input, output);
+
+	i_stream_unref(&input);
+	o_stream_unref(&output);
+	i_close_fd(&fd);
+	i_close_fd(&fd_listen);
+	i_close_fd(&fd_fetches[1]);
+	return 0;
+}
+
+/*
+ * Client
+ */
+
+static struct mailbox *
+test_client_init(struct test_mail_storage_ctx **ctx_r)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct mailbox *box;
+
+	fd_listen = net_listen(&bind_ip, &bind_port, 128);
+	if (fd_listen == -1)
+		i_fatal("listen(%s) failed: %m", net_ip2addr(&bind_ip));
+	if (pipe(fd_fetches) < 0)
+		i_fatal("pipe() failed: %m");
+	fd_set_nonblock(fd_fetches[0], TRUE);
+
+	test_subprocess_fork(test_run_server, (void *)NULL, FALSE);
+	i_close_fd(&fd_listen);
+	i_close_fd(&fd_fetches[1]);
+
+	struct test_mail_storage_settings set = {
+		.driver = "imapc",
+		.extra_input = (const char *const[]) {
+			"imapc_host=127.0.0.1",
+			t_strdup_printf("imapc_port=%u", bind_port),
+			"imapc_user=testuser",
+			"imapc_password=testpass",
+			"mail_prefetch_count=0",
+			NULL
+		},
+	};
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+	*ctx_r = ctx;
+	return box;
+}
+
+static void
+test_client_deinit(struct test_mail_storage_ctx **ctx, struct mailbox **box)
+{
+	mailbox_free(box);
+	test_mail_storage_deinit_user(*ctx);
+	test_mail_storage_deinit(ctx);
+	test_subprocess_kill_all(SERVER_KILL_TIMEOUT_SECS);
+	i_close_fd(&fd_fetches[0]);
+	bind_port = 0;
+}
+
+/* Returns the UID FETCH arguments that the server has received, or NULL if
+   nothing. */
+static const char *const *test_server_get_fetches(void)
+{
+	string_t *str = t_str_new(1024);
+	unsigned char buf[1024];
+	ssize_t ret;
+
+	while ((ret = read(fd_fetches[0], buf, sizeof(buf))) > 0)
+		str_append_data(str, buf, ret);
+	if (ret < 0 && errno != EAGAIN)
+		i_fatal("read(fetches pipe) failed: %m");
+	if (str_len(str) == 0)
+		return NULL;
+	str_truncate(str, str_len(str) - 1);
+	return t_strsplit(str_c(str), "\n");
+}
+
+/* Look up the received dates of the given mails. The FETCHes are sent
+   only when the first date is needed, so they can all be merged. */
+static void
+test_client_fetch_dates(struct mailbox *box, const uint32_t *seqs,
+			unsigned int count)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail **mails;
+	time_t date;
+	unsigned int i;
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mails = t_new(struct mail *, count);
+	for (i = 0; i < count; i++) {
+		mails[i] = mail_alloc(trans, MAIL_FETCH_RECEIVED_DATE, NULL);
+		mail_set_seq(mails[i], seqs[i]);
+	}
+	for (i = 0; i < count; i++) {
+		test_assert_idx(mail_get_received_date(mails[i], &date) == 0, i);
+		test_assert_idx(date == test_uid_to_date(mails[i]->uid), i);
+		mail_free(&mails[i]);
+	}
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+}
+
+static void test_imapc_mail_fetch_merge(void)
+{
+	static const uint32_t seqs[] = { 1, 2, 3, 5, 7, 8, 9, 12 };
+	struct test_mail_storage_ctx *ctx;
+	struct mailbox *box;
+	const char *const *fetches;
+
+	test_begin("imapc mail fetch merge");
+	box = test_client_init(&ctx);
+	test_assert(test_server_get_fetches() == NULL);
+
+	/* consecutive UIDs are merged into ranges */
+	test_client_fetch_dates(box, seqs, N_ELEMENTS(seqs));
+	fetches = test_server_get_fetches();
+	test_assert(fetches != NULL && str_array_length(fetches) == 1);
+	if (fetches != NULL) {
+		test_assert_strcmp(fetches[0],
+				   "1:3,5,7:9,14 (INTERNALDATE)");
+	}
+
+	/* UIDs that were already fetched aren't fetched again */
+	test_client_fetch_dates(box, seqs, 2);
+	test_assert(test_server_get_fetches() == NULL);
+
+	test_client_deinit(&ctx, &box);
+	test_end();
+}
+
+static void test_imapc_mail_fetch_max_length(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct mailbox *box;
+	ARRAY_TYPE(seq_range) fetched_uids, uids;
+	const char *const *fetches;
+	const struct seq_range *range;
+	uint32_t *seqs, uid, last_uid = 0;
+	unsigned int i, count, fetches_count;
+
+	test_begin("imapc mail fetch max length");
+	box = test_client_init(&ctx);
+
+	count = TEST_MAIL_COUNT - TEST_CONSECUTIVE_UID_COUNT;
+	seqs = t_new(uint32_t, count);
+	for (i = 0; i < count; i++)
+		seqs[i] = TEST_CONSECUTIVE_UID_COUNT + 1 + i;
+	test_client_fetch_dates(box, seqs, count);
+
+	/* the UID set is split into multiple FETCH commands, none of which
+	   is too long */
+	fetches = test_server_get_fetches();
+	fetches_count = fetches == NULL ? 0 : str_array_length(fetches);
+	test_assert(fetches_count == 2);
+
+	t_array_init(&fetched_uids, count);
+	t_array_init(&uids, count);
+	for (i = 0; i < fetches_count; i++) {
+		const char *set = t_strcut(fetches[i], ' ');
+
+		test_assert_idx(strlen(set) <= TEST_CMDLINE_MAX_LEN, i);
+		test_assert_idx(strcmp(fetches[i] + strlen(set),
+				       " (INTERNALDATE)") == 0, i);
+		array_clear(&uids);
+		test_assert_idx(imap_seq_set_nostar_parse(set, &uids) == 0, i);
+		if (array_count(&uids) == 0)
+			continue;
+		/* the FETCHes are sent in UID order */
+		range = array_front(&uids);
+		test_assert_idx(range->seq1 > last_uid, i);
+		range = array_back(&uids);
+		last_uid = range->seq2;
+		seq_range_array_merge(&fetched_uids, &uids);
+	}
+	/* all the UIDs were fetched once */
+	test_assert(seq_range_count(&fetched_uids) == count);
+	for (i = 0; i < count; i++) {
+		uid = test_seq_to_uid(seqs[i]);
+		test_assert_idx(seq_range_exists(&fetched_uids, uid), i);
+	}
+
+	test_client_deinit(&ctx, &box);
+	test_end();
+}
+
+static void main_deinit(void)
+{
+	/* also called from sub-processes */
+	if (fd_fetches[0] != -1)
+		i_close_fd(&fd_fetches[0]);
+	if (fd_fetches[1] != -1)
+		i_close_fd(&fd_fetches[1]);
+}
+
+int main(int argc, char **argv)
+{
+	static void (*const test_functions[])(void) = {
+		test_imapc_mail_fetch_merge,
+		test_imapc_mail_fetch_max_length,
+		NULL
+	};
+	int c, ret;
+
+	master_service = master_service_init("test-imapc-mail-fetch",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "D");
+	while ((c = master_getopt(master_service)) > 0) {
+		switch (c) {
+		case 'D':
+			debug = TRUE;
+			break;
+		default:
+			i_fatal("Usage: %s [-D]", argv[0]);
+		}
+	}
+
+	test_subprocesses_init(debug);
+	test_subprocess_set_cleanup_callback(main_deinit);
+
+	/* listen on localhost */
+	i_zero(&bind_ip);
+	bind_ip.family = AF_INET;
+	bind_ip.u.ip4.s_addr = htonl(INADDR_LOOPBACK);
+
+	ret = test_run(test_functions);
+
+	test_subprocesses_deinit();
+	main_deinit();
+	master_service_deinit(&master_service);
+	return ret;
+}
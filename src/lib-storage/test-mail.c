@@ -2,9 +2,11 @@
 
 #include "lib.h"
 #include "test-common.h"
+#include "str.h"
 #include "istream.h"
 #include "master-service.h"
 #include "message-size.h"
+#include "mail-cache.h"
 #include "test-mail-storage-common.h"
 
 static struct event *test_event;
@@ -477,6 +479,114 @@ static void test_bodystructure_corruption_reparsing(void)
 	test_end();
 }
 
+static void test_mail_precache(struct mailbox *box, uint32_t seq)
+{
+	struct mailbox_transaction_context *trans;
+	struct mailbox_metadata metadata;
+	struct mail *mail;
+
+	/* the same way as doveadm index and indexer do it */
+	test_assert(mailbox_get_metadata(box, MAILBOX_METADATA_PRECACHE_FIELDS,
+					 &metadata) == 0);
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_NO_CACHE_DEC, __func__);
+	mail = mail_alloc(trans, metadata.precache_fields, NULL);
+	mail_set_seq(mail, seq);
+	test_assert(mail_precache(mail) == 0);
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+}
+
+/* Returns the cache field's value if it's cached, otherwise NULL. This doesn't
+   go through mail_get_*(), which could add the field to the cache. */
+static const char *
+test_mail_get_cached(struct mailbox *box, uint32_t seq, const char *field_name)
+{
+	struct mailbox_transaction_context *trans;
+	string_t *str = t_str_new(128);
+	unsigned int field_idx;
+	int ret;
+
+	field_idx = mail_cache_register_lookup(box->cache, field_name);
+	i_assert(field_idx != UINT_MAX);
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	ret = mail_cache_lookup_field(trans->cache_view, str, seq, field_idx);
+	test_assert(ret >= 0);
+	mailbox_transaction_rollback(&trans);
+	return ret > 0 ? str_c(str) : NULL;
+}
+
+static void
+test_mail_update_cache_decision(struct mailbox *box, const char *field,
+				enum mail_cache_decision_type decision)
+{
+	struct mailbox_cache_field cache_updates[] = {
+		{ .name = field, .decision = decision, .last_used = (time_t)-1 },
+		{ .name = NULL }
+	};
+	struct mailbox_update update = {
+		.cache_updates = cache_updates,
+	};
+
+	test_assert(mailbox_update(box, &update) == 0);
+}
+
+static void test_mail_precache_body_snippet(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.extra_input = (const char *const[]) {
+			"mail_cache_fields=",
+			NULL
+		},
+	};
+	unsigned int i;
+
+	test_begin("mail precache body snippet");
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	struct mailbox *box =
+		mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+
+	/* nothing is cached while saving */
+	for (i = 0; i < 2; i++) {
+		test_mail_save(box,
+			       "From: <test1@example.com>\r\n"
+			       "Content-Type: text/html\r\n"
+			       "\r\n"
+			       "<html><body><p>Hello <b>snippet</b></p></body></html>\n");
+	}
+	test_assert(test_mail_get_cached(box, 1, "body.snippet") == NULL);
+
+	/* precaching generates the snippet in the same body parse
+	   ('1' = snippet from HTML) */
+	test_mail_update_cache_decision(box, "body.snippet",
+					MAIL_CACHE_DECISION_YES);
+	test_mail_precache(box, 1);
+	test_assert_strcmp(test_mail_get_cached(box, 1, "body.snippet"),
+			   "1Hello snippet");
+	/* the BODYSTRUCTURE parsed for it isn't cached when the mailbox
+	   doesn't want it */
+	test_assert(test_mail_get_cached(box, 1, "imap.bodystructure") == NULL);
+
+	/* ..but it is when the mailbox does */
+	test_mail_update_cache_decision(box, "imap.bodystructure",
+					MAIL_CACHE_DECISION_YES);
+	test_mail_precache(box, 2);
+	test_assert_strcmp(test_mail_get_cached(box, 2, "body.snippet"),
+			   "1Hello snippet");
+	test_assert(test_mail_get_cached(box, 2, "imap.bodystructure") != NULL);
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
 int main(int argc, char **argv)
 {
 	void (*const tests[])(void) = {
@@ -484,6 +594,7 @@ int main(int argc, char **argv)
 		test_attachment_flags_during_header_fetch,
 		test_bodystructure_reparsing,
 		test_bodystructure_corruption_reparsing,
+		test_mail_precache_body_snippet,
 		NULL
 	};
 	int ret;
@@ -36,6 +36,32 @@ static void test_unichar_uni_utf8_partial_strlen_n(void)
 	test_end();
 }
 
+static void test_unichar_uni_utf8_ascii_prefix_len(void)
+{
+	unsigned char data[64];
+	unsigned int i, j;
+
+	test_begin("uni_utf8_ascii_prefix_len()");
+	memset(data, 'a', sizeof(data));
+	test_assert(uni_utf8_ascii_prefix_len(data, 0) == 0);
+	for (i = 0; i <= sizeof(data); i++)
+		test_assert_idx(uni_utf8_ascii_prefix_len(data, i) == i, i);
+	for (i = 0; i < sizeof(data); i++) {
+		data[i] = 0x80 | i;
+		for (j = 0; j <= sizeof(data); j++) {
+			test_assert_idx(uni_utf8_ascii_prefix_len(data, j) ==
+					I_MIN(i, j), i * 100 + j);
+		}
+		data[i] = 0x7f;
+	}
+	/* valid UTF-8 with long ASCII parts around the characters */
+	test_assert(uni_utf8_data_is_valid((const unsigned char *)
+		"0123456789abcdef\xC3\xA4" "0123456789abcdefgh\xE2\x82\xAC", 39));
+	test_assert(!uni_utf8_data_is_valid((const unsigned char *)
+		"0123456789abcdef0123456789abcdef\xC3", 33));
+	test_end();
+}
+
 static void test_unichar_valid_unicode(void)
 {
 	struct {
@@ -180,6 +206,7 @@ void test_unichar(void)
 
 	test_unichar_uni_utf8_strlen();
 	test_unichar_uni_utf8_partial_strlen_n();
+	test_unichar_uni_utf8_ascii_prefix_len();
 	test_unichar_valid_unicode();
 	test_unichar_surrogates();
 }
@@ -5,6 +5,10 @@
 #include "bsearch-insert-pos.h"
 #include "unichar.h"
 
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
 #include "unicodemap.c"
 
 #define HANGUL_FIRST 0xac00
@@ -207,9 +211,16 @@ unsigned int uni_utf8_partial_strlen_n(const void *_input, size_t size,
 {
 	const unsigned char *input = _input;
 	unsigned int count, len = 0;
-	size_t i;
+	size_t i, ascii_len;
 
 	for (i = 0; i < size; ) {
+		if (input[i] < 0x80) {
+			ascii_len = uni_utf8_ascii_prefix_len(input + i,
+							      size - i);
+			i += ascii_len;
+			len += ascii_len;
+			continue;
+		}
 		count = uni_utf8_char_bytes(input[i]);
 		if (i + count > size)
 			break;
@@ -372,7 +383,7 @@ static int uni_utf8_find_invalid_pos(const unsigned char *input, size_t size,
 	/* find the first invalid utf8 sequence */
 	for (i = 0; i < size;) {
 		if (input[i] < 0x80)
-			i++;
+			i += uni_utf8_ascii_prefix_len(input + i, size - i);
 		else {
 			len = is_valid_utf8_seq(input + i, size-i);
 			if (unlikely(len == 0)) {
@@ -399,7 +410,9 @@ bool uni_utf8_get_valid_data(const unsigned char *input, size_t size,
 	output_add_replacement_char(buf);
 	while (i < size) {
 		if (input[i] < 0x80) {
-			buffer_append_c(buf, input[i++]);
+			len = uni_utf8_ascii_prefix_len(input + i, size - i);
+			buffer_append(buf, input + i, len);
+			i += len;
 			continue;
 		}
 
@@ -430,6 +443,31 @@ bool uni_utf8_data_is_valid(const unsigned char *data, size_t size)
 	return uni_utf8_find_invalid_pos(data, size, &i) == 0;
 }
 
+size_t uni_utf8_ascii_prefix_len(const unsigned char *data, size_t size)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	for (; i + 16 <= size; i += 16) {
+		unsigned int mask = _mm_movemask_epi8(
+			_mm_loadu_si128((const void *)(data + i)));
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+#else
+	for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+		uint64_t word;
+
+		memcpy(&word, data + i, sizeof(word));
+		if ((word & 0x8080808080808080ULL) != 0)
+			break;
+	}
+#endif
+	while (i < size && data[i] < 0x80)
+		i++;
+	return i;
+}
+
 size_t uni_utf8_data_truncate(const unsigned char *data, size_t old_size,
 			      size_t max_new_size)
 {
@@ -51,6 +51,8 @@ extern struct auth_client *auth_client;
 extern struct login_client_list *login_client_list;
 extern bool closing_down, login_debug;
 extern struct anvil_client *anvil;
+/* anvil's connect-limit table in shared memory, or NULL if not available */
+extern struct anvil_shm *anvil_shm;
 extern const char *login_rawlog_dir;
 extern unsigned int initial_service_count;
 /* NULL-terminated array of all alt_usernames seen so far. Existing fields are
@@ -18,6 +18,7 @@
 #include "access-lookup.h"
 #include "master-admin-client.h"
 #include "anvil-client.h"
+#include "anvil-shm.h"
 #include "auth-client.h"
 #include "dsasl-client.h"
 #include "master-service-ssl-settings.h"
@@ -37,6 +38,7 @@ struct auth_client *auth_client;
 struct login_client_list *login_client_list;
 bool closing_down, login_debug;
 struct anvil_client *anvil;
+struct anvil_shm *anvil_shm;
 const char *login_rawlog_dir = NULL;
 unsigned int initial_service_count;
 struct login_module_register login_module_register;
@@ -274,6 +276,12 @@ void login_anvil_init(void)
 	anvil = anvil_client_init("anvil", &callbacks, 0);
 	if (anvil_client_connect(anvil, TRUE) < 0)
 		i_fatal("Couldn't connect to anvil");
+
+	/* Open before chrooting. If it fails, all the lookups are simply
+	   sent to anvil. */
+	const char *error;
+	if (anvil_shm_open(ANVIL_SHM_FILE_NAME, &anvil_shm, &error) < 0)
+		i_error("%s", error);
 }
 
 static void
@@ -451,6 +459,7 @@ static void main_deinit(void)
 		i_free(str);
 	array_free(&global_alt_usernames);
 
+	anvil_shm_close(&anvil_shm);
 	if (anvil != NULL)
 		anvil_client_deinit(&anvil);
 	timeout_remove(&auth_client_to);
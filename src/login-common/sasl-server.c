@@ -12,6 +12,7 @@
 #include "strescape.h"
 #include "str-sanitize.h"
 #include "anvil-client.h"
+#include "anvil-shm.h"
 #include "auth-client.h"
 #include "iostream-ssl.h"
 #include "master-service.h"
@@ -272,6 +273,20 @@ anvil_check_too_many_connections(struct client *client,
 		anvil_lookup_callback(NULL, req);
 		return;
 	}
+	if (anvil_shm != NULL) {
+		const char *key =
+			anvil_shm_userip_key(client->virtual_user,
+					     login_binary->protocol,
+					     &client->ip);
+		unsigned int conn_count, unused;
+
+		if (anvil_shm_lookup(anvil_shm, ANVIL_SHM_TABLE_USERIP, key,
+				     &conn_count, &unused) >= 0) {
+			/* found the answer without asking anvil */
+			anvil_lookup_callback(dec2str(conn_count), req);
+			return;
+		}
+	}
 
 	query = t_strconcat("LOOKUP\t",
 			    str_tabescape(client->virtual_user), "\t",
@@ -14,6 +14,7 @@ extern bool core_dumps_disabled;
 extern bool have_proc_fs_suid_dumpable;
 extern bool have_proc_sys_kernel_core_pattern;
 extern const char *ssl_manual_key_password;
+extern char *ssl_ticket_key_secrets;
 extern int global_master_dead_pipe_fd[2];
 extern struct service_list *services;
 extern bool startup_finished;
@@ -10,6 +10,9 @@
 #include "path-util.h"
 #include "ipwd.h"
 #include "str.h"
+#include "hex-binary.h"
+#include "randgen.h"
+#include "safe-memset.h"
 #include "time-util.h"
 #include "execv-const.h"
 #include "restrict-process-size.h"
@@ -47,6 +50,9 @@
 #define FATAL_FILENAME "master-fatal.lastlog"
 #define MASTER_PID_FILE_NAME "master.pid"
 #define SERVICE_TIME_MOVED_BACKWARDS_MAX_THROTTLE_MSECS (60*3*1000)
+/* How often a new TLS session ticket key secret is generated. It's also
+   generated on every config reload. */
+#define SSL_TICKET_KEY_SECRET_ROTATE_SECS (60*60*24)
 
 struct master_delayed_error {
 	enum log_type type;
@@ -59,6 +65,7 @@ bool core_dumps_disabled;
 bool have_proc_fs_suid_dumpable;
 bool have_proc_sys_kernel_core_pattern;
 const char *ssl_manual_key_password;
+char *ssl_ticket_key_secrets;
 int global_master_dead_pipe_fd[2];
 struct service_list *services;
 bool startup_finished = FALSE;
@@ -66,6 +73,7 @@ bool startup_finished = FALSE;
 static char *pidfile_path;
 static struct master_instance_list *instances;
 static struct timeout *to_instance;
+static struct timeout *to_ssl_ticket_key;
 
 static ARRAY(struct master_delayed_error) delayed_errors;
 static pool_t delayed_errors_pool;
@@ -367,6 +375,29 @@ static void instance_update(const struct master_settings *set)
 	instance_update_now(instances);
 }
 
+static void ssl_ticket_key_secret_rotate(void *context ATTR_UNUSED)
+{
+	unsigned char secret[32];
+	const char *hex_secret;
+	char *prev_secrets = ssl_ticket_key_secrets;
+
+	/* The new processes get the new secret. The previous secret is kept
+	   for decrypting the tickets that were issued with it, since they
+	   may still be in use by the clients and the processes started
+	   earlier. */
+	random_fill(secret, sizeof(secret));
+	hex_secret = binary_to_hex(secret, sizeof(secret));
+	safe_memset(secret, 0, sizeof(secret));
+	if (prev_secrets == NULL)
+		ssl_ticket_key_secrets = i_strdup(hex_secret);
+	else {
+		ssl_ticket_key_secrets = i_strconcat(hex_secret, " ",
+			t_strcut(prev_secrets, ' '), NULL);
+		safe_memset(prev_secrets, 0, strlen(prev_secrets));
+		i_free(prev_secrets);
+	}
+}
+
 static void
 sig_settings_reload(const siginfo_t *si ATTR_UNUSED,
 		    void *context ATTR_UNUSED)
@@ -434,6 +465,11 @@ sig_settings_reload(const siginfo_t *si ATTR_UNUSED,
 	}
 	services_destroy(services, FALSE);
 
+	/* the processes for the new configuration get a new TLS session
+	   ticket key secret */
+	ssl_ticket_key_secret_rotate(NULL);
+	timeout_reset(to_ssl_ticket_key);
+
 	services = new_services;
         services_monitor_start(services);
 	i_sd_notify(0, "READY=1");
@@ -559,6 +595,8 @@ static void main_init(const struct master_settings *set)
 	create_config_symlink(set);
 	instance_update(set);
 	master_clients_init();
+	to_ssl_ticket_key = timeout_add(SSL_TICKET_KEY_SECRET_ROTATE_SECS * 1000,
+					ssl_ticket_key_secret_rotate, NULL);
 
 	services_monitor_start(services);
 	i_sd_notifyf(0, "READY=1\nSTATUS=v" DOVECOT_VERSION_FULL " running\n"
@@ -582,6 +620,7 @@ static void main_deinit(void)
 	instance_update_now(instances);
 	timeout_remove(&to_instance);
 	master_instance_list_deinit(&instances);
+	timeout_remove(&to_ssl_ticket_key);
 
 	/* kill services and wait for them to die before unlinking pid file */
 	global_dead_pipe_close();
@@ -589,6 +628,8 @@ static void main_deinit(void)
 
 	i_unlink(pidfile_path);
 	i_free(pidfile_path);
+	safe_memset(ssl_ticket_key_secrets, 0, strlen(ssl_ticket_key_secrets));
+	i_free(ssl_ticket_key_secrets);
 
 	service_anvil_global_deinit();
 	service_pids_deinit();
@@ -867,6 +908,7 @@ int main(int argc, char *argv[])
 		ssl_manual_key_password =
 			t_askpass("Give the password for SSL keys: ");
 	}
+	ssl_ticket_key_secret_rotate(NULL);
 
 	if (dup2(dev_null_fd, STDIN_FILENO) < 0)
 		i_fatal("dup2(dev_null_fd) failed: %m");
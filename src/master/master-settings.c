@@ -408,6 +408,22 @@ service_get_client_limit(struct master_settings *set, const char *name)
 	return set->default_client_limit;
 }
 
+static unsigned int
+service_get_process_limit(struct master_settings *set, const char *name)
+{
+	struct service_settings *service;
+
+	array_foreach_elem(&set->services, service) {
+		if (strcmp(service->name, name) == 0) {
+			if (service->process_limit != 0)
+				return service->process_limit;
+			else
+				return set->default_process_limit;
+		}
+	}
+	return set->default_process_limit;
+}
+
 static bool service_is_enabled(const struct master_settings *set,
 			       struct service_settings *service)
 {
@@ -427,6 +443,7 @@ master_settings_verify(void *_set, pool_t pool, const char **error_r)
 	struct passwd pw;
 	unsigned int i, j, count, client_limit, process_limit;
 	unsigned int max_auth_client_processes, max_anvil_client_processes;
+	unsigned int max_auth_master_processes, max_auth_clients;
 	string_t *max_auth_client_processes_reason = t_str_new(64);
 	string_t *max_anvil_client_processes_reason = t_str_new(64);
 	size_t len;
@@ -517,6 +534,7 @@ master_settings_verify(void *_set, pool_t pool, const char **error_r)
 	}
 	t_array_init(&all_listeners, 64);
 	max_auth_client_processes = 0;
+	max_auth_master_processes = 0;
 	max_anvil_client_processes = 2; /* blocking, nonblocking pipes */
 	for (i = 0; i < count; i++) {
 		struct service_settings *service = services[i];
@@ -587,6 +605,8 @@ master_settings_verify(void *_set, pool_t pool, const char **error_r)
 					    " + service %s { process_limit=%u }",
 					    service->name, process_limit);
 				max_auth_client_processes += process_limit;
+				if (strcmp(service->type, "login") != 0)
+					max_auth_master_processes += process_limit;
 			}
 		}
 		if (strcmp(service->type, "login") == 0 ||
@@ -612,14 +632,22 @@ master_settings_verify(void *_set, pool_t pool, const char **error_r)
 		add_inet_listeners(&service->inet_listeners, &all_listeners);
 	}
 
+	/* clients are spread over all the auth processes, but with multiple
+	   auth processes each post-login process also connects to all of
+	   their per-process auth-master sockets */
 	client_limit = service_get_client_limit(set, "auth");
-	if (client_limit < max_auth_client_processes && !warned_auth) {
+	process_limit = service_get_process_limit(set, "auth");
+	max_auth_clients = (max_auth_client_processes + process_limit - 1) /
+		process_limit;
+	if (process_limit > 1)
+		max_auth_clients += max_auth_master_processes;
+	if (client_limit < max_auth_clients && !warned_auth) {
 		warned_auth = TRUE;
 		str_delete(max_auth_client_processes_reason, 0, 3);
-		i_warning("service auth { client_limit=%u } is lower than "
-			  "required under max. load (%u). "
+		i_warning("service auth { client_limit=%u process_limit=%u } "
+			  "is lower than required under max. load (%u). "
 			  "Counted for protocol services with service_count != 1: %s",
-			  client_limit, max_auth_client_processes,
+			  client_limit, process_limit, max_auth_clients,
 			  str_c(max_auth_client_processes_reason));
 	}
 
@@ -324,6 +324,12 @@ service_process_setup_environment(struct service *service, unsigned int uid,
 		   that have inet listeners. */
 		env_put(MASTER_SSL_KEY_PASSWORD_ENV, ssl_manual_key_password);
 	}
+	if (service->have_inet_listeners) {
+		/* the same TLS session ticket keys are used by all the
+		   processes, so sessions can be resumed with any of them */
+		env_put(MASTER_SSL_TICKET_KEY_SECRET_ENV,
+			ssl_ticket_key_secrets);
+	}
 	if (service->type == SERVICE_TYPE_ANVIL &&
 	    service_anvil_global->restarted)
 		env_put("ANVIL_RESTARTED", "1");
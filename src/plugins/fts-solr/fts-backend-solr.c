@@ -5,7 +5,6 @@
 #include "str.h"
 #include "hash.h"
 #include "strescape.h"
-#include "unichar.h"
 #include "iostream-ssl.h"
 #include "http-url.h"
 #include "mail-storage-private.h"
@@ -45,7 +44,6 @@ struct solr_fts_backend_update_context {
 	struct mailbox *cur_box;
 	char box_guid[MAILBOX_GUID_HEX_LENGTH+1];
 
-	struct solr_connection_post *post;
 	uint32_t prev_uid;
 	string_t *cmd, *cur_value, *cur_value2;
 	string_t *cmd_expunge;
@@ -56,6 +54,7 @@ struct solr_fts_backend_update_context {
 
 	bool tokenized_input:1;
 	bool last_indexed_uid_set:1;
+	bool batch_open:1;
 	bool body_open:1;
 	bool documents_added:1;
 	bool expunges:1;
@@ -64,85 +63,48 @@ struct solr_fts_backend_update_context {
 
 static const char *solr_escape_chars = "+-&|!(){}[]^\"~*?:\\/ ";
 
-static bool is_valid_xml_char(unichar_t chr)
-{
-	/* Valid characters in XML:
-
-	   #x9 | #xA | #xD | [#x20-#xD7FF] | [#xE000-#xFFFD] |
-	   [#x10000-#x10FFFF]
-
-	   This function gets called only for #x80 and higher */
-	if (chr > 0xd7ff && chr < 0xe000)
-		return FALSE;
-	if (chr > 0xfffd && chr < 0x10000)
-		return FALSE;
-	return chr < 0x10ffff;
-}
-
-static size_t
-xml_encode_data_max(string_t *dest, const unsigned char *data, size_t len,
-		    unsigned int max_len)
+static void
+json_encode_data(string_t *dest, const unsigned char *data, size_t len)
 {
-	unichar_t chr;
-	size_t i;
+	size_t i, start = 0;
 
-	i_assert(max_len > 0 || len == 0);
+	/* the input is valid UTF-8, so only the ASCII characters need to be
+	   looked at */
+	for (i = 0; i < len; i++) {
+		if (data[i] >= 32 && data[i] != '"' && data[i] != '\\')
+			continue;
 
-	if (max_len > len)
-		max_len = len;
-	for (i = 0; i < max_len; i++) {
+		str_append_data(dest, data + start, i - start);
+		start = i + 1;
 		switch (data[i]) {
-		case '&':
-			str_append(dest, "&amp;");
-			break;
-		case '<':
-			str_append(dest, "&lt;");
+		case '"':
+			str_append(dest, "\\\"");
 			break;
-		case '>':
-			str_append(dest, "&gt;");
+		case '\\':
+			str_append(dest, "\\\\");
 			break;
 		case '\t':
+			str_append(dest, "\\t");
+			break;
 		case '\n':
+			str_append(dest, "\\n");
+			break;
 		case '\r':
-			/* exceptions to the following control char check */
-			str_append_c(dest, data[i]);
+			str_append(dest, "\\r");
 			break;
 		default:
-			if (data[i] < 32) {
-				/* SOLR doesn't like control characters.
-				   replace them with spaces. */
-				str_append_c(dest, ' ');
-			} else if (data[i] >= 0x80) {
-				/* make sure the character is valid for XML
-				   so we don't get XML parser errors */
-				int char_len =
-					uni_utf8_get_char_n(data + i, len - i, &chr);
-				i_assert(char_len > 0); /* input is valid UTF8 */
-				if (is_valid_xml_char(chr))
-					str_append_data(dest, data + i, char_len);
-				else {
-					str_append_data(dest, utf8_replacement_char,
-							UTF8_REPLACEMENT_CHAR_LEN);
-				}
-				i += char_len - 1;
-			} else {
-				str_append_c(dest, data[i]);
-			}
+			/* SOLR doesn't like control characters.
+			   replace them with spaces. */
+			str_append_c(dest, ' ');
 			break;
 		}
 	}
-	return i;
+	str_append_data(dest, data + start, len - start);
 }
 
-static void
-xml_encode_data(string_t *dest, const unsigned char *data, size_t len)
-{
-	(void)xml_encode_data_max(dest, data, len, len);
-}
-
-static void xml_encode(string_t *dest, const char *str)
+static void json_encode(string_t *dest, const char *str)
 {
-	xml_encode_data(dest, (const unsigned char *)str, strlen(str));
+	json_encode_data(dest, (const unsigned char *)str, strlen(str));
 }
 
 static const char *solr_escape(const char *str)
@@ -286,14 +248,15 @@ fts_backend_solr_update_init(struct fts_backend *_backend)
 	return &ctx->ctx;
 }
 
-static void xml_encode_id(struct solr_fts_backend_update_context *ctx,
-			  string_t *str, uint32_t uid)
+static void json_encode_id(struct solr_fts_backend_update_context *ctx,
+			   string_t *str, uint32_t uid)
 {
-	str_printfa(str, "%u/%s", uid, ctx->box_guid);
+	str_printfa(str, "\"%u/%s", uid, ctx->box_guid);
 	if (ctx->ctx.backend->ns->owner != NULL) {
 		str_append_c(str, '/');
-		xml_encode(str, ctx->ctx.backend->ns->owner->username);
+		json_encode(str, ctx->ctx.backend->ns->owner->username);
 	}
+	str_append_c(str, '"');
 }
 
 static void
@@ -302,18 +265,12 @@ fts_backend_solr_doc_open(struct solr_fts_backend_update_context *ctx,
 {
 	ctx->documents_added = TRUE;
 
-	str_printfa(ctx->cmd, "<doc>"
-		    "<field name=\"uid\">%u</field>"
-		    "<field name=\"box\">%s</field>",
+	str_printfa(ctx->cmd, "{\"uid\":%u,\"box\":\"%s\",\"user\":\"",
 		    uid, ctx->box_guid);
-	str_append(ctx->cmd, "<field name=\"user\">");
 	if (ctx->ctx.backend->ns->owner != NULL)
-		xml_encode(ctx->cmd, ctx->ctx.backend->ns->owner->username);
-	str_append(ctx->cmd, "</field>");
-
-	str_printfa(ctx->cmd, "<field name=\"id\">");
-	xml_encode_id(ctx, ctx->cmd, uid);
-	str_append(ctx->cmd, "</field>");
+		json_encode(ctx->cmd, ctx->ctx.backend->ns->owner->username);
+	str_append(ctx->cmd, "\",\"id\":");
+	json_encode_id(ctx, ctx->cmd, uid);
 }
 
 static string_t *
@@ -342,32 +299,48 @@ fts_backend_solr_doc_close(struct solr_fts_backend_update_context *ctx)
 
 	if (ctx->body_open) {
 		ctx->body_open = FALSE;
-		str_append(ctx->cmd, "</field>");
+		str_append_c(ctx->cmd, '"');
 	}
 	array_foreach_modifiable(&ctx->fields, field) {
-		str_printfa(ctx->cmd, "<field name=\"%s\">", field->key);
-		/* the values are already xml-escaped */
+		if (str_len(field->value) == 0)
+			continue;
+		str_append(ctx->cmd, ",\"");
+		json_encode(ctx->cmd, field->key);
+		str_append(ctx->cmd, "\":\"");
+		/* the values are already json-escaped */
 		str_append_str(ctx->cmd, field->value);
-		str_append(ctx->cmd, "</field>");
+		str_append_c(ctx->cmd, '"');
 		str_truncate(field->value, 0);
 	}
-	str_append(ctx->cmd, "</doc>");
+	str_append_c(ctx->cmd, '}');
 }
 
-static int
-fts_backed_solr_build_flush(struct solr_fts_backend_update_context *ctx)
+static void
+fts_backend_solr_batch_send(struct solr_fts_backend_update_context *ctx)
 {
-	if (ctx->post == NULL)
-		return 0;
+	struct solr_fts_backend *backend =
+		(struct solr_fts_backend *)ctx->ctx.backend;
+
+	if (!ctx->batch_open)
+		return;
 
 	fts_backend_solr_doc_close(ctx);
-	str_append(ctx->cmd, "</add>");
+	str_append_c(ctx->cmd, ']');
+	ctx->batch_open = FALSE;
 	ctx->mails_since_flush = 0;
 
-	solr_connection_post_more(ctx->post, str_data(ctx->cmd),
-				  str_len(ctx->cmd));
+	solr_connection_update(backend->solr_conn, ctx->cmd);
 	str_truncate(ctx->cmd, 0);
-	return solr_connection_post_end(&ctx->post);
+}
+
+static int
+fts_backed_solr_build_flush(struct solr_fts_backend_update_context *ctx)
+{
+	struct solr_fts_backend *backend =
+		(struct solr_fts_backend *)ctx->ctx.backend;
+
+	fts_backend_solr_batch_send(ctx);
+	return solr_connection_update_flush(backend->solr_conn);
 }
 
 static void
@@ -376,10 +349,14 @@ fts_backend_solr_expunge_flush(struct solr_fts_backend_update_context *ctx)
 	struct solr_fts_backend *backend =
 		(struct solr_fts_backend *)ctx->ctx.backend;
 
-	str_append(ctx->cmd_expunge, "</delete>");
-	(void)solr_connection_post(backend->solr_conn, str_c(ctx->cmd_expunge));
+	/* the mails may still be getting added by the earlier requests */
+	if (fts_backed_solr_build_flush(ctx) < 0)
+		ctx->ctx.failed = TRUE;
+
+	str_append(ctx->cmd_expunge, "]}");
+	solr_connection_update(backend->solr_conn, ctx->cmd_expunge);
 	str_truncate(ctx->cmd_expunge, 0);
-	str_append(ctx->cmd_expunge, "<delete>");
+	str_append(ctx->cmd_expunge, "{\"delete\":[");
 }
 
 static int
@@ -391,7 +368,7 @@ fts_backend_solr_update_deinit(struct fts_backend_update_context *_ctx)
 		(struct solr_fts_backend *)_ctx->backend;
 	struct fts_solr_user *fuser = FTS_SOLR_USER_CONTEXT(_ctx->backend->ns->user);
 	struct solr_fts_field *field;
-	const char *str;
+	string_t *str;
 	int ret = _ctx->failed ? -1 : 0;
 
 	if (fts_backed_solr_build_flush(ctx) < 0)
@@ -403,11 +380,16 @@ fts_backend_solr_update_deinit(struct fts_backend_update_context *_ctx)
 		if (ctx->expunges)
 			fts_backend_solr_expunge_flush(ctx);
 		if (fuser->set.soft_commit) {
-			str = t_strdup_printf("<commit softCommit=\"true\" waitSearcher=\"%s\"/>",
-					      ctx->documents_added ? "true" : "false");
-			if (solr_connection_post(backend->solr_conn, str) < 0)
-				ret = -1;
+			str = str_new(default_pool, 128);
+			str_printfa(str, "{\"commit\":{\"softCommit\":true,"
+				    "\"waitSearcher\":%s}}",
+				    ctx->documents_added ? "true" : "false");
+			solr_connection_update(backend->solr_conn, str);
+			str_free(&str);
 		}
+		if (solr_connection_update_flush(backend->solr_conn) < 0 ||
+		    _ctx->failed)
+			ret = -1;
 	}
 
 	str_free(&ctx->cmd);
@@ -477,15 +459,14 @@ fts_backend_solr_update_expunge(struct fts_backend_update_context *_ctx,
 	if (!ctx->expunges) {
 		ctx->expunges = TRUE;
 		ctx->cmd_expunge = str_new(default_pool, 1024);
-		str_append(ctx->cmd_expunge, "<delete>");
-	}
-
-	if (str_len(ctx->cmd_expunge) >= SOLR_CMDBUF_FLUSH_SIZE)
+		str_append(ctx->cmd_expunge, "{\"delete\":[");
+	} else if (str_len(ctx->cmd_expunge) >= SOLR_CMDBUF_FLUSH_SIZE) {
 		fts_backend_solr_expunge_flush(ctx);
+	} else {
+		str_append_c(ctx->cmd_expunge, ',');
+	}
 
-	str_append(ctx->cmd_expunge, "<id>");
-	xml_encode_id(ctx, ctx->cmd_expunge, uid);
-	str_append(ctx->cmd_expunge, "</id>");
+	json_encode_id(ctx, ctx->cmd_expunge, uid);
 }
 
 static void
@@ -496,18 +477,22 @@ fts_backend_solr_uid_changed(struct solr_fts_backend_update_context *ctx,
 		(struct solr_fts_backend *)ctx->ctx.backend;
 	struct fts_solr_user *fuser = FTS_SOLR_USER_CONTEXT(ctx->ctx.backend->ns->user);
 
-	if (ctx->mails_since_flush >= fuser->set.batch_size) {
-		if (fts_backed_solr_build_flush(ctx) < 0)
-			ctx->ctx.failed = TRUE;
-	}
+	/* the batch is sent in the background, while the next one is being
+	   built */
+	if (ctx->mails_since_flush >= fuser->set.batch_size ||
+	    (ctx->batch_open && str_len(ctx->cmd) >= fuser->set.batch_bytes))
+		fts_backend_solr_batch_send(ctx);
+	else
+		(void)solr_connection_update_poll(backend->solr_conn);
 	ctx->mails_since_flush++;
-	if (ctx->post == NULL) {
+	if (!ctx->batch_open) {
 		if (ctx->cmd == NULL)
 			ctx->cmd = str_new(default_pool, SOLR_CMDBUF_SIZE);
-		ctx->post = solr_connection_post_begin(backend->solr_conn);
-		str_append(ctx->cmd, "<add>");
+		str_append_c(ctx->cmd, '[');
+		ctx->batch_open = TRUE;
 	} else {
 		fts_backend_solr_doc_close(ctx);
+		str_append_c(ctx->cmd, ',');
 	}
 	ctx->prev_uid = uid;
 	ctx->truncate_header = FALSE;
@@ -533,13 +518,13 @@ fts_backend_solr_update_set_build_key(struct fts_backend_update_context *_ctx,
 		/* fall through */
 	case FTS_BACKEND_BUILD_KEY_MIME_HDR:
 		ctx->cur_value = fts_solr_field_get(ctx, "hdr");
-		xml_encode(ctx->cur_value, key->hdr_name);
+		json_encode(ctx->cur_value, key->hdr_name);
 		str_append(ctx->cur_value, ": ");
 		break;
 	case FTS_BACKEND_BUILD_KEY_BODY_PART:
 		if (!ctx->body_open) {
 			ctx->body_open = TRUE;
-			str_append(ctx->cmd, "<field name=\"body\">");
+			str_append(ctx->cmd, ",\"body\":\"");
 		}
 		ctx->cur_value = ctx->cmd;
 		break;
@@ -572,52 +557,30 @@ fts_backend_solr_update_build_more(struct fts_backend_update_context *_ctx,
 {
 	struct solr_fts_backend_update_context *ctx =
 		(struct solr_fts_backend_update_context *)_ctx;
-	size_t len;
 
 	if (_ctx->failed)
 		return -1;
 
 	if (ctx->cur_value2 == NULL && ctx->cur_value == ctx->cmd) {
-		/* we're writing to message body. if size is huge,
-		   flush it once in a while */
-		while (size >= SOLR_CMDBUF_FLUSH_SIZE) {
-			if (str_len(ctx->cmd) >= SOLR_CMDBUF_FLUSH_SIZE) {
-				solr_connection_post_more(ctx->post,
-							  str_data(ctx->cmd),
-							  str_len(ctx->cmd));
-				str_truncate(ctx->cmd, 0);
-			}
-			len = xml_encode_data_max(ctx->cmd, data, size,
-						  SOLR_CMDBUF_FLUSH_SIZE -
-						  str_len(ctx->cmd));
-			i_assert(len > 0);
-			i_assert(len <= size);
-			data += len;
-			size -= len;
-		}
-		xml_encode_data(ctx->cmd, data, size);
+		/* we're writing to message body */
+		json_encode_data(ctx->cmd, data, size);
 		if (ctx->tokenized_input)
 			str_append_c(ctx->cmd, ' ');
 	} else {
 		if (!ctx->truncate_header) {
-			xml_encode_data(ctx->cur_value, data, size);
+			json_encode_data(ctx->cur_value, data, size);
 			if (ctx->tokenized_input)
 				str_append_c(ctx->cur_value, ' ');
 		}
 		if (ctx->cur_value2 != NULL &&
 		    (!ctx->truncate_header ||
 		     str_len(ctx->cur_value2) < SOLR_HEADER_LINE_MAX_TRUNC_SIZE)) {
-			xml_encode_data(ctx->cur_value2, data, size);
+			json_encode_data(ctx->cur_value2, data, size);
 			if (ctx->tokenized_input)
 				str_append_c(ctx->cur_value2, ' ');
 		}
 	}
 
-	if (str_len(ctx->cmd) >= SOLR_CMDBUF_FLUSH_SIZE) {
-		solr_connection_post_more(ctx->post, str_data(ctx->cmd),
-					  str_len(ctx->cmd));
-		str_truncate(ctx->cmd, 0);
-	}
 	if (!ctx->truncate_header &&
 	    str_len(ctx->cur_value) >= SOLR_HEADER_MAX_SIZE) {
 		/* a large header */
@@ -5,11 +5,14 @@
 #include "http-client.h"
 #include "mail-user.h"
 #include "mail-storage-hooks.h"
+#include "settings-parser.h"
 #include "solr-connection.h"
 #include "fts-user.h"
 #include "fts-solr-plugin.h"
 
 #define DEFAULT_SOLR_BATCH_SIZE 1000
+#define DEFAULT_SOLR_BATCH_BYTES (4*1024*1024)
+#define DEFAULT_SOLR_UPDATE_CONCURRENCY 2
 
 const char *fts_solr_plugin_version = DOVECOT_ABI_VERSION;
 struct http_client *solr_http_client = NULL;
@@ -21,12 +24,14 @@ static int
 fts_solr_plugin_init_settings(struct mail_user *user,
 			      struct fts_solr_settings *set, const char *str)
 {
-	const char *value, *const *tmp;
+	const char *value, *error, *const *tmp;
 
 	if (str == NULL)
 		str = "";
 
 	set->batch_size = DEFAULT_SOLR_BATCH_SIZE;
+	set->batch_bytes = DEFAULT_SOLR_BATCH_BYTES;
+	set->update_concurrency = DEFAULT_SOLR_UPDATE_CONCURRENCY;
 	set->soft_commit = TRUE;
 
 	for (tmp = t_strsplit_spaces(str, " "); *tmp != NULL; tmp++) {
@@ -47,6 +52,20 @@ fts_solr_plugin_init_settings(struct mail_user *user,
 					"fts-solr: batch_size must be a positive integer");
 					return -1;
 			}
+		} else if (str_begins(*tmp, "batch_bytes=", &value)) {
+			if (settings_get_size(value, &set->batch_bytes,
+					      &error) < 0) {
+				e_error(user->event,
+					"fts-solr: Invalid batch_bytes: %s", error);
+				return -1;
+			}
+		} else if (str_begins(*tmp, "update_concurrency=", &value)) {
+			if (str_to_uint(value, &set->update_concurrency) < 0 ||
+			    set->update_concurrency == 0) {
+				e_error(user->event,
+					"fts-solr: update_concurrency must be a positive integer");
+				return -1;
+			}
 		} else if (str_begins(*tmp, "soft_commit=", &value)) {
 			if (strcmp(value, "yes") == 0) {
 				set->soft_commit = TRUE;
@@ -13,6 +13,8 @@
 struct fts_solr_settings {
 	const char *url, *default_ns_prefix, *rawlog_dir;
 	unsigned int batch_size;
+	uoff_t batch_bytes;
+	unsigned int update_concurrency;
 	bool use_libfts;
 	bool debug;
 	bool soft_commit;
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "llist.h"
 #include "hash.h"
 #include "str.h"
 #include "strescape.h"
@@ -35,6 +36,15 @@ struct solr_connection_post {
 	bool failed:1;
 };
 
+struct solr_connection_update {
+	struct solr_connection_update *prev, *next;
+	struct solr_connection *conn;
+
+	struct io *io;
+	struct solr_update_response_parser *parser;
+	char *http_error;
+};
+
 struct solr_connection {
 	struct event *event;
 	char *http_host;
@@ -44,9 +54,21 @@ struct solr_connection {
 	char *http_user;
 	char *http_password;
 
+	/* Update requests that haven't finished yet. The ones whose error
+	   response is still being read are also in parsing_updates. */
+	unsigned int updates_pending;
+	struct solr_connection_update *parsing_updates;
+	unsigned int update_concurrency;
+	/* The HTTP client is moved to update_ioloop while there are update
+	   requests pending. It's run while waiting for them to finish, and
+	   briefly between building the requests. */
+	struct ioloop *update_ioloop;
+	struct ioloop *update_prev_ioloop, *update_prev_client_ioloop;
+
 	bool debug:1;
 	bool posting:1;
 	bool http_ssl:1;
+	bool updates_failed:1;
 };
 
 /* Regardless of the specified URL, make sure path ends in '/' */
@@ -94,11 +116,13 @@ int solr_connection_init(const struct fts_solr_settings *solr_set,
 	}
 
 	conn->debug = solr_set->debug;
+	conn->update_concurrency = solr_set->update_concurrency;
 
 	if (solr_http_client == NULL) {
 		i_zero(&http_set);
 		http_set.max_idle_time_msecs = 5*1000;
-		http_set.max_parallel_connections = 1;
+		http_set.max_parallel_connections =
+			solr_set->update_concurrency;
 		http_set.max_pipelined_requests = 1;
 		http_set.max_redirects = 1;
 		http_set.max_attempts = 3;
@@ -127,6 +151,8 @@ void solr_connection_deinit(struct solr_connection **_conn)
 	struct solr_connection *conn = *_conn;
 
 	*_conn = NULL;
+	i_assert(conn->updates_pending == 0);
+	i_assert(conn->update_ioloop == NULL);
 	event_unref(&conn->event);
 	i_free(conn->http_host);
 	i_free(conn->http_base_url);
@@ -135,6 +161,60 @@ void solr_connection_deinit(struct solr_connection **_conn)
 	i_free(conn);
 }
 
+static void solr_connection_update_ioloop_init(struct solr_connection *conn)
+{
+	conn->update_prev_ioloop = current_ioloop;
+	conn->update_ioloop = io_loop_create();
+	conn->update_prev_client_ioloop =
+		http_client_switch_ioloop(solr_http_client);
+	io_loop_set_current(conn->update_prev_ioloop);
+}
+
+static void solr_connection_update_ioloop_deinit(struct solr_connection *conn)
+{
+	if (conn->update_prev_client_ioloop != NULL)
+		io_loop_set_current(conn->update_prev_client_ioloop);
+	else
+		io_loop_set_current(conn->update_prev_ioloop);
+	(void)http_client_switch_ioloop(solr_http_client);
+	io_loop_set_current(conn->update_ioloop);
+	io_loop_destroy(&conn->update_ioloop);
+}
+
+static void
+solr_connection_update_run(struct solr_connection *conn,
+			   unsigned int max_pending, bool nonblocking)
+{
+	struct timeout *to;
+
+	if (conn->updates_pending <= max_pending &&
+	    conn->parsing_updates == NULL)
+		return;
+
+	/* Like http_client_wait(), but return as soon as there are at most
+	   max_pending requests left, or with nonblocking as soon as the I/O
+	   that is already ready has been handled. The error responses are
+	   read with IOs in update_ioloop, so wait for them to be fully read.
+	   The HTTP client stays in update_ioloop until all the requests have
+	   finished, so a connection that is still being set up isn't moved
+	   between ioloops. */
+	if (conn->update_ioloop == NULL)
+		solr_connection_update_ioloop_init(conn);
+	io_loop_set_current(conn->update_ioloop);
+	to = !nonblocking ? NULL :
+		timeout_add_short(0, io_loop_stop_delayed, conn->update_ioloop);
+	do {
+		io_loop_run(conn->update_ioloop);
+	} while (!nonblocking &&
+		 (conn->updates_pending > max_pending ||
+		  conn->parsing_updates != NULL));
+	timeout_remove(&to);
+	io_loop_set_current(conn->update_prev_ioloop);
+
+	if (conn->updates_pending == 0 && conn->parsing_updates == NULL)
+		solr_connection_update_ioloop_deinit(conn);
+}
+
 static void solr_connection_payload_input(struct solr_lookup_context *lctx)
 {
 	int ret;
@@ -190,6 +270,8 @@ int solr_connection_select(struct solr_connection *conn, const char *query,
 	struct http_client_request *http_req;
 	const char *url;
 
+	solr_connection_update_run(conn, 0, FALSE);
+
 	i_zero(&lctx);
 	lctx.result_pool = pool;
 	lctx.event = conn->event;
@@ -259,6 +341,7 @@ solr_connection_post_begin(struct solr_connection *conn)
 	struct solr_connection_post *post;
 
 	i_assert(!conn->posting);
+	solr_connection_update_run(conn, 0, FALSE);
 	conn->posting = TRUE;
 
 	post = i_new(struct solr_connection_post, 1);
@@ -313,6 +396,7 @@ int solr_connection_post(struct solr_connection *conn, const char *cmd)
 	struct solr_connection_post post;
 
 	i_assert(!conn->posting);
+	solr_connection_update_run(conn, 0, FALSE);
 
 	i_zero(&post);
 	post.conn = conn;
@@ -328,3 +412,134 @@ int solr_connection_post(struct solr_connection *conn, const char *cmd)
 
 	return post.request_status;
 }
+
+static void
+solr_connection_update_finish(struct solr_connection_update *update,
+			      bool success)
+{
+	struct solr_connection *conn = update->conn;
+
+	if (update->parser != NULL) {
+		DLLIST_REMOVE(&conn->parsing_updates, update);
+		solr_update_response_parser_deinit(&update->parser);
+	}
+	io_remove(&update->io);
+	i_free(update->http_error);
+	i_free(update);
+
+	if (!success)
+		conn->updates_failed = TRUE;
+	i_assert(conn->updates_pending > 0);
+	conn->updates_pending--;
+	if (conn->update_ioloop != NULL)
+		io_loop_stop(conn->update_ioloop);
+}
+
+static void
+solr_connection_update_payload_input(struct solr_connection_update *update)
+{
+	struct solr_connection *conn = update->conn;
+	const char *error_msg, *error;
+	int ret;
+
+	ret = solr_update_response_parse(update->parser, &error_msg, &error);
+	if (ret == 0) {
+		/* we will be called again for more data */
+		return;
+	}
+	if (ret < 0) {
+		e_debug(conn->event, "fts-solr: "
+			"Invalid update response from HTTP server: %s", error);
+		error_msg = NULL;
+	}
+	if (error_msg == NULL) {
+		e_error(conn->event, "fts-solr: Indexing failed: %s",
+			update->http_error);
+	} else {
+		e_error(conn->event, "fts-solr: Indexing failed: %s: %s",
+			update->http_error, error_msg);
+	}
+	solr_connection_update_finish(update, FALSE);
+}
+
+static void
+solr_connection_update_json_response(const struct http_response *response,
+				     struct solr_connection_update *update)
+{
+	struct solr_connection *conn = update->conn;
+
+	if (response->status / 100 == 2) {
+		solr_connection_update_finish(update, TRUE);
+		return;
+	}
+	if (response->payload == NULL) {
+		e_error(conn->event, "fts-solr: Indexing failed: %s",
+			http_response_get_message(response));
+		solr_connection_update_finish(update, FALSE);
+		return;
+	}
+
+	/* Solr's error message is in the response payload */
+	update->http_error = i_strdup(http_response_get_message(response));
+	update->parser = solr_update_response_parser_init(response->payload);
+	DLLIST_PREPEND(&conn->parsing_updates, update);
+	update->io = io_add_istream(response->payload,
+				    solr_connection_update_payload_input,
+				    update);
+	solr_connection_update_payload_input(update);
+}
+
+unsigned int solr_connection_update_poll(struct solr_connection *conn)
+{
+	solr_connection_update_run(conn, 0, TRUE);
+	return conn->updates_pending;
+}
+
+void solr_connection_update(struct solr_connection *conn, const string_t *json)
+{
+	struct solr_connection_update *update;
+	struct http_client_request *http_req;
+	struct istream *payload;
+	const char *url;
+
+	i_assert(!conn->posting);
+
+	solr_connection_update_run(conn, conn->update_concurrency - 1, FALSE);
+	if (conn->update_ioloop == NULL)
+		solr_connection_update_ioloop_init(conn);
+
+	update = i_new(struct solr_connection_update, 1);
+	update->conn = conn;
+
+	url = t_strconcat(conn->http_base_url, "update?wt=json", NULL);
+	http_req = http_client_request(solr_http_client, "POST",
+				       conn->http_host, url,
+				       solr_connection_update_json_response,
+				       update);
+	if (conn->http_user != NULL) {
+		http_client_request_set_auth_simple(
+			http_req, conn->http_user, conn->http_password);
+	}
+	http_client_request_set_port(http_req, conn->http_port);
+	http_client_request_set_ssl(http_req, conn->http_ssl);
+	http_client_request_add_header(http_req, "Content-Type",
+				       "application/json");
+
+	/* the caller reuses the string for the next request */
+	payload = i_stream_create_copy_from_string(json);
+	http_client_request_set_payload(http_req, payload, FALSE);
+	i_stream_unref(&payload);
+
+	conn->updates_pending++;
+	http_client_request_submit(http_req);
+}
+
+int solr_connection_update_flush(struct solr_connection *conn)
+{
+	int ret;
+
+	solr_connection_update_run(conn, 0, FALSE);
+	ret = conn->updates_failed ? -1 : 0;
+	conn->updates_failed = FALSE;
+	return ret;
+}
@@ -23,4 +23,16 @@ void solr_connection_post_more(struct solr_connection_post *post,
 			       const unsigned char *data, size_t size);
 int solr_connection_post_end(struct solr_connection_post **post);
 
+/* Send a JSON update request without waiting for its response. At most
+   update_concurrency requests are sent concurrently, so this may need to
+   wait for one of the earlier requests to finish first. */
+void solr_connection_update(struct solr_connection *conn, const string_t *json);
+/* Handle the update requests' I/O that is ready, without waiting for more.
+   This lets the requests progress while the next batch is being built.
+   Returns the number of update requests that are still pending. */
+unsigned int solr_connection_update_poll(struct solr_connection *conn);
+/* Wait for all the update requests to finish. Returns 0 if all of them
+   succeeded since the last call, -1 if any of them failed. */
+int solr_connection_update_flush(struct solr_connection *conn);
+
 #endif
@@ -5,6 +5,7 @@
 #include "hash.h"
 #include "str.h"
 #include "istream.h"
+#include "json-parser.h"
 #include "solr-response.h"
 
 #include <expat.h>
@@ -51,6 +52,23 @@ struct solr_response_parser {
 	bool xml_failed:1;
 };
 
+enum solr_update_response_section {
+	SOLR_UPDATE_RESPONSE_SECTION_NONE = 0,
+	SOLR_UPDATE_RESPONSE_SECTION_ERROR
+};
+
+struct solr_update_response_parser {
+	struct json_parser *json_parser;
+
+	/* the last object key */
+	string_t *key;
+	/* nesting level: the members of the root object are at 0 */
+	unsigned int depth;
+	enum solr_update_response_section section;
+
+	char *error_msg;
+};
+
 static int
 solr_xml_parse(struct solr_response_parser *parser,
 	       const void *data, size_t size, bool done)
@@ -378,3 +396,91 @@ int solr_response_parse(struct solr_response_parser *parser,
 	*box_results_r = array_front_modifiable(&parser->results);
 	return (ret == 0 ? 1 : -1);
 }
+
+struct solr_update_response_parser *
+solr_update_response_parser_init(struct istream *input)
+{
+	struct solr_update_response_parser *parser;
+
+	parser = i_new(struct solr_update_response_parser, 1);
+	parser->json_parser = json_parser_init(input);
+	parser->key = str_new(default_pool, 32);
+	return parser;
+}
+
+void solr_update_response_parser_deinit(
+	struct solr_update_response_parser **_parser)
+{
+	struct solr_update_response_parser *parser = *_parser;
+	const char *error;
+
+	*_parser = NULL;
+
+	if (parser == NULL)
+		return;
+
+	if (parser->json_parser != NULL)
+		(void)json_parser_deinit(&parser->json_parser, &error);
+	str_free(&parser->key);
+	i_free(parser->error_msg);
+	i_free(parser);
+}
+
+static void
+solr_update_response_parse_value(struct solr_update_response_parser *parser,
+				 enum json_type type, const char *value)
+{
+	switch (type) {
+	case JSON_TYPE_OBJECT_KEY:
+		str_truncate(parser->key, 0);
+		str_append(parser->key, value);
+		break;
+	case JSON_TYPE_OBJECT:
+	case JSON_TYPE_ARRAY:
+		if (parser->depth++ == 0 && type == JSON_TYPE_OBJECT &&
+		    strcmp(str_c(parser->key), "error") == 0)
+			parser->section = SOLR_UPDATE_RESPONSE_SECTION_ERROR;
+		str_truncate(parser->key, 0);
+		break;
+	case JSON_TYPE_OBJECT_END:
+	case JSON_TYPE_ARRAY_END:
+		i_assert(parser->depth > 0);
+		if (--parser->depth == 0)
+			parser->section = SOLR_UPDATE_RESPONSE_SECTION_NONE;
+		break;
+	case JSON_TYPE_STRING:
+		/* {"error":{"msg":"..."}} */
+		if (parser->depth == 1 &&
+		    parser->section == SOLR_UPDATE_RESPONSE_SECTION_ERROR &&
+		    strcmp(str_c(parser->key), "msg") == 0 &&
+		    parser->error_msg == NULL)
+			parser->error_msg = i_strdup(value);
+		break;
+	default:
+		break;
+	}
+}
+
+int solr_update_response_parse(struct solr_update_response_parser *parser,
+			       const char **error_msg_r, const char **error_r)
+{
+	enum json_type type;
+	const char *value;
+	int ret;
+
+	*error_msg_r = NULL;
+	i_assert(parser->json_parser != NULL);
+
+	while ((ret = json_parse_next(parser->json_parser,
+				      &type, &value)) > 0)
+		solr_update_response_parse_value(parser, type, value);
+	if (ret == 0) {
+		/* we will be called again for more data */
+		return 0;
+	}
+
+	if (json_parser_deinit(&parser->json_parser, error_r) < 0)
+		return -1;
+	*error_msg_r = parser->error_msg;
+	return 1;
+}
@@ -5,6 +5,7 @@
 #include "fts-api.h"
 
 struct solr_response_parser;
+struct solr_update_response_parser;
 
 struct solr_result {
 	const char *box_id;
@@ -21,4 +22,17 @@ void solr_response_parser_deinit(struct solr_response_parser **_parser);
 int solr_response_parse(struct solr_response_parser *parser,
 			struct solr_result ***box_results_r);
 
+/* Parser for the JSON responses to update requests. */
+struct solr_update_response_parser *
+solr_update_response_parser_init(struct istream *input);
+void solr_update_response_parser_deinit(
+	struct solr_update_response_parser **_parser);
+
+/* Returns 1 once the whole response is parsed, 0 if more input is needed and
+   -1 if the response is invalid. *error_msg_r is set to the error message
+   returned by Solr, or NULL if there was none. It's valid until the parser
+   is deinitialized. */
+int solr_update_response_parse(struct solr_update_response_parser *parser,
+			       const char **error_msg_r, const char **error_r);
+
 #endif
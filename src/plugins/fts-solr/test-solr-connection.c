@@ -0,0 +1,327 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "strnum.h"
+#include "write-full.h"
+#include "hostpid.h"
+#include "ioloop.h"
+#include "net.h"
+#include "http-client.h"
+#include "test-common.h"
+#include "test-subprocess.h"
+#include "fts-solr-plugin.h"
+#include "solr-connection.h"
+
+#include <unistd.h>
+#include <sys/signal.h>
+
+#define SERVER_KILL_TIMEOUT_SECS 20
+/* If the server doesn't receive the expected number of concurrent requests
+   within this time, it fails the ones it has. */
+#define SERVER_CONCURRENCY_TIMEOUT_MSECS 2000
+
+#define SERVER_RESPONSE_OK_BODY \
+	"{\"responseHeader\":{\"status\":0}}"
+#define SERVER_RESPONSE_FAIL_BODY \
+	"{\"error\":{\"msg\":\"ERROR: unknown field 'fail'\",\"code\":400}}"
+
+struct http_client *solr_http_client = NULL;
+
+static struct ip_addr bind_ip;
+static in_port_t bind_port;
+static int fd_listen = -1;
+static bool debug = FALSE;
+
+static struct io *io_listen;
+static struct timeout *to_server;
+static unsigned int server_concurrency;
+
+/*
+ * Server
+ */
+
+struct test_server_request {
+	int fd;
+	bool fail;
+};
+static ARRAY(struct test_server_request) server_requests;
+
+static bool test_server_read_request(int fd, bool *fail_r)
+{
+	string_t *str = t_str_new(256);
+	const char *p, *body;
+	unsigned char buf[1024];
+	unsigned int content_length;
+	ssize_t ret;
+
+	/* read the headers */
+	while ((p = strstr(str_c(str), "\r\n\r\n")) == NULL) {
+		if ((ret = read(fd, buf, sizeof(buf))) <= 0)
+			return FALSE;
+		str_append_data(str, buf, ret);
+	}
+	body = p + 4;
+	p = strstr(str_c(str), "Content-Length: ");
+	if (p == NULL || str_parse_uint(p + 16, &content_length, &p) < 0)
+		i_fatal("Content-Length missing from request");
+	i_assert(strstr(str_c(str), "POST /solr/update?wt=json ") != NULL);
+
+	/* read the body */
+	size_t body_pos = body - str_c(str);
+	while (str_len(str) - body_pos < content_length) {
+		if ((ret = read(fd, buf, sizeof(buf))) <= 0)
+			return FALSE;
+		str_append_data(str, buf, ret);
+	}
+	*fail_r = strstr(str_c(str) + body_pos, "fail") != NULL;
+	return TRUE;
+}
+
+static void test_server_respond(bool timeout)
+{
+	struct test_server_request *request;
+	const char *response;
+
+	timeout_remove(&to_server);
+	array_foreach_modifiable(&server_requests, request) {
+		if (timeout) {
+			response = "HTTP/1.1 500 Requests Not Concurrent\r\n"
+				"Connection: close\r\n"
+				"Content-Length: 0\r\n\r\n";
+		} else if (request->fail) {
+			response = t_strdup_printf(
+				"HTTP/1.1 400 Bad Request\r\n"
+				"Connection: close\r\n"
+				"Content-Type: application/json\r\n"
+				"Content-Length: %zu\r\n\r\n%s",
+				strlen(SERVER_RESPONSE_FAIL_BODY),
+				SERVER_RESPONSE_FAIL_BODY);
+		} else {
+			response = t_strdup_printf(
+				"HTTP/1.1 200 OK\r\n"
+				"Connection: close\r\n"
+				"Content-Type: application/json\r\n"
+				"Content-Length: %zu\r\n\r\n%s",
+				strlen(SERVER_RESPONSE_OK_BODY),
+				SERVER_RESPONSE_OK_BODY);
+		}
+		if (write_full(request->fd, response, strlen(response)) < 0)
+			i_fatal("write() failed: %m");
+		i_close_fd(&request->fd);
+	}
+	array_clear(&server_requests);
+}
+
+static void test_server_timeout(void *context ATTR_UNUSED)
+{
+	test_server_respond(TRUE);
+}
+
+static void test_server_accept(void *context ATTR_UNUSED)
+{
+	struct test_server_request request;
+
+	i_zero(&request);
+	request.fd = net_accept(fd_listen, NULL, NULL);
+	if (request.fd == -1)
+		return;
+	if (request.fd < 0)
+		i_fatal("accept() failed: %m");
+	/* the requests are small, so just read them blocking */
+	fd_set_nonblock(request.fd, FALSE);
+	if (!test_server_read_request(request.fd, &request.fail)) {
+		i_close_fd(&request.fd);
+		return;
+	}
+	array_push_back(&server_requests, &request);
+
+	/* Hold the responses until the expected number of requests are
+	   being sent concurrently. */
+	if (array_count(&server_requests) == server_concurrency)
+		test_server_respond(FALSE);
+	else if (to_server == NULL) {
+		to_server = timeout_add(SERVER_CONCURRENCY_TIMEOUT_MSECS,
+					test_server_timeout, NULL);
+	}
+}
+
+static int test_run_server(void *context ATTR_UNUSED)
+{
+	struct ioloop *ioloop;
+
+	i_set_failure_prefix("SERVER: ");
+	if (debug)
+		i_debug("PID=%s", my_pid);
+	test_subprocess_notify_signal_send_parent(SIGHUP);
+
+	ioloop = io_loop_create();
+	i_array_init(&server_requests, server_concurrency);
+	io_listen = io_add(fd_listen, IO_READ, test_server_accept, NULL);
+	io_loop_run(ioloop);
+
+	io_remove(&io_listen);
+	test_server_respond(TRUE);
+	array_free(&server_requests);
+	io_loop_destroy(&ioloop);
+	return 0;
+}
+
+/*
+ * Client
+ */
+
+static struct solr_connection *
+test_client_init(unsigned int concurrency, unsigned int concurrency_wait)
+{
+	struct fts_solr_settings set;
+	struct solr_connection *conn;
+	const char *error;
+
+	fd_listen = net_listen(&bind_ip, &bind_port, 128);
+	if (fd_listen == -1)
+		i_fatal("listen(%s) failed: %m", net_ip2addr(&bind_ip));
+	test_subprocess_notify_signal_reset(SIGHUP);
+	server_concurrency = concurrency_wait;
+	test_subprocess_fork(test_run_server, (void *)NULL, FALSE);
+	i_close_fd(&fd_listen);
+	test_subprocess_notify_signal_wait(SIGHUP, 10000);
+
+	i_zero(&set);
+	set.url = t_strdup_printf("http://%s:%u/solr/",
+				  net_ip2addr(&bind_ip), bind_port);
+	set.update_concurrency = concurrency;
+	set.debug = debug;
+	if (solr_connection_init(&set, NULL, NULL, &conn, &error) < 0)
+		i_fatal("solr_connection_init() failed: %s", error);
+	return conn;
+}
+
+static void test_client_deinit(struct solr_connection **_conn)
+{
+	solr_connection_deinit(_conn);
+	http_client_deinit(&solr_http_client);
+	test_subprocess_kill_all(SERVER_KILL_TIMEOUT_SECS);
+	bind_port = 0;
+}
+
+static void test_client_update(struct solr_connection *conn, const char *json)
+{
+	string_t *str = t_str_new(64);
+
+	str_append(str, json);
+	solr_connection_update(conn, str);
+}
+
+static void test_solr_connection_update_concurrency(void)
+{
+	struct ioloop *ioloop = io_loop_create();
+	struct solr_connection *conn;
+
+	test_begin("solr connection update concurrency");
+	conn = test_client_init(2, 2);
+	test_client_update(conn, "[{\"id\":\"1\"}]");
+	test_client_update(conn, "[{\"id\":\"2\"}]");
+	test_client_update(conn, "[{\"id\":\"3\"}]");
+	test_client_update(conn, "[{\"id\":\"4\"}]");
+	test_assert(solr_connection_update_flush(conn) == 0);
+	test_client_deinit(&conn);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_solr_connection_update_failure(void)
+{
+	struct ioloop *ioloop = io_loop_create();
+	struct solr_connection *conn;
+
+	test_begin("solr connection update failure");
+	conn = test_client_init(2, 2);
+	test_client_update(conn, "[{\"id\":\"1\"}]");
+	test_expect_error_string("Indexing failed: 400 Bad Request: "
+				 "ERROR: unknown field 'fail'");
+	test_client_update(conn, "[{\"id\":\"2\",\"fail\":\"\"}]");
+	test_assert(solr_connection_update_flush(conn) == -1);
+	test_expect_no_more_errors();
+
+	/* the failure is reported only once */
+	test_client_update(conn, "[{\"id\":\"3\"}]");
+	test_client_update(conn, "[{\"id\":\"4\"}]");
+	test_assert(solr_connection_update_flush(conn) == 0);
+	test_client_deinit(&conn);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_solr_connection_update_serial(void)
+{
+	struct ioloop *ioloop = io_loop_create();
+	struct solr_connection *conn;
+
+	test_begin("solr connection update serial");
+	conn = test_client_init(1, 1);
+	test_client_update(conn, "[{\"id\":\"1\"}]");
+	test_client_update(conn, "[{\"id\":\"2\"}]");
+	test_assert(solr_connection_update_flush(conn) == 0);
+	test_client_deinit(&conn);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_solr_connection_update_poll(void)
+{
+	struct ioloop *ioloop = io_loop_create();
+	struct solr_connection *conn;
+	unsigned int i;
+
+	test_begin("solr connection update poll");
+	conn = test_client_init(2, 1);
+	test_client_update(conn, "[{\"id\":\"1\"}]");
+	/* the request finishes without waiting for it */
+	for (i = 0; i < 1000; i++) {
+		if (solr_connection_update_poll(conn) == 0)
+			break;
+		usleep(10000);
+	}
+	test_assert(solr_connection_update_poll(conn) == 0);
+	test_assert(solr_connection_update_flush(conn) == 0);
+	test_client_deinit(&conn);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+int main(int argc, char *argv[])
+{
+	static void (*const test_functions[])(void) = {
+		test_solr_connection_update_concurrency,
+		test_solr_connection_update_failure,
+		test_solr_connection_update_serial,
+		test_solr_connection_update_poll,
+		NULL
+	};
+	int c, ret;
+
+	lib_init();
+	while ((c = getopt(argc, argv, "D")) > 0) {
+		switch (c) {
+		case 'D':
+			debug = TRUE;
+			break;
+		default:
+			i_fatal("Usage: %s [-D]", argv[0]);
+		}
+	}
+
+	test_subprocesses_init(debug);
+
+	/* listen on localhost */
+	i_zero(&bind_ip);
+	bind_ip.family = AF_INET;
+	bind_ip.u.ip4.s_addr = htonl(INADDR_LOOPBACK);
+
+	ret = test_run(test_functions);
+
+	test_subprocesses_deinit();
+	lib_deinit();
+	return ret;
+}
@@ -243,6 +243,74 @@ static void test_solr_response_parser(void)
 	event_unref(&event);
 }
 
+static const struct {
+	const char *input;
+	int ret;
+	const char *error_msg;
+} update_tests[] = {
+	{ "{\"responseHeader\":{\"status\":0,\"QTime\":12}}\n", 1, NULL },
+	{ "{\"responseHeader\":{\"status\":400,\"QTime\":1},"
+	  "\"error\":{\"metadata\":[\"error-class\","
+	  "\"org.apache.solr.common.SolrException\"],"
+	  "\"msg\":\"ERROR: [doc=1/abc] unknown field 'foo'\","
+	  "\"code\":400}}\n", 1, "ERROR: [doc=1/abc] unknown field 'foo'" },
+	{ "{\"error\":{\"code\":500,\"trace\":{\"msg\":\"nested\"}}}", 1, NULL },
+	{ "{\"msg\":\"not an error\",\"error\":{\"msg\":\"a \\\"quoted\\\" msg\"}}",
+	  1, "a \"quoted\" msg" },
+	{ "<html><body>Bad Gateway</body></html>", -1, NULL },
+	{ "{\"responseHeader\":{\"status\":0", -1, NULL },
+};
+
+static void
+test_solr_update_response_parse(const char *text, unsigned int text_len,
+				bool trickle, int expected_ret,
+				const char *expected_error_msg)
+{
+	struct solr_update_response_parser *parser;
+	struct istream *input;
+	const char *error_msg, *error = NULL;
+	unsigned int pos;
+	int ret = 0;
+
+	input = test_istream_create_data(text, text_len);
+	parser = solr_update_response_parser_init(input);
+	if (!trickle)
+		ret = solr_update_response_parse(parser, &error_msg, &error);
+	else {
+		for (pos = 0; pos <= text_len && ret == 0; pos++) {
+			test_istream_set_size(input, pos);
+			ret = solr_update_response_parse(parser, &error_msg,
+							 &error);
+		}
+	}
+	test_assert(ret == expected_ret);
+	if (ret > 0)
+		test_assert_strcmp(error_msg, expected_error_msg);
+	else if (ret < 0)
+		test_assert(error != NULL);
+	solr_update_response_parser_deinit(&parser);
+	i_stream_unref(&input);
+}
+
+static void test_solr_update_response_parser(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(update_tests); i++) T_BEGIN {
+		const char *text = update_tests[i].input;
+		unsigned int text_len = strlen(text);
+
+		test_begin(t_strdup_printf("solr update response [%u]", i));
+		test_solr_update_response_parse(text, text_len, FALSE,
+						update_tests[i].ret,
+						update_tests[i].error_msg);
+		test_solr_update_response_parse(text, text_len, TRUE,
+						update_tests[i].ret,
+						update_tests[i].error_msg);
+		test_end();
+	} T_END;
+}
+
 static void test_solr_response_file(const char *file)
 {
 	struct event *event = event_create(NULL);
@@ -273,6 +341,7 @@ int main(int argc, char *argv[])
 
 	static void (*test_functions[])(void) = {
 		test_solr_response_parser,
+		test_solr_update_response_parser,
 		NULL
 	};
 
@@ -32,6 +32,8 @@ enum fts_backend_build_key_type {
 struct fts_backend_build_key {
 	uint32_t uid;
 	enum fts_backend_build_key_type type;
+	/* NULL if the mail was tokenized in a separate process
+	   (fts_index_processes) */
 	struct message_part *part;
 
 	/* for _KEY_HDR: */
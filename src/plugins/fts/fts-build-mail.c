@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "istream.h"
 #include "buffer.h"
+#include "numpack.h"
 #include "str.h"
 #include "rfc822-parser.h"
 #include "message-address.h"
@@ -25,8 +26,39 @@
    wherever */
 #define MAX_WORD_SIZE 1024
 
+/* Operations written by fts_build_mail_record() and
+   fts_build_mail_tokenize() */
+enum fts_build_op {
+	/* uid, type, flags, [hdr_name], [content_type], [disposition] */
+	FTS_BUILD_OP_KEY = 1,
+	FTS_BUILD_OP_UNSET,
+	/* size, data */
+	FTS_BUILD_OP_DATA,
+	FTS_BUILD_OP_DATA_LAST,
+	FTS_BUILD_OP_TOKEN,
+	/* ret + 1 */
+	FTS_BUILD_OP_END,
+};
+
+enum fts_build_op_key_flags {
+	FTS_BUILD_OP_KEY_FLAG_HDR_NAME		= 0x01,
+	FTS_BUILD_OP_KEY_FLAG_CONTENT_TYPE	= 0x02,
+	FTS_BUILD_OP_KEY_FLAG_DISPOSITION	= 0x04,
+};
+
+struct fts_build_op_rec {
+	enum fts_build_op op;
+	struct fts_backend_build_key key;
+	const unsigned char *data;
+	size_t size;
+	int ret;
+};
+
 struct fts_mail_build_context {
+	/* NULL when tokenizing a recorded mail */
 	struct mail *mail;
+	struct mailbox *box;
+	uint32_t uid;
 	struct fts_backend_update_context *update_ctx;
 
 	char *content_type, *content_disposition;
@@ -34,11 +66,168 @@ struct fts_mail_build_context {
 
 	buffer_t *word_buf, *pending_input;
 	struct fts_user_language *cur_user_lang;
+
+	/* If set, the build keys and the text are written here instead of
+	   being tokenized and sent to the backend. */
+	buffer_t *record;
+	/* If set, the build keys and the tokens are written here instead of
+	   being sent to the backend. */
+	buffer_t *tokens;
+	bool record_key_open;
 };
 
 static int fts_build_data(struct fts_mail_build_context *ctx,
 			  const unsigned char *data, size_t size, bool last);
 
+static void fts_build_op_append_str(buffer_t *dest, const char *str)
+{
+	buffer_append(dest, str, strlen(str) + 1);
+}
+
+static void
+fts_build_op_append_key(buffer_t *dest, const struct fts_backend_build_key *key)
+{
+	enum fts_build_op_key_flags flags = 0;
+
+	if (key->hdr_name != NULL)
+		flags |= FTS_BUILD_OP_KEY_FLAG_HDR_NAME;
+	if (key->body_content_type != NULL)
+		flags |= FTS_BUILD_OP_KEY_FLAG_CONTENT_TYPE;
+	if (key->body_content_disposition != NULL)
+		flags |= FTS_BUILD_OP_KEY_FLAG_DISPOSITION;
+
+	buffer_append_c(dest, FTS_BUILD_OP_KEY);
+	numpack_encode(dest, key->uid);
+	buffer_append_c(dest, key->type);
+	buffer_append_c(dest, flags);
+	if (key->hdr_name != NULL)
+		fts_build_op_append_str(dest, key->hdr_name);
+	if (key->body_content_type != NULL)
+		fts_build_op_append_str(dest, key->body_content_type);
+	if (key->body_content_disposition != NULL)
+		fts_build_op_append_str(dest, key->body_content_disposition);
+}
+
+static void
+fts_build_op_append_data(buffer_t *dest, enum fts_build_op op,
+			 const void *data, size_t size)
+{
+	buffer_append_c(dest, op);
+	numpack_encode(dest, size);
+	buffer_append(dest, data, size);
+}
+
+static void fts_build_op_append_end(buffer_t *dest, int ret)
+{
+	i_assert(ret >= -1 && ret <= 1);
+
+	buffer_append_c(dest, FTS_BUILD_OP_END);
+	buffer_append_c(dest, ret + 1);
+}
+
+static bool
+fts_build_op_read_str(const unsigned char **p, const unsigned char *end,
+		      const char **str_r)
+{
+	const unsigned char *nul = memchr(*p, '\0', end - *p);
+
+	if (nul == NULL)
+		return FALSE;
+	*str_r = (const char *)*p;
+	*p = nul + 1;
+	return TRUE;
+}
+
+static bool
+fts_build_op_read(const unsigned char **p, const unsigned char *end,
+		  struct fts_build_op_rec *rec_r)
+{
+	uint64_t num;
+	uint8_t flags;
+
+	i_zero(rec_r);
+	if (*p == end)
+		return FALSE;
+	rec_r->op = *(*p)++;
+	switch (rec_r->op) {
+	case FTS_BUILD_OP_KEY:
+		if (numpack_decode32(p, end, &rec_r->key.uid) < 0 ||
+		    end - *p < 2)
+			return FALSE;
+		rec_r->key.type = *(*p)++;
+		flags = *(*p)++;
+		if ((flags & FTS_BUILD_OP_KEY_FLAG_HDR_NAME) != 0 &&
+		    !fts_build_op_read_str(p, end, &rec_r->key.hdr_name))
+			return FALSE;
+		if ((flags & FTS_BUILD_OP_KEY_FLAG_CONTENT_TYPE) != 0 &&
+		    !fts_build_op_read_str(p, end,
+					   &rec_r->key.body_content_type))
+			return FALSE;
+		if ((flags & FTS_BUILD_OP_KEY_FLAG_DISPOSITION) != 0 &&
+		    !fts_build_op_read_str(p, end,
+					   &rec_r->key.body_content_disposition))
+			return FALSE;
+		return TRUE;
+	case FTS_BUILD_OP_UNSET:
+		return TRUE;
+	case FTS_BUILD_OP_DATA:
+	case FTS_BUILD_OP_DATA_LAST:
+	case FTS_BUILD_OP_TOKEN:
+		if (numpack_decode(p, end, &num) < 0 ||
+		    num > (size_t)(end - *p))
+			return FALSE;
+		rec_r->data = *p;
+		rec_r->size = num;
+		*p += num;
+		return TRUE;
+	case FTS_BUILD_OP_END:
+		if (*p == end || **p > 2)
+			return FALSE;
+		rec_r->ret = *(*p)++ - 1;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+static bool fts_build_set_build_key(struct fts_mail_build_context *ctx,
+				    const struct fts_backend_build_key *key)
+{
+	if (ctx->record == NULL)
+		return fts_backend_update_set_build_key(ctx->update_ctx, key);
+
+	fts_build_op_append_key(ctx->record, key);
+	ctx->record_key_open = TRUE;
+	return TRUE;
+}
+
+static void fts_build_unset_build_key(struct fts_mail_build_context *ctx)
+{
+	if (ctx->record == NULL)
+		fts_backend_update_unset_build_key(ctx->update_ctx);
+	else if (ctx->record_key_open) {
+		buffer_append_c(ctx->record, FTS_BUILD_OP_UNSET);
+		ctx->record_key_open = FALSE;
+	}
+}
+
+static void ATTR_FORMAT(2, 3)
+fts_build_set_critical(struct fts_mail_build_context *ctx,
+		       const char *fmt, ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	T_BEGIN {
+		const char *msg = t_strdup_vprintf(fmt, args);
+
+		if (ctx->mail != NULL)
+			mail_set_critical(ctx->mail, "%s", msg);
+		else
+			mailbox_set_critical(ctx->box, "UID=%u: %s", ctx->uid, msg);
+	} T_END;
+	va_end(args);
+}
+
 static void fts_build_parse_content_type(struct fts_mail_build_context *ctx,
 					 const struct message_header_line *hdr)
 {
@@ -108,6 +297,10 @@ fts_build_unstructured_header(struct fts_mail_build_context *ctx,
 static void fts_mail_build_ctx_set_lang(struct fts_mail_build_context *ctx,
 					struct fts_user_language *user_lang)
 {
+	if (ctx->record != NULL) {
+		/* the language is chosen only when tokenizing */
+		return;
+	}
 	i_assert(user_lang != NULL);
 
 	ctx->cur_user_lang = user_lang;
@@ -119,14 +312,14 @@ static void fts_mail_build_ctx_set_lang(struct fts_mail_build_context *ctx,
 
 static void
 fts_build_tokenized_hdr_update_lang(struct fts_mail_build_context *ctx,
-				    const struct message_header_line *hdr)
+				    const char *hdr_name)
 {
 	/* Headers that don't contain any human language will only be
 	   translated to lowercase - no stemming or other filtering. There's
 	   unfortunately no pefect way of detecting which headers contain
 	   human languages, so we check with fts_header_has_language if the
 	   header is something that's supposed to containing human text. */
-	if (fts_header_has_language(hdr->name))
+	if (fts_header_has_language(hdr_name))
 		ctx->cur_user_lang = NULL;
 	else {
 		fts_mail_build_ctx_set_lang(ctx,
@@ -155,9 +348,9 @@ static int fts_build_mail_header(struct fts_mail_build_context *ctx,
 
 	if ((ctx->update_ctx->backend->flags &
 	     FTS_BACKEND_FLAG_TOKENIZED_INPUT) != 0)
-		fts_build_tokenized_hdr_update_lang(ctx, hdr);
+		fts_build_tokenized_hdr_update_lang(ctx, hdr->name);
 
-	if (!fts_backend_update_set_build_key(ctx->update_ctx, &key))
+	if (!fts_build_set_build_key(ctx, &key))
 		return 0;
 
 	if (!message_header_is_address(hdr->name)) {
@@ -187,7 +380,7 @@ static int fts_build_mail_header(struct fts_mail_build_context *ctx,
 		fts_mail_build_ctx_set_lang(ctx,
 			fts_user_get_data_lang(ctx->update_ctx->backend->ns->user));
 		key.hdr_name = "";
-		if (fts_backend_update_set_build_key(ctx->update_ctx, &key)) {
+		if (fts_build_set_build_key(ctx, &key)) {
 			if (fts_build_data(ctx, (const void *)hdr->name,
 					   strlen(hdr->name), TRUE) < 0)
 				ret = -1;
@@ -250,7 +443,7 @@ fts_build_body_begin(struct fts_mail_build_context *ctx,
 	key.body_content_type = parser_context.content_type;
 	key.body_content_disposition = ctx->content_disposition;
 	ctx->cur_user_lang = NULL;
-	if (!fts_backend_update_set_build_key(ctx->update_ctx, &key)) {
+	if (!fts_build_set_build_key(ctx, &key)) {
 		if (ctx->body_parser != NULL)
 			(void)fts_parser_deinit(&ctx->body_parser, NULL);
 		event_unref(&parser_context.event);
@@ -275,15 +468,19 @@ fts_build_add_tokens_with_filter(struct fts_mail_build_context *ctx,
 		if (ret2 > 0 && filter != NULL)
 			ret2 = fts_filter_filter(filter, &token, &error);
 		if (ret2 < 0) {
-			mail_set_critical(ctx->mail,
+			fts_build_set_critical(ctx,
 				"fts: Couldn't create indexable tokens: %s",
 				error);
 		}
-		if (ret2 > 0) {
+		if (ret2 > 0 && ctx->tokens != NULL) {
+			fts_build_op_append_data(ctx->tokens,
+						 FTS_BUILD_OP_TOKEN,
+						 token, strlen(token));
+		} else if (ret2 > 0) {
 			if (fts_backend_update_build_more(ctx->update_ctx,
 							  (const void *)token,
 							  strlen(token)) < 0) {
-				mail_storage_set_internal_error(ctx->mail->box->storage);
+				mail_storage_set_internal_error(ctx->box->storage);
 				ret = -1;
 			}
 		}
@@ -321,7 +518,7 @@ fts_detect_language(struct fts_mail_build_context *ctx,
 	case FTS_LANGUAGE_RESULT_ERROR:
 		/* internal language detection library failure
 		   (e.g. invalid config). don't index anything. */
-		mail_set_critical(ctx->mail,
+		fts_build_set_critical(ctx,
 			"Language detection library initialization failed: %s",
 			error);
 		return -1;
@@ -424,8 +621,13 @@ fts_build_full_words(struct fts_mail_build_context *ctx,
 static int fts_build_data(struct fts_mail_build_context *ctx,
 			  const unsigned char *data, size_t size, bool last)
 {
-	if ((ctx->update_ctx->backend->flags &
-	     FTS_BACKEND_FLAG_TOKENIZED_INPUT) != 0) {
+	if (ctx->record != NULL) {
+		fts_build_op_append_data(ctx->record, last ?
+					 FTS_BUILD_OP_DATA_LAST :
+					 FTS_BUILD_OP_DATA, data, size);
+		return 0;
+	} else if ((ctx->update_ctx->backend->flags &
+		    FTS_BACKEND_FLAG_TOKENIZED_INPUT) != 0) {
 		return fts_build_tokenized(ctx, data, size, last);
 	} else if ((ctx->update_ctx->backend->flags &
 		    FTS_BACKEND_FLAG_BUILD_FULL_WORDS) != 0) {
@@ -566,7 +768,7 @@ is_header_indexable(const char *header_name, struct fts_backend *backend)
 
 static int
 fts_build_mail_real(struct fts_backend_update_context *update_ctx,
-		    struct mail *mail,
+		    struct mail *mail, buffer_t *record,
 		    const char **retriable_err_msg_r,
 		    bool *may_need_retry_r)
 {
@@ -596,6 +798,9 @@ fts_build_mail_real(struct fts_backend_update_context *update_ctx,
 	i_zero(&ctx);
 	ctx.update_ctx = update_ctx;
 	ctx.mail = mail;
+	ctx.box = mail->box;
+	ctx.uid = mail->uid;
+	ctx.record = record;
 	if ((update_ctx->backend->flags & FTS_BACKEND_FLAG_TOKENIZED_INPUT) != 0)
 		ctx.pending_input = buffer_create_dynamic(default_pool, 128);
 
@@ -628,7 +833,7 @@ fts_build_mail_real(struct fts_backend_update_context *update_ctx,
 				}
 			}
 			message_decoder_set_return_binary(decoder, FALSE);
-			fts_backend_update_unset_build_key(update_ctx);
+			fts_build_unset_build_key(&ctx);
 			prev_part = raw_block.part;
 			i_free_and_null(ctx.content_type);
 			i_free_and_null(ctx.content_disposition);
@@ -700,18 +905,20 @@ fts_build_mail_real(struct fts_backend_update_context *update_ctx,
 	return ret < 0 ? -1 : 1;
 }
 
-int fts_build_mail(struct fts_backend_update_context *update_ctx,
-		   struct mail *mail)
+static int
+fts_build_mail_full(struct fts_backend_update_context *update_ctx,
+		    struct mail *mail, buffer_t *record)
 {
 	struct event *event = update_ctx->backend->event;
 	int ret;
 	/* Number of attempts to be taken if retry is needed */
 	unsigned int attempts = 2;
 	const char *retriable_err_msg;
+	size_t record_start = record == NULL ? 0 : record->used;
 	bool may_need_retry;
 
 	T_BEGIN {
-		while ((ret = fts_build_mail_real(update_ctx, mail,
+		while ((ret = fts_build_mail_real(update_ctx, mail, record,
 						  &retriable_err_msg,
 						  &may_need_retry)) < 0 &&
 		       may_need_retry) {
@@ -727,7 +934,127 @@ int fts_build_mail(struct fts_backend_update_context *update_ctx,
 				ret = 0;
 				break;
 			}
+			if (record != NULL)
+				buffer_set_used_size(record, record_start);
 		}
 	} T_END;
 	return ret;
 }
+
+int fts_build_mail(struct fts_backend_update_context *update_ctx,
+		   struct mail *mail)
+{
+	return fts_build_mail_full(update_ctx, mail, NULL);
+}
+
+int fts_build_mail_record(struct fts_backend_update_context *update_ctx,
+			  struct mail *mail, buffer_t *dest)
+{
+	int ret;
+
+	i_assert((update_ctx->backend->flags &
+		  FTS_BACKEND_FLAG_TOKENIZED_INPUT) != 0);
+
+	ret = fts_build_mail_full(update_ctx, mail, dest);
+	fts_build_op_append_end(dest, ret);
+	return ret;
+}
+
+int fts_build_mail_tokenize(struct fts_backend_update_context *update_ctx,
+			    const unsigned char **data,
+			    const unsigned char *end, buffer_t *dest)
+{
+	struct fts_mail_build_context ctx;
+	struct fts_build_op_rec rec;
+	int ret = 0;
+
+	i_zero(&ctx);
+	ctx.update_ctx = update_ctx;
+	ctx.box = update_ctx->cur_box;
+	ctx.tokens = dest;
+	ctx.pending_input = buffer_create_dynamic(default_pool, 128);
+
+	for (;;) {
+		if (!fts_build_op_read(data, end, &rec))
+			i_panic("fts: Corrupted recorded mail");
+		if (rec.op == FTS_BUILD_OP_END) {
+			fts_build_op_append_end(dest, ret < 0 ? -1 : rec.ret);
+			break;
+		}
+		if (ret < 0) {
+			/* tokenizing failed - skip the rest of the mail */
+			continue;
+		}
+
+		switch (rec.op) {
+		case FTS_BUILD_OP_KEY:
+			/* choose the language the same way as
+			   fts_build_mail() */
+			ctx.uid = rec.key.uid;
+			if (rec.key.type == FTS_BACKEND_BUILD_KEY_HDR ||
+			    rec.key.type == FTS_BACKEND_BUILD_KEY_MIME_HDR)
+				fts_build_tokenized_hdr_update_lang(&ctx,
+					rec.key.hdr_name);
+			else
+				ctx.cur_user_lang = NULL;
+			fts_build_op_append_key(dest, &rec.key);
+			break;
+		case FTS_BUILD_OP_UNSET:
+			buffer_append_c(dest, FTS_BUILD_OP_UNSET);
+			break;
+		case FTS_BUILD_OP_DATA:
+		case FTS_BUILD_OP_DATA_LAST:
+			T_BEGIN {
+				ret = fts_build_tokenized(&ctx, rec.data, rec.size,
+					rec.op == FTS_BUILD_OP_DATA_LAST);
+			} T_END;
+			break;
+		default:
+			i_panic("fts: Unexpected operation %d in recorded mail",
+				rec.op);
+		}
+	}
+	buffer_free(&ctx.pending_input);
+	return ret;
+}
+
+int fts_build_mail_replay(struct fts_backend_update_context *update_ctx,
+			  const unsigned char **data, const unsigned char *end)
+{
+	struct fts_build_op_rec rec;
+	bool key_open = FALSE;
+	int ret = 0;
+
+	for (;;) {
+		if (!fts_build_op_read(data, end, &rec))
+			i_panic("fts: Corrupted tokenized mail");
+		if (rec.op == FTS_BUILD_OP_END)
+			return ret < 0 ? -1 : rec.ret;
+		if (ret < 0)
+			continue;
+
+		switch (rec.op) {
+		case FTS_BUILD_OP_KEY:
+			key_open = fts_backend_update_set_build_key(update_ctx,
+								    &rec.key);
+			break;
+		case FTS_BUILD_OP_UNSET:
+			fts_backend_update_unset_build_key(update_ctx);
+			key_open = FALSE;
+			break;
+		case FTS_BUILD_OP_TOKEN:
+			if (!key_open)
+				break;
+			if (fts_backend_update_build_more(update_ctx, rec.data,
+							  rec.size) < 0) {
+				mail_storage_set_internal_error(
+					update_ctx->cur_box->storage);
+				ret = -1;
+			}
+			break;
+		default:
+			i_panic("fts: Unexpected operation %d in tokenized mail",
+				rec.op);
+		}
+	}
+}
@@ -6,4 +6,23 @@
 int fts_build_mail(struct fts_backend_update_context *update_ctx,
 		   struct mail *mail);
 
+/* The following functions split fts_build_mail() into stages, so that the
+   tokenizing can be done in another process. They can be used only with
+   backends that have FTS_BACKEND_FLAG_TOKENIZED_INPUT. */
+
+/* Parse and decode the mail, and append the build keys and the text to
+   dest. Returns the same as fts_build_mail(). */
+int fts_build_mail_record(struct fts_backend_update_context *update_ctx,
+			  struct mail *mail, buffer_t *dest);
+/* Tokenize a mail written by fts_build_mail_record() and append the build
+   keys and the tokens to dest. *data is updated to point after the mail.
+   Returns 0 on success, -1 if tokenizing failed. The error is logged. */
+int fts_build_mail_tokenize(struct fts_backend_update_context *update_ctx,
+			    const unsigned char **data,
+			    const unsigned char *end, buffer_t *dest);
+/* Send a mail written by fts_build_mail_tokenize() to the backend. *data is
+   updated to point after the mail. Returns the same as fts_build_mail(). */
+int fts_build_mail_replay(struct fts_backend_update_context *update_ctx,
+			  const unsigned char **data, const unsigned char *end);
+
 #endif
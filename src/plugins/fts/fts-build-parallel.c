@@ -0,0 +1,448 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "time-util.h"
+#include "write-full.h"
+#include "mail-search-build.h"
+#include "mail-storage-private.h"
+#include "fts-api-private.h"
+#include "fts-build-mail.h"
+#include "fts-build-parallel.h"
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+/* Mails are read and decoded in batches. While the tokenizer processes work
+   on one batch, the next one is being read and the previous one is being
+   sent to the backend. */
+#define FTS_BUILD_PARALLEL_BATCH_MAX_MAILS 256
+#define FTS_BUILD_PARALLEL_BATCH_MAX_SIZE (8*1024*1024)
+
+#define FTS_BUILD_PARALLEL_TRAILER_MAGIC 0x46545331
+
+/* Written by the tokenizer process after all the mails. A process that
+   died in the middle of writing won't have a valid trailer. */
+struct fts_build_parallel_trailer {
+	uint32_t magic;
+	uint32_t mail_count;
+	uint64_t nsecs;
+};
+
+struct fts_build_parallel_child {
+	/* -1 if the batch is tokenized by this process */
+	pid_t pid;
+	int fd;
+	buffer_t *output;
+	const unsigned char *pos, *end;
+};
+
+struct fts_build_parallel_batch {
+	buffer_t *input;
+	/* input offset for each mail */
+	ARRAY(size_t) offsets;
+	ARRAY(struct fts_build_parallel_child) children;
+};
+
+struct fts_build_parallel {
+	struct fts_backend_update_context *update_ctx;
+	struct event *event;
+	unsigned int process_count;
+	struct fts_build_parallel_batch batches[2];
+
+	unsigned int mail_count;
+	uint64_t read_bytes, tokens_bytes;
+	uint64_t read_nsecs, tokenize_nsecs, wait_nsecs, backend_nsecs;
+};
+
+static buffer_t *
+fts_build_parallel_tokenize(struct fts_build_parallel *par,
+			    const struct fts_build_parallel_batch *batch,
+			    unsigned int idx)
+{
+	const unsigned char *input = batch->input->data;
+	struct fts_build_parallel_trailer trailer;
+	const unsigned char *data, *end;
+	const size_t *offsets;
+	unsigned int i, count;
+	uint64_t start = i_nanoseconds();
+	buffer_t *output;
+
+	output = buffer_create_dynamic(default_pool,
+		batch->input->used / par->process_count + 1024);
+	i_zero(&trailer);
+	offsets = array_get(&batch->offsets, &count);
+	for (i = idx; i < count; i += par->process_count) {
+		data = input + offsets[i];
+		end = i + 1 < count ? input + offsets[i + 1] :
+			input + batch->input->used;
+		(void)fts_build_mail_tokenize(par->update_ctx, &data, end,
+					      output);
+		i_assert(data == end);
+		trailer.mail_count++;
+	}
+	trailer.magic = FTS_BUILD_PARALLEL_TRAILER_MAGIC;
+	trailer.nsecs = i_nanoseconds() - start;
+	buffer_append(output, &trailer, sizeof(trailer));
+	return output;
+}
+
+static void ATTR_NORETURN
+fts_build_parallel_child(struct fts_build_parallel *par,
+			 const struct fts_build_parallel_batch *batch,
+			 unsigned int idx, int fd)
+{
+	buffer_t *output;
+
+	/* Everything else that was inherited from the parent process is
+	   left alone. Especially nothing must be committed, so exit without
+	   any deinitialization. */
+	output = fts_build_parallel_tokenize(par, batch, idx);
+	if (write_full(fd, output->data, output->used) < 0) {
+		e_error(par->event, "write(fts tokenizer pipe) failed: %m");
+		_exit(FATAL_DEFAULT);
+	}
+	_exit(0);
+}
+
+static void
+fts_build_parallel_start(struct fts_build_parallel *par,
+			 struct fts_build_parallel_batch *batch)
+{
+	struct fts_build_parallel_child *child;
+	unsigned int i, count;
+	int fd[2];
+
+	count = I_MIN(par->process_count, array_count(&batch->offsets));
+	for (i = 0; i < count; i++) {
+		child = array_append_space(&batch->children);
+		child->pid = -1;
+		child->fd = -1;
+
+		if (pipe(fd) < 0) {
+			e_error(par->event,
+				"pipe() failed: %m - tokenizing in this process");
+			continue;
+		}
+		child->pid = fork();
+		if (child->pid < 0) {
+			e_error(par->event,
+				"fork() failed: %m - tokenizing in this process");
+			i_close_fd(&fd[0]);
+			i_close_fd(&fd[1]);
+			continue;
+		}
+		if (child->pid == 0) {
+			i_close_fd(&fd[0]);
+			fts_build_parallel_child(par, batch, i, fd[1]);
+		}
+		i_close_fd(&fd[1]);
+		child->fd = fd[0];
+	}
+}
+
+static int
+fts_build_parallel_read(struct fts_build_parallel *par,
+			struct fts_build_parallel_child *child)
+{
+	buffer_t *buf = child->output;
+	size_t used;
+	ssize_t ret;
+	void *data;
+
+	for (;;) {
+		used = buf->used;
+		data = buffer_append_space_unsafe(buf, IO_BLOCK_SIZE);
+		ret = read(child->fd, data, IO_BLOCK_SIZE);
+		buffer_set_used_size(buf, used + (ret > 0 ? ret : 0));
+		if (ret == 0)
+			return 0;
+		if (ret < 0 && errno != EINTR) {
+			e_error(par->event, "read(fts tokenizer pipe) failed: %m");
+			return -1;
+		}
+	}
+}
+
+static void
+fts_build_parallel_wait(struct fts_build_parallel *par,
+			const struct fts_build_parallel_child *child)
+{
+	int status;
+
+	while (waitpid(child->pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+			/* ECHILD if someone else already reaped it. The
+			   trailer tells if it succeeded. */
+			if (errno != ECHILD)
+				e_error(par->event, "waitpid() failed: %m");
+			return;
+		}
+	}
+	if (WIFSIGNALED(status)) {
+		e_error(par->event, "fts tokenizer process %ld "
+			"was killed by signal %d",
+			(long)child->pid, WTERMSIG(status));
+	} else if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+		e_error(par->event, "fts tokenizer process %ld "
+			"returned status %d",
+			(long)child->pid, WEXITSTATUS(status));
+	}
+}
+
+static bool
+fts_build_parallel_get_trailer(struct fts_build_parallel_child *child,
+			       unsigned int mail_count, uint64_t *nsecs_r)
+{
+	struct fts_build_parallel_trailer trailer;
+	buffer_t *buf = child->output;
+
+	if (buf->used < sizeof(trailer))
+		return FALSE;
+	memcpy(&trailer, CONST_PTR_OFFSET(buf->data,
+					  buf->used - sizeof(trailer)),
+	       sizeof(trailer));
+	if (trailer.magic != FTS_BUILD_PARALLEL_TRAILER_MAGIC ||
+	    trailer.mail_count != mail_count)
+		return FALSE;
+	buffer_set_used_size(buf, buf->used - sizeof(trailer));
+	*nsecs_r = trailer.nsecs;
+	return TRUE;
+}
+
+static int
+fts_build_parallel_collect(struct fts_build_parallel *par,
+			   struct fts_build_parallel_batch *batch)
+{
+	struct fts_build_parallel_child *children;
+	unsigned int i, count, mail_count = array_count(&batch->offsets);
+	uint64_t start, nsecs;
+	int ret = 0;
+
+	children = array_get_modifiable(&batch->children, &count);
+	for (i = 0; i < count; i++) {
+		struct fts_build_parallel_child *child = &children[i];
+
+		if (child->pid == -1) {
+			child->output = fts_build_parallel_tokenize(par, batch, i);
+		} else {
+			start = i_nanoseconds();
+			child->output = buffer_create_dynamic(default_pool,
+							      IO_BLOCK_SIZE);
+			if (fts_build_parallel_read(par, child) < 0)
+				ret = -1;
+			i_close_fd(&child->fd);
+			fts_build_parallel_wait(par, child);
+			par->wait_nsecs += i_nanoseconds() - start;
+		}
+		if (!fts_build_parallel_get_trailer(child,
+				(mail_count - i - 1) / par->process_count + 1,
+				&nsecs)) {
+			e_error(par->event,
+				"fts tokenizer process %ld didn't finish",
+				(long)child->pid);
+			ret = -1;
+			continue;
+		}
+		par->tokenize_nsecs += nsecs;
+		par->tokens_bytes += child->output->used;
+		child->pos = child->output->data;
+		child->end = child->pos + child->output->used;
+	}
+	return ret;
+}
+
+static void
+fts_build_parallel_batch_reset(struct fts_build_parallel_batch *batch)
+{
+	struct fts_build_parallel_child *child;
+
+	array_foreach_modifiable(&batch->children, child) {
+		if (child->output != NULL)
+			buffer_free(&child->output);
+	}
+	array_clear(&batch->children);
+	array_clear(&batch->offsets);
+	buffer_set_used_size(batch->input, 0);
+}
+
+static int
+fts_build_parallel_finish(struct fts_build_parallel *par,
+			  struct fts_build_parallel_batch *batch)
+{
+	struct fts_build_parallel_child *children, *child;
+	unsigned int i, mail_count = array_count(&batch->offsets);
+	uint64_t start;
+	int ret;
+
+	if ((ret = fts_build_parallel_collect(par, batch)) < 0)
+		mail_storage_set_internal_error(par->update_ctx->cur_box->storage);
+	else {
+		/* send the mails to the backend in the original order */
+		start = i_nanoseconds();
+		children = array_front_modifiable(&batch->children);
+		for (i = 0; i < mail_count; i++) {
+			child = &children[i % par->process_count];
+			if (fts_build_mail_replay(par->update_ctx, &child->pos,
+						  child->end) < 0) {
+				/* the rest of the mails aren't sent, same
+				   as with fts_build_mail() */
+				ret = -1;
+				break;
+			}
+			par->mail_count++;
+		}
+		par->backend_nsecs += i_nanoseconds() - start;
+	}
+	fts_build_parallel_batch_reset(batch);
+	return ret;
+}
+
+static void
+fts_build_parallel_abort(struct fts_build_parallel *par,
+			 struct fts_build_parallel_batch *batch)
+{
+	struct fts_build_parallel_child *child;
+	int status;
+
+	/* The tokens are thrown away, so don't wait for the processes to
+	   finish their work. */
+	array_foreach_modifiable(&batch->children, child) {
+		if (child->pid == -1)
+			continue;
+		(void)kill(child->pid, SIGKILL);
+		i_close_fd(&child->fd);
+		while (waitpid(child->pid, &status, 0) < 0) {
+			if (errno != EINTR) {
+				if (errno != ECHILD)
+					e_error(par->event, "waitpid() failed: %m");
+				break;
+			}
+		}
+	}
+	fts_build_parallel_batch_reset(batch);
+}
+
+static int
+fts_build_parallel_record(struct fts_build_parallel *par,
+			  struct mail_search_context *search_ctx,
+			  struct fts_build_parallel_batch *batch)
+{
+	struct mail *mail;
+	size_t offset;
+	uint64_t start = i_nanoseconds();
+	int ret = 1;
+
+	while (array_count(&batch->offsets) < FTS_BUILD_PARALLEL_BATCH_MAX_MAILS &&
+	       batch->input->used < FTS_BUILD_PARALLEL_BATCH_MAX_SIZE) {
+		if (!mailbox_search_next(search_ctx, &mail)) {
+			ret = 0;
+			break;
+		}
+		offset = batch->input->used;
+		array_push_back(&batch->offsets, &offset);
+		if (fts_build_mail_record(par->update_ctx, mail,
+					  batch->input) < 0) {
+			/* the mails so far are still indexed */
+			ret = -1;
+			break;
+		}
+	}
+	par->read_bytes += batch->input->used;
+	par->read_nsecs += i_nanoseconds() - start;
+	return ret;
+}
+
+int fts_build_parallel(struct fts_backend_update_context *update_ctx,
+		       struct mailbox_transaction_context *trans,
+		       uint32_t seq1, uint32_t seq2,
+		       unsigned int process_count)
+{
+	struct fts_build_parallel par;
+	struct fts_build_parallel_batch *running = NULL, *next;
+	struct mail_search_args *search_args;
+	struct mail_search_context *search_ctx;
+	unsigned int i;
+	int ret = 0, record_ret = 1;
+
+	i_assert(process_count > 0);
+
+	i_zero(&par);
+	par.update_ctx = update_ctx;
+	par.event = update_ctx->backend->event;
+	par.process_count = process_count;
+	for (i = 0; i < N_ELEMENTS(par.batches); i++) {
+		par.batches[i].input = buffer_create_dynamic(default_pool,
+			FTS_BUILD_PARALLEL_BATCH_MAX_SIZE / 4);
+		i_array_init(&par.batches[i].offsets,
+			     FTS_BUILD_PARALLEL_BATCH_MAX_MAILS);
+		i_array_init(&par.batches[i].children, process_count);
+	}
+
+	search_args = mail_search_build_init();
+	mail_search_build_add_seqset(search_args, seq1, seq2);
+	search_ctx = mailbox_search_init(trans, search_args, NULL,
+					 MAIL_FETCH_STREAM_HEADER |
+					 MAIL_FETCH_STREAM_BODY, NULL);
+	mail_search_args_unref(&search_args);
+
+	while (record_ret > 0 || running != NULL) {
+		next = NULL;
+		if (record_ret > 0) {
+			/* read the next batch while the previous one is
+			   still being tokenized */
+			next = running == &par.batches[0] ?
+				&par.batches[1] : &par.batches[0];
+			record_ret = fts_build_parallel_record(&par, search_ctx,
+							       next);
+			if (record_ret < 0)
+				ret = -1;
+			if (array_count(&next->offsets) > 0)
+				fts_build_parallel_start(&par, next);
+			else
+				next = NULL;
+		}
+		if (running != NULL &&
+		    fts_build_parallel_finish(&par, running) < 0) {
+			/* The mails after the failed one must not be sent to
+			   the backend, or its last indexed UID would skip
+			   over the failed mail. Throw away the next batch. */
+			ret = -1;
+			record_ret = 0;
+			if (next != NULL) {
+				fts_build_parallel_abort(&par, next);
+				next = NULL;
+			}
+		}
+		running = next;
+	}
+	if (mailbox_search_deinit(&search_ctx) < 0)
+		ret = -1;
+
+	for (i = 0; i < N_ELEMENTS(par.batches); i++) {
+		buffer_free(&par.batches[i].input);
+		array_free(&par.batches[i].offsets);
+		array_free(&par.batches[i].children);
+	}
+
+	e_debug(event_create_passthrough(par.event)->
+		set_name("fts_index_parallel_finished")->
+		add_int("mails", par.mail_count)->
+		add_int("processes", process_count)->
+		add_int("read_bytes", par.read_bytes)->
+		add_int("read_usecs", par.read_nsecs / 1000)->
+		add_int("tokens_bytes", par.tokens_bytes)->
+		add_int("tokenize_usecs", par.tokenize_nsecs / 1000)->
+		add_int("tokenize_wait_usecs", par.wait_nsecs / 1000)->
+		add_int("backend_usecs", par.backend_nsecs / 1000)->event(),
+		"Indexed %u mails with %u tokenizer processes: "
+		"read %"PRIu64" kB in %"PRIu64" ms, "
+		"tokenized in %"PRIu64" ms (waited %"PRIu64" ms), "
+		"backend %"PRIu64" ms", par.mail_count, process_count,
+		par.read_bytes / 1024, par.read_nsecs / 1000000,
+		par.tokenize_nsecs / 1000000, par.wait_nsecs / 1000000,
+		par.backend_nsecs / 1000000);
+	return ret;
+}
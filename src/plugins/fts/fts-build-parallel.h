@@ -0,0 +1,13 @@
+#ifndef FTS_BUILD_PARALLEL_H
+#define FTS_BUILD_PARALLEL_H
+
+/* Build indexes for mails seq1..seq2 using process_count processes for
+   tokenizing. The mails are read and decoded in this process, and the
+   tokens are sent to the backend in UID order. The backend must have
+   FTS_BACKEND_FLAG_TOKENIZED_INPUT. Returns 0 on success, -1 on error. */
+int fts_build_parallel(struct fts_backend_update_context *update_ctx,
+		       struct mailbox_transaction_context *trans,
+		       uint32_t seq1, uint32_t seq2,
+		       unsigned int process_count);
+
+#endif
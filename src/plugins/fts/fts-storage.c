@@ -12,6 +12,7 @@
 #include "fts-tokenizer.h"
 #include "fts-indexer.h"
 #include "fts-build-mail.h"
+#include "fts-build-parallel.h"
 #include "fts-search-serialize.h"
 #include "fts-plugin.h"
 #include "fts-user.h"
@@ -31,6 +32,9 @@
 	MODULE_CONTEXT_REQUIRE(obj, fts_mailbox_list_module)
 
 #define INDEXER_SOCKET_NAME "indexer"
+/* With fts_index_processes, index at most this many mails at a time so
+   that the indexer's progress updates keep flowing. */
+#define FTS_INDEX_PARALLEL_MAX_MAILS 1000
 #define INDEXER_HANDSHAKE "VERSION\tindexer-client\t1\t0\n"
 
 struct fts_mailbox_list {
@@ -57,6 +61,7 @@ struct fts_transaction_context {
 	uint32_t next_index_seq;
 	uint32_t highest_virtual_uid;
 	unsigned int precache_extra_count;
+	unsigned int index_process_count;
 
 	bool indexing:1;
 	bool precached:1;
@@ -482,6 +487,24 @@ fts_mail_precache_range(struct mailbox_transaction_context *trans,
 	return ret;
 }
 
+static unsigned int
+fts_mail_get_index_process_count(struct mailbox *box,
+				 struct fts_backend *backend)
+{
+	const char *value;
+	unsigned int count;
+
+	/* only the tokenizing is done in the other processes */
+	if ((backend->flags & FTS_BACKEND_FLAG_TOKENIZED_INPUT) == 0)
+		return 1;
+
+	value = mail_user_plugin_getenv(box->storage->user,
+					"fts_index_processes");
+	if (value == NULL || str_to_uint(value, &count) < 0 || count == 0)
+		return 1;
+	return count;
+}
+
 static int fts_mail_precache_init(struct mail *_mail)
 {
 	struct fts_transaction_context *ft = FTS_CONTEXT_REQUIRE(_mail->transaction);
@@ -495,6 +518,8 @@ static int fts_mail_precache_init(struct mail *_mail)
 
 	ft->precached = TRUE;
 	ft->next_index_seq = last_seq + 1;
+	ft->index_process_count =
+		fts_mail_get_index_process_count(_mail->box, flist->backend);
 	if (flist->update_ctx == NULL)
 		flist->update_ctx = fts_backend_update_init(flist->backend);
 	flist->update_ctx_refcount++;
@@ -549,7 +574,19 @@ static int fts_mail_index(struct mail *_mail)
 		ft->next_index_seq = _mail->seq;
 	}
 
-	if (ft->next_index_seq == _mail->seq) {
+	if (ft->next_index_seq == _mail->seq && ft->index_process_count > 1) {
+		/* index also the following mails, so they can be tokenized
+		   in parallel. They're precached later by the caller. */
+		uint32_t seq2 = I_MIN(_mail->seq + FTS_INDEX_PARALLEL_MAX_MAILS - 1,
+			mail_index_view_get_messages_count(_mail->box->view));
+
+		fts_backend_update_set_mailbox(flist->update_ctx, _mail->box);
+		if (fts_build_parallel(flist->update_ctx, _mail->transaction,
+				       _mail->seq, seq2,
+				       ft->index_process_count) < 0)
+			return -1;
+		ft->next_index_seq = seq2 + 1;
+	} else if (ft->next_index_seq == _mail->seq) {
 		fts_backend_update_set_mailbox(flist->update_ctx, _mail->box);
 		if (fts_build_mail(flist->update_ctx, _mail) < 0)
 			return -1;
@@ -145,6 +145,19 @@ fts_user_create_filters(struct mail_user *user, const struct fts_language *lang,
 			fts_filter_unref(&parent);
 		return -1;
 	}
+
+	str = mail_user_plugin_getenv(user, "fts_filter_cache_size");
+	if (str != NULL && filter != NULL) {
+		unsigned int cache_size;
+
+		if (str_to_uint(str, &cache_size) < 0) {
+			*error_r = t_strdup_printf(
+				"Invalid fts_filter_cache_size: %s", str);
+			fts_filter_unref(&filter);
+			return -1;
+		}
+		fts_filter_set_cache_size(filter, cache_size);
+	}
 	*filter_r = filter;
 	return 0;
 }
@@ -0,0 +1,388 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "istream.h"
+#include "master-service.h"
+#include "test-common.h"
+#include "test-mail-storage-common.h"
+#include "fts-library.h"
+#include "fts-api-private.h"
+#include "fts-user.h"
+#include "fts-build-mail.h"
+#include "fts-build-parallel.h"
+
+/* more than one fts_build_parallel() batch */
+#define TEST_MAIL_COUNT 300
+/* this mail fails to be indexed when test_fail is set */
+#define TEST_FAIL_UID 20
+#define TEST_FAIL_TOKEN "failword"
+
+static struct event *test_event;
+static string_t *test_calls;
+static bool test_fail;
+
+static struct fts_backend_update_context *
+test_backend_update_init(struct fts_backend *backend)
+{
+	struct fts_backend_update_context *ctx;
+
+	ctx = i_new(struct fts_backend_update_context, 1);
+	ctx->backend = backend;
+	return ctx;
+}
+
+static int test_backend_update_deinit(struct fts_backend_update_context *ctx)
+{
+	i_free(ctx);
+	return 0;
+}
+
+static void
+test_backend_update_set_mailbox(struct fts_backend_update_context *ctx ATTR_UNUSED,
+				struct mailbox *box ATTR_UNUSED)
+{
+}
+
+static bool
+test_backend_update_set_build_key(struct fts_backend_update_context *ctx ATTR_UNUSED,
+				  const struct fts_backend_build_key *key)
+{
+	str_printfa(test_calls, "key %u %d", key->uid, key->type);
+	if (key->hdr_name != NULL)
+		str_printfa(test_calls, " %s", key->hdr_name);
+	if (key->body_content_type != NULL)
+		str_printfa(test_calls, " %s", key->body_content_type);
+	if (key->body_content_disposition != NULL)
+		str_printfa(test_calls, " %s", key->body_content_disposition);
+	str_append_c(test_calls, '\n');
+	return TRUE;
+}
+
+static void
+test_backend_update_unset_build_key(struct fts_backend_update_context *ctx ATTR_UNUSED)
+{
+	str_append(test_calls, "unset\n");
+}
+
+static int
+test_backend_update_build_more(struct fts_backend_update_context *ctx ATTR_UNUSED,
+			       const unsigned char *data, size_t size)
+{
+	if (test_fail && size == strlen(TEST_FAIL_TOKEN) &&
+	    memcmp(data, TEST_FAIL_TOKEN, size) == 0)
+		return -1;
+	str_append(test_calls, "token ");
+	str_append_data(test_calls, data, size);
+	str_append_c(test_calls, '\n');
+	return 0;
+}
+
+static struct fts_backend test_backend = {
+	.name = "test",
+	.flags = FTS_BACKEND_FLAG_TOKENIZED_INPUT,
+	.v = {
+		.update_init = test_backend_update_init,
+		.update_deinit = test_backend_update_deinit,
+		.update_set_mailbox = test_backend_update_set_mailbox,
+		.update_set_build_key = test_backend_update_set_build_key,
+		.update_unset_build_key = test_backend_update_unset_build_key,
+		.update_build_more = test_backend_update_build_more,
+	}
+};
+
+static void test_mail_save(struct mailbox *box, const char *mail_input)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_save_context *save_ctx;
+	struct istream *input;
+	int ret;
+
+	input = i_stream_create_from_data(mail_input, strlen(mail_input));
+	trans = mailbox_transaction_begin(box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	save_ctx = mailbox_save_alloc(trans);
+	ret = mailbox_save_begin(&save_ctx, input);
+	while (ret == 0 && (ret = i_stream_read(input)) > 0) {
+		if (mailbox_save_continue(save_ctx) < 0)
+			ret = -1;
+	}
+	if (ret < -1 || input->stream_errno != 0) {
+		mailbox_save_cancel(&save_ctx);
+		ret = -1;
+	} else {
+		ret = mailbox_save_finish(&save_ctx);
+	}
+	if (ret == 0)
+		ret = mailbox_transaction_commit(&trans);
+	else
+		mailbox_transaction_rollback(&trans);
+	if (ret < 0) {
+		i_fatal("Failed to save mail: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+	i_stream_unref(&input);
+}
+
+static const char *test_mail_get(unsigned int uid)
+{
+	const char *body = uid == TEST_FAIL_UID ?
+		"hello "TEST_FAIL_TOKEN" world\n" : "hello world\n";
+
+	if (uid % 3 != 0) {
+		return t_strdup_printf(
+			"From: user%u@example.com\r\n"
+			"Subject: mail number %u\r\n"
+			"\r\n"
+			"Body of mail %u: %s", uid, uid, uid, body);
+	}
+	return t_strdup_printf(
+		"From: user%u@example.com\r\n"
+		"Subject: multipart %u\r\n"
+		"MIME-Version: 1.0\r\n"
+		"Content-Type: multipart/mixed; boundary=\"bound\"\r\n"
+		"\r\n"
+		"--bound\r\n"
+		"Content-Type: text/plain\r\n"
+		"\r\n"
+		"First part of %u: %s\r\n"
+		"--bound\r\n"
+		"Content-Type: text/html\r\n"
+		"Content-Disposition: inline\r\n"
+		"\r\n"
+		"<p>Second <b>part</b> of %u</p>\r\n"
+		"--bound--\r\n", uid, uid, uid, body, uid);
+}
+
+static struct mailbox *test_mailbox_init(struct test_mail_storage_ctx *ctx)
+{
+	struct mailbox *box;
+	const char *error;
+	unsigned int uid;
+
+	test_backend.ns = ctx->user->namespaces;
+	test_backend.event = event_create(test_event);
+	i_zero(&test_backend.header_filters);
+	test_backend.header_filters.pool =
+		pool_alloconly_create("fts_header_filters", 256);
+	p_array_init(&test_backend.header_filters.includes,
+		     test_backend.header_filters.pool, 8);
+	p_array_init(&test_backend.header_filters.excludes,
+		     test_backend.header_filters.pool, 8);
+	if (fts_mail_user_init(ctx->user, TRUE, &error) < 0)
+		i_fatal("fts_mail_user_init() failed: %s", error);
+
+	box = mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	if (mailbox_open(box) < 0) {
+		i_fatal("Failed to open mailbox: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+	for (uid = 1; uid <= TEST_MAIL_COUNT; uid++) T_BEGIN {
+		test_mail_save(box, test_mail_get(uid));
+	} T_END;
+	if (mailbox_sync(box, 0) < 0) {
+		i_fatal("Failed to sync mailbox: %s",
+			mailbox_get_last_internal_error(box, NULL));
+	}
+	return box;
+}
+
+static void test_mailbox_deinit(struct test_mail_storage_ctx *ctx,
+				struct mailbox **_box)
+{
+	mailbox_free(_box);
+	fts_mail_user_deinit(ctx->user);
+	event_unref(&test_backend.event);
+	pool_unref(&test_backend.header_filters.pool);
+}
+
+static int test_build_serial(struct mailbox *box, string_t *dest)
+{
+	struct fts_backend_update_context *update_ctx;
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+	uint32_t seq;
+	int ret = 0;
+
+	test_calls = dest;
+	update_ctx = fts_backend_update_init(&test_backend);
+	fts_backend_update_set_mailbox(update_ctx, box);
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, MAIL_FETCH_STREAM_HEADER |
+			  MAIL_FETCH_STREAM_BODY, NULL);
+	for (seq = 1; seq <= TEST_MAIL_COUNT && ret == 0; seq++) {
+		mail_set_seq(mail, seq);
+		if (fts_build_mail(update_ctx, mail) < 0)
+			ret = -1;
+	}
+	mail_free(&mail);
+	(void)mailbox_transaction_commit(&trans);
+	if (fts_backend_update_deinit(&update_ctx) < 0)
+		ret = -1;
+	test_calls = NULL;
+	return ret;
+}
+
+static int test_build_parallel(struct mailbox *box, string_t *dest)
+{
+	struct fts_backend_update_context *update_ctx;
+	struct mailbox_transaction_context *trans;
+	int ret;
+
+	test_calls = dest;
+	update_ctx = fts_backend_update_init(&test_backend);
+	fts_backend_update_set_mailbox(update_ctx, box);
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	ret = fts_build_parallel(update_ctx, trans, 1, TEST_MAIL_COUNT, 3);
+	(void)mailbox_transaction_commit(&trans);
+	if (fts_backend_update_deinit(&update_ctx) < 0)
+		ret = -1;
+	test_calls = NULL;
+	return ret;
+}
+
+static void test_fts_build_mail_stages(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.extra_input = (const char *const[]) {
+			"fts_languages=en",
+			"fts_tokenizers=generic email-address",
+			NULL
+		},
+	};
+	struct fts_backend_update_context *update_ctx;
+	struct mailbox_transaction_context *trans;
+	struct mailbox *box;
+	struct mail *mail;
+	const unsigned char *data, *end;
+	string_t *serial, *staged;
+	buffer_t *recorded, *tokenized;
+	uint32_t seq;
+
+	test_begin("fts build mail record/tokenize/replay");
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+	box = test_mailbox_init(ctx);
+
+	serial = str_new(default_pool, 1024*64);
+	test_assert(test_build_serial(box, serial) == 0);
+
+	staged = str_new(default_pool, 1024*64);
+	recorded = buffer_create_dynamic(default_pool, 1024);
+	tokenized = buffer_create_dynamic(default_pool, 1024);
+	test_calls = staged;
+	update_ctx = fts_backend_update_init(&test_backend);
+	fts_backend_update_set_mailbox(update_ctx, box);
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, MAIL_FETCH_STREAM_HEADER |
+			  MAIL_FETCH_STREAM_BODY, NULL);
+	for (seq = 1; seq <= TEST_MAIL_COUNT; seq++) {
+		buffer_set_used_size(recorded, 0);
+		buffer_set_used_size(tokenized, 0);
+		mail_set_seq(mail, seq);
+		test_assert(fts_build_mail_record(update_ctx, mail,
+						  recorded) > 0);
+
+		data = recorded->data;
+		end = data + recorded->used;
+		test_assert(fts_build_mail_tokenize(update_ctx, &data, end,
+						    tokenized) == 0);
+		test_assert(data == end);
+
+		data = tokenized->data;
+		end = data + tokenized->used;
+		test_assert(fts_build_mail_replay(update_ctx, &data, end) > 0);
+		test_assert(data == end);
+	}
+	mail_free(&mail);
+	(void)mailbox_transaction_commit(&trans);
+	test_assert(fts_backend_update_deinit(&update_ctx) == 0);
+	test_calls = NULL;
+
+	test_assert(strstr(str_c(serial), "token multipart\n") != NULL);
+	test_assert_strcmp(str_c(staged), str_c(serial));
+
+	buffer_free(&recorded);
+	buffer_free(&tokenized);
+	str_free(&serial);
+	str_free(&staged);
+	test_mailbox_deinit(ctx, &box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+static void test_fts_build_parallel(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+		.extra_input = (const char *const[]) {
+			"fts_languages=en",
+			"fts_tokenizers=generic email-address",
+			NULL
+		},
+	};
+	struct mailbox *box;
+	string_t *serial, *parallel;
+
+	test_begin("fts build parallel");
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+	box = test_mailbox_init(ctx);
+
+	serial = str_new(default_pool, 1024*64);
+	parallel = str_new(default_pool, 1024*64);
+	test_assert(test_build_serial(box, serial) == 0);
+	test_assert(test_build_parallel(box, parallel) == 0);
+	test_assert_strcmp(str_c(parallel), str_c(serial));
+
+	/* A failure stops indexing at the failed mail. The mails in the
+	   batch that was already being tokenized aren't sent either. */
+	test_fail = TRUE;
+	str_truncate(serial, 0);
+	str_truncate(parallel, 0);
+	test_assert(test_build_serial(box, serial) < 0);
+	test_assert(test_build_parallel(box, parallel) < 0);
+	test_assert_strcmp(str_c(parallel), str_c(serial));
+	test_assert(strstr(str_c(parallel),
+		t_strdup_printf("key %u ", TEST_FAIL_UID + 1)) == NULL);
+	test_fail = FALSE;
+
+	str_free(&serial);
+	str_free(&parallel);
+	test_mailbox_deinit(ctx, &box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+int main(int argc, char **argv)
+{
+	void (*const tests[])(void) = {
+		test_fts_build_mail_stages,
+		test_fts_build_parallel,
+		NULL
+	};
+	int ret;
+
+	master_service = master_service_init("test-fts-build-mail",
+					     MASTER_SERVICE_FLAG_STANDALONE |
+					     MASTER_SERVICE_FLAG_DONT_SEND_STATS |
+					     MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+					     MASTER_SERVICE_FLAG_NO_SSL_INIT |
+					     MASTER_SERVICE_FLAG_NO_INIT_DATASTACK_FRAME,
+					     &argc, &argv, "");
+
+	test_event = event_create(NULL);
+	if (null_strcmp(getenv("DEBUG"), "1") == 0)
+		event_set_forced_debug(test_event, TRUE);
+	fts_library_init();
+	ret = test_run(tests);
+	fts_library_deinit();
+	event_unref(&test_event);
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -260,6 +260,7 @@ client_input_notify(struct doveadm_connection *client, const char *const *args)
 		user->last_full_sync = ioloop_time;
 	user->last_fast_sync = ioloop_time;
 	user->last_update = ioloop_time;
+	replicator_queue_user_updated(queue, user);
 
 	if (args[2][0] != '\0') {
 		i_free(user->state);
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "ioloop.h"
+#include "time-util.h"
 #include "dsync-client.h"
 #include "replicator-settings.h"
 #include "replicator-queue.h"
@@ -11,6 +12,8 @@
 struct replicator_sync_context {
 	struct replicator_brain *brain;
 	struct replicator_user *user;
+	struct timeval start_time;
+	bool full;
 };
 
 struct replicator_brain {
@@ -112,6 +115,27 @@ get_dsync_client(struct replicator_brain *brain)
 	return conn;
 }
 
+static unsigned int
+replicator_brain_full_sync_count(struct replicator_brain *brain)
+{
+	struct dsync_client *conn;
+	unsigned int count = 0;
+
+	array_foreach_elem(&brain->dsync_clients, conn) {
+		if (dsync_client_is_busy(conn) &&
+		    dsync_client_get_type(conn) == DSYNC_TYPE_FULL)
+			count++;
+	}
+	return count;
+}
+
+static bool replicator_brain_can_full_sync(struct replicator_brain *brain)
+{
+	return brain->set->replication_max_full_sync_conns == 0 ||
+		replicator_brain_full_sync_count(brain) <
+		brain->set->replication_max_full_sync_conns;
+}
+
 static void dsync_callback(enum dsync_reply reply, const char *state,
 			   void *context)
 {
@@ -129,8 +153,14 @@ static void dsync_callback(enum dsync_reply reply, const char *state,
 		i_free(ctx->user->state);
 		ctx->user->state = i_strdup_empty(state);
 		ctx->user->last_sync_failed = reply != DSYNC_REPLY_OK;
-		if (reply == DSYNC_REPLY_OK)
+		if (reply == DSYNC_REPLY_OK) {
+			int msecs = timeval_diff_msecs(&ioloop_timeval,
+						       &ctx->start_time);
+
 			ctx->user->last_successful_sync = ioloop_time;
+			replicator_user_update_sync_cost(ctx->user, ctx->full,
+							 I_MAX(msecs, 0));
+		}
 		replicator_queue_push(ctx->brain->queue, ctx->user);
 	}
 	if (!ctx->brain->deinitializing)
@@ -138,21 +168,32 @@ static void dsync_callback(enum dsync_reply reply, const char *state,
 	i_free(ctx);
 }
 
+static bool
+replicator_brain_want_full_sync(struct replicator_brain *brain,
+				const struct replicator_user *user)
+{
+	return user->last_full_sync +
+		brain->set->replication_full_sync_interval <= ioloop_time;
+}
+
 static bool
 dsync_replicate(struct replicator_brain *brain, struct replicator_user *user)
 {
 	struct replicator_sync_context *ctx;
 	struct dsync_client *conn;
-	time_t next_full_sync;
 	bool full;
 
 	conn = get_dsync_client(brain);
 	if (conn == NULL)
 		return FALSE;
 
-	next_full_sync = user->last_full_sync +
-		brain->set->replication_full_sync_interval;
-	full = next_full_sync <= ioloop_time;
+	full = replicator_brain_want_full_sync(brain, user);
+	if (full && !replicator_brain_can_full_sync(brain)) {
+		/* there are changes to replicate. do a fast sync now and the
+		   full sync later. */
+		i_assert(user->priority != REPLICATION_PRIORITY_NONE);
+		full = FALSE;
+	}
 	/* update the sync times immediately. if the replication fails we still
 	   wouldn't want it to be retried immediately. */
 	user->last_fast_sync = ioloop_time;
@@ -167,13 +208,17 @@ dsync_replicate(struct replicator_brain *brain, struct replicator_user *user)
 	ctx = i_new(struct replicator_sync_context, 1);
 	ctx->brain = brain;
 	ctx->user = user;
+	ctx->start_time = ioloop_timeval;
+	ctx->full = full;
 	replicator_user_ref(user);
 	dsync_client_sync(conn, user->username, user->state, full,
 			  dsync_callback, ctx);
 	return TRUE;
 }
 
-static bool replicator_brain_fill_next(struct replicator_brain *brain)
+static bool
+replicator_brain_fill_next(struct replicator_brain *brain,
+			   ARRAY_TYPE(replicator_user) *skipped_users)
 {
 	struct replicator_user *user;
 	unsigned int next_secs;
@@ -187,6 +232,18 @@ static bool replicator_brain_fill_next(struct replicator_brain *brain)
 		return FALSE;
 	}
 
+	if (user->priority == REPLICATION_PRIORITY_NONE &&
+	    replicator_brain_want_full_sync(brain, user) &&
+	    !replicator_brain_can_full_sync(brain)) {
+		/* Full syncs can take a long time. Don't let them fill all
+		   the connections, so the small incremental syncs keep
+		   flowing. The user only needs the periodic full sync, so it
+		   waits for a free slot while the users after it are
+		   replicated. */
+		array_push_back(skipped_users, &user);
+		return TRUE;
+	}
+
 	if (!dsync_replicate(brain, user)) {
 		/* all connections were full, put the user back to queue */
 		replicator_queue_push(brain->queue, user);
@@ -198,5 +255,12 @@ static bool replicator_brain_fill_next(struct replicator_brain *brain)
 
 static void replicator_brain_fill(struct replicator_brain *brain)
 {
-	while (replicator_brain_fill_next(brain)) ;
+	ARRAY_TYPE(replicator_user) skipped_users;
+	struct replicator_user *user;
+
+	i_array_init(&skipped_users, 8);
+	while (replicator_brain_fill_next(brain, &skipped_users)) ;
+	array_foreach_elem(&skipped_users, user)
+		replicator_queue_push(brain->queue, user);
+	array_free(&skipped_users);
 }
@@ -41,9 +41,19 @@ struct replicator_queue_iter {
 	struct hash_iterate_context *iter;
 };
 
+/* Weight of the previous estimate when updating it with a new sync
+   duration. */
+#define REPLICATOR_SYNC_COST_HISTORY_WEIGHT 3
+
+static time_t user_fast_sync_expected_end(const struct replicator_user *user)
+{
+	return user->last_fast_sync + user->fast_sync_msecs / 1000;
+}
+
 static int user_priority_cmp(const void *p1, const void *p2)
 {
 	const struct replicator_user *user1 = p1, *user2 = p2;
+	time_t end1, end2;
 
 	if (user1->priority > user2->priority)
 		return -1;
@@ -51,33 +61,54 @@ static int user_priority_cmp(const void *p1, const void *p2)
 		return 1;
 
 	if (user1->priority != REPLICATION_PRIORITY_NONE) {
-		/* there is something to replicate */
-		if (user1->last_fast_sync < user2->last_fast_sync)
+		/* there is something to replicate. prefer the users whose
+		   sync is expected to finish first, so a few huge users don't
+		   delay everyone else. the time since the last sync is
+		   included, so the huge users still get their turn. */
+		end1 = user_fast_sync_expected_end(user1);
+		end2 = user_fast_sync_expected_end(user2);
+		if (end1 < end2)
 			return -1;
-		if (user1->last_fast_sync > user2->last_fast_sync)
-			return 1;
-	} else if (user1->last_sync_failed != user2->last_sync_failed) {
-		/* resync failures first */
-		if (user1->last_sync_failed)
-			return -1;
-		else
+		if (end1 > end2)
 			return 1;
-	} else if (user1->last_sync_failed) {
-		/* both have failed. resync failures with fast-sync timestamp */
 		if (user1->last_fast_sync < user2->last_fast_sync)
 			return -1;
 		if (user1->last_fast_sync > user2->last_fast_sync)
 			return 1;
 	} else {
-		/* nothing to replicate, but do still periodic full syncs */
-		if (user1->last_full_sync < user2->last_full_sync)
+		/* nothing to replicate, but do still periodic full syncs and
+		   resync failures. the user that is due first is at the head
+		   of the queue, so replicator_queue_pop() doesn't need to
+		   look further. */
+		if (user1->next_sync < user2->next_sync)
 			return -1;
-		if (user1->last_full_sync > user2->last_full_sync)
+		if (user1->next_sync > user2->next_sync)
 			return 1;
+		if (user1->last_sync_failed != user2->last_sync_failed) {
+			/* resync failures first */
+			return user1->last_sync_failed ? -1 : 1;
+		}
 	}
 	return 0;
 }
 
+static time_t
+replicator_queue_user_next_sync(struct replicator_queue *queue,
+				const struct replicator_user *user)
+{
+	if (user->last_sync_failed)
+		return user->last_fast_sync + queue->failure_resync_interval;
+	return user->last_full_sync + queue->full_sync_interval;
+}
+
+static void
+replicator_queue_user_add(struct replicator_queue *queue,
+			  struct replicator_user *user)
+{
+	user->next_sync = replicator_queue_user_next_sync(queue, user);
+	priorityq_add(queue->user_queue, &user->item);
+}
+
 struct replicator_queue *
 replicator_queue_init(unsigned int full_sync_interval,
 		      unsigned int failure_resync_interval)
@@ -146,6 +177,25 @@ bool replicator_user_unref(struct replicator_user **_user)
 	return FALSE;
 }
 
+void replicator_user_update_sync_cost(struct replicator_user *user, bool full,
+				      unsigned int msecs)
+{
+	unsigned int *cost = full ? &user->full_sync_msecs :
+		&user->fast_sync_msecs;
+
+	/* the ordering in the queue depends on this */
+	i_assert(user->popped);
+
+	if (msecs == 0)
+		msecs = 1;
+	if (*cost == 0)
+		*cost = msecs;
+	else {
+		*cost = ((uint64_t)*cost * REPLICATOR_SYNC_COST_HISTORY_WEIGHT +
+			 msecs) / (REPLICATOR_SYNC_COST_HISTORY_WEIGHT + 1);
+	}
+}
+
 struct replicator_user *
 replicator_queue_lookup(struct replicator_queue *queue, const char *username)
 {
@@ -176,7 +226,7 @@ replicator_queue_add_int(struct replicator_queue *queue, const char *username,
 	user->last_update = ioloop_time;
 
 	if (!user->popped)
-		priorityq_add(queue->user_queue, &user->item);
+		replicator_queue_user_add(queue, user);
 	return user;
 }
 
@@ -237,12 +287,7 @@ bool replicator_queue_want_sync_now(struct replicator_queue *queue,
 	if (user->priority != REPLICATION_PRIORITY_NONE)
 		return TRUE;
 
-	if (user->last_sync_failed) {
-		next_sync = user->last_fast_sync +
-			queue->failure_resync_interval;
-	} else {
-		next_sync = user->last_full_sync + queue->full_sync_interval;
-	}
+	next_sync = replicator_queue_user_next_sync(queue, user);
 	if (next_sync <= ioloop_time)
 		return TRUE;
 
@@ -303,12 +348,21 @@ replicator_queue_handle_sync_lookups(struct replicator_queue *queue,
 		lookups->callback(success, lookups->context);
 }
 
+void replicator_queue_user_updated(struct replicator_queue *queue,
+				   struct replicator_user *user)
+{
+	if (!user->popped) {
+		priorityq_remove(queue->user_queue, &user->item);
+		replicator_queue_user_add(queue, user);
+	}
+}
+
 void replicator_queue_push(struct replicator_queue *queue,
 			   struct replicator_user *user)
 {
 	i_assert(user->popped);
 
-	priorityq_add(queue->user_queue, &user->item);
+	replicator_queue_user_add(queue, user);
 	user->popped = FALSE;
 
 	T_BEGIN {
@@ -324,7 +378,8 @@ replicator_queue_import_line(struct replicator_queue *queue, const char *line)
 	struct replicator_user *user, tmp_user;
 
 	/* <user> <priority> <last update> <last fast sync> <last full sync>
-	   <last failed> <state> <last successful sync>*/
+	   <last failed> <state> <last successful sync>
+	   <fast sync msecs> <full sync msecs> */
 	args = t_strsplit_tabescaped(line);
 	if (str_array_length(args) < 7)
 		return -1;
@@ -348,6 +403,11 @@ replicator_queue_import_line(struct replicator_queue *queue, const char *line)
 		tmp_user.last_successful_sync = 0;
                 /* On-disk format didn't have this yet */
 	}
+	if (str_array_length(args) >= 10) {
+		if (str_to_uint(args[8], &tmp_user.fast_sync_msecs) < 0 ||
+		    str_to_uint(args[9], &tmp_user.full_sync_msecs) < 0)
+			return -1;
+	}
 
 	user = hash_table_lookup(queue->user_hash, username);
 	if (user != NULL) {
@@ -369,6 +429,9 @@ replicator_queue_import_line(struct replicator_queue *queue, const char *line)
 	user->last_full_sync = tmp_user.last_full_sync;
 	user->last_successful_sync = tmp_user.last_successful_sync;
 	user->last_sync_failed = tmp_user.last_sync_failed;
+	user->fast_sync_msecs = tmp_user.fast_sync_msecs;
+	user->full_sync_msecs = tmp_user.full_sync_msecs;
+	replicator_queue_user_updated(queue, user);
 	i_free(user->state);
 	user->state = i_strdup(state);
 	return 0;
@@ -418,7 +481,9 @@ replicator_queue_export_user(struct replicator_user *user, string_t *str)
 		    user->last_sync_failed ? 1 : 0);
 	if (user->state != NULL)
 		str_append_tabescaped(str, user->state);
-	str_printfa(str, "\t%lld\n", (long long)user->last_successful_sync);
+	str_printfa(str, "\t%lld\t%u\t%u\n",
+		    (long long)user->last_successful_sync,
+		    user->fast_sync_msecs, user->full_sync_msecs);
 }
 
 int replicator_queue_export(struct replicator_queue *queue, const char *path)
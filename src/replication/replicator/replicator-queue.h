@@ -14,6 +14,13 @@ struct replicator_user {
 	time_t last_update;
 	/* last_fast_sync is always >= last_full_sync. */
 	time_t last_fast_sync, last_full_sync, last_successful_sync;
+	/* Estimated duration of fast and full syncs in milliseconds, based
+	   on the previous successful syncs. 0 if not known yet. */
+	unsigned int fast_sync_msecs, full_sync_msecs;
+	/* When the periodic full sync or the failure resync is due for a user
+	   with REPLICATION_PRIORITY_NONE. Updated when the user is added to
+	   the queue. */
+	time_t next_sync;
 
 	int refcount;
 	enum replication_priority priority;
@@ -24,6 +31,7 @@ struct replicator_user {
 	/* Force a full sync on the next replication */
 	bool force_full_sync:1;
 };
+ARRAY_DEFINE_TYPE(replicator_user, struct replicator_user *);
 
 typedef void replicator_sync_callback_t(bool success, void *context);
 
@@ -43,6 +51,11 @@ void replicator_user_ref(struct replicator_user *user);
 /* Unreference the user. Returns TRUE if refcount is still >0. */
 bool replicator_user_unref(struct replicator_user **user);
 
+/* Update user's sync duration estimate after a successful sync. The user must
+   currently be popped from the queue. */
+void replicator_user_update_sync_cost(struct replicator_user *user, bool full,
+				      unsigned int msecs);
+
 /* Lookup an existing user */
 struct replicator_user *
 replicator_queue_lookup(struct replicator_queue *queue, const char *username);
@@ -68,6 +81,10 @@ replicator_queue_pop(struct replicator_queue *queue,
 /* Add user back to queue. */
 void replicator_queue_push(struct replicator_queue *queue,
 			   struct replicator_user *user);
+/* Update user's position in the queue after its sync timestamps were
+   changed. */
+void replicator_queue_user_updated(struct replicator_queue *queue,
+				   struct replicator_user *user);
 
 int replicator_queue_import(struct replicator_queue *queue, const char *path);
 int replicator_queue_export(struct replicator_queue *queue, const char *path);
@@ -59,6 +59,7 @@ static const struct setting_define replicator_setting_defines[] = {
 
 	DEF(TIME, replication_full_sync_interval),
 	DEF(UINT, replication_max_conns),
+	DEF(UINT, replication_max_full_sync_conns),
 
 	SETTING_DEFINE_LIST_END
 };
@@ -69,7 +70,8 @@ const struct replicator_settings replicator_default_settings = {
 	.replication_dsync_parameters = "-d -N -l 30 -U",
 
 	.replication_full_sync_interval = 60*60*24,
-	.replication_max_conns = 10
+	.replication_max_conns = 10,
+	.replication_max_full_sync_conns = 3
 };
 
 const struct setting_parser_info replicator_setting_parser_info = {
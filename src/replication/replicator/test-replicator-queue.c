@@ -0,0 +1,180 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "replicator-queue.h"
+#include "test-common.h"
+
+#define TEST_FULL_SYNC_INTERVAL 1000
+#define TEST_FAILURE_RESYNC_INTERVAL 100
+#define TEST_NOW 1000000
+
+static struct replicator_user *
+test_user_add(struct replicator_queue *queue, const char *username,
+	      enum replication_priority priority,
+	      time_t last_fast_sync, time_t last_full_sync)
+{
+	struct replicator_user *user;
+
+	user = replicator_queue_add(queue, username, priority);
+	user->last_fast_sync = last_fast_sync;
+	user->last_full_sync = last_full_sync;
+	replicator_queue_user_updated(queue, user);
+	return user;
+}
+
+static const char *test_pop(struct replicator_queue *queue)
+{
+	struct replicator_user *user;
+	unsigned int next_secs;
+
+	user = replicator_queue_pop(queue, &next_secs);
+	if (user == NULL)
+		return NULL;
+	/* keep it out of the queue until the test is finished */
+	return user->username;
+}
+
+static void test_replicator_queue_push_all(struct replicator_queue *queue)
+{
+	struct replicator_queue_iter *iter;
+	struct replicator_user *user;
+
+	iter = replicator_queue_iter_init(queue);
+	while ((user = replicator_queue_iter_next(iter)) != NULL) {
+		if (user->popped)
+			replicator_queue_push(queue, user);
+	}
+	replicator_queue_iter_deinit(&iter);
+}
+
+static void test_replicator_queue_priority(void)
+{
+	struct replicator_queue *queue;
+	struct replicator_user *user;
+
+	test_begin("replicator queue priority");
+	ioloop_time = TEST_NOW;
+	queue = replicator_queue_init(TEST_FULL_SYNC_INTERVAL,
+				      TEST_FAILURE_RESYNC_INTERVAL);
+
+	(void)test_user_add(queue, "none", REPLICATION_PRIORITY_NONE,
+			    0, 0);
+	(void)test_user_add(queue, "low", REPLICATION_PRIORITY_LOW,
+			    TEST_NOW, TEST_NOW);
+	(void)test_user_add(queue, "high", REPLICATION_PRIORITY_HIGH,
+			    TEST_NOW, TEST_NOW);
+	/* the same priority: the sync that is expected to finish first */
+	user = test_user_add(queue, "slow", REPLICATION_PRIORITY_SYNC,
+			     TEST_NOW - 100, TEST_NOW - 100);
+	user->fast_sync_msecs = 200 * 1000;
+	replicator_queue_user_updated(queue, user);
+	(void)test_user_add(queue, "fast", REPLICATION_PRIORITY_SYNC,
+			    TEST_NOW - 10, TEST_NOW - 10);
+
+	test_assert_strcmp(test_pop(queue), "fast");
+	test_assert_strcmp(test_pop(queue), "slow");
+	test_assert_strcmp(test_pop(queue), "high");
+	test_assert_strcmp(test_pop(queue), "low");
+	test_assert_strcmp(test_pop(queue), "none");
+	test_assert(test_pop(queue) == NULL);
+
+	test_replicator_queue_push_all(queue);
+	replicator_queue_deinit(&queue);
+	test_end();
+}
+
+static void test_replicator_queue_due_time(void)
+{
+	struct replicator_queue *queue;
+	struct replicator_user *user;
+	unsigned int next_secs;
+
+	test_begin("replicator queue due time");
+	ioloop_time = TEST_NOW;
+	queue = replicator_queue_init(TEST_FULL_SYNC_INTERVAL,
+				      TEST_FAILURE_RESYNC_INTERVAL);
+
+	/* a failed user whose resync isn't due yet must not block the
+	   users whose full sync is due */
+	user = test_user_add(queue, "failed", REPLICATION_PRIORITY_NONE,
+			     TEST_NOW - 50, TEST_NOW - 50);
+	user->last_sync_failed = TRUE;
+	replicator_queue_user_updated(queue, user);
+	/* the expected full sync duration doesn't delay the due users */
+	user = test_user_add(queue, "full1", REPLICATION_PRIORITY_NONE,
+			     TEST_NOW - 1500, TEST_NOW - 1500);
+	user->full_sync_msecs = 10000 * 1000;
+	replicator_queue_user_updated(queue, user);
+	(void)test_user_add(queue, "full2", REPLICATION_PRIORITY_NONE,
+			    TEST_NOW - 1200, TEST_NOW - 1200);
+	(void)test_user_add(queue, "full3", REPLICATION_PRIORITY_NONE,
+			    TEST_NOW - 100, TEST_NOW - 900);
+	(void)test_user_add(queue, "recent", REPLICATION_PRIORITY_NONE,
+			    TEST_NOW, TEST_NOW);
+
+	test_assert_strcmp(test_pop(queue), "full1");
+	test_assert_strcmp(test_pop(queue), "full2");
+	test_assert(replicator_queue_pop(queue, &next_secs) == NULL);
+	test_assert(next_secs == 50);
+
+	ioloop_time = TEST_NOW + 50;
+	test_assert_strcmp(test_pop(queue), "failed");
+	test_assert(replicator_queue_pop(queue, &next_secs) == NULL);
+	test_assert(next_secs == 50);
+
+	ioloop_time = TEST_NOW + 100;
+	test_assert_strcmp(test_pop(queue), "full3");
+	test_assert(replicator_queue_pop(queue, &next_secs) == NULL);
+	test_assert(next_secs == TEST_FULL_SYNC_INTERVAL - 100);
+
+	test_replicator_queue_push_all(queue);
+	replicator_queue_deinit(&queue);
+	test_end();
+}
+
+static void test_replicator_queue_user_updated(void)
+{
+	struct replicator_queue *queue;
+	struct replicator_user *user;
+	unsigned int next_secs;
+
+	test_begin("replicator queue user updated");
+	ioloop_time = TEST_NOW;
+	queue = replicator_queue_init(TEST_FULL_SYNC_INTERVAL,
+				      TEST_FAILURE_RESYNC_INTERVAL);
+
+	user = test_user_add(queue, "user1", REPLICATION_PRIORITY_NONE,
+			     TEST_NOW - 2000, TEST_NOW - 2000);
+	(void)test_user_add(queue, "user2", REPLICATION_PRIORITY_NONE,
+			    TEST_NOW - 1500, TEST_NOW - 1500);
+	/* e.g. doveadm sync was run for the user */
+	user->last_fast_sync = TEST_NOW;
+	user->last_full_sync = TEST_NOW;
+	replicator_queue_user_updated(queue, user);
+
+	test_assert_strcmp(test_pop(queue), "user2");
+	test_assert(replicator_queue_pop(queue, &next_secs) == NULL);
+	test_assert(next_secs == TEST_FULL_SYNC_INTERVAL);
+
+	/* pushing back orders by the new due time */
+	test_replicator_queue_push_all(queue);
+	ioloop_time = TEST_NOW + TEST_FULL_SYNC_INTERVAL;
+	test_assert_strcmp(test_pop(queue), "user2");
+	test_assert_strcmp(test_pop(queue), "user1");
+
+	test_replicator_queue_push_all(queue);
+	replicator_queue_deinit(&queue);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_replicator_queue_priority,
+		test_replicator_queue_due_time,
+		test_replicator_queue_user_updated,
+		NULL
+	};
+	return test_run(test_functions);
+}